@@ -0,0 +1,66 @@
+# Build checks for the rp2040_mcp4728 libraries; see rp2040_mcp4728_no_heap() and
+# rp2040_mcp4728_footprint() in the top level CMakeLists.txt.
+#
+# usage: cmake -DMODE=no_heap|footprint -DNM=<path to nm> -DELF=<linked program> [-DCONFIG=<label>]
+#        -P rp2040_mcp4728_check.cmake
+cmake_minimum_required(VERSION 3.13)
+
+if (MODE STREQUAL "no_heap")
+    execute_process(COMMAND ${NM} -S --size-sort ${ELF}
+        OUTPUT_VARIABLE symbols
+        RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${NM} could not read ${ELF}")
+    endif()
+    string(REPLACE "\n" ";" symbols "${symbols}")
+    # malloc() and friends, possibly wrapped by pico_malloc, and operator new/new[]
+    set(heap_regex "^[0-9a-f]+ [0-9a-f]+ [TtWw] (__wrap_)?(_?malloc|_?calloc|_?realloc|_malloc_r|_calloc_r|_realloc_r|_Znwj|_Znaj|_Znwm|_Znam|_ZnwjRKSt9nothrow_t|_ZnajRKSt9nothrow_t)$")
+    set(heap_users "")
+    foreach(line IN LISTS symbols)
+        if (line MATCHES "${heap_regex}")
+            string(REGEX REPLACE "^.* " "" name "${line}")
+            list(APPEND heap_users ${name})
+        endif()
+    endforeach()
+    if (heap_users)
+        list(JOIN heap_users " " heap_users)
+        message(FATAL_ERROR "${ELF} links heap allocation functions: ${heap_users}")
+    endif()
+elseif (MODE STREQUAL "footprint")
+    # Classify by section, not by nm type: RP2040_MCP4728_RAM_FUNCS=1 code is type T but lives
+    # in .time_critical.*, which the Pico SDK linker script copies from flash to SRAM with .data
+    execute_process(COMMAND ${NM} --format=sysv ${ELF}
+        OUTPUT_VARIABLE sections
+        RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${NM} could not read ${ELF}")
+    endif()
+    string(REPLACE "\n" ";" sections "${sections}")
+    set(flash 0)
+    set(ram 0)
+    set(ram_code 0)
+    # name|value|class|type|size|line|section
+    set(sysv_regex "^([^|]*rppicomidi[^|]*)\\|[^|]*\\|[ ]*([A-Za-z])[ ]*\\|[^|]*\\|[ ]*([0-9a-f]+)[ ]*\\|[^|]*\\|[ ]*([^ ]+)")
+    foreach(line IN LISTS sections)
+        if (line MATCHES "${sysv_regex}")
+            set(type ${CMAKE_MATCH_2})
+            math(EXPR size "0x${CMAKE_MATCH_3}")
+            set(section ${CMAKE_MATCH_4})
+            if (section MATCHES "^\\.(time_critical|data|scratch_[xy]|ram_vector_table)")
+                # stored in flash and copied to RAM at boot
+                math(EXPR flash "${flash} + ${size}")
+                math(EXPR ram "${ram} + ${size}")
+                if (type MATCHES "[TtWw]")
+                    math(EXPR ram_code "${ram_code} + ${size}")
+                endif()
+            elseif (section MATCHES "^\\.(bss|uninitialized_data)" OR section STREQUAL "*COM*")
+                math(EXPR ram "${ram} + ${size}")
+            elseif (section MATCHES "^\\.(text|rodata|flashdata)")
+                math(EXPR flash "${flash} + ${size}")
+            endif()
+        endif()
+    endforeach()
+    message(STATUS "rp2040_mcp4728 footprint ${CONFIG}: flash ${flash} bytes, static RAM ${ram} bytes (${ram_code} bytes of code)")
+else()
+    message(FATAL_ERROR "unknown MODE ${MODE}")
+endif()
@@ -30,6 +30,8 @@
 #include "rp2040_mcp4728_lib.h"
 #include "embedded_cli.h"
 #include "rp2040_mcp4728_cli.h"
+#include "rp2040_mcp4728_group.h"
+#include "rp2040_mcp4728_binary.h"
 #ifndef RP2040_MCP4728_EXAMPLES_I2C
 #define RP2040_MCP4728_EXAMPLES_I2C i2c1
 #endif
@@ -96,6 +98,10 @@
 #ifndef RP2040_MCP4728_EXAMPLES_INVERT_LDAC
 #define RP2040_MCP4728_EXAMPLES_INVERT_LDAC false
 #endif
+#ifndef RP2040_MCP4728_EXAMPLES_SERVICE_BUDGET_US
+// The most time each main loop iteration spends running device task() functions
+#define RP2040_MCP4728_EXAMPLES_SERVICE_BUDGET_US 500
+#endif
 
 // Required functions for the CLI
 
@@ -125,6 +131,13 @@ static void writeCharFn(EmbeddedCli *embeddedCli, char c)
     putchar(c);
 }
 
+// Send binary protocol bytes to the host without newline translation
+static void binary_send(void*, const uint8_t* data, size_t nbytes)
+{
+    for (size_t idx = 0; idx < nbytes; idx++)
+        putchar_raw(data[idx]);
+}
+
 int main()
 {
     EmbeddedCli *cli;
@@ -192,6 +205,19 @@ int main()
     cli->writeChar = writeCharFn;
     rppicomidi::RP2040_MCP4728_cli dac_cli(cli, dac_list, RP2040_MCP4728_EXAMPLES_NUM_DACS, 0);
 
+    // A 0 byte, which a terminal never sends, switches from the CLI to the binary protocol.
+    // The group takes the bus from the CLI while binary mode is open.
+    rppicomidi::RP2040_MCP4728_group dac_group(dac_list, RP2040_MCP4728_EXAMPLES_NUM_DACS, &i2c_bus);
+    rppicomidi::RP2040_MCP4728_binary binary(&dac_group, binary_send, nullptr);
+    bool binary_mode = false;
+    bool binary_was_open = false;
+
+    // Let the bus run the task() function of any chip that has callbacks waiting,
+    // not just the chip the CLI has selected
+    for (auto& dac: dac_list)
+        i2c_bus.attach(&dac);
+    i2c_bus.attach(&dac_group);
+
     int c;
     do {
         c = getchar_timeout_us(0);
@@ -202,11 +228,33 @@ int main()
     printf("MCP4728 Demo Command Line Interpreter\r\n");
     printf("Type help for more infomation\r\n");
     while (true) {
-        dac_cli.get_current_dac()->task();
+        dac_cli.task();
+        i2c_bus.service(RP2040_MCP4728_EXAMPLES_SERVICE_BUDGET_US);
         c = getchar_timeout_us(0);
         if (c != PICO_ERROR_TIMEOUT) {
-            embeddedCliReceiveChar(cli, c);
-            embeddedCliProcess(cli);
+            if (c == 0 && !binary_mode) {
+                binary_mode = true;
+                dac_cli.get_current_dac()->release_bus(nullptr, nullptr);
+            }
+            if (binary_mode) {
+                binary.receive(c);
+            }
+            else {
+                embeddedCliReceiveChar(cli, c);
+                embeddedCliProcess(cli);
+            }
+        }
+        if (binary_mode) {
+            binary.task();
+            if (binary.is_open()) {
+                binary_was_open = true;
+            }
+            else if (binary_was_open) {
+                // the host closed binary mode; give the bus back to the CLI
+                binary_mode = false;
+                binary_was_open = false;
+                dac_cli.get_current_dac()->request_bus(nullptr, nullptr);
+            }
         }
     }
 }
@@ -0,0 +1,302 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This program measures how many MCP4728 channel updates per second the I2C bus
+ * sustains. For each I2C clock rate and each number of chips it streams
+ * operations as fast as the library can issue them and prints the achieved
+ * channel updates per second and the percentage of the wire limit, the update
+ * rate if the bus never paused between transactions.
+ */
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "rp2040_mcp4728_lib.h"
+#ifndef RP2040_MCP4728_EXAMPLES_I2C
+#define RP2040_MCP4728_EXAMPLES_I2C i2c1
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_SDA_GPIO
+#define RP2040_MCP4728_EXAMPLES_SDA_GPIO 2
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_SCL_GPIO
+#define RP2040_MCP4728_EXAMPLES_SCL_GPIO 3
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR0
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR0 0x60
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR1
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR1 0x61
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR2
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR2 0x62
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR3
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR3 0x63
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR4
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR4 0x64
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR5
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR5 0x65
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR6
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR6 0x66
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR7
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR7 0x67
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_NUM_DACS
+#define RP2040_MCP4728_EXAMPLES_NUM_DACS 1
+#endif
+#ifndef RP2040_MCP4728_BENCH_ITERATIONS
+// The number of operations per measurement
+#define RP2040_MCP4728_BENCH_ITERATIONS 2000
+#endif
+#ifndef RP2040_MCP4728_BENCH_EEPROM_ITERATIONS
+// EEPROM writes take up to 50ms each and wear the EEPROM, so do only a few
+#define RP2040_MCP4728_BENCH_EEPROM_ITERATIONS 4
+#endif
+
+enum bench_op {
+    bench_fast_write,
+    bench_multi_write,
+    bench_eeprom_write,
+};
+
+static const char* op_names[] = {"fast_write", "multi_write", "seq_write_eeprom"};
+
+static void count_callback(void* context)
+{
+    ++*reinterpret_cast<uint32_t*>(context);
+}
+
+static void status_callback(void* context, bool is_busy, bool)
+{
+    *reinterpret_cast<int*>(context) = is_busy ? 1 : 0;
+}
+
+/**
+ * @brief submit one operation
+ *
+ * @return true if the operation was submitted, false if all of the chip's operation records are in use
+ */
+static bool submit(rppicomidi::RP2040_MCP4728& dac, bench_op op, uint8_t nchan, uint32_t iteration, uint32_t& done)
+{
+    uint16_t code = (iteration * 64) & 0xFFF;
+    switch(op) {
+    case bench_fast_write:
+    {
+        uint16_t codes[4] = {code, code, code, code};
+        return dac.fast_write(codes, nchan, true, count_callback, &done);
+    }
+    case bench_multi_write:
+    case bench_eeprom_write:
+    {
+        rppicomidi::mcp4728_channel_data chan_dat[4];
+        for (uint8_t chan = 0; chan < nchan; chan++) {
+            chan_dat[chan].chan = (4 - nchan) + chan;
+            chan_dat[chan].vref = 0;
+            chan_dat[chan].pd = 0;
+            chan_dat[chan].gain = 0;
+            chan_dat[chan].udac = 0;
+            chan_dat[chan].dac_code = code;
+        }
+        if (op == bench_multi_write)
+            return dac.multi_write(chan_dat, nchan, count_callback, &done);
+        return dac.sequential_write_eeprom(chan_dat, nchan, count_callback, &done);
+    }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *
+ * @return the number of bytes after the address byte in one transaction
+ */
+static uint32_t payload_bytes(bench_op op, uint8_t nchan)
+{
+    switch(op) {
+    case bench_fast_write:
+        return nchan * 2;
+    case bench_multi_write:
+        return nchan * 3;
+    case bench_eeprom_write:
+        return 1 + nchan * 2;
+    }
+    return 0;
+}
+
+/**
+ * @brief
+ *
+ * @return the most channel updates per second the wire can carry: every transaction is
+ * a start bit, the address byte and the payload bytes (9 clocks each with ACK) and a stop bit
+ */
+static float wire_limit(uint baudrate, bench_op op, uint8_t nchan)
+{
+    uint32_t bits = 1 + 9 * (1 + payload_bytes(op, nchan)) + 1;
+    return (float)baudrate * nchan / bits;
+}
+
+static void wait_eeprom_ready(rppicomidi::RP2040_MCP4728& dac)
+{
+    int busy;
+    do {
+        busy = -1;
+        if (dac.poll_status(status_callback, &busy)) {
+            while (busy < 0)
+                dac.task();
+        }
+    } while (busy != 0);
+}
+
+static void released_callback(void* context)
+{
+    *reinterpret_cast<bool*>(context) = true;
+}
+
+/**
+ * @brief release the bus, running the chip's task() until its operations
+ * finish and the release is done
+ */
+static void release_bus_and_wait(rppicomidi::RP2040_MCP4728& dac)
+{
+    bool released = false;
+    if (dac.release_bus(released_callback, &released) != 0)
+        return;
+    while (!released)
+        dac.task();
+}
+
+static void report(const char* name, uint8_t nchips, uint8_t nchan, uint32_t updates, uint64_t elapsed_us, float limit)
+{
+    float rate = elapsed_us ? (float)updates * 1e6f / elapsed_us : 0;
+    printf("%-17s chips=%u chans=%u %9.0f updates/s %5.1f%% of wire limit %9.0f\r\n",
+        name, nchips, nchan, rate, limit > 0 ? 100.0f * rate / limit : 0, limit);
+}
+
+/**
+ * @brief run iterations operations, spread round robin over nchips chips that take turns
+ * requesting and releasing the bus, so bus arbitration is part of the measurement when nchips > 1
+ */
+static void run(rppicomidi::RP2040_MCP4728* dacs, uint8_t nchips, bench_op op, uint8_t nchan, uint32_t iterations, uint baudrate)
+{
+    uint32_t done = 0;
+    uint64_t start = time_us_64();
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+        auto& dac = dacs[iteration % nchips];
+        if (nchips > 1) {
+            while (dac.request_bus(nullptr, nullptr) != 1)
+                tight_loop_contents();
+        }
+        while (!submit(dac, op, nchan, iteration, done))
+            dac.task();
+        if (op == bench_eeprom_write) {
+            while (done <= iteration)
+                dac.task();
+            wait_eeprom_ready(dac);
+        }
+        if (nchips > 1) {
+            // releasing waits for the chip's operations to finish
+            release_bus_and_wait(dac);
+        }
+    }
+    while (done < iterations) {
+        for (uint8_t idx = 0; idx < nchips; idx++)
+            dacs[idx].task();
+    }
+    uint64_t elapsed = time_us_64() - start;
+    report(op_names[op], nchips, nchan, iterations * nchan, elapsed, wire_limit(baudrate, op, nchan));
+}
+
+int main()
+{
+    stdio_init_all();
+    rppicomidi::Rp2040_i2c_bus i2c_bus(RP2040_MCP4728_EXAMPLES_I2C, 400000,
+        RP2040_MCP4728_EXAMPLES_SDA_GPIO, RP2040_MCP4728_EXAMPLES_SCL_GPIO);
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS <= 0
+#error "RP2040_MCP4728_EXAMPLES_NUM_DACS must be at least 1"
+#elif RP2040_MCP4728_EXAMPLES_NUM_DACS > 0
+    rppicomidi::RP2040_MCP4728 dac_list[RP2040_MCP4728_EXAMPLES_NUM_DACS] = {
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR0, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 1
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR1, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 2
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR2, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 3
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR3, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 4
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR4, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 5
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR5, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 6
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR6, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 7
+        rppicomidi::RP2040_MCP4728(RP2040_MCP4728_EXAMPLES_DAC_ADDR7, &i2c_bus),
+#endif
+#if RP2040_MCP4728_EXAMPLES_NUM_DACS > 8
+#error "The maximum number of MCP4728 chips on a bus is 8"
+#endif
+    };
+    // wait for a terminal to connect
+    do {
+        printf("Press any key to start\r\n");
+    } while (getchar_timeout_us(1000000) == PICO_ERROR_TIMEOUT);
+    printf("MCP4728 throughput benchmark with %u chip(s)\r\n", RP2040_MCP4728_EXAMPLES_NUM_DACS);
+    static const uint baudrates[] = {100000, 400000, 1000000};
+    for (uint baudrate: baudrates) {
+        // the first chip sets the bus clock
+        while (dac_list[0].request_bus(nullptr, nullptr) != 1)
+            tight_loop_contents();
+        uint actual = i2c_bus.set_baudrate(&dac_list[0], baudrate);
+        printf("\r\nI2C clock %u Hz (actual %u Hz)\r\n", baudrate, actual);
+        for (uint8_t nchips = 1; nchips <= RP2040_MCP4728_EXAMPLES_NUM_DACS; nchips++) {
+            if (nchips > 1) {
+                // the chips take turns with the bus
+                release_bus_and_wait(dac_list[0]);
+            }
+            for (uint8_t nchan = 1; nchan <= 4; nchan++)
+                run(dac_list, nchips, bench_fast_write, nchan, RP2040_MCP4728_BENCH_ITERATIONS, actual);
+            for (uint8_t nchan = 1; nchan <= 4; nchan++)
+                run(dac_list, nchips, bench_multi_write, nchan, RP2040_MCP4728_BENCH_ITERATIONS, actual);
+            if (nchips > 1) {
+                while (dac_list[0].request_bus(nullptr, nullptr) != 1)
+                    tight_loop_contents();
+            }
+        }
+        run(dac_list, 1, bench_eeprom_write, 4, RP2040_MCP4728_BENCH_EEPROM_ITERATIONS, actual);
+        release_bus_and_wait(dac_list[0]);
+    }
+    printf("\r\nDone\r\n");
+    // the SDK's exit() spins on the RP2040; on the host simulation the program ends
+    return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This program measures how long the library takes to start an MCP4728 fast write
+ * and how long after the start the I2C interrupt reports it done, with a warm
+ * XIP flash cache and with a cold one. Build it with and without
+ * RP2040_MCP4728_RAM_FUNCS=1 (the isr-latency-ram and isr-latency-flash
+ * programs) to see how much running the hot path from SRAM saves.
+ */
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "rp2040_mcp4728_lib.h"
+#ifndef RP2040_MCP4728_EXAMPLES_I2C
+#define RP2040_MCP4728_EXAMPLES_I2C i2c1
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_SDA_GPIO
+#define RP2040_MCP4728_EXAMPLES_SDA_GPIO 2
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_SCL_GPIO
+#define RP2040_MCP4728_EXAMPLES_SCL_GPIO 3
+#endif
+#ifndef RP2040_MCP4728_EXAMPLES_DAC_ADDR0
+#define RP2040_MCP4728_EXAMPLES_DAC_ADDR0 0x60
+#endif
+#ifndef RP2040_MCP4728_LATENCY_ITERATIONS
+// The number of fast writes per measurement
+#define RP2040_MCP4728_LATENCY_ITERATIONS 1000
+#endif
+
+enum cache_workload {
+    cache_warm,     // nothing else uses the cache
+    cache_cold,     // flush the cache before the write starts and again before the IRQ
+    cache_thrash,   // keep flushing the cache until the IRQ
+};
+
+static const char* workload_names[] = {"warm", "cold", "thrash"};
+
+struct latency_stats {
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t count;
+    void reset() { min_us = UINT32_MAX; max_us = 0; total_us = 0; count = 0; }
+    void add(uint32_t us) {
+        if (us < min_us)
+            min_us = us;
+        if (us > max_us)
+            max_us = us;
+        total_us += us;
+        ++count;
+    }
+};
+
+static volatile uint32_t irq_us;
+static volatile bool irq_seen;
+
+// Called from the I2C IRQ when the write is done. It is in SRAM in both builds
+// so that only the library code differs.
+static void __not_in_flash_func(irq_notify)(void*)
+{
+    irq_us = time_us_32();
+    irq_seen = true;
+}
+
+static void flush_xip_cache()
+{
+    xip_ctrl_hw->flush = 1;
+    (void)xip_ctrl_hw->flush; // the read does not finish until the flush is done
+}
+
+static void run(rppicomidi::RP2040_MCP4728& dac, cache_workload workload, uint32_t iterations)
+{
+    latency_stats submit, done;
+    submit.reset();
+    done.reset();
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+        uint16_t code = (iteration * 64) & 0xFFF;
+        uint16_t codes[4] = {code, code, code, code};
+        if (workload != cache_warm)
+            flush_xip_cache();
+        irq_seen = false;
+        uint32_t start = time_us_32();
+        bool ok = dac.fast_write(codes, 4, true, nullptr, nullptr);
+        uint32_t submitted = time_us_32();
+        if (!ok) {
+            printf("fast_write() failed\r\n");
+            return;
+        }
+        if (workload != cache_warm)
+            flush_xip_cache();
+        while (!irq_seen) {
+            if (workload == cache_thrash)
+                flush_xip_cache();
+        }
+        submit.add(submitted - start);
+        done.add(irq_us - start);
+        // free the operation record
+        while (dac.has_pending_ops())
+            dac.task();
+    }
+    printf("%-6s submit us min %4lu avg %4lu max %4lu | IRQ done us min %4lu avg %4lu max %4lu spread %4lu\r\n",
+        workload_names[workload], submit.min_us, (uint32_t)(submit.total_us / submit.count), submit.max_us,
+        done.min_us, (uint32_t)(done.total_us / done.count), done.max_us, done.max_us - done.min_us);
+}
+
+int main()
+{
+    stdio_init_all();
+    rppicomidi::Rp2040_i2c_bus i2c_bus(RP2040_MCP4728_EXAMPLES_I2C, 400000,
+        RP2040_MCP4728_EXAMPLES_SDA_GPIO, RP2040_MCP4728_EXAMPLES_SCL_GPIO);
+    rppicomidi::RP2040_MCP4728 dac(RP2040_MCP4728_EXAMPLES_DAC_ADDR0, &i2c_bus);
+    dac.set_irq_notify(irq_notify, nullptr);
+    // wait for a terminal to connect
+    do {
+        printf("Press any key to start\r\n");
+    } while (getchar_timeout_us(1000000) == PICO_ERROR_TIMEOUT);
+    printf("MCP4728 fast_write() latency with the hot path in %s\r\n", RP2040_MCP4728_RAM_FUNCS ? "SRAM" : "XIP flash");
+    while (dac.request_bus(nullptr, nullptr) != 1)
+        tight_loop_contents();
+    static const uint baudrates[] = {100000, 400000, 1000000};
+    for (uint baudrate: baudrates) {
+        uint actual = i2c_bus.set_baudrate(&dac, baudrate);
+        printf("\r\nI2C clock %u Hz (actual %u Hz)\r\n", baudrate, actual);
+        for (uint8_t workload = cache_warm; workload <= cache_thrash; workload++)
+            run(dac, static_cast<cache_workload>(workload), RP2040_MCP4728_LATENCY_ITERATIONS);
+    }
+    printf("\r\nDone\r\n");
+    for (;;)
+        tight_loop_contents();
+}
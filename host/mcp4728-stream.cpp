@@ -0,0 +1,80 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This program streams a ramp to every channel of the MCP4728 chips on the
+ * target through the binary protocol and prints the update rate it achieved.
+ *
+ * usage: mcp4728-stream device nchips [seconds]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "rp2040_mcp4728_host_client.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "usage: %s device nchips [seconds]\n", argv[0]);
+        return 1;
+    }
+    int nchips = atoi(argv[2]);
+    double seconds = argc == 4 ? atof(argv[3]) : 5.0;
+    if (nchips < 1 || nchips > 8 || seconds <= 0) {
+        fprintf(stderr, "nchips must be 1-8 and seconds must be positive\n");
+        return 1;
+    }
+    rppicomidi::RP2040_MCP4728_host_client client;
+    if (!client.open(argv[1])) {
+        fprintf(stderr, "%s: no answer from the target\n", argv[1]);
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    uint64_t updates = 0;
+    uint16_t code = 0;
+    bool ok = true;
+    while (ok && elapsed < seconds) {
+        uint16_t codes[4] = {code, code, code, code};
+        for (int chip = 0; ok && chip < nchips; chip++)
+            ok = client.fast_write(chip, codes, 4);
+        updates += 4 * nchips;
+        code = (code + 16) & 0xFFF;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    ok = ok && client.flush() && client.wait_acked();
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    rppicomidi::RP2040_MCP4728_host_client::statistics stats;
+    client.get_statistics(stats);
+    if (!client.close())
+        ok = false;
+    printf("%llu channel updates in %.2f s: %.0f updates/s\n", (unsigned long long)updates, elapsed, updates / elapsed);
+    printf("frames %u resent %u acks %u rejected %u\n", stats.frames, stats.resent, stats.acks, stats.rejected);
+    if (!ok) {
+        fprintf(stderr, "the target stopped answering\n");
+        return 1;
+    }
+    return 0;
+}
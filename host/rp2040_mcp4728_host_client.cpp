@@ -0,0 +1,261 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "rp2040_mcp4728_host_client.h"
+
+rppicomidi::RP2040_MCP4728_host_client::RP2040_MCP4728_host_client() :
+    fd{-1}, next_seq{0}, queue_free{0}, have_ack{false}, target_closed{false}, last_resend_seq{0}, last_progress_ms{0},
+    stat{}
+{
+}
+
+rppicomidi::RP2040_MCP4728_host_client::~RP2040_MCP4728_host_client()
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+int64_t rppicomidi::RP2040_MCP4728_host_client::now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::open(const char* device, int timeout_ms)
+{
+    if (fd >= 0)
+        return false;
+    fd = ::open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return false;
+    termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    tcflush(fd, TCIOFLUSH);
+    // a 0 byte ends anything the target has half received and switches the example programs to binary mode
+    uint8_t delimiter = 0;
+    if (write(fd, &delimiter, 1) != 1) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    window.clear();
+    building.clear();
+    have_ack = false;
+    target_closed = false;
+    if (!send_new_frame(mcp4728_protocol::msg_open, {}, timeout_ms) || !wait_acked(timeout_ms)) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::close(int timeout_ms)
+{
+    if (fd < 0)
+        return false;
+    bool result = flush(timeout_ms) && send_new_frame(mcp4728_protocol::msg_close, {}, timeout_ms);
+    sent_frame close_frame = result ? window.back() : sent_frame{};
+    int64_t deadline = now_ms() + timeout_ms;
+    while (result && !target_closed) {
+        int64_t remaining = deadline - now_ms();
+        if (remaining <= 0 || !poll(remaining < resend_timeout_ms ? remaining : resend_timeout_ms))
+            result = false;
+        else if (window.empty() && now_ms() - last_progress_ms > resend_timeout_ms) {
+            // the target accepted the close frame but the ack that reports the close was lost
+            last_progress_ms = now_ms();
+            result = send_frame(close_frame);
+            ++stat.resent;
+        }
+    }
+    ::close(fd);
+    fd = -1;
+    return result;
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::fast_write(uint8_t chip, const uint16_t* codes, uint8_t nchan)
+{
+    if (nchan < 1 || nchan > 4)
+        return false;
+    uint8_t command[8];
+    for (uint8_t chan = 0; chan < nchan; chan++) {
+        if (codes[chan] > 0x3FFF)
+            return false;
+        mcp4728_encode::fast_write_channel(codes[chan], command + chan * 2);
+    }
+    return write_record(chip, command, nchan * 2);
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::multi_write(uint8_t chip, const mcp4728_channel_data* chan_dat, uint8_t nchan)
+{
+    if (nchan < 1 || nchan > 4)
+        return false;
+    uint8_t command[12];
+    for (uint8_t chan = 0; chan < nchan; chan++)
+        mcp4728_encode::multi_write_channel(chan_dat[chan], command + chan * 3);
+    return write_record(chip, command, nchan * 3);
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::write_record(uint8_t chip, const uint8_t* command, uint8_t nbytes)
+{
+    if (fd < 0 || nbytes == 0 || nbytes > mcp4728_protocol::max_record_bytes)
+        return false;
+    if (building.size() + 2 + nbytes > mcp4728_protocol::max_payload && !flush())
+        return false;
+    building.push_back(chip);
+    building.push_back(nbytes);
+    building.insert(building.end(), command, command + nbytes);
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::flush(int timeout_ms)
+{
+    if (building.empty())
+        return true;
+    if (!send_new_frame(mcp4728_protocol::msg_write, building, timeout_ms))
+        return false;
+    building.clear();
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::wait_acked(int timeout_ms)
+{
+    int64_t deadline = now_ms() + timeout_ms;
+    while (!window.empty()) {
+        int64_t remaining = deadline - now_ms();
+        if (remaining <= 0 || !poll(remaining < resend_timeout_ms ? remaining : resend_timeout_ms))
+            return false;
+    }
+    return true;
+}
+
+size_t rppicomidi::RP2040_MCP4728_host_client::get_window_bytes() const
+{
+    size_t nbytes = 0;
+    for (auto& frame: window)
+        nbytes += frame.payload.size();
+    return nbytes;
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::send_frame(const sent_frame& frame)
+{
+    uint8_t wire[mcp4728_protocol::cobs_max_encoded(mcp4728_protocol::max_frame) + 1];
+    size_t nbytes = mcp4728_protocol::encode_frame(frame.seq, frame.type, frame.payload.data(), frame.payload.size(), wire);
+    size_t offset = 0;
+    while (offset < nbytes) {
+        ssize_t result = write(fd, wire + offset, nbytes - offset);
+        if (result < 0 && errno != EINTR)
+            return false;
+        if (result > 0)
+            offset += result;
+    }
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::send_new_frame(uint8_t type, const std::vector<uint8_t>& payload, int timeout_ms)
+{
+    // The open frame resets the target, so it does not need room in the queue
+    int64_t deadline = now_ms() + timeout_ms;
+    while (type != mcp4728_protocol::msg_open &&
+            (!have_ack || window.size() >= max_window || get_window_bytes() + payload.size() > queue_free)) {
+        int64_t remaining = deadline - now_ms();
+        if (remaining <= 0 || !poll(remaining < resend_timeout_ms ? remaining : resend_timeout_ms))
+            return false;
+    }
+    if (window.empty())
+        last_progress_ms = now_ms();
+    window.push_back({next_seq++, type, payload});
+    ++stat.frames;
+    return send_frame(window.back());
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::resend_window()
+{
+    if (window.empty())
+        return true;
+    last_resend_seq = window.front().seq;
+    last_progress_ms = now_ms();
+    for (auto& frame: window) {
+        if (!send_frame(frame))
+            return false;
+        ++stat.resent;
+    }
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_host_client::process_ack(const uint8_t* payload, size_t nbytes)
+{
+    if (nbytes != mcp4728_protocol::ack_payload_len)
+        return;
+    uint8_t expected_seq = payload[0];
+    uint8_t flags = payload[1];
+    ++stat.acks;
+    have_ack = true;
+    queue_free = ((size_t)payload[2] << 8) | payload[3];
+    // drop the frames the target has accepted
+    while (!window.empty() && (int8_t)(expected_seq - window.front().seq) > 0) {
+        window.pop_front();
+        last_progress_ms = now_ms();
+    }
+    if (flags & mcp4728_protocol::ack_flag_closed)
+        target_closed = true;
+    if (flags & mcp4728_protocol::ack_flag_rejected) {
+        ++stat.rejected;
+        // the target drops everything after the first rejected frame, so later acks report
+        // rejections of frames that were already sent again; the resend timeout covers those
+        if (!window.empty() && window.front().seq != last_resend_seq)
+            resend_window();
+    }
+}
+
+bool rppicomidi::RP2040_MCP4728_host_client::poll(int timeout_ms)
+{
+    pollfd pfd = {fd, POLLIN, 0};
+    int result = ::poll(&pfd, 1, timeout_ms);
+    if (result < 0)
+        return errno == EINTR;
+    if (result > 0) {
+        uint8_t data[256];
+        ssize_t nread = read(fd, data, sizeof(data));
+        if (nread <= 0)
+            return false;
+        for (ssize_t idx = 0; idx < nread; idx++) {
+            if (decoder.receive(data[idx]) == 1 && decoder.get_type() == mcp4728_protocol::msg_ack)
+                process_ack(decoder.get_payload(), decoder.get_payload_len());
+        }
+    }
+    if (!window.empty() && now_ms() - last_progress_ms > resend_timeout_ms)
+        return resend_window();
+    return true;
+}
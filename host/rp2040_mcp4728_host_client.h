@@ -0,0 +1,160 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class is the host end of the binary DAC control protocol (see
+ * rp2040_mcp4728_protocol.h and rp2040_mcp4728_binary.h). It runs on Linux
+ * and talks to the target through a serial port, usually the Pico's USB
+ * CDC port.
+ *
+ * The write functions encode MCP4728 commands and add them as records to a
+ * frame; the frame is sent when it is full or when you call flush(). The
+ * client sends a frame only when the target's write queue has room for it,
+ * keeps every frame until the target acknowledges it, and sends the
+ * unacknowledged frames again if the target rejects a frame or stops
+ * answering.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "rp2040_mcp4728_frames.h"
+#include "rp2040_mcp4728_protocol.h"
+namespace rppicomidi
+{
+class RP2040_MCP4728_host_client
+{
+public:
+    struct statistics {
+        uint32_t frames;        // frames sent, not counting resent frames
+        uint32_t resent;        // frames sent again
+        uint32_t acks;          // acks received
+        uint32_t rejected;      // acks that reported a rejected frame
+    };
+
+    RP2040_MCP4728_host_client();
+    ~RP2040_MCP4728_host_client();
+
+    /**
+     * @brief open the serial port and start binary mode on the target
+     *
+     * @return false if the port cannot be opened or the target does not answer
+     * @param device the serial port device, for example /dev/ttyACM0
+     * @param timeout_ms how long to wait for the target to answer
+     */
+    bool open(const char* device, int timeout_ms=1000);
+
+    /**
+     * @brief send everything, leave binary mode on the target and close the serial port
+     *
+     * @return false if the target did not confirm
+     * @param timeout_ms how long to wait for the target to confirm
+     */
+    bool close(int timeout_ms=1000);
+
+    /**
+     * @brief add a fast write of channels A through nchan-1 to the frame
+     *
+     * @return false if the parameters are out of range or the frame could not be sent
+     * @param chip the index of the chip in the target's group
+     * @param codes nchan 12-bit DAC codes with the power-down code in bits 13:12
+     * @param nchan the number of channels 1-4
+     */
+    bool fast_write(uint8_t chip, const uint16_t* codes, uint8_t nchan);
+
+    /**
+     * @brief add a multi write to the frame
+     *
+     * @return false if the parameters are out of range or the frame could not be sent
+     * @param chip the index of the chip in the target's group
+     * @param chan_dat the channel data
+     * @param nchan the number of channels 1-4
+     */
+    bool multi_write(uint8_t chip, const mcp4728_channel_data* chan_dat, uint8_t nchan);
+
+    /**
+     * @brief add an encoded MCP4728 command to the frame
+     *
+     * @return false if nbytes is out of range or the frame could not be sent
+     * @param chip the index of the chip in the target's group
+     * @param command the encoded command (see rp2040_mcp4728_frames.h)
+     * @param nbytes the number of bytes in the command (1-16)
+     */
+    bool write_record(uint8_t chip, const uint8_t* command, uint8_t nbytes);
+
+    /**
+     * @brief send the frame being built, waiting for room in the target's queue if necessary
+     *
+     * @return false if the target did not make room in time
+     */
+    bool flush(int timeout_ms=1000);
+
+    /**
+     * @brief wait until the target has acknowledged every frame
+     *
+     * @return false if the target did not acknowledge everything in time
+     */
+    bool wait_acked(int timeout_ms=1000);
+
+    void get_statistics(statistics& stats) const { stats = stat; }
+protected:
+    struct sent_frame {
+        uint8_t seq;
+        uint8_t type;
+        std::vector<uint8_t> payload;
+    };
+    // sequence numbers are 8 bits, so fewer than half of them may be unacknowledged
+    static const size_t max_window = 120;
+    static const int resend_timeout_ms = 200;
+    bool send_frame(const sent_frame& frame);
+    bool send_new_frame(uint8_t type, const std::vector<uint8_t>& payload, int timeout_ms);
+    bool resend_window();
+    /**
+     * @brief read and process what the target sent
+     *
+     * @return false if the serial port failed
+     * @param timeout_ms the most time to wait for the first byte
+     */
+    bool poll(int timeout_ms);
+    void process_ack(const uint8_t* payload, size_t nbytes);
+    size_t get_window_bytes() const;
+    static int64_t now_ms();
+    int fd;
+    mcp4728_protocol::frame_decoder decoder;
+    std::vector<uint8_t> building;
+    std::deque<sent_frame> window;  // sent frames the target has not acknowledged
+    uint8_t next_seq;
+    size_t queue_free;              // the free space in the target's queue in the last ack
+    bool have_ack;
+    bool target_closed;
+    uint8_t last_resend_seq;
+    int64_t last_progress_ms;
+    statistics stat;
+private:
+    RP2040_MCP4728_host_client(const RP2040_MCP4728_host_client&)=delete;
+    RP2040_MCP4728_host_client& operator=(const RP2040_MCP4728_host_client&)=delete;
+};
+}
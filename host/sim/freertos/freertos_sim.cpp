@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * The FreeRTOS stand-in (see FreeRTOS.h). The notification value belongs to
+ * the one task; waiting runs the simulation through pico_sim.h.
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "freertos_sim.h"
+#include "pico_sim.h"
+
+static int the_task; // its address is the task handle
+static uint32_t notify_value = 0;
+static rppicomidi::sim::task_statistics stats = {};
+
+rppicomidi::sim::task_statistics rppicomidi::sim::get_task_statistics()
+{
+    return stats;
+}
+
+bool freertos_sim_in_isr()
+{
+    return rppicomidi::sim::in_irq();
+}
+
+void freertos_sim_yield_from_isr(BaseType_t higher_priority_task_woken)
+{
+    if (higher_priority_task_woken != pdFALSE)
+        ++stats.yields_from_isr;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return &the_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    if (notify_value == 0 && xTicksToWait != 0) {
+        ++stats.blocks;
+        const uint64_t tick_ns = 1000000000ull / configTICK_RATE_HZ;
+        // the tick interrupt wakes the task on a tick boundary
+        uint64_t deadline_ns = (rppicomidi::sim::now_ns() / tick_ns + xTicksToWait) * tick_ns;
+        if (xTicksToWait == portMAX_DELAY)
+            deadline_ns = UINT64_MAX;
+        while (notify_value == 0 && rppicomidi::sim::now_ns() < deadline_ns)
+            rppicomidi::sim::wait_for_irq(deadline_ns);
+        if (notify_value == 0)
+            ++stats.timeouts;
+    }
+    uint32_t value = notify_value;
+    if (xClearCountOnExit != pdFALSE)
+        notify_value = 0;
+    else if (notify_value != 0)
+        --notify_value;
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    (void)xTaskToNotify;
+    ++notify_value;
+    ++stats.gives;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t* pxHigherPriorityTaskWoken)
+{
+    (void)xTaskToNotify;
+    ++notify_value;
+    ++stats.gives_from_isr;
+    // the one task is the only one that can be waiting, so it always preempts
+    if (pxHigherPriorityTaskWoken)
+        *pxHigherPriorityTaskWoken = pdTRUE;
+}
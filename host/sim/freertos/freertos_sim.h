@@ -0,0 +1,49 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * The counters the FreeRTOS stand-in (see FreeRTOS.h) keeps for the tests
+ */
+#pragma once
+#include <cstdint>
+namespace rppicomidi
+{
+namespace sim
+{
+struct task_statistics {
+    uint32_t blocks;            // ulTaskNotifyTake() calls that had to wait
+    uint32_t timeouts;          // waits that ended because the timeout expired
+    uint32_t gives;             // xTaskNotifyGive() calls
+    uint32_t gives_from_isr;    // vTaskNotifyGiveFromISR() calls
+    uint32_t yields_from_isr;   // portYIELD_FROM_ISR() calls that asked for a context switch
+};
+/**
+ * @brief
+ *
+ * @return the task notification counters
+ */
+task_statistics get_task_statistics();
+}
+}
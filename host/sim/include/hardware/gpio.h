@@ -0,0 +1,43 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * GPIO outputs drive simulated pins; models such as the MCP4728 LDAC\ input
+ * watch them (see rppicomidi::sim::gpio_level()). Inputs read high, as if
+ * pulled up.
+ */
+#pragma once
+#include "pico.h"
+enum gpio_function { GPIO_FUNC_I2C=3, GPIO_FUNC_SIO=5, GPIO_FUNC_NULL=0x1f };
+enum gpio_override { GPIO_OVERRIDE_NORMAL=0, GPIO_OVERRIDE_INVERT=1, GPIO_OVERRIDE_LOW=2, GPIO_OVERRIDE_HIGH=3 };
+#define GPIO_OUT 1
+#define GPIO_IN 0
+void gpio_init(uint gpio);
+void gpio_deinit(uint gpio);
+void gpio_set_outover(uint gpio, uint value);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_function(uint gpio, gpio_function fn);
+void gpio_pull_up(uint gpio);
@@ -0,0 +1,138 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * The simulated RP2040 I2C controller registers. Plain registers are plain
+ * memory. Registers with side effects are proxy objects that call into the
+ * controller model in pico_sim.cpp. Reading clr_tx_abrt, clr_stop_det or
+ * data_cmd has a side effect even when the value is discarded with (void),
+ * so those three names are macros for member function calls; the library
+ * source does not change.
+ */
+#pragma once
+#include "pico.h"
+#include "pico/time.h"
+namespace rppicomidi
+{
+namespace sim
+{
+enum i2c_reg : uint8_t {
+    reg_enable,
+    reg_status,
+    reg_txflr,
+    reg_rxflr,
+    reg_intr_stat,
+    reg_raw_intr_stat,
+    reg_clr_tx_abrt,
+    reg_clr_stop_det,
+    reg_data_cmd
+};
+uint32_t i2c_reg_read(uint8_t index, i2c_reg reg);
+void i2c_reg_write(uint8_t index, i2c_reg reg, uint32_t value);
+
+class i2c_ro_reg
+{
+public:
+    constexpr i2c_ro_reg(uint8_t index_, i2c_reg reg_) : index{index_}, reg{reg_} {}
+    operator uint32_t() const { return i2c_reg_read(index, reg); }
+protected:
+    uint8_t index;
+    i2c_reg reg;
+};
+
+class i2c_rw_reg : public i2c_ro_reg
+{
+public:
+    constexpr i2c_rw_reg(uint8_t index_, i2c_reg reg_) : i2c_ro_reg{index_, reg_} {}
+    i2c_rw_reg& operator=(uint32_t value) { i2c_reg_write(index, reg, value); return *this; }
+};
+
+/**
+ * A read of data_cmd pops the RX FIFO. If the proxy is neither converted
+ * nor assigned, as in (void)hw->data_cmd, the destructor does the read.
+ */
+class i2c_data_cmd_reg
+{
+public:
+    explicit i2c_data_cmd_reg(uint8_t index_) : index{index_}, used{false} {}
+    ~i2c_data_cmd_reg() { if (!used) i2c_reg_read(index, reg_data_cmd); }
+    operator uint32_t() { used = true; return i2c_reg_read(index, reg_data_cmd); }
+    void operator=(uint32_t value) { used = true; i2c_reg_write(index, reg_data_cmd, value); }
+private:
+    uint8_t index;
+    bool used;
+};
+}
+}
+
+struct i2c_hw_t {
+    constexpr explicit i2c_hw_t(uint8_t index_) : tar{0x55}, intr_mask{0x8ff}, rx_tl{0}, tx_tl{0}, index{index_},
+        enable{index_, rppicomidi::sim::reg_enable}, status{index_, rppicomidi::sim::reg_status},
+        txflr{index_, rppicomidi::sim::reg_txflr}, rxflr{index_, rppicomidi::sim::reg_rxflr},
+        intr_stat{index_, rppicomidi::sim::reg_intr_stat}, raw_intr_stat{index_, rppicomidi::sim::reg_raw_intr_stat} {}
+    io_rw_32 tar;
+    io_rw_32 intr_mask;
+    io_rw_32 rx_tl;
+    io_rw_32 tx_tl;
+    const uint8_t index;
+    rppicomidi::sim::i2c_rw_reg enable;
+    rppicomidi::sim::i2c_ro_reg status;
+    rppicomidi::sim::i2c_ro_reg txflr;
+    rppicomidi::sim::i2c_ro_reg rxflr;
+    rppicomidi::sim::i2c_ro_reg intr_stat;
+    rppicomidi::sim::i2c_ro_reg raw_intr_stat;
+    uint32_t clr_tx_abrt_reg() { return rppicomidi::sim::i2c_reg_read(index, rppicomidi::sim::reg_clr_tx_abrt); }
+    uint32_t clr_stop_det_reg() { return rppicomidi::sim::i2c_reg_read(index, rppicomidi::sim::reg_clr_stop_det); }
+    rppicomidi::sim::i2c_data_cmd_reg data_cmd_reg() { return rppicomidi::sim::i2c_data_cmd_reg{index}; }
+};
+#define clr_tx_abrt clr_tx_abrt_reg()
+#define clr_stop_det clr_stop_det_reg()
+#define data_cmd data_cmd_reg()
+
+typedef struct i2c_inst { i2c_hw_t* hw; bool restart_on_next; } i2c_inst_t;
+extern i2c_inst_t i2c0_inst, i2c1_inst;
+#define i2c0 (&i2c0_inst)
+#define i2c1 (&i2c1_inst)
+uint i2c_init(i2c_inst_t* i2c, uint baudrate);
+void i2c_deinit(i2c_inst_t* i2c);
+uint i2c_set_baudrate(i2c_inst_t* i2c, uint baudrate);
+#define I2C_IC_DATA_CMD_RESTART_BITS 0x400u
+#define I2C_IC_DATA_CMD_STOP_BITS 0x200u
+#define I2C_IC_DATA_CMD_CMD_BITS 0x100u
+#define I2C_IC_STATUS_ACTIVITY_BITS 0x1u
+#define I2C_IC_STATUS_TFE_BITS 0x4u
+#define I2C_IC_INTR_MASK_M_TX_EMPTY_BITS 0x10u
+#define I2C_IC_INTR_MASK_M_RX_FULL_BITS 0x4u
+#define I2C_IC_INTR_MASK_M_STOP_DET_BITS 0x200u
+#define I2C_IC_INTR_MASK_M_TX_ABRT_BITS 0x40u
+#define I2C_IC_INTR_STAT_R_TX_EMPTY_BITS 0x10u
+#define I2C_IC_INTR_STAT_R_STOP_DET_BITS 0x200u
+#define I2C_IC_INTR_STAT_R_RX_FULL_BITS 0x4u
+#define I2C_IC_INTR_STAT_R_TX_ABRT_BITS 0x40u
+#define I2C_IC_RAW_INTR_STAT_TX_EMPTY_BITS 0x10u
+#define I2C_IC_RAW_INTR_STAT_RX_FULL_BITS 0x4u
+#define I2C_IC_RAW_INTR_STAT_STOP_DET_BITS 0x200u
+#define I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS 0x40u
+#define I2C_IC_TAR_SPECIAL_BITS 0x800u
+#define I2C_IC_TAR_GC_OR_START_BITS 0x400u
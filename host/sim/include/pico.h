@@ -0,0 +1,54 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * The host simulation's stand-in for the Pico SDK pico.h. The sim headers in
+ * this directory declare only what the library uses; pico_sim.cpp implements
+ * them against a simulated clock, interrupt controller and I2C controller.
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+typedef unsigned int uint;
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+#define PICO_ERROR_GENERIC -2
+#define PICO_DEFAULT_IRQ_PRIORITY 0x80
+#define PICO_HIGHEST_IRQ_PRIORITY 0
+#define PICO_LOWEST_IRQ_PRIORITY 0xc0
+typedef volatile uint32_t io_rw_32;
+typedef const volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
+static inline void hw_set_bits(io_rw_32* addr, uint32_t mask) { *addr |= mask; }
+static inline void hw_clear_bits(io_rw_32* addr, uint32_t mask) { *addr &= ~mask; }
+// Busy loops call this, so it lets simulated time pass
+void tight_loop_contents();
+static inline void __dmb() {}
+static inline void __compiler_memory_barrier() {}
+void __wfe();
+void __sev();
+static inline uint get_core_num() { return 0; }
@@ -0,0 +1,841 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include "pico_sim.h"
+#include "pico/stdlib.h"
+#include "pico/critical_section.h"
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+static i2c_hw_t i2c0_hw{0};
+static i2c_hw_t i2c1_hw{1};
+i2c_inst_t i2c0_inst = {&i2c0_hw, false};
+i2c_inst_t i2c1_inst = {&i2c1_hw, false};
+
+namespace
+{
+using rppicomidi::sim::i2c_target;
+using rppicomidi::sim::bus_statistics;
+
+const uint64_t never = UINT64_MAX;
+const uint num_gpios = 30;
+const uint num_hardware_alarms = 4;
+const size_t fifo_depth = 16;
+
+struct i2c_controller {
+    i2c_inst_t* inst;
+    uint irq_num;
+    uint baudrate;
+    std::vector<i2c_target*> targets;   // the targets wired to the bus side of the controller
+    std::deque<uint32_t> tx;
+    std::deque<uint8_t> rx;
+    uint32_t raw;               // the latched TX_ABRT and STOP_DET bits
+    bool enabled;
+    bool abort_hold;            // the TX FIFO stays flushed until clr_tx_abrt is read
+    bool in_transfer;           // a start condition was sent and no stop condition yet
+    bool is_read;
+    bool shifting;              // a command is on the wire
+    bool addr_phase;            // the command on the wire starts with a (repeated) start and address
+    uint32_t cmd;
+    uint64_t phase_end_ns;
+    std::vector<i2c_target*> active;    // the targets that answered the address
+    bus_statistics stats;
+};
+
+struct timer_entry {
+    int32_t id;
+    uint64_t when_ns;
+    alarm_callback_t alarm_callback;
+    repeating_timer_t* rt;
+    int hardware_alarm;
+    void* user_data;
+};
+
+struct sim_state {
+    uint64_t now_ns = 0;
+    uint32_t call_cost_ns = 100;
+    uint64_t limit_ns = 600ull * 1000000000ull;
+    uint32_t irq_masked = 0;
+    bool in_irq = false;
+    bool event_flag = false;
+    std::vector<irq_handler_t> handlers[32];
+    bool irq_enabled[32] = {};
+    std::vector<timer_entry> timers;
+    int32_t next_alarm_id = 1;
+    bool alarm_claimed[num_hardware_alarms] = {};
+    hardware_alarm_callback_t alarm_callbacks[num_hardware_alarms] = {};
+    bool gpio_out[num_gpios] = {};
+    bool gpio_dir_out[num_gpios] = {};
+    uint gpio_override[num_gpios] = {};
+    bool gpio_levels[num_gpios];
+    std::vector<std::function<void(uint, bool)>> gpio_watchers;
+    std::deque<int> input;
+    uint32_t wfe_wakeups = 0;
+    uint32_t irq_count = 0;
+    i2c_controller i2c[2];
+    sim_state() {
+        std::fill(gpio_levels, gpio_levels+num_gpios, true);
+        i2c[0] = i2c_controller{};
+        i2c[0].inst = &i2c0_inst;
+        i2c[0].irq_num = I2C0_IRQ;
+        i2c[1] = i2c_controller{};
+        i2c[1].inst = &i2c1_inst;
+        i2c[1].irq_num = I2C1_IRQ;
+    }
+};
+
+sim_state& state()
+{
+    static sim_state s;
+    return s;
+}
+
+void advance_to(uint64_t t_ns);
+
+void tick()
+{
+    advance_to(state().now_ns + state().call_cost_ns);
+}
+
+/* The I2C controller model */
+
+uint64_t bit_ns(const i2c_controller& c)
+{
+    return 1000000000ull / (c.baudrate ? c.baudrate : 100000);
+}
+
+void flush_fifos(i2c_controller& c)
+{
+    c.tx.clear();
+    c.rx.clear();
+}
+
+void end_transfer(i2c_controller& c)
+{
+    for (auto target: c.active)
+        target->stop();
+    c.active.clear();
+    c.in_transfer = false;
+    c.raw |= I2C_IC_RAW_INTR_STAT_STOP_DET_BITS;
+}
+
+void abort_transfer(i2c_controller& c)
+{
+    ++c.stats.nacks;
+    c.raw |= I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS;
+    c.tx.clear();
+    c.abort_hold = true;
+    end_transfer(c);
+}
+
+void start_phase(i2c_controller& c)
+{
+    c.cmd = c.tx.front();
+    c.tx.pop_front();
+    bool is_read = (c.cmd & I2C_IC_DATA_CMD_CMD_BITS) != 0;
+    c.addr_phase = !c.in_transfer || (c.cmd & I2C_IC_DATA_CMD_RESTART_BITS) != 0 || is_read != c.is_read;
+    // start or repeated start, the address byte and ACK; the data byte and ACK; the stop condition
+    uint64_t bits = (c.addr_phase ? 10 : 0) + 9 + ((c.cmd & I2C_IC_DATA_CMD_STOP_BITS) ? 1 : 0);
+    uint64_t duration = bits * bit_ns(c);
+    c.phase_end_ns = state().now_ns + duration;
+    c.stats.busy_ns += duration;
+    c.shifting = true;
+}
+
+void finish_phase(i2c_controller& c)
+{
+    c.shifting = false;
+    bool is_read = (c.cmd & I2C_IC_DATA_CMD_CMD_BITS) != 0;
+    if (c.addr_phase) {
+        uint32_t tar = c.inst->hw->tar;
+        uint8_t addr = ((tar & I2C_IC_TAR_SPECIAL_BITS) != 0 && (tar & I2C_IC_TAR_GC_OR_START_BITS) == 0) ? 0 : (tar & 0x7f);
+        if (!c.in_transfer)
+            ++c.stats.transactions;
+        for (auto target: c.active)
+            target->stop();
+        c.active.clear();
+        for (auto target: c.targets)
+            target->find(addr, c.active);
+        if (addr != 0 && c.active.size() > 1)
+            ++c.stats.collisions;
+        bool ack = false;
+        for (auto target: c.active)
+            ack = target->start(addr, is_read) || ack;
+        c.in_transfer = true;
+        c.is_read = is_read;
+        if (!ack) {
+            abort_transfer(c);
+            return;
+        }
+    }
+    if (is_read) {
+        uint8_t data = c.active.empty() ? 0xff : c.active.front()->read_byte();
+        if (c.rx.size() < fifo_depth)
+            c.rx.push_back(data);
+    }
+    else {
+        bool ack = false;
+        for (auto target: c.active)
+            ack = target->write_byte(c.cmd & 0xff) || ack;
+        if (!ack) {
+            abort_transfer(c);
+            return;
+        }
+    }
+    if ((c.cmd & I2C_IC_DATA_CMD_STOP_BITS) != 0)
+        end_transfer(c);
+}
+
+void run_controller(i2c_controller& c)
+{
+    for (;;) {
+        if (c.shifting) {
+            if (state().now_ns < c.phase_end_ns)
+                return;
+            finish_phase(c);
+        }
+        if (!c.enabled || c.tx.empty())
+            return;
+        start_phase(c);
+    }
+}
+
+uint32_t raw_intr_stat(const i2c_controller& c)
+{
+    uint32_t raw = c.raw;
+    const i2c_hw_t* hw = c.inst->hw;
+    // TX_EMPTY_CTRL is set, so at threshold 0 TX_EMPTY also waits for the last command to finish
+    if (c.tx.size() <= hw->tx_tl && (hw->tx_tl != 0 || !c.shifting))
+        raw |= I2C_IC_RAW_INTR_STAT_TX_EMPTY_BITS;
+    if (c.rx.size() > hw->rx_tl)
+        raw |= I2C_IC_RAW_INTR_STAT_RX_FULL_BITS;
+    return raw;
+}
+
+bool irq_pending(const i2c_controller& c)
+{
+    return state().irq_enabled[c.irq_num] && (raw_intr_stat(c) & c.inst->hw->intr_mask) != 0;
+}
+
+/* Timers and interrupts */
+
+uint64_t next_event_ns()
+{
+    uint64_t next = never;
+    for (auto& c: state().i2c) {
+        if (c.shifting)
+            next = std::min(next, c.phase_end_ns);
+    }
+    for (auto& entry: state().timers)
+        next = std::min(next, entry.when_ns);
+    return next;
+}
+
+void fire_timer(timer_entry entry)
+{
+    auto& s = state();
+    uint64_t scheduled = entry.when_ns;
+    if (entry.hardware_alarm >= 0) {
+        if (s.alarm_callbacks[entry.hardware_alarm])
+            s.alarm_callbacks[entry.hardware_alarm](entry.hardware_alarm);
+    }
+    else if (entry.rt != nullptr) {
+        if (entry.rt->callback(entry.rt) && entry.rt->alarm_id == entry.id) {
+            int64_t delay = entry.rt->delay_us;
+            entry.when_ns = delay < 0 ? scheduled + (uint64_t)(-delay) * 1000 : s.now_ns + (uint64_t)delay * 1000;
+            s.timers.push_back(entry);
+        }
+    }
+    else {
+        int64_t result = entry.alarm_callback(entry.id, entry.user_data);
+        if (result != 0) {
+            entry.when_ns = result < 0 ? scheduled + (uint64_t)(-result) * 1000 : s.now_ns + (uint64_t)result * 1000;
+            s.timers.push_back(entry);
+        }
+    }
+}
+
+/**
+ * @brief run the interrupts that are pending and not masked
+ */
+void dispatch()
+{
+    auto& s = state();
+    if (s.in_irq || s.irq_masked != 0)
+        return;
+    for (;;) {
+        auto due = std::min_element(s.timers.begin(), s.timers.end(),
+            [](const timer_entry& a, const timer_entry& b) { return a.when_ns < b.when_ns; });
+        if (due != s.timers.end() && due->when_ns <= s.now_ns) {
+            timer_entry entry = *due;
+            s.timers.erase(due);
+            s.in_irq = true;
+            ++s.irq_count;
+            fire_timer(entry);
+            s.in_irq = false;
+            continue;
+        }
+        i2c_controller* pending = nullptr;
+        for (auto& c: s.i2c) {
+            if (irq_pending(c)) {
+                pending = &c;
+                break;
+            }
+        }
+        if (pending == nullptr)
+            return;
+        s.in_irq = true;
+        ++s.irq_count;
+        // the interrupt entry latency
+        s.now_ns += s.call_cost_ns;
+        std::vector<irq_handler_t> handlers = s.handlers[pending->irq_num];
+        for (auto handler: handlers)
+            handler();
+        s.in_irq = false;
+        for (auto& c: s.i2c)
+            run_controller(c);
+    }
+}
+
+void advance_to(uint64_t t_ns)
+{
+    auto& s = state();
+    if (t_ns > s.limit_ns) {
+        fprintf(stderr, "simulation time limit of %llu us reached\n", (unsigned long long)(s.limit_ns / 1000));
+        exit(2);
+    }
+    for (;;) {
+        for (auto& c: s.i2c)
+            run_controller(c);
+        dispatch();
+        if (s.now_ns >= t_ns)
+            return;
+        s.now_ns = std::max(s.now_ns, std::min(t_ns, next_event_ns()));
+    }
+}
+
+i2c_controller& controller(uint8_t index)
+{
+    return state().i2c[index];
+}
+
+void set_gpio_level(uint gpio)
+{
+    auto& s = state();
+    bool level = s.gpio_dir_out[gpio] ? (s.gpio_out[gpio] != (s.gpio_override[gpio] == GPIO_OVERRIDE_INVERT)) : true;
+    if (s.gpio_override[gpio] == GPIO_OVERRIDE_LOW)
+        level = false;
+    else if (s.gpio_override[gpio] == GPIO_OVERRIDE_HIGH)
+        level = true;
+    if (level == s.gpio_levels[gpio])
+        return;
+    s.gpio_levels[gpio] = level;
+    auto watchers = s.gpio_watchers;
+    for (auto& watcher: watchers)
+        watcher(gpio, level);
+}
+}
+
+/* The simulation control functions */
+
+void rppicomidi::sim::attach(i2c_inst_t* i2c, i2c_target* target)
+{
+    controller(i2c->hw->index).targets.push_back(target);
+}
+
+void rppicomidi::sim::reset()
+{
+    state() = sim_state{};
+    i2c0_hw.tar = i2c1_hw.tar = 0x55;
+    i2c0_hw.intr_mask = i2c1_hw.intr_mask = 0x8ff;
+    i2c0_hw.rx_tl = i2c1_hw.rx_tl = 0;
+    i2c0_hw.tx_tl = i2c1_hw.tx_tl = 0;
+}
+
+uint64_t rppicomidi::sim::now_ns()
+{
+    return state().now_ns;
+}
+
+void rppicomidi::sim::advance_us(uint64_t us)
+{
+    advance_to(state().now_ns + us * 1000);
+}
+
+void rppicomidi::sim::set_call_cost_ns(uint32_t ns)
+{
+    state().call_cost_ns = ns;
+}
+
+void rppicomidi::sim::set_time_limit_us(uint64_t limit_us)
+{
+    state().limit_ns = limit_us * 1000;
+}
+
+bool rppicomidi::sim::gpio_level(uint gpio)
+{
+    return gpio < num_gpios && state().gpio_levels[gpio];
+}
+
+void rppicomidi::sim::watch_gpio(std::function<void(uint gpio, bool level)> watcher)
+{
+    state().gpio_watchers.push_back(watcher);
+}
+
+void rppicomidi::sim::push_input(const char* text)
+{
+    while (*text)
+        state().input.push_back((uint8_t)*text++);
+}
+
+rppicomidi::sim::bus_statistics rppicomidi::sim::get_bus_statistics(i2c_inst_t* i2c)
+{
+    return controller(i2c->hw->index).stats;
+}
+
+uint32_t rppicomidi::sim::get_wfe_wakeups()
+{
+    return state().wfe_wakeups;
+}
+
+uint32_t rppicomidi::sim::get_irq_count()
+{
+    return state().irq_count;
+}
+
+bool rppicomidi::sim::in_irq()
+{
+    return state().in_irq;
+}
+
+bool rppicomidi::sim::wait_for_irq(uint64_t deadline_ns)
+{
+    auto& s = state();
+    uint32_t irq_count = s.irq_count;
+    while (s.irq_count == irq_count && s.now_ns < deadline_ns) {
+        if (s.event_flag) {
+            s.event_flag = false;
+            return false;
+        }
+        uint64_t next = std::min(deadline_ns, next_event_ns());
+        advance_to(std::max(next, s.now_ns + s.call_cost_ns));
+    }
+    return s.irq_count != irq_count;
+}
+
+/* The I2C registers */
+
+uint32_t rppicomidi::sim::i2c_reg_read(uint8_t index, i2c_reg reg)
+{
+    auto& c = controller(index);
+    switch(reg) {
+    case reg_enable:
+        return c.enabled ? 1 : 0;
+    case reg_status:
+        return ((c.shifting || c.in_transfer || (c.enabled && !c.tx.empty())) ? I2C_IC_STATUS_ACTIVITY_BITS : 0) |
+            (c.tx.empty() ? I2C_IC_STATUS_TFE_BITS : 0);
+    case reg_txflr:
+        return c.tx.size();
+    case reg_rxflr:
+        return c.rx.size();
+    case reg_intr_stat:
+        return raw_intr_stat(c) & c.inst->hw->intr_mask;
+    case reg_raw_intr_stat:
+        return raw_intr_stat(c);
+    case reg_clr_tx_abrt:
+        c.raw &= ~I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS;
+        c.abort_hold = false;
+        return 0;
+    case reg_clr_stop_det:
+        c.raw &= ~I2C_IC_RAW_INTR_STAT_STOP_DET_BITS;
+        return 0;
+    case reg_data_cmd:
+    {
+        if (c.rx.empty())
+            return 0;
+        uint8_t data = c.rx.front();
+        c.rx.pop_front();
+        return data;
+    }
+    }
+    return 0;
+}
+
+void rppicomidi::sim::i2c_reg_write(uint8_t index, i2c_reg reg, uint32_t value)
+{
+    auto& c = controller(index);
+    switch(reg) {
+    case reg_enable:
+        c.enabled = (value & 1) != 0;
+        if (!c.enabled)
+            flush_fifos(c);
+        break;
+    case reg_data_cmd:
+        if (!c.enabled || c.abort_hold)
+            ++c.stats.flushed_writes;
+        else if (c.tx.size() >= fifo_depth)
+            ++c.stats.tx_overflows;
+        else
+            c.tx.push_back(value & 0x7ff);
+        break;
+    default:
+        break;
+    }
+}
+
+/* The SDK functions */
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate)
+{
+    auto& c = controller(i2c->hw->index);
+    flush_fifos(c);
+    c.active.clear();
+    c.raw = 0;
+    c.abort_hold = false;
+    c.in_transfer = false;
+    c.shifting = false;
+    c.enabled = true;
+    c.baudrate = baudrate;
+    i2c->hw->tar = 0x55;
+    i2c->hw->intr_mask = 0x8ff;
+    i2c->hw->rx_tl = 0;
+    i2c->hw->tx_tl = 0;
+    return baudrate;
+}
+
+void i2c_deinit(i2c_inst_t* i2c)
+{
+    auto& c = controller(i2c->hw->index);
+    c.enabled = false;
+    flush_fifos(c);
+}
+
+uint i2c_set_baudrate(i2c_inst_t* i2c, uint baudrate)
+{
+    controller(i2c->hw->index).baudrate = baudrate;
+    return baudrate;
+}
+
+void critical_section_init(critical_section_t *crit_sec)
+{
+    crit_sec->depth = 0;
+}
+
+void critical_section_enter_blocking(critical_section_t *crit_sec)
+{
+    ++crit_sec->depth;
+    ++state().irq_masked;
+}
+
+void critical_section_exit(critical_section_t *crit_sec)
+{
+    assert(crit_sec->depth > 0);
+    --crit_sec->depth;
+    if (--state().irq_masked == 0)
+        tick();
+}
+
+void critical_section_deinit(critical_section_t *crit_sec)
+{
+    (void)crit_sec;
+}
+
+uint32_t save_and_disable_interrupts()
+{
+    ++state().irq_masked;
+    return 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    (void)status;
+    if (--state().irq_masked == 0)
+        tick();
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority)
+{
+    (void)order_priority;
+    state().handlers[num].push_back(handler);
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    state().irq_enabled[num] = enabled;
+}
+
+void irq_remove_handler(uint num, irq_handler_t handler)
+{
+    auto& handlers = state().handlers[num];
+    handlers.erase(std::remove(handlers.begin(), handlers.end(), handler), handlers.end());
+}
+
+void irq_set_priority(uint num, uint8_t hardware_priority)
+{
+    (void)num;
+    (void)hardware_priority;
+}
+
+void tight_loop_contents()
+{
+    tick();
+}
+
+void __wfe()
+{
+    auto& s = state();
+    rppicomidi::sim::wait_for_irq(s.now_ns + 1000000);
+    ++s.wfe_wakeups;
+}
+
+void __sev()
+{
+    state().event_flag = true;
+}
+
+uint32_t time_us_32()
+{
+    return (uint32_t)time_us_64();
+}
+
+uint64_t time_us_64()
+{
+    tick();
+    return state().now_ns / 1000;
+}
+
+absolute_time_t get_absolute_time()
+{
+    return time_us_64();
+}
+
+bool time_reached(absolute_time_t t)
+{
+    return time_us_64() >= t;
+}
+
+void sleep_us(uint64_t us)
+{
+    advance_to(state().now_ns + us * 1000);
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us(ms * 1000ull);
+}
+
+void busy_wait_us_32(uint32_t delay_us)
+{
+    sleep_us(delay_us);
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp)
+{
+    auto& s = state();
+    ++s.wfe_wakeups;
+    if (rppicomidi::sim::wait_for_irq(timeout_timestamp * 1000))
+        return false;
+    return s.now_ns / 1000 >= timeout_timestamp;
+}
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void *user_data, bool fire_if_past)
+{
+    auto& s = state();
+    uint64_t when_ns = time * 1000;
+    if (when_ns <= s.now_ns) {
+        if (!fire_if_past)
+            return 0;
+        when_ns = s.now_ns;
+    }
+    alarm_id_t id = s.next_alarm_id++;
+    s.timers.push_back({id, when_ns, callback, nullptr, -1, user_data});
+    return id;
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past)
+{
+    return add_alarm_at(state().now_ns / 1000 + us, callback, user_data, fire_if_past);
+}
+
+bool cancel_alarm(alarm_id_t alarm_id)
+{
+    auto& timers = state().timers;
+    auto found = std::find_if(timers.begin(), timers.end(), [alarm_id](const timer_entry& entry) { return entry.id == alarm_id; });
+    if (found == timers.end())
+        return false;
+    timers.erase(found);
+    return true;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out)
+{
+    auto& s = state();
+    out->delay_us = delay_us;
+    out->pool = nullptr;
+    out->callback = callback;
+    out->user_data = user_data;
+    out->alarm_id = s.next_alarm_id++;
+    uint64_t period_us = delay_us < 0 ? -delay_us : delay_us;
+    s.timers.push_back({out->alarm_id, s.now_ns + period_us * 1000, nullptr, out, -1, user_data});
+    return true;
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer)
+{
+    bool result = timer->alarm_id != 0 && cancel_alarm(timer->alarm_id);
+    timer->alarm_id = 0;
+    return result;
+}
+
+void hardware_alarm_claim(uint alarm_num)
+{
+    assert(!state().alarm_claimed[alarm_num]);
+    state().alarm_claimed[alarm_num] = true;
+}
+
+int hardware_alarm_claim_unused(bool required)
+{
+    for (uint alarm_num = 0; alarm_num < num_hardware_alarms; alarm_num++) {
+        if (!state().alarm_claimed[alarm_num]) {
+            state().alarm_claimed[alarm_num] = true;
+            return alarm_num;
+        }
+    }
+    assert(!required);
+    return -1;
+}
+
+void hardware_alarm_unclaim(uint alarm_num)
+{
+    hardware_alarm_cancel(alarm_num);
+    state().alarm_claimed[alarm_num] = false;
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback)
+{
+    state().alarm_callbacks[alarm_num] = callback;
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t)
+{
+    auto& s = state();
+    hardware_alarm_cancel(alarm_num);
+    if (t * 1000 <= s.now_ns)
+        return true;
+    s.timers.push_back({0, t * 1000, nullptr, nullptr, (int)alarm_num, nullptr});
+    return false;
+}
+
+void hardware_alarm_cancel(uint alarm_num)
+{
+    auto& timers = state().timers;
+    timers.erase(std::remove_if(timers.begin(), timers.end(),
+        [alarm_num](const timer_entry& entry) { return entry.hardware_alarm == (int)alarm_num; }), timers.end());
+}
+
+void hardware_alarm_force_irq(uint alarm_num)
+{
+    auto& s = state();
+    s.timers.push_back({0, s.now_ns, nullptr, nullptr, (int)alarm_num, nullptr});
+}
+
+void gpio_init(uint gpio)
+{
+    auto& s = state();
+    s.gpio_out[gpio] = false;
+    s.gpio_dir_out[gpio] = false;
+    s.gpio_override[gpio] = GPIO_OVERRIDE_NORMAL;
+    set_gpio_level(gpio);
+}
+
+void gpio_deinit(uint gpio)
+{
+    gpio_init(gpio);
+}
+
+void gpio_set_outover(uint gpio, uint value)
+{
+    state().gpio_override[gpio] = value;
+    set_gpio_level(gpio);
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    state().gpio_out[gpio] = value;
+    set_gpio_level(gpio);
+}
+
+bool gpio_get(uint gpio)
+{
+    tick();
+    return state().gpio_levels[gpio];
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+    state().gpio_dir_out[gpio] = out;
+    set_gpio_level(gpio);
+}
+
+void gpio_set_function(uint gpio, gpio_function fn)
+{
+    (void)gpio;
+    (void)fn;
+}
+
+void gpio_pull_up(uint gpio)
+{
+    (void)gpio;
+}
+
+bool stdio_init_all()
+{
+    return true;
+}
+
+int getchar_timeout_us(uint32_t timeout_us)
+{
+    auto& s = state();
+    if (s.input.empty())
+        sleep_us(timeout_us);
+    else
+        tick();
+    if (s.input.empty())
+        return PICO_ERROR_TIMEOUT;
+    int c = s.input.front();
+    s.input.pop_front();
+    return c;
+}
+
+int putchar_raw(int c)
+{
+    return putchar(c);
+}
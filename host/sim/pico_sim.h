@@ -0,0 +1,188 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * This is the control side of the host simulation of the Pico SDK functions
+ * the library uses (see include/). Tests and harnesses use it to attach
+ * simulated I2C chips to a bus, move simulated time forward, feed stdin and
+ * read the counters the simulation keeps.
+ *
+ * Simulated time only moves when the code under test calls an SDK function
+ * that would take time on the RP2040: leaving a critical section,
+ * tight_loop_contents(), reading the time, sleeping or waiting for an event.
+ * Each such call costs a small fixed amount of time. Simulated interrupts
+ * run when time moves and interrupts are not masked. The I2C controller
+ * model takes the same number of SCL periods as the wire for every start,
+ * byte and stop condition.
+ */
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "hardware/i2c.h"
+namespace rppicomidi
+{
+namespace sim
+{
+/**
+ * The base class of the simulated chips on an I2C bus
+ */
+class i2c_target
+{
+public:
+    virtual ~i2c_target()=default;
+    /**
+     * @brief add this target, and for a mux the targets behind its connected
+     * channels, to out if they answer to addr
+     *
+     * @param addr the 7-bit address; 0 is the general call address
+     */
+    virtual void find(uint8_t addr, std::vector<i2c_target*>& out)=0;
+
+    /**
+     * @brief a start or repeated start condition addressed this target
+     *
+     * @return true to acknowledge the address
+     * @param addr the address on the wire; 0 for a general call
+     * @param is_read true for a read transaction
+     */
+    virtual bool start(uint8_t addr, bool is_read)=0;
+
+    /**
+     * @brief
+     *
+     * @return true to acknowledge the byte
+     */
+    virtual bool write_byte(uint8_t data)=0;
+
+    /**
+     * @brief
+     *
+     * @return the byte the target sends
+     */
+    virtual uint8_t read_byte()=0;
+
+    /**
+     * @brief a stop condition ended the transaction
+     */
+    virtual void stop() {}
+};
+
+/**
+ * @brief connect target to the bus side of the I2C controller
+ */
+void attach(i2c_inst_t* i2c, i2c_target* target);
+
+/**
+ * @brief disconnect every target from every bus and reset the simulated
+ * time, timers, GPIO, stdin and counters
+ */
+void reset();
+
+/**
+ * @brief
+ *
+ * @return the simulated time since boot in nanoseconds
+ */
+uint64_t now_ns();
+
+/**
+ * @brief move simulated time forward, running the I2C hardware, timers and
+ * interrupts as it goes
+ */
+void advance_us(uint64_t us);
+
+/**
+ * @brief set how long each SDK call that takes time costs
+ */
+void set_call_cost_ns(uint32_t ns);
+
+/**
+ * @brief stop the program with a message if simulated time passes limit_us;
+ * a test that hangs in the simulation fails instead of running forever
+ */
+void set_time_limit_us(uint64_t limit_us);
+
+/**
+ * @brief
+ *
+ * @return the output level of the GPIO pin after the output override
+ */
+bool gpio_level(uint gpio);
+
+/**
+ * @brief call watcher(gpio, level) whenever an output pin changes level
+ */
+void watch_gpio(std::function<void(uint gpio, bool level)> watcher);
+
+/**
+ * @brief add text to what getchar_timeout_us() returns
+ */
+void push_input(const char* text);
+
+struct bus_statistics {
+    uint32_t transactions;  // start conditions, not counting repeated starts
+    uint32_t nacks;         // transactions the controller aborted
+    uint32_t collisions;    // addresses more than one target acknowledged
+    uint32_t tx_overflows;  // data_cmd writes to a full TX FIFO
+    uint32_t flushed_writes;// data_cmd writes while the TX FIFO was held flushed after an abort
+    uint64_t busy_ns;       // time with SCL running
+};
+/**
+ * @brief
+ *
+ * @return the counters of the I2C controller the i2c instance uses
+ */
+bus_statistics get_bus_statistics(i2c_inst_t* i2c);
+
+/**
+ * @brief
+ *
+ * @return the number of times best_effort_wfe_or_timeout() or __wfe() returned
+ */
+uint32_t get_wfe_wakeups();
+
+/**
+ * @brief
+ *
+ * @return the number of times an interrupt handler or timer callback ran
+ */
+uint32_t get_irq_count();
+
+/**
+ * @brief
+ *
+ * @return true if the code under test is running in a simulated interrupt
+ */
+bool in_irq();
+
+/**
+ * @brief wait in simulated time until an interrupt handler or timer callback runs or
+ * until deadline_ns
+ *
+ * @return true if an interrupt ran
+ */
+bool wait_for_irq(uint64_t deadline_ns);
+}
+}
@@ -0,0 +1,301 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstring>
+#include "sim_devices.h"
+
+rppicomidi::sim::mcp4728_model::mcp4728_model(uint8_t addr_, int ldac_gpio_, uint32_t eeprom_write_us_) :
+    addr{addr_}, ldac_gpio{ldac_gpio_}, eeprom_write_us{eeprom_write_us_}, present{true}, is_general_call{false},
+    cmd{cmd_none}, nbytes{0}, chan{0}, udac{false}, first_seq_chan{0}, last_seq_chan{3}, config{0}, read_pos{0},
+    busy_until_ns{0}
+{
+    memset(input, 0, sizeof(input));
+    memset(output, 0, sizeof(output));
+    memset(eeprom, 0, sizeof(eeprom));
+    memset(read_image, 0, sizeof(read_image));
+    memset(&stats, 0, sizeof(stats));
+    if (ldac_gpio != no_ldac)
+        watch_gpio([this](uint gpio, bool level) { on_gpio(gpio, level); });
+}
+
+bool rppicomidi::sim::mcp4728_model::is_busy() const
+{
+    return now_ns() < busy_until_ns;
+}
+
+bool rppicomidi::sim::mcp4728_model::ldac_low() const
+{
+    return ldac_gpio == no_ldac || !gpio_level(ldac_gpio);
+}
+
+void rppicomidi::sim::mcp4728_model::on_gpio(uint gpio, bool level)
+{
+    // a high to low LDAC\ transition updates all outputs
+    if ((int)gpio == ldac_gpio && !level)
+        update_all_outputs();
+}
+
+void rppicomidi::sim::mcp4728_model::update_output(uint8_t chan_)
+{
+    output[chan_] = input[chan_];
+    stats.last_output_ns = now_ns();
+}
+
+void rppicomidi::sim::mcp4728_model::update_all_outputs()
+{
+    for (uint8_t idx = 0; idx < 4; idx++)
+        output[idx] = input[idx];
+    ++stats.output_updates;
+    stats.last_output_ns = now_ns();
+}
+
+void rppicomidi::sim::mcp4728_model::find(uint8_t addr_, std::vector<i2c_target*>& out)
+{
+    if (present && (addr_ == addr || addr_ == 0))
+        out.push_back(this);
+}
+
+bool rppicomidi::sim::mcp4728_model::start(uint8_t addr_, bool is_read)
+{
+    is_general_call = addr_ == 0;
+    cmd = is_general_call ? cmd_general_call : cmd_none;
+    nbytes = 0;
+    if (is_general_call)
+        return !is_read;
+    ++stats.transactions;
+    if (is_read) {
+        bool busy = is_busy();
+        for (uint8_t idx = 0; idx < 4; idx++) {
+            const channel* regs[2] = {&input[idx], &eeprom[idx]};
+            for (uint8_t reg = 0; reg < 2; reg++) {
+                uint8_t* bytes = read_image + idx*6 + reg*3;
+                // RDY/BSY\, POR, the channel and the address bits
+                bytes[0] = (busy ? 0 : 0x80) | 0x40 | (idx << 4) | ((addr & 0x7) << 1);
+                bytes[1] = (regs[reg]->vref << 7) | (regs[reg]->pd << 5) | (regs[reg]->gain << 4) | ((regs[reg]->code >> 8) & 0xF);
+                bytes[2] = regs[reg]->code & 0xFF;
+            }
+        }
+        read_pos = 0;
+    }
+    return true;
+}
+
+bool rppicomidi::sim::mcp4728_model::write_byte(uint8_t data)
+{
+    if (is_general_call) {
+        ++stats.general_calls;
+        switch(data) {
+        case 0x06: // reset: load the EEPROM into the DAC registers
+            for (uint8_t idx = 0; idx < 4; idx++)
+                input[idx] = eeprom[idx];
+            update_all_outputs();
+            break;
+        case 0x09: // wake-up: clear the power-down bits
+            for (uint8_t idx = 0; idx < 4; idx++)
+                input[idx].pd = output[idx].pd = 0;
+            break;
+        case 0x08: // software update
+            update_all_outputs();
+            break;
+        default:
+            ++stats.bad_commands;
+            break;
+        }
+        return true;
+    }
+    bool first = nbytes == 0;
+    ++nbytes;
+    if (cmd == cmd_none || (cmd == cmd_multi && nbytes == 1)) {
+        // the first byte of a command
+        if ((data & 0xC0) == 0x00) {
+            cmd = cmd_fast;
+            chan = 0;
+        }
+        else if ((data & 0xF8) == 0x40) {
+            cmd = cmd_multi;
+            chan = (data >> 1) & 0x3;
+            udac = (data & 1) != 0;
+            return true;
+        }
+        else if ((data & 0xF8) == 0x50 || (data & 0xF8) == 0x58) {
+            cmd = (data & 0xF8) == 0x50 ? cmd_seq : cmd_single;
+            chan = first_seq_chan = (data >> 1) & 0x3;
+            last_seq_chan = first_seq_chan;
+            udac = (data & 1) != 0;
+            return true;
+        }
+        else if ((data & 0xF0) == 0x80 || (data & 0xF0) == 0xC0) {
+            // write Vref or gain select bits; bit 3 is channel A
+            bool is_vref = (data & 0xF0) == 0x80;
+            for (uint8_t idx = 0; idx < 4; idx++) {
+                uint8_t bit = (data >> (3 - idx)) & 1;
+                if (is_vref)
+                    input[idx].vref = output[idx].vref = bit;
+                else
+                    input[idx].gain = output[idx].gain = bit;
+            }
+            cmd = cmd_other;
+            return true;
+        }
+        else if ((data & 0xE0) == 0xA0) {
+            cmd = cmd_pd;
+            input[0].pd = output[0].pd = (data >> 2) & 0x3;
+            input[1].pd = output[1].pd = data & 0x3;
+            return true;
+        }
+        else {
+            cmd = cmd_other;
+            ++stats.bad_commands;
+            return true;
+        }
+    }
+    if (is_busy() && cmd != cmd_other) {
+        if (first)
+            ++stats.ignored;
+        return true;
+    }
+    switch(cmd) {
+    case cmd_fast:
+        // 2 bytes per channel; channel A follows channel D
+        if ((nbytes & 1) != 0) {
+            config = data;
+        }
+        else {
+            input[chan].pd = (config >> 4) & 0x3;
+            input[chan].code = ((config & 0xF) << 8) | data;
+            ++stats.fast_writes;
+            if (ldac_low())
+                update_output(chan);
+            chan = (chan + 1) & 0x3;
+        }
+        break;
+    case cmd_multi:
+        if (nbytes == 2) {
+            config = data;
+        }
+        else {
+            input[chan] = {(uint16_t)(((config & 0xF) << 8) | data), (uint8_t)(config >> 7), (uint8_t)((config >> 4) & 1), (uint8_t)((config >> 5) & 0x3)};
+            ++stats.multi_writes;
+            if (!udac || ldac_low())
+                update_output(chan);
+            // the next byte is the next multi write command
+            nbytes = 0;
+        }
+        break;
+    case cmd_seq:
+    case cmd_single:
+        if ((nbytes & 1) == 0) {
+            config = data;
+        }
+        else if (chan < 4 && (cmd == cmd_seq || chan == first_seq_chan)) {
+            input[chan] = {(uint16_t)(((config & 0xF) << 8) | data), (uint8_t)(config >> 7), (uint8_t)((config >> 4) & 1), (uint8_t)((config >> 5) & 0x3)};
+            if (!udac || ldac_low())
+                update_output(chan);
+            last_seq_chan = chan;
+            ++chan;
+        }
+        break;
+    case cmd_pd:
+        if (nbytes == 2) {
+            input[2].pd = output[2].pd = (data >> 6) & 0x3;
+            input[3].pd = output[3].pd = (data >> 4) & 0x3;
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+uint8_t rppicomidi::sim::mcp4728_model::read_byte()
+{
+    uint8_t data = read_image[read_pos];
+    read_pos = (read_pos + 1) % sizeof(read_image);
+    return data;
+}
+
+void rppicomidi::sim::mcp4728_model::stop()
+{
+    if ((cmd == cmd_seq || cmd == cmd_single) && nbytes >= 3 && !is_busy()) {
+        // the EEPROM write starts at the stop condition
+        for (uint8_t idx = first_seq_chan; idx <= last_seq_chan; idx++)
+            eeprom[idx] = input[idx];
+        ++stats.eeprom_writes;
+        busy_until_ns = now_ns() + eeprom_write_us * 1000ull;
+    }
+    cmd = cmd_none;
+    nbytes = 0;
+    is_general_call = false;
+}
+
+rppicomidi::sim::tca9548a_model::tca9548a_model(uint8_t addr_) : addr{addr_}, channels{0}, write_pending{false},
+    pending{0}, writes{0}
+{
+}
+
+void rppicomidi::sim::tca9548a_model::attach(uint8_t channel, i2c_target* target)
+{
+    children[channel].push_back(target);
+}
+
+void rppicomidi::sim::tca9548a_model::find(uint8_t addr_, std::vector<i2c_target*>& out)
+{
+    if (addr_ == addr)
+        out.push_back(this);
+    for (uint8_t channel = 0; channel < 8; channel++) {
+        if ((channels & (1u << channel)) != 0) {
+            for (auto target: children[channel])
+                target->find(addr_, out);
+        }
+    }
+}
+
+bool rppicomidi::sim::tca9548a_model::start(uint8_t addr_, bool is_read)
+{
+    (void)is_read;
+    write_pending = false;
+    return addr_ == addr;
+}
+
+bool rppicomidi::sim::tca9548a_model::write_byte(uint8_t data)
+{
+    pending = data;
+    write_pending = true;
+    return true;
+}
+
+uint8_t rppicomidi::sim::tca9548a_model::read_byte()
+{
+    return channels;
+}
+
+void rppicomidi::sim::tca9548a_model::stop()
+{
+    // the new channels connect at the stop condition
+    if (write_pending) {
+        channels = pending;
+        ++writes;
+    }
+    write_pending = false;
+}
@@ -0,0 +1,182 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * Simulated I2C chips for the host tests: the MCP4728 quad DAC and the
+ * TCA9548A I2C mux. The models follow the command formats in the data sheets,
+ * not the library's encoders, so a test fails if the two disagree.
+ */
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "pico_sim.h"
+namespace rppicomidi
+{
+namespace sim
+{
+class mcp4728_model : public i2c_target
+{
+public:
+    static const int no_ldac = -1;
+    struct channel {
+        uint16_t code;
+        uint8_t vref;
+        uint8_t gain;
+        uint8_t pd;
+    };
+
+    /**
+     * @brief constructor
+     *
+     * @param addr_ the 7-bit I2C address 0x60-0x67
+     * @param ldac_gpio_ the GPIO that drives the LDAC\ pin or no_ldac if LDAC\ is tied low
+     * @param eeprom_write_us_ how long an EEPROM write keeps RDY/BSY\ low
+     */
+    mcp4728_model(uint8_t addr_, int ldac_gpio_=no_ldac, uint32_t eeprom_write_us_=50000);
+
+    void find(uint8_t addr_, std::vector<i2c_target*>& out) override;
+    bool start(uint8_t addr_, bool is_read) override;
+    bool write_byte(uint8_t data) override;
+    uint8_t read_byte() override;
+    void stop() override;
+
+    /**
+     * @brief take the chip off the bus (present_=false) so it does not acknowledge
+     * its address, or put it back
+     */
+    void set_present(bool present_) { present = present_; }
+
+    const channel& get_input(uint8_t chan) const { return input[chan]; }
+    const channel& get_output(uint8_t chan) const { return output[chan]; }
+    const channel& get_eeprom(uint8_t chan) const { return eeprom[chan]; }
+
+    /**
+     * @brief
+     *
+     * @return true while an EEPROM write is in progress
+     */
+    bool is_busy() const;
+
+    struct statistics {
+        uint32_t transactions;      // write or read transactions addressed to the chip
+        uint32_t fast_writes;       // fast write channel updates
+        uint32_t multi_writes;      // multi write channel updates
+        uint32_t eeprom_writes;     // sequential and single EEPROM writes
+        uint32_t general_calls;     // general call commands
+        uint32_t output_updates;    // times any output changed because of LDAC\ or a general call update
+        uint32_t ignored;           // commands ignored because the EEPROM was busy
+        uint32_t bad_commands;      // bytes that are not a valid command
+        uint64_t last_output_ns;    // the simulated time an output last changed
+    };
+    const statistics& get_statistics() const { return stats; }
+protected:
+    enum command : uint8_t {
+        cmd_none,
+        cmd_fast,
+        cmd_multi,
+        cmd_seq,
+        cmd_single,
+        cmd_pd,
+        cmd_other,
+        cmd_general_call
+    };
+    void update_output(uint8_t chan);
+    void update_all_outputs();
+    bool ldac_low() const;
+    void on_gpio(uint gpio, bool level);
+    uint8_t addr;
+    int ldac_gpio;
+    uint32_t eeprom_write_us;
+    bool present;
+    bool is_general_call;
+    command cmd;
+    uint8_t nbytes;             // bytes of the current command received
+    uint8_t chan;               // the channel the current command writes
+    bool udac;
+    uint8_t first_seq_chan;
+    uint8_t last_seq_chan;
+    uint8_t config;             // the Vref, PD, gain and upper data byte of the current channel
+    uint8_t read_image[24];
+    uint8_t read_pos;
+    uint64_t busy_until_ns;
+    channel input[4];
+    channel output[4];
+    channel eeprom[4];
+    statistics stats;
+private:
+    mcp4728_model()=delete;
+    mcp4728_model(const mcp4728_model&)=delete;
+    mcp4728_model& operator=(const mcp4728_model&)=delete;
+};
+
+class tca9548a_model : public i2c_target
+{
+public:
+    /**
+     * @brief constructor
+     *
+     * @param addr_ the 7-bit I2C address 0x70-0x77
+     */
+    explicit tca9548a_model(uint8_t addr_);
+
+    /**
+     * @brief wire target to the channel side of the mux
+     *
+     * @param channel the mux channel 0-7
+     */
+    void attach(uint8_t channel, i2c_target* target);
+
+    void find(uint8_t addr_, std::vector<i2c_target*>& out) override;
+    bool start(uint8_t addr_, bool is_read) override;
+    bool write_byte(uint8_t data) override;
+    uint8_t read_byte() override;
+    void stop() override;
+
+    /**
+     * @brief
+     *
+     * @return the control register; bit n set means channel n is connected
+     */
+    uint8_t get_channels() const { return channels; }
+
+    /**
+     * @brief
+     *
+     * @return the number of times the control register was written
+     */
+    uint32_t get_writes() const { return writes; }
+protected:
+    uint8_t addr;
+    uint8_t channels;
+    bool write_pending;
+    uint8_t pending;
+    uint32_t writes;
+    std::vector<i2c_target*> children[8];
+private:
+    tca9548a_model()=delete;
+    tca9548a_model(const tca9548a_model&)=delete;
+    tca9548a_model& operator=(const tca9548a_model&)=delete;
+};
+}
+}
@@ -0,0 +1,122 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * This test checks the frame builders in rp2040_mcp4728_frames.h against the
+ * bytes a simulated MCP4728 receives from the matching RP2040_MCP4728 calls.
+ */
+#include <vector>
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_lib.h"
+#include "rp2040_mcp4728_frames.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::Rp2040_i2c_bus;
+using rppicomidi::mcp4728_channel_data;
+using rppicomidi::mcp4728_op_handle;
+using namespace rppicomidi::sim;
+
+/**
+ * Passes the bus traffic to a chip and keeps the bytes of the last write transaction
+ */
+class recording_target : public i2c_target
+{
+public:
+    explicit recording_target(mcp4728_model& chip_) : chip{chip_} {}
+    void find(uint8_t addr, std::vector<i2c_target*>& out) override
+    {
+        std::vector<i2c_target*> found;
+        chip.find(addr, found);
+        if (!found.empty())
+            out.push_back(this);
+    }
+    bool start(uint8_t addr, bool is_read) override
+    {
+        if (!is_read)
+            bytes.clear();
+        return chip.start(addr, is_read);
+    }
+    bool write_byte(uint8_t data) override
+    {
+        bytes.push_back(data);
+        return chip.write_byte(data);
+    }
+    uint8_t read_byte() override { return chip.read_byte(); }
+    void stop() override { chip.stop(); }
+
+    std::vector<uint8_t> bytes;
+private:
+    mcp4728_model& chip;
+};
+
+template<size_t N>
+static bool received(const recording_target& target, const std::array<uint8_t, N>& frame)
+{
+    return target.bytes == std::vector<uint8_t>(frame.begin(), frame.end());
+}
+
+int main()
+{
+    mcp4728_model chip(0x60, mcp4728_model::no_ldac, 1000);
+    recording_target target(chip);
+    attach(i2c0, &target);
+    Rp2040_i2c_bus bus(i2c0, 400000, 4, 5);
+    RP2040_MCP4728 dac(0x60, &bus);
+    CHECK(run_until([&dac]() { dac.task(); }, [&dac]() { return dac.request_bus(nullptr, nullptr) == 1; }, 10000));
+    mcp4728_op_handle handle;
+
+    const std::array<uint16_t, 4> codes = {0x0123, 0x1456, 0x2789, 0x3ABC};
+    CHECK(dac.fast_write(codes.data(), 4, true, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_fast_write_frame(codes)));
+    CHECK(dac.fast_write(codes.data(), 2, true, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_fast_write_frame<2>({codes[0], codes[1]})));
+
+    const std::array<mcp4728_channel_data, 4> chan_dat = {
+        mcp4728_channel_data{3, 1, 1, 0, 1, 0x0FFF},
+        mcp4728_channel_data{0, 0, 0, 1, 0, 0x0001},
+        mcp4728_channel_data{2, 1, 1, 2, 0, 0x0800},
+        mcp4728_channel_data{1, 0, 0, 3, 1, 0x0A5A}};
+    CHECK(dac.multi_write(chan_dat.data(), 4, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_multi_write_frame(chan_dat)));
+    CHECK(dac.multi_write(chan_dat.data(), 1, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_multi_write_frame<1>({chan_dat[0]})));
+
+    CHECK(dac.set_all_gains(true, false, true, false, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_gains_frame(true, false, true, false)));
+    CHECK(dac.set_all_vrefs(false, true, true, false, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_vrefs_frame(false, true, true, false)));
+    CHECK(dac.set_all_pds(1, 0, 3, 2, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_pds_frame(1, 0, 3, 2)));
+
+    // the chip ignores writes while it programs its EEPROM, so wait that out between writes
+    const std::array<mcp4728_channel_data, 2> last_two = {chan_dat[2], chan_dat[0]};
+    CHECK(dac.sequential_write_eeprom(last_two.data(), 2, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_seq_write_eeprom_frame(last_two)));
+    advance_us(2000);
+    CHECK(dac.sequential_write_eeprom(chan_dat.data() + 1, 1, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000));
+    CHECK(received(target, rppicomidi::mcp4728_seq_write_eeprom_frame<1>({chan_dat[1]})));
+    CHECK(chip.get_statistics().bad_commands == 0);
+    return test_result("frames_test");
+}
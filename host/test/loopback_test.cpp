@@ -0,0 +1,185 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * This test runs the binary DAC control protocol end to end. The real host
+ * client talks through a pseudo terminal to the target side, an
+ * RP2040_MCP4728_binary object whose group drives simulated MCP4728 chips
+ * on the simulated I2C bus. The target thread drops bytes in both
+ * directions, so the test covers frame rejection, resending and lost acks.
+ */
+#include <atomic>
+#include <cstdlib>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_binary.h"
+#include "rp2040_mcp4728_host_client.h"
+
+using namespace rppicomidi;
+
+/**
+ * The target end of the pseudo terminal
+ */
+class loopback_target
+{
+public:
+    loopback_target(int master_, RP2040_MCP4728_group* group, uint32_t rx_drop_, uint32_t tx_drop_) :
+        master{master_}, binary{group, send, this}, rx_drop{rx_drop_}, tx_drop{tx_drop_}, seed{12345},
+        rx_dropped{0}, tx_dropped{0}, drop_send{false}, stop{false} {}
+
+    /**
+     * @brief the target's main loop; run it in its own thread
+     */
+    void run() {
+        while (!stop) {
+            uint8_t buf[256];
+            ssize_t nbytes = read(master, buf, sizeof(buf));
+            for (ssize_t idx = 0; idx < nbytes; idx++) {
+                if (drop(rx_drop))
+                    ++rx_dropped;
+                else
+                    binary.receive(buf[idx]);
+            }
+            binary.task();
+            // let the I2C bus run
+            sim::advance_us(20);
+            if (nbytes <= 0)
+                usleep(100);
+        }
+    }
+
+    RP2040_MCP4728_binary& get_binary() { return binary; }
+    uint32_t get_rx_dropped() const { return rx_dropped; }
+    uint32_t get_tx_dropped() const { return tx_dropped; }
+    void request_stop() { stop = true; }
+
+    /**
+     * @brief drop the ack that confirms the close
+     */
+    void drop_close_ack() { drop_send = true; }
+protected:
+    /**
+     * @brief
+     *
+     * @return true one time in one_in
+     */
+    bool drop(uint32_t one_in) {
+        seed = seed * 1103515245 + 12345;
+        return one_in != 0 && ((seed >> 16) % one_in) == 0;
+    }
+
+    static void send(void* context, const uint8_t* data, size_t nbytes) {
+        auto me = reinterpret_cast<loopback_target*>(context);
+        if (!me->binary.is_open() && me->drop_send.exchange(false)) {
+            me->tx_dropped += nbytes;
+            return;
+        }
+        for (size_t idx = 0; idx < nbytes; idx++) {
+            if (me->drop(me->tx_drop)) {
+                ++me->tx_dropped;
+                continue;
+            }
+            while (write(me->master, data + idx, 1) != 1)
+                usleep(100);
+        }
+    }
+    int master;
+    RP2040_MCP4728_binary binary;
+    std::atomic<uint32_t> rx_drop;
+    std::atomic<uint32_t> tx_drop;
+    uint32_t seed;
+    uint32_t rx_dropped;
+    uint32_t tx_dropped;
+    std::atomic<bool> drop_send;
+    std::atomic<bool> stop;
+};
+
+int main()
+{
+    const uint8_t nchips = 2;
+    const uint32_t nupdates = 3000;
+    sim::mcp4728_model chip0(0x60), chip1(0x61);
+    sim::attach(i2c0, &chip0);
+    sim::attach(i2c0, &chip1);
+    Rp2040_i2c_bus bus(i2c0, 1000000, 4, 5);
+    RP2040_MCP4728 dacs[nchips] = {RP2040_MCP4728(0x60, &bus), RP2040_MCP4728(0x61, &bus)};
+    RP2040_MCP4728_group group(dacs, nchips, &bus);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0);
+    if (master < 0)
+        return test_result("loopback_test");
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    // lose about one byte in 2000 from the host and one in 100 to the host
+    loopback_target target(master, &group, 2000, 100);
+    std::thread target_thread(&loopback_target::run, &target);
+
+    RP2040_MCP4728_host_client client;
+    CHECK(client.open(ptsname(master), 5000));
+    uint16_t last[nchips][4] = {};
+    for (uint32_t update = 0; update < nupdates; update++) {
+        uint8_t chip = update % nchips;
+        for (uint8_t chan = 0; chan < 4; chan++)
+            last[chip][chan] = (update * 7 + chan * 1000) & 0xFFF;
+        if (!client.fast_write(chip, last[chip], 4)) {
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK(client.flush(5000));
+    CHECK(client.wait_acked(20000));
+    // lose the ack of the close frame; the client sends the close again
+    target.drop_close_ack();
+    CHECK(client.close(5000));
+    target.request_stop();
+    target_thread.join();
+
+    RP2040_MCP4728_host_client::statistics client_stats;
+    client.get_statistics(client_stats);
+    RP2040_MCP4728_binary::statistics target_stats;
+    target.get_binary().get_statistics(target_stats);
+    printf("%u frames, %u resent, %u acks, %u rejected; %u bytes dropped to the target, %u from the target\n",
+        (unsigned)client_stats.frames, (unsigned)client_stats.resent, (unsigned)client_stats.acks, (unsigned)client_stats.rejected,
+        (unsigned)target.get_rx_dropped(), (unsigned)target.get_tx_dropped());
+    // the drops happened and the protocol recovered from them
+    CHECK(target.get_rx_dropped() > 0);
+    CHECK(target.get_tx_dropped() > 0);
+    CHECK(client_stats.rejected > 0);
+    CHECK(client_stats.resent > 0);
+    CHECK(target_stats.rejected > 0);
+    // every write reached the chips exactly once and in order
+    CHECK(target_stats.writes == nupdates);
+    CHECK(chip0.get_statistics().fast_writes + chip1.get_statistics().fast_writes == nupdates * 4);
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        CHECK(chip0.get_output(chan).code == last[0][chan]);
+        CHECK(chip1.get_output(chan).code == last[1][chan]);
+    }
+    CHECK(!target.get_binary().is_open());
+    CHECK(!group.has_bus());
+    close(master);
+    return test_result("loopback_test");
+}
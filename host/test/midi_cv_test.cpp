@@ -0,0 +1,181 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This test feeds MIDI byte streams to RP2040_MCP4728_midi_cv and checks the
+ * simulated MCP4728 outputs, the choice between fast writes and multi-writes,
+ * one bus frame per receive() call, and the latency statistics.
+ */
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_midi_cv.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::RP2040_MCP4728_group;
+using rppicomidi::RP2040_MCP4728_midi_cv;
+using rppicomidi::Rp2040_i2c_bus;
+using namespace rppicomidi::sim;
+
+static RP2040_MCP4728_group* group;
+static RP2040_MCP4728_midi_cv* midi_cv;
+
+/**
+ * @brief run the group and midi_cv tasks until every bus frame is done
+ */
+static bool settle()
+{
+    // midi_cv->task() sends any changes that waited for the previous frame, so the
+    // group is idle only when nothing is left to send
+    return run_until([]() { group->task(); midi_cv->task(); }, []() { return !group->is_updating(); }, 10000);
+}
+
+static void play(std::initializer_list<uint8_t> bytes)
+{
+    midi_cv->receive(bytes.begin(), bytes.size());
+}
+
+/**
+ * @return the pitch code for note with pitch bend bend (-8192 to 8191), 1000 codes per octave,
+ * note 24 is code 0 and the bend range is 2 semitones
+ */
+static uint16_t pitch_code(uint8_t note, int32_t bend=0)
+{
+    int32_t code = (((int32_t)note - 24) * 8192 + bend * 2) * 1000 / (12 * 8192);
+    return code < 0 ? 0 : (code > 4095 ? 4095 : code);
+}
+
+int main()
+{
+    mcp4728_model chip0(0x60), chip1(0x61);
+    attach(i2c0, &chip0);
+    attach(i2c0, &chip1);
+    Rp2040_i2c_bus bus(i2c0, 1000000, 4, 5);
+    RP2040_MCP4728 dacs[2] = {RP2040_MCP4728(0x60, &bus), RP2040_MCP4728(0x61, &bus)};
+    RP2040_MCP4728_group chips(dacs, 2, &bus);
+    group = &chips;
+    RP2040_MCP4728_midi_cv converter(&chips);
+    midi_cv = &converter;
+
+    // three voices with pitch on chip 0 A-C and gates on chip 1 A-C; CC 1 to chip 0 D and CC 7 to chip 1 D
+    const RP2040_MCP4728_midi_cv::voice_config voices[3] = {{0, 4, RP2040_MCP4728_midi_cv::no_channel},
+        {1, 5, RP2040_MCP4728_midi_cv::no_channel}, {2, 6, RP2040_MCP4728_midi_cv::no_channel}};
+    CHECK(converter.set_voices(voices, 3, RP2040_MCP4728_midi_cv::alloc_round_robin));
+    converter.set_pitch_scale(1000, 24, 2);
+    CHECK(converter.map_cc(1, 3));
+    CHECK(converter.map_cc(7, 7));
+    CHECK(!converter.map_cc(7, 8));
+    // the pitch and gate channels of voice 1 are configured, so they may use multi-writes
+    CHECK(converter.set_channel_config(1, 1, 1, 0));
+    CHECK(converter.set_channel_config(5, 1, 1, 0));
+    CHECK(!converter.set_channel_config(8, 1, 1, 0));
+
+    // the board set chip 0 channel D to Vref=2.048V and gain=2 before the converter starts
+    RP2040_MCP4728& dac0 = dacs[0];
+    CHECK(run_until([&dac0]() { dac0.task(); }, [&dac0]() { return dac0.request_bus(nullptr, nullptr) == 1; }, 10000));
+    rppicomidi::mcp4728_channel_data preset = {3, 0, 1, 0, 1, 0};
+    rppicomidi::mcp4728_op_handle handle;
+    CHECK(dac0.multi_write(&preset, 1, nullptr, nullptr, &handle) && dac0.wait_op(handle, 10000));
+    bool released = false;
+    if (dac0.release_bus([](void* context) { *reinterpret_cast<bool*>(context) = true; }, &released) == 0)
+        CHECK(run_until([&dac0]() { dac0.task(); }, [&released]() { return released; }, 10000));
+    uint32_t preset_multi_writes = chip0.get_statistics().multi_writes;
+
+    CHECK(chips.request_bus(nullptr, nullptr) >= 0);
+    CHECK(run_until([]() { group->task(); }, []() { return group->has_bus(); }, 10000));
+
+    // a note on updates the pitch with a fast write (channel A only) and the gate
+    play({0x90, 60, 100});
+    CHECK(settle());
+    CHECK(chip0.get_output(0).code == pitch_code(60));
+    CHECK(chip1.get_output(0).code == 4095);
+    CHECK(chip0.get_statistics().fast_writes == 1 && chip0.get_statistics().multi_writes == preset_multi_writes);
+    CHECK(converter.get_latency_stats().count == 1);
+
+    // running status: the next voice gets the note. Configured channel B alone is shorter as a multi-write.
+    play({64, 100});
+    CHECK(settle());
+    CHECK(chip0.get_output(1).code == pitch_code(64));
+    CHECK(chip1.get_output(1).code == 4095);
+    CHECK(chip0.get_statistics().multi_writes == preset_multi_writes + 1 && chip1.get_statistics().multi_writes == 1);
+    CHECK(chip0.get_output(1).vref == 1 && chip0.get_output(1).gain == 1);
+    CHECK(converter.get_latency_stats().count == 2);
+
+    // real-time bytes inside a message and system exclusive messages are skipped;
+    // the end of the system exclusive message cancels running status
+    play({0x90, 67, 0xF8, 100, 0xF0, 0x7E, 0x01, 0xF7, 70, 100});
+    CHECK(settle());
+    CHECK(chip0.get_output(2).code == pitch_code(67));
+    CHECK(chip1.get_output(2).code == 4095);
+    CHECK(converter.get_latency_stats().count == 3);
+
+    // the oldest note is stolen when every voice is busy; note on velocity 0 is a note off
+    play({0x90, 72, 90, 64, 0});
+    CHECK(settle());
+    CHECK(chip0.get_output(0).code == pitch_code(72));
+    CHECK(chip1.get_output(1).code == 0);
+
+    // pitch bend moves every voice; one receive() call is one bus frame for both chips
+    uint32_t frames = converter.get_latency_stats().count;
+    play({0xE0, 0x7F, 0x7F});
+    CHECK(settle());
+    CHECK(chip0.get_output(0).code == pitch_code(72, 8191));
+    CHECK(chip0.get_output(1).code == pitch_code(64, 8191));
+    CHECK(chip0.get_output(2).code == pitch_code(67, 8191));
+    CHECK(converter.get_latency_stats().count == frames + 1);
+
+    // control changes, and a second receive() while the first frame is on the bus
+    frames = converter.get_latency_stats().count;
+    play({0xB0, 1, 127});
+    play({7, 64});
+    CHECK(settle());
+    CHECK(chip0.get_output(3).code == 4095);
+    CHECK(chip1.get_output(3).code == 64 * 4095 / 127);
+    CHECK(converter.get_latency_stats().count == frames + 2);
+
+    // a change to unconfigured channel D alone goes out as a fast write of A-D, which
+    // keeps the Vref and gain the board set
+    uint32_t fast_writes = chip0.get_statistics().fast_writes;
+    play({0xB0, 1, 100});
+    CHECK(settle());
+    CHECK(chip0.get_output(3).code == 100 * 4095 / 127);
+    CHECK(chip0.get_output(3).vref == 1 && chip0.get_output(3).gain == 1);
+    CHECK(chip0.get_statistics().fast_writes == fast_writes + 4);
+
+    // note off for all held notes closes every gate
+    play({0x80, 72, 0, 67, 0});
+    CHECK(settle());
+    for (uint8_t chan = 0; chan < 3; chan++)
+        CHECK(chip1.get_output(chan).code == 0);
+
+    // a 4-channel frame to each chip at 1 MHz takes well under 200us
+    auto& stats = converter.get_latency_stats();
+    CHECK(stats.min_done_us > 0 && stats.min_done_us <= stats.max_done_us);
+    CHECK(stats.max_done_us < 200);
+    CHECK(stats.max_submit_us < stats.max_done_us + 200);
+    CHECK(get_bus_statistics(i2c0).nacks == 0);
+    printf("%u frames: latency %u-%u us, mean %u us\n", (unsigned)stats.count, (unsigned)stats.min_done_us,
+        (unsigned)stats.max_done_us, (unsigned)(stats.total_done_us / stats.count));
+    return test_result("midi_cv_test");
+}
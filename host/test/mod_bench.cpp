@@ -0,0 +1,118 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This program measures how many channels per millisecond
+ * RP2040_MCP4728_mod::compute() sustains on the host, after it checks on the
+ * simulated bus that write_frames() sends the computed codes to every chip.
+ * The rate is host CPU time, not RP2040 time, so use it to compare changes
+ * to the engine rather than as a target figure.
+ */
+#include <chrono>
+#include <cstring>
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_mod.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::RP2040_MCP4728_group;
+using rppicomidi::RP2040_MCP4728_mod;
+using rppicomidi::Rp2040_i2c_bus;
+using namespace rppicomidi::sim;
+
+int main()
+{
+    // the MCP4728 has 8 addresses, so this is the most chips a bus can have without a mux
+    const uint8_t nchips = 8;
+    const uint32_t tick_rate_hz = 1000;
+    mcp4728_model chips[nchips] = {mcp4728_model(0x60), mcp4728_model(0x61), mcp4728_model(0x62), mcp4728_model(0x63),
+        mcp4728_model(0x64), mcp4728_model(0x65), mcp4728_model(0x66), mcp4728_model(0x67)};
+    for (uint8_t idx = 0; idx < nchips; idx++)
+        attach(i2c0, &chips[idx]);
+    Rp2040_i2c_bus bus(i2c0, 1000000, 4, 5);
+    RP2040_MCP4728 dacs[nchips] = {RP2040_MCP4728(0x60, &bus), RP2040_MCP4728(0x61, &bus), RP2040_MCP4728(0x62, &bus),
+        RP2040_MCP4728(0x63, &bus), RP2040_MCP4728(0x64, &bus), RP2040_MCP4728(0x65, &bus), RP2040_MCP4728(0x66, &bus),
+        RP2040_MCP4728(0x67, &bus)};
+    RP2040_MCP4728_group group(dacs, nchips, &bus);
+    RP2040_MCP4728_mod mod(&group, tick_rate_hz);
+    const uint8_t nchans = nchips * 4;
+    for (uint8_t chan = 0; chan < nchans; chan++) {
+        CHECK(mod.set_base(chan, 2048));
+        CHECK(mod.set_lfo(chan, (RP2040_MCP4728_mod::lfo_shape)(1 + chan % 4), 500 + chan * 250, 1000));
+        CHECK(mod.set_adsr(chan, 20000, 50000, 40000, 100000, 800));
+        CHECK(mod.gate(chan, true));
+    }
+
+    // every tick's frames reach the chips
+    CHECK(group.request_bus(nullptr, nullptr) >= 0);
+    CHECK(run_until([&group]() { group.task(); }, [&group]() { return group.has_bus(); }, 10000));
+    const uint32_t nticks = 200;
+    for (uint32_t tick = 0; tick < nticks; tick++) {
+        mod.compute();
+        CHECK(mod.write_frames());
+        CHECK(run_until([&group]() { group.task(); }, [&group]() { return !group.is_updating(); }, 10000));
+    }
+    CHECK(group.get_failed_chips() == 0);
+    bus_statistics bus_stats = get_bus_statistics(i2c0);
+    CHECK(bus_stats.nacks == 0);
+    printf("%u chips at 1 MHz: %.1f us of bus time per tick\n", (unsigned)nchips, bus_stats.busy_ns / 1000.0 / nticks);
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        const uint8_t* frame = mod.get_frame(idx);
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            uint16_t code = ((frame[chan * 2] & 0x0F) << 8) | frame[chan * 2 + 1];
+            CHECK(chips[idx].get_output(chan).code == code);
+        }
+        CHECK(chips[idx].get_statistics().fast_writes == nticks * 4); // the model counts channels
+    }
+
+    // compute() while the group is still sending must not change the frames in flight
+    mod.compute();
+    CHECK(mod.write_frames());
+    uint8_t sent[nchips][8];
+    for (uint8_t idx = 0; idx < nchips; idx++)
+        memcpy(sent[idx], mod.get_frame(idx), sizeof(sent[idx]));
+    mod.compute();
+    CHECK(group.is_updating());
+    CHECK(memcmp(sent[0], mod.get_frame(0), sizeof(sent[0])) != 0);
+    CHECK(run_until([&group]() { group.task(); }, [&group]() { return !group.is_updating(); }, 10000));
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            uint16_t code = ((sent[idx][chan * 2] & 0x0F) << 8) | sent[idx][chan * 2 + 1];
+            CHECK(chips[idx].get_output(chan).code == code);
+        }
+    }
+
+    // the compute() rate on the host
+    const uint32_t nbench = 200000;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t tick = 0; tick < nbench; tick++)
+        mod.compute();
+    auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if (elapsed_ns > 0) {
+        printf("%u channels: %.1f ns per compute(), %.0f channels per ms\n", (unsigned)nchans,
+            (double)elapsed_ns / nbench, (double)nbench * nchans * 1e6 / elapsed_ns);
+    }
+    return test_result("mod_bench");
+}
@@ -0,0 +1,199 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * This test runs Rp2040_i2c_bus mux switching (grant_locked()) and queue
+ * regrouping (regroup_locked()) against simulated TCA9548A muxes with
+ * MCP4728 chips that share an address on different mux channels.
+ */
+#include <string>
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_lib.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::Rp2040_i2c_bus;
+using namespace rppicomidi::sim;
+
+static std::string grants;
+
+struct named_dac {
+    RP2040_MCP4728* dac;
+    char name;
+};
+
+static void granted(void* context)
+{
+    grants += reinterpret_cast<named_dac*>(context)->name;
+}
+
+static void run_tasks(named_dac* dacs, size_t ndacs)
+{
+    for (size_t idx = 0; idx < ndacs; idx++)
+        dacs[idx].dac->task();
+}
+
+/**
+ * @brief get the bus, write code to every channel and release the bus
+ */
+static bool write_all(RP2040_MCP4728& dac, uint16_t code)
+{
+    if (!run_until([&dac]() { dac.task(); }, [&dac]() { return dac.request_bus(nullptr, nullptr) == 1; }, 10000))
+        return false;
+    uint16_t codes[4] = {code, code, code, code};
+    rppicomidi::mcp4728_op_handle handle;
+    bool result = dac.fast_write(codes, 4, true, nullptr, nullptr, &handle) && dac.wait_op(handle, 10000);
+    bool released = false;
+    if (dac.release_bus([](void* context) { *reinterpret_cast<bool*>(context) = true; }, &released) == 0)
+        run_until([&dac]() { dac.task(); }, [&released]() { return released; }, 10000);
+    return result;
+}
+
+int main()
+{
+    // a and a2 are behind mux 0x70 channel 0, b behind channel 1, c behind mux 0x71 channel 2.
+    // a, b and c share address 0x60. d is on the bus side of the muxes. Nothing answers 0x72.
+    tca9548a_model mux70(0x70), mux71(0x71);
+    mcp4728_model chip_a(0x60), chip_a2(0x62), chip_b(0x60), chip_c(0x60), chip_d(0x61);
+    mux70.attach(0, &chip_a);
+    mux70.attach(0, &chip_a2);
+    mux70.attach(1, &chip_b);
+    mux71.attach(2, &chip_c);
+    attach(i2c0, &mux70);
+    attach(i2c0, &mux71);
+    attach(i2c0, &chip_d);
+
+    Rp2040_i2c_bus bus(i2c0, 400000, 4, 5);
+    RP2040_MCP4728 a(0x60, &bus), a2(0x62, &bus), b(0x60, &bus), c(0x60, &bus), d(0x61, &bus), e(0x60, &bus);
+    CHECK(a.set_mux_path(0x70, 0x01));
+    CHECK(a2.set_mux_path(0x70, 0x01));
+    CHECK(b.set_mux_path(0x70, 0x02));
+    CHECK(c.set_mux_path(0x71, 0x04));
+    CHECK(e.set_mux_path(0x72, 0x01));
+    CHECK(!e.set_mux_path(0x69, 0x01));
+    CHECK(!e.set_mux_path(0x72, 0));
+    named_dac dacs[] = {{&a, 'a'}, {&a2, 'A'}, {&b, 'b'}, {&c, 'c'}, {&d, 'd'}, {&e, 'e'}};
+    const size_t ndacs = sizeof(dacs)/sizeof(dacs[0]);
+
+    // Each chip gets only its own writes even though three of them share an address
+    CHECK(write_all(a, 0x111));
+    CHECK(write_all(b, 0x222));
+    CHECK(write_all(c, 0x333));
+    CHECK(write_all(d, 0x444));
+    CHECK(write_all(a, 0x555));
+    CHECK(write_all(c, 0x666));
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        CHECK(chip_a.get_output(chan).code == 0x555);
+        CHECK(chip_b.get_output(chan).code == 0x222);
+        CHECK(chip_c.get_output(chan).code == 0x666);
+        CHECK(chip_d.get_output(chan).code == 0x444);
+        CHECK(chip_a2.get_output(chan).code == 0);
+    }
+    CHECK(get_bus_statistics(i2c0).collisions == 0);
+    CHECK(get_bus_statistics(i2c0).nacks == 0);
+    // c is the last device, so only its mux channel is connected
+    CHECK(mux70.get_channels() == 0);
+    CHECK(mux71.get_channels() == 0x04);
+    Rp2040_i2c_bus::Mux_statistics stats;
+    bus.get_mux_statistics(stats);
+    // a: 0x70=1; b: 0x70=2; c: 0x70=0, 0x71=4; d: none; a: 0x71=0, 0x70=1; c: 0x70=0, 0x71=4
+    CHECK(stats.switches == 8);
+    CHECK(stats.switches == mux70.get_writes() + mux71.get_writes());
+    CHECK(stats.errors == 0);
+    CHECK(stats.regrouped == 0);
+    CHECK(stats.switch_us > 0);
+
+    // A device on the connected segment goes ahead of one that needs a switch
+    CHECK(write_all(a, 0x777));
+    bus.reset_mux_statistics();
+    CHECK(a.request_bus(nullptr, nullptr) == 1);
+    CHECK(b.request_bus(granted, &dacs[2]) == 0);
+    CHECK(a2.request_bus(granted, &dacs[1]) == 0);
+    grants.clear();
+    CHECK(a.release_bus(nullptr, nullptr) == 1);
+    run_until([&]() { run_tasks(dacs, ndacs); }, []() { return !grants.empty(); }, 10000);
+    CHECK(grants == "A");
+    bus.get_mux_statistics(stats);
+    CHECK(stats.regrouped == 1);
+    CHECK(stats.grants_no_switch == 2); // a's request and a2's grant
+    CHECK(stats.switches == 0);
+    CHECK(a2.release_bus(nullptr, nullptr) == 1);
+    run_until([&]() { run_tasks(dacs, ndacs); }, []() { return grants.size() == 2; }, 10000);
+    CHECK(grants == "Ab");
+    CHECK(mux70.get_channels() == 0x02);
+    CHECK(b.release_bus(nullptr, nullptr) == 1);
+
+    // The device at the front of the queue is passed over at most RP2040_I2C_MUX_MAX_SKIPS times
+    CHECK(write_all(a, 0x888));
+    bus.reset_mux_statistics();
+    grants.clear();
+    CHECK(a.request_bus(nullptr, nullptr) == 1);
+    CHECK(b.request_bus(granted, &dacs[2]) == 0);
+    named_dac* holder = &dacs[0];
+    named_dac* waiting = nullptr;
+    for (int round = 0; round < RP2040_I2C_MUX_MAX_SKIPS + 2 && grants.find('b') == std::string::npos; round++) {
+        // the other device on the connected segment asks for the bus before the holder lets go
+        named_dac* next = holder == &dacs[0] ? &dacs[1] : &dacs[0];
+        CHECK(next->dac->request_bus(granted, next) == 0);
+        CHECK(holder->dac->release_bus(nullptr, nullptr) == 1);
+        size_t ngrants = grants.size();
+        run_until([&]() { run_tasks(dacs, ndacs); }, [ngrants]() { return grants.size() > ngrants; }, 10000);
+        if (grants.back() == 'b')
+            waiting = next;
+        else
+            holder = next;
+    }
+    // a2 and a took turns RP2040_I2C_MUX_MAX_SKIPS times, then b got the bus
+    CHECK(grants.size() == RP2040_I2C_MUX_MAX_SKIPS + 1);
+    CHECK(grants.back() == 'b');
+    bus.get_mux_statistics(stats);
+    CHECK(stats.regrouped == RP2040_I2C_MUX_MAX_SKIPS);
+    run_until([&]() { run_tasks(dacs, ndacs); }, [&]() { return b.request_bus(nullptr, nullptr) == 1; }, 10000);
+    CHECK(mux70.get_channels() == 0x02);
+    // the device that was left waiting gets the bus next
+    CHECK(waiting != nullptr);
+    CHECK(b.release_bus(nullptr, nullptr) == 1);
+    run_until([&]() { run_tasks(dacs, ndacs); }, [&]() { return grants.size() == RP2040_I2C_MUX_MAX_SKIPS + 2; }, 10000);
+    CHECK(waiting && grants.back() == waiting->name);
+    CHECK(waiting && waiting->dac->release_bus(nullptr, nullptr) == 1);
+
+    // A mux that does not acknowledge is counted and written again on the next switch
+    // e still gets the bus, and its write is not acknowledged because no segment is connected
+    bus.reset_mux_statistics();
+    uint32_t nacks = get_bus_statistics(i2c0).nacks;
+    write_all(e, 0x123);
+    bus.get_mux_statistics(stats);
+    CHECK(stats.errors == 1);
+    CHECK(mux70.get_channels() == 0);
+    CHECK(get_bus_statistics(i2c0).nacks == nacks + 2);
+    CHECK(write_all(a, 0x321));
+    write_all(e, 0x123);
+    bus.get_mux_statistics(stats);
+    // a's switch also tries to close the channels of the mux whose state is unknown
+    CHECK(stats.errors == 3);
+    CHECK(get_bus_statistics(i2c0).nacks == nacks + 5);
+    CHECK(chip_a.get_output(0).code == 0x321);
+    CHECK(get_bus_statistics(i2c0).collisions == 0);
+    return test_result("mux_test");
+}
@@ -0,0 +1,82 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * This test runs Rp2040_i2c_bus::probe() against a simulated MCP4728 and checks
+ * that interrupts keep running while it polls and that a timed out probe leaves
+ * the bus ready for the next transfer.
+ */
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_group.h"
+#include "rp2040_mcp4728_frames.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::RP2040_MCP4728_group;
+using rppicomidi::Rp2040_i2c_bus;
+using namespace rppicomidi::sim;
+
+static volatile uint32_t ticks = 0;
+
+static bool count_tick(repeating_timer_t* rt)
+{
+    (void)rt;
+    ++ticks;
+    return true;
+}
+
+int main()
+{
+    mcp4728_model chip(0x60);
+    attach(i2c0, &chip);
+    Rp2040_i2c_bus bus(i2c0, 100000, 4, 5);
+    RP2040_MCP4728 dacs[1] = {RP2040_MCP4728(0x60, &bus)};
+    RP2040_MCP4728_group group(dacs, 1, &bus);
+    CHECK(group.request_bus(nullptr, nullptr) >= 0);
+    CHECK(run_until([&group]() { group.task(); }, [&group]() { return group.has_bus(); }, 10000));
+
+    // a 1-byte read takes about 200us at 100kHz; the timer must keep firing during it
+    repeating_timer_t timer;
+    CHECK(add_repeating_timer_us(20, count_tick, nullptr, &timer));
+    uint32_t start_ticks = ticks;
+    CHECK(bus.probe(&group, 0x60, 1000) == 1);
+    CHECK(ticks - start_ticks >= 5);
+    CHECK(bus.probe(&group, 0x65, 1000) == 0);
+    CHECK(bus.get_target_addr() == 0x60);
+    cancel_repeating_timer(&timer);
+
+    // a probe that times out still waits for the read to finish and drops the late byte
+    CHECK(bus.probe(&group, 0x60, 1) == -1);
+    CHECK(!bus.is_busy());
+    CHECK(i2c0->hw->rxflr == 0);
+    CHECK(bus.get_target_addr() == 0x60);
+
+    // the next transfer goes to the chip, not to the probed address
+    auto frame = rppicomidi::mcp4728_fast_write_frame(std::array<uint16_t, 4>{10, 20, 30, 40});
+    CHECK(group.write_chip(0, frame.data(), frame.size()));
+    CHECK(run_until([&group]() { group.task(); }, [&group]() { return !group.is_bus_busy(); }, 10000));
+    for (uint8_t chan = 0; chan < 4; chan++)
+        CHECK(chip.get_output(chan).code == 10 * (chan + 1));
+    return test_result("probe_test");
+}
@@ -0,0 +1,105 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This test records frame programs with RP2040_MCP4728_recorder and replays
+ * them with RP2040_MCP4728_player on simulated MCP4728 chips with LDAC\ pins.
+ */
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_program.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::RP2040_MCP4728_group;
+using rppicomidi::RP2040_MCP4728_player;
+using rppicomidi::RP2040_MCP4728_recorder;
+using rppicomidi::Rp2040_i2c_bus;
+using rppicomidi::mcp4728_channel_data;
+using namespace rppicomidi::sim;
+
+static bool outputs_are(const mcp4728_model& chip, const uint16_t* codes)
+{
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        if (chip.get_output(chan).code != codes[chan])
+            return false;
+    }
+    return true;
+}
+
+int main()
+{
+    // chip 0's LDAC\ pin is GPIO 10; chip 1 has none and its LDAC\ pin is held high on the board
+    mcp4728_model chip0(0x60, 10), chip1(0x61, 11);
+    attach(i2c0, &chip0);
+    attach(i2c0, &chip1);
+    Rp2040_i2c_bus bus(i2c0, 400000, 4, 5);
+    RP2040_MCP4728 dacs[2] = {RP2040_MCP4728(0x60, &bus, 10), RP2040_MCP4728(0x61, &bus)};
+    RP2040_MCP4728_group group(dacs, 2, &bus);
+    RP2040_MCP4728_player player(&group);
+    CHECK(group.request_bus(nullptr, nullptr) >= 0);
+    CHECK(run_until([&group]() { group.task(); }, [&group]() { return group.has_bus(); }, 10000));
+
+    // write chip 0 and pulse its LDAC\ pin, twice. LDAC\ is high, so each write only loads
+    // the input registers and each pulse must latch the values written just before it.
+    uint8_t buffer[64];
+    RP2040_MCP4728_recorder recorder(buffer, sizeof(buffer));
+    recorder.start();
+    const uint16_t first[4] = {100, 200, 300, 400};
+    CHECK(recorder.fast_write(0, first, 4));
+    CHECK(recorder.ldac_pulse(0));
+    CHECK(recorder.delay(1000));
+    mcp4728_channel_data second[4];
+    const uint16_t second_codes[4] = {1000, 2000, 3000, 4000};
+    for (uint8_t chan = 0; chan < 4; chan++)
+        second[chan] = {chan, 1, 0, 0, 0, second_codes[chan]};
+    CHECK(recorder.multi_write(0, second, 4));
+    CHECK(recorder.ldac_pulse(0));
+    size_t size = recorder.finish();
+    CHECK(size > 0);
+
+    bool done = false;
+    uint64_t start = time_us_64();
+    CHECK(player.start(recorder.get_program(), size, 0, [](void* context) { *reinterpret_cast<bool*>(context) = true; }, &done));
+    run_until([&player]() { player.task(); }, []() { return false; }, 900);
+    CHECK(outputs_are(chip0, first));
+    CHECK(chip0.get_statistics().output_updates == 1);
+    CHECK(run_until([&player]() { player.task(); }, [&done]() { return done; }, 10000));
+    CHECK(outputs_are(chip0, second_codes));
+    CHECK(chip0.get_statistics().output_updates == 2);
+    // each pulse waited for its write, which takes about 200us at 400kHz
+    CHECK(player.get_late_steps() == 2);
+    CHECK(time_us_64() - start > 1000 + 200);
+
+    // an LDAC\ pulse on a chip without an LDAC\ pin is not a valid program
+    recorder.start();
+    CHECK(recorder.fast_write(1, first, 4));
+    CHECK(recorder.ldac_pulse(1));
+    size = recorder.finish();
+    CHECK(!player.start(recorder.get_program(), size));
+    CHECK(RP2040_MCP4728_player::validate(recorder.get_program(), size, 2));
+    CHECK(!RP2040_MCP4728_player::validate(recorder.get_program(), size, 2, 0x1));
+    CHECK(get_bus_statistics(i2c0).nacks == 0);
+    return test_result("program_test");
+}
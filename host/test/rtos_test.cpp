@@ -0,0 +1,146 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This test runs the blocking RP2040_MCP4728_rtos calls against a simulated
+ * MCP4728. CMake builds it twice: once with the default WFE sleep and once
+ * with RP2040_MCP4728_USE_FREERTOS=1 against the FreeRTOS stand-in in
+ * sim/freertos. Both builds check that the waiting code wakes up a few times
+ * per operation instead of spinning, and that the timeouts hold.
+ */
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_rtos.h"
+#if RP2040_MCP4728_USE_FREERTOS
+#include "freertos_sim.h"
+#define TEST_NAME "rtos_freertos_test"
+#else
+#define TEST_NAME "rtos_test"
+#endif
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::RP2040_MCP4728_rtos;
+using rppicomidi::Rp2040_i2c_bus;
+using rppicomidi::mcp4728_channel_data;
+using rppicomidi::mcp4728_channel_read_data;
+using namespace rppicomidi::sim;
+
+/**
+ * @return the number of times the waiting code has woken up
+ */
+static uint32_t get_wakeups()
+{
+#if RP2040_MCP4728_USE_FREERTOS
+    return get_task_statistics().blocks;
+#else
+    return get_wfe_wakeups();
+#endif
+}
+
+int main()
+{
+    mcp4728_model chip(0x60), other_chip(0x61);
+    attach(i2c0, &chip);
+    attach(i2c0, &other_chip);
+    Rp2040_i2c_bus bus(i2c0, 400000, 4, 5);
+    RP2040_MCP4728 dac(0x60, &bus), other_dac(0x61, &bus);
+    RP2040_MCP4728_rtos rtos(&dac);
+
+    // another device has the bus, so the request times out, then gets the bus after the release
+    CHECK(other_dac.request_bus(nullptr, nullptr) == 1);
+    uint64_t start = time_us_64();
+    CHECK(rtos.request_bus(1500) == 0);
+    uint64_t waited = time_us_64() - start;
+    CHECK(waited >= 1500);
+#if RP2040_MCP4728_USE_FREERTOS
+    // 1500 us rounds up to 2 ticks of 1 ms
+    CHECK(waited <= 2000 + 50);
+    CHECK(get_task_statistics().timeouts > 0);
+#else
+    CHECK(waited <= 1500 + 50);
+#endif
+    CHECK(other_dac.release_bus(nullptr, nullptr) == 1);
+    CHECK(rtos.request_bus(1000) == 1);
+
+    // blocking writes: each wait wakes up a few times; the interrupt ends each sleep
+    uint32_t wakeups = get_wakeups();
+    const uint16_t codes[4] = {100, 200, 300, 400};
+    start = time_us_64();
+    CHECK(rtos.fast_write(codes, 4, 10000));
+    uint64_t write_us = time_us_64() - start;
+    for (uint8_t chan = 0; chan < 4; chan++)
+        CHECK(chip.get_output(chan).code == codes[chan]);
+    uint32_t write_wakeups = get_wakeups() - wakeups;
+    // polling task() would take about 2000 turns of the loop in that time
+    CHECK(write_wakeups >= 1 && write_wakeups <= 4);
+    // 9 bytes at 400 kHz is about 210 us; waking up finds the write done soon after the last IRQ
+    CHECK(write_us < 300);
+
+    mcp4728_channel_data chan_dat[2] = {{1, 0, 1, 0, 1, 1234}, {3, 0, 0, 0, 0, 4000}};
+    wakeups = get_wakeups();
+    CHECK(rtos.multi_write(chan_dat, 2, 10000));
+    CHECK(chip.get_output(1).code == 1234 && chip.get_output(1).vref == 1 && chip.get_output(1).gain == 1);
+    CHECK(chip.get_output(3).code == 4000);
+    CHECK(get_wakeups() - wakeups <= 8);
+
+    // blocking reads
+    mcp4728_channel_read_data read_dat[8];
+    CHECK(rtos.read_channels(read_dat, 8, 10000));
+    CHECK(read_dat[0].dac_code == 100 && read_dat[2].dac_code == 1234 && read_dat[6].dac_code == 4000);
+    bool is_busy = true, is_powered_on = false;
+    CHECK(rtos.poll_status(is_busy, is_powered_on, 10000));
+    CHECK(!is_busy && is_powered_on);
+
+    // a timed out write or read that uses the caller's buffer returns only after the
+    // transfer is done, so the buffer can be reused right away
+    mcp4728_channel_data stream_dat[6];
+    for (uint8_t idx = 0; idx < 6; idx++)
+        stream_dat[idx] = {(uint8_t)(idx % 4), 0, 0, 0, 0, (uint16_t)(500 + idx)};
+    bool stream_ok = rtos.multi_write(stream_dat, 6, 10);
+    for (uint8_t idx = 0; idx < 6; idx++)
+        stream_dat[idx].dac_code = 0;
+    CHECK(chip.get_output(0).code == 504 && chip.get_output(1).code == 505);
+    CHECK(chip.get_output(2).code == 502 && chip.get_output(3).code == 503);
+    bool read_ok = rtos.read_channels(read_dat, 8, 10);
+    CHECK(read_dat[0].dac_code == 504 && read_dat[6].dac_code == 503);
+    CHECK(!bus.is_busy());
+#if !RP2040_MCP4728_USE_FREERTOS
+    // the FreeRTOS build sleeps at least one 1 ms tick, so only the WFE build times out
+    CHECK(!stream_ok && !read_ok);
+#else
+    (void)stream_ok;
+    (void)read_ok;
+#endif
+
+#if RP2040_MCP4728_USE_FREERTOS
+    // the I2C IRQ notified the task from the ISR and asked for a context switch
+    task_statistics stats = get_task_statistics();
+    CHECK(stats.gives_from_isr > 0 && stats.yields_from_isr == stats.gives_from_isr);
+#endif
+    CHECK(rtos.release_bus(10000));
+    CHECK(other_dac.request_bus(nullptr, nullptr) == 1);
+    printf("%u wakeups for a %u us fast write\n", (unsigned)write_wakeups, (unsigned)write_us);
+    return test_result(TEST_NAME);
+}
@@ -0,0 +1,209 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This test runs RP2040_MCP4728_scheduler against the simulated timer alarms,
+ * LDAC\ pins and I2C bus. It checks that the outputs of the simulated MCP4728
+ * chips change at the scheduled times, that events with the same time commit
+ * together, and the lateness, late count and lead time reports.
+ */
+#include <vector>
+#include "sim_test.h"
+#include "sim_devices.h"
+#include "rp2040_mcp4728_scheduler.h"
+
+using rppicomidi::RP2040_MCP4728;
+using rppicomidi::RP2040_MCP4728_group;
+using rppicomidi::RP2040_MCP4728_scheduler;
+using rppicomidi::Rp2040_i2c_bus;
+using rppicomidi::mcp4728_channel_data;
+using namespace rppicomidi::sim;
+
+static RP2040_MCP4728_group* group;
+static RP2040_MCP4728_scheduler* scheduler;
+
+struct report {
+    uint16_t id;
+    uint32_t lateness_us;
+};
+static std::vector<report> reports;
+
+static void on_report(void*, uint16_t event_id, uint32_t lateness_us)
+{
+    reports.push_back({event_id, lateness_us});
+}
+
+/**
+ * @brief run the group and scheduler tasks until simulated time time_us
+ */
+static void run_to(uint64_t time_us)
+{
+    run_until([]() { group->task(); scheduler->task(); }, [time_us]() { return time_us_64() >= time_us; }, 1000000);
+}
+
+/**
+ * @brief fill chan_dat with code + channel number for channels A-D
+ */
+static void make_channels(mcp4728_channel_data* chan_dat, uint16_t code)
+{
+    for (uint8_t chan = 0; chan < 4; chan++)
+        chan_dat[chan] = {chan, 0, 1, 0, 1, (uint16_t)(code + chan)};
+}
+
+static bool outputs_are(const mcp4728_model& chip, uint16_t code)
+{
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        if (chip.get_output(chan).code != code + chan)
+            return false;
+    }
+    return true;
+}
+
+static bool inputs_are(const mcp4728_model& chip, uint16_t code)
+{
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        if (chip.get_input(chan).code != code + chan)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @return true if the chip's outputs last changed from when_us to when_us + guard_us
+ */
+static bool changed_on_time(const mcp4728_model& chip, uint64_t when_us, uint32_t guard_us)
+{
+    uint64_t changed_ns = chip.get_statistics().last_output_ns;
+    return changed_ns >= when_us * 1000 && changed_ns <= (when_us + guard_us) * 1000;
+}
+
+int main()
+{
+    const uint32_t guard_us = 100;
+    const uint32_t initial_latency_us = 500;
+    // chips 0 and 1 have LDAC\ pins on GPIO 10 and 11. Chip 2's LDAC\ pin is held high
+    // on the board (the simulated GPIO 12 reads high), so only a general call commits it.
+    mcp4728_model chip0(0x60, 10), chip1(0x61, 11), chip2(0x62, 12);
+    attach(i2c0, &chip0);
+    attach(i2c0, &chip1);
+    attach(i2c0, &chip2);
+    Rp2040_i2c_bus bus(i2c0, 1000000, 4, 5);
+    RP2040_MCP4728 dacs[3] = {RP2040_MCP4728(0x60, &bus, 10), RP2040_MCP4728(0x61, &bus, 11), RP2040_MCP4728(0x62, &bus)};
+    RP2040_MCP4728_group chips(dacs, 3, &bus);
+    group = &chips;
+    RP2040_MCP4728_scheduler sched(&chips, guard_us, initial_latency_us);
+    scheduler = &sched;
+    sched.set_report_callback(on_report, nullptr);
+    CHECK(chips.request_bus(nullptr, nullptr) >= 0);
+    CHECK(run_until([]() { group->task(); }, []() { return group->has_bus(); }, 10000));
+
+    // parameter checks
+    mcp4728_channel_data chan_dat[4];
+    make_channels(chan_dat, 100);
+    uint64_t now = time_us_64();
+    CHECK(!sched.schedule(from_us_since_boot(now + 1000), 3, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac));
+    CHECK(!sched.schedule(from_us_since_boot(now + 1000), 0, chan_dat, 0, RP2040_MCP4728_scheduler::commit_ldac));
+    CHECK(!sched.schedule(from_us_since_boot(now + 1000), 2, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac));
+    CHECK(sched.get_num_pending() == 0);
+
+    // one event: the input registers load before the event time and the outputs change at it
+    uint64_t when = time_us_64() + 5000;
+    uint16_t id = 0xFFFF;
+    CHECK(sched.schedule(from_us_since_boot(when), 0, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac, &id));
+    CHECK(id == 0 && sched.get_num_pending() == 1);
+    run_to(when - initial_latency_us - guard_us - 10);
+    CHECK(sched.get_num_pending() == 1 && !inputs_are(chip0, 100));
+    run_to(when - 10);
+    CHECK(sched.get_num_pending() == 0);
+    CHECK(inputs_are(chip0, 100) && !outputs_are(chip0, 100));
+    run_to(when + guard_us + 10);
+    CHECK(outputs_are(chip0, 100) && changed_on_time(chip0, when, guard_us));
+    CHECK(reports.size() == 1 && reports[0].id == id && reports[0].lateness_us <= guard_us);
+    CHECK(sched.get_late_count() == 0);
+
+    // events with the same time on three chips commit together, with LDAC\ pulses and a general call
+    when = time_us_64() + 3000;
+    make_channels(chan_dat, 200);
+    CHECK(sched.schedule(from_us_since_boot(when), 0, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac));
+    make_channels(chan_dat, 300);
+    CHECK(sched.schedule(from_us_since_boot(when), 1, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac));
+    make_channels(chan_dat, 400);
+    CHECK(sched.schedule(from_us_since_boot(when), 2, chan_dat, 4, RP2040_MCP4728_scheduler::commit_general_call));
+    run_to(when - 10);
+    CHECK(inputs_are(chip0, 200) && inputs_are(chip1, 300) && inputs_are(chip2, 400));
+    CHECK(!outputs_are(chip0, 200) && !outputs_are(chip1, 300) && !outputs_are(chip2, 400));
+    run_to(when + guard_us + 10);
+    CHECK(outputs_are(chip0, 200) && outputs_are(chip1, 300) && outputs_are(chip2, 400));
+    CHECK(changed_on_time(chip0, when, guard_us) && changed_on_time(chip1, when, guard_us) && changed_on_time(chip2, when, guard_us));
+    CHECK(chip2.get_statistics().general_calls == 1);
+    CHECK(reports.size() == 4);
+
+    // events scheduled out of order run in time order
+    reports.clear();
+    uint64_t start = time_us_64();
+    uint16_t ids[3];
+    make_channels(chan_dat, 1000);
+    CHECK(sched.schedule(from_us_since_boot(start + 3000), 0, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac, &ids[0]));
+    make_channels(chan_dat, 2000);
+    CHECK(sched.schedule(from_us_since_boot(start + 1000), 0, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac, &ids[1]));
+    make_channels(chan_dat, 3000);
+    CHECK(sched.schedule(from_us_since_boot(start + 2000), 0, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac, &ids[2]));
+    run_to(start + 1000 + guard_us + 10);
+    CHECK(outputs_are(chip0, 2000) && changed_on_time(chip0, start + 1000, guard_us));
+    run_to(start + 2000 + guard_us + 10);
+    CHECK(outputs_are(chip0, 3000) && changed_on_time(chip0, start + 2000, guard_us));
+    run_to(start + 3000 + guard_us + 10);
+    CHECK(outputs_are(chip0, 1000) && changed_on_time(chip0, start + 3000, guard_us));
+    CHECK(reports.size() == 3 && reports[0].id == ids[1] && reports[1].id == ids[2] && reports[2].id == ids[0]);
+
+    // the lead time follows the measured staging time down from the initial guess
+    CHECK(sched.get_latency_us() < initial_latency_us);
+    CHECK(sched.get_lead_us() == sched.get_latency_us() + guard_us);
+    CHECK(sched.get_late_count() == 0 && sched.get_max_lateness_us() <= guard_us);
+
+    // an event in the past runs right away and counts as late
+    reports.clear();
+    when = time_us_64() - 1000;
+    make_channels(chan_dat, 500);
+    CHECK(sched.schedule(from_us_since_boot(when), 1, chan_dat, 4, RP2040_MCP4728_scheduler::commit_ldac));
+    run_to(time_us_64() + 500);
+    CHECK(outputs_are(chip1, 500));
+    CHECK(reports.size() == 1 && reports[0].lateness_us > 1000);
+    CHECK(sched.get_late_count() == 1 && sched.get_max_lateness_us() == reports[0].lateness_us);
+
+    // the queue holds RP2040_MCP4728_SCHEDULER_MAX_EVENTS events; cancel_all() empties it
+    when = time_us_64() + 100000;
+    for (int idx = 0; idx < RP2040_MCP4728_SCHEDULER_MAX_EVENTS; idx++)
+        CHECK(sched.schedule(from_us_since_boot(when + idx), 0, chan_dat, 1, RP2040_MCP4728_scheduler::commit_ldac));
+    CHECK(!sched.schedule(from_us_since_boot(when), 0, chan_dat, 1, RP2040_MCP4728_scheduler::commit_ldac));
+    sched.cancel_all();
+    CHECK(sched.get_num_pending() == 0);
+    uint32_t updates = chip0.get_statistics().output_updates;
+    run_to(when + 1000);
+    CHECK(chip0.get_statistics().output_updates == updates);
+    CHECK(get_bus_statistics(i2c0).nacks == 0);
+    printf("lead %u us, max lateness %u us\n", (unsigned)sched.get_lead_us(), (unsigned)sched.get_max_lateness_us());
+    return test_result("scheduler_test");
+}
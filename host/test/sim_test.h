@@ -0,0 +1,74 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+/**
+ * The checks and helpers the host simulation tests share. Each test is a
+ * program that returns 0 if every CHECK() passed; ctest runs them.
+ */
+#pragma once
+#include <cstdio>
+#include "pico_sim.h"
+#include "pico/stdlib.h"
+
+inline int check_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        ++check_failures; \
+    } \
+} while(0)
+
+/**
+ * @brief call poll() until done() returns true or until timeout_us of simulated time passes
+ *
+ * @return the value of done() at the end
+ */
+template<typename Poll, typename Done>
+bool run_until(Poll poll, Done done, uint32_t timeout_us)
+{
+    uint64_t deadline = time_us_64() + timeout_us;
+    while (!done()) {
+        if (time_us_64() >= deadline)
+            return false;
+        poll();
+        tight_loop_contents();
+    }
+    return true;
+}
+
+/**
+ * @brief print PASS or the number of failed checks
+ *
+ * @return the program exit status
+ */
+inline int test_result(const char* name)
+{
+    if (check_failures == 0) {
+        printf("%s: PASS\n", name);
+        return 0;
+    }
+    printf("%s: %d check(s) failed\n", name, check_failures);
+    return 1;
+}
@@ -27,13 +27,21 @@
  */
 #include "rp2040_i2c_lib.h"
 #include <cstring> // memset
+#include "hardware/timer.h"
 /* static variables */
 rppicomidi::Rp2040_i2c_bus* rppicomidi::Rp2040_i2c_bus::i2c0_irq_context = nullptr;
 rppicomidi::Rp2040_i2c_bus* rppicomidi::Rp2040_i2c_bus::i2c1_irq_context = nullptr;
 
-rppicomidi::Rp2040_i2c_bus::Rp2040_i2c_bus(i2c_inst_t* i2c_ , uint baudrate_, uint sda_pin_, uint scl_pin_) : i2c_bus{i2c_}, baudrate{baudrate_}, sda_pin{sda_pin_}, scl_pin{scl_pin_}
+rppicomidi::Rp2040_i2c_bus::Rp2040_i2c_bus(i2c_inst_t* i2c_ , uint baudrate_, uint sda_pin_, uint scl_pin_) : i2c_bus{i2c_}, baudrate{baudrate_}, sda_pin{sda_pin_}, scl_pin{scl_pin_},
+    num_requesting_devices{0}, pending{0}, next_service_slot{0}, num_mux_writes{0}, next_mux_write{0}, mux_switching{false},
+    mux_skips{0}, mux_switch_start_us{0}, probing{false}
 {
+    static_assert(RP2040_I2C_MAX_ATTACHED_DEVICES >= 1 && RP2040_I2C_MAX_ATTACHED_DEVICES <= 32, "RP2040_I2C_MAX_ATTACHED_DEVICES must be 1-32");
     critical_section_init(&crit_sec);
+    memset(attached_devices, 0, sizeof(attached_devices));
+    memset(mux_state, 0, sizeof(mux_state)); // TCA9548A muxes power up with all channels off
+    memset(&mux_stats, 0, sizeof(mux_stats));
+    memset(&current_frame, 0, sizeof(current_frame));
 #if 0
     i2c_init(i2c_bus, baudrate);
     set_bus_pins(sda_pin, scl_pin);
@@ -86,6 +94,18 @@ bool rppicomidi::Rp2040_i2c_bus::set_bus_pins(RP2040_i2c_device* dev, uint sda_p
     return result;
 }
 
+uint rppicomidi::Rp2040_i2c_bus::set_baudrate(RP2040_i2c_device* dev, uint baudrate_)
+{
+    uint result = 0;
+    critical_section_enter_blocking(&crit_sec);
+    if (is_active_device(dev) && !is_busy() && current_transfer.callback == nullptr) {
+        baudrate = baudrate_;
+        result = i2c_set_baudrate(i2c_bus, baudrate);
+    }
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
 bool rppicomidi::Rp2040_i2c_bus::deinit_i2c_bus(RP2040_i2c_device* dev)
 {
     bool result = false;
@@ -133,6 +153,7 @@ bool rppicomidi::Rp2040_i2c_bus::reinit_i2c_bus(RP2040_i2c_device* dev)
     critical_section_enter_blocking(&crit_sec);
     if (is_active_device(dev)) {
         result = true;
+        current_transfer.reset(); // anything left in the old hardware is gone
         init_bus();
         i2c_bus->hw->enable = 0;
         i2c_bus->hw->tar = dev->get_addr();
@@ -142,11 +163,79 @@ bool rppicomidi::Rp2040_i2c_bus::reinit_i2c_bus(RP2040_i2c_device* dev)
     return result;
 }
 
-void rppicomidi::Rp2040_i2c_bus::i2c_irq_handler()
+void RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::i2c0_irq_handler(void)
+{
+    i2c0_irq_context->i2c_irq_handler();
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::i2c1_irq_handler(void)
+{
+    i2c1_irq_context->i2c_irq_handler();
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::i2c_irq_handler()
 {
     critical_section_enter_blocking(&crit_sec);
+    if (mux_switching) {
+        // Only the STOP_DET IRQ is enabled during a mux switch
+        if ((i2c_bus->hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) != 0) {
+            // The mux did not acknowledge, so its channels are unknown; write it again next time
+            (void)i2c_bus->hw->clr_tx_abrt;
+            mux_state[mux_writes[next_mux_write-1].addr - RP2040_i2c_device::first_mux_addr] = mux_unknown;
+            ++mux_stats.errors;
+        }
+        if ((i2c_bus->hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) != 0) {
+            (void)i2c_bus->hw->clr_stop_det;
+            mux_next_locked();
+        }
+        critical_section_exit(&crit_sec);
+        return;
+    }
+    if (is_framing()) {
+        // Only the STOP_DET IRQ is enabled during a frame; each entry ends with a stop condition
+        uint32_t raw = i2c_bus->hw->raw_intr_stat;
+        if ((raw & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) != 0) {
+            Frame_entry& entry = current_frame.entries[current_frame.next];
+            if ((raw & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) != 0) {
+                (void)i2c_bus->hw->clr_tx_abrt;
+                entry.status = frame_nack;
+            }
+            else {
+                entry.status = frame_ok;
+            }
+            (void)i2c_bus->hw->clr_stop_det;
+            ++current_frame.next;
+            frame_next_locked();
+        }
+        critical_section_exit(&crit_sec);
+        return;
+    }
     static io_ro_32 mask = (I2C_IC_INTR_STAT_R_TX_EMPTY_BITS | I2C_IC_INTR_STAT_R_STOP_DET_BITS | I2C_IC_INTR_STAT_R_RX_FULL_BITS);
     if ((i2c_bus->hw->intr_stat & mask) != 0) {
+        if (current_transfer.fill_callback != nullptr) {
+            if ((i2c_bus->hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) != 0) {
+                // The hardware flushed the TX FIFO; drop the rest of the stream
+                (void)i2c_bus->hw->clr_tx_abrt;
+                current_transfer.stream_remaining = 0;
+            }
+            if (current_transfer.stream_remaining != 0) {
+                stream_fill_locked();
+                critical_section_exit(&crit_sec);
+                return;
+            }
+            // The whole stream is in the TX FIFO. Finish like a normal write when it drains.
+            current_transfer.fill_callback = nullptr;
+            i2c_bus->hw->tx_tl = 0;
+            if (i2c_bus->hw->txflr != 0) {
+                critical_section_exit(&crit_sec);
+                return;
+            }
+        }
+        if ((i2c_bus->hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) != 0) {
+            // The target did not acknowledge. The hardware flushed the TX FIFO and keeps
+            // dropping writes to it until the abort is cleared.
+            (void)i2c_bus->hw->clr_tx_abrt;
+        }
         // Disable the TX_EMPTY IRQ if currently active
         if ((i2c_bus->hw->intr_stat & I2C_IC_INTR_STAT_R_TX_EMPTY_BITS) != 0) {
             i2c_bus->hw->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
@@ -196,27 +285,23 @@ int rppicomidi::Rp2040_i2c_bus::request_bus(RP2040_i2c_device* requesting_device
     int result = -1;
     if (requesting_device) {
         critical_section_enter_blocking(&crit_sec);
-        for (auto it=requesting_devices.begin(); it != requesting_devices.end(); it++) {
-            if (it->dev == requesting_device) {
+        bool found = false;
+        for (uint8_t idx = 0; idx < num_requesting_devices; idx++) {
+            if (requesting_devices[idx].dev == requesting_device) {
                 // It's in the list. Is the active device if at the front of the list.
-                result =  is_active_device(it->dev) ? 1:0;
+                result =  is_active_device(requesting_device) ? 1:0;
+                found = true;
                 break;
             }
         }
-        if (result == -1) {
+        if (!found && num_requesting_devices < RP2040_I2C_MAX_DEVICES) {
             // dev was not found in the list. Add it to the end
-            requesting_devices.push_back({requesting_device, ready_callback});
-            result =  is_active_device(requesting_device) ? 1:0;
+            requesting_devices[num_requesting_devices++] = {requesting_device, ready_callback};
+            // If the list was previously empty, then the device is now active; otherwise, it's in queue;
+            result = (num_requesting_devices == 1 && grant_locked()) ? 1:0;
         }
         critical_section_exit(&crit_sec);
     }
-    // If the list was previously empty, then the device is now active; otherwise, it's in queue;
-    if (result == 1) {
-        // Assign the target address
-        i2c_bus->hw->enable = 0;
-        i2c_bus->hw->tar = requesting_device->get_addr();
-        i2c_bus->hw->enable = 1;
-    }
     return result;
 }
 
@@ -224,11 +309,11 @@ int rppicomidi::Rp2040_i2c_bus::release_bus(RP2040_i2c_device* requesting_device
 {
     int result = -1;
     critical_section_enter_blocking(&crit_sec);
-    for (auto it=requesting_devices.begin(); it!=requesting_devices.end();) {
-        if (it->dev == requesting_device) {
-            if (is_active_device(requesting_device)) {
+    for (uint8_t idx = 0; idx < num_requesting_devices; idx++) {
+        if (requesting_devices[idx].dev == requesting_device) {
+            if (idx == 0) {
                 // This is the active device. Are there any active transfers?
-                if ((i2c_bus->hw->status & I2C_IC_STATUS_ACTIVITY_BITS) != 0) {
+                if ((i2c_bus->hw->status & I2C_IC_STATUS_ACTIVITY_BITS) != 0 || mux_switching || is_framing()) {
                     result = 0; // bus transaction is ongoing. Need to wait until it is done
                 }
                 else {
@@ -237,31 +322,139 @@ int rppicomidi::Rp2040_i2c_bus::release_bus(RP2040_i2c_device* requesting_device
             }
             if (result != 0) {
                 result = 1;
-                requesting_devices.erase(it);
-                if (requesting_devices.begin() != requesting_devices.end()) {
+                bool was_active = idx == 0;
+                --num_requesting_devices;
+                for (; idx < num_requesting_devices; idx++)
+                    requesting_devices[idx] = requesting_devices[idx+1];
+                if (was_active && num_requesting_devices != 0) {
                     // The list is not empty; signal to the new head of the list it is now active
-                    // but first, assign the device's address as the new target address.
-                    i2c_bus->hw->enable = 0;
-                    i2c_bus->hw->tar = requesting_devices.begin()->dev->get_addr();
-                    i2c_bus->hw->enable = 1;
-                    requesting_devices.begin()->callback(requesting_devices.begin()->dev);
+                    // unless it has to wait for a mux switch first.
+                    regroup_locked();
+                    if (grant_locked())
+                        requesting_devices[0].callback(requesting_devices[0].dev);
                 }
             }
             break;
         }
-        else {
-            ++it;
+    }
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
+bool rppicomidi::Rp2040_i2c_bus::needs_mux_switch(const RP2040_i2c_device* dev) const
+{
+    if (dev->mux_addr == RP2040_i2c_device::no_mux)
+        return false;
+    uint8_t target = dev->mux_addr - RP2040_i2c_device::first_mux_addr;
+    for (uint8_t idx = 0; idx < num_mux_addrs; idx++) {
+        if (mux_state[idx] != (idx == target ? dev->mux_channels : 0))
+            return true;
+    }
+    return false;
+}
+
+void rppicomidi::Rp2040_i2c_bus::regroup_locked()
+{
+    if (num_requesting_devices < 2 || !needs_mux_switch(requesting_devices[0].dev)) {
+        mux_skips = 0;
+        return;
+    }
+    if (mux_skips >= RP2040_I2C_MUX_MAX_SKIPS) {
+        mux_skips = 0;
+        return;
+    }
+    for (uint8_t idx = 1; idx < num_requesting_devices; idx++) {
+        if (requesting_devices[idx].dev->mux_addr != RP2040_i2c_device::no_mux && !needs_mux_switch(requesting_devices[idx].dev)) {
+            I2c_dev_cb next = requesting_devices[idx];
+            for (; idx > 0; idx--)
+                requesting_devices[idx] = requesting_devices[idx-1];
+            requesting_devices[0] = next;
+            ++mux_skips;
+            ++mux_stats.regrouped;
+            break;
         }
     }
+}
+
+bool rppicomidi::Rp2040_i2c_bus::grant_locked()
+{
+    RP2040_i2c_device* dev = requesting_devices[0].dev;
+    if (!needs_mux_switch(dev)) {
+        if (dev->mux_addr != RP2040_i2c_device::no_mux)
+            ++mux_stats.grants_no_switch;
+        // Assign the target address
+        i2c_bus->hw->enable = 0;
+        i2c_bus->hw->tar = dev->get_addr();
+        i2c_bus->hw->enable = 1;
+        return true;
+    }
+    // Close the channels of other muxes first so two segments are never connected at once
+    uint8_t target = dev->mux_addr - RP2040_i2c_device::first_mux_addr;
+    num_mux_writes = 0;
+    next_mux_write = 0;
+    for (uint8_t idx = 0; idx < num_mux_addrs; idx++) {
+        if (idx != target && mux_state[idx] != 0)
+            mux_writes[num_mux_writes++] = {static_cast<uint16_t>(RP2040_i2c_device::first_mux_addr + idx), 0};
+    }
+    if (mux_state[target] != dev->mux_channels)
+        mux_writes[num_mux_writes++] = {dev->mux_addr, dev->mux_channels};
+    mux_switching = true;
+    mux_switch_start_us = time_us_64();
+    (void)i2c_bus->hw->clr_stop_det;
+    i2c_bus->hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+    mux_next_locked();
+    return false;
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::mux_next_locked()
+{
+    if (next_mux_write < num_mux_writes) {
+        const Mux_write& next = mux_writes[next_mux_write++];
+        i2c_bus->hw->enable = 0;
+        i2c_bus->hw->tar = next.addr;
+        i2c_bus->hw->enable = 1;
+        i2c_bus->hw->data_cmd = next.channels | I2C_IC_DATA_CMD_STOP_BITS;
+        mux_state[next.addr - RP2040_i2c_device::first_mux_addr] = next.channels;
+        ++mux_stats.switches;
+        return;
+    }
+    i2c_bus->hw->intr_mask = 0;
+    mux_switching = false;
+    mux_stats.switch_us += time_us_64() - mux_switch_start_us;
+    I2c_dev_cb& front = requesting_devices[0];
+    i2c_bus->hw->enable = 0;
+    i2c_bus->hw->tar = front.dev->get_addr();
+    i2c_bus->hw->enable = 1;
+    if (front.callback)
+        front.callback(front.dev);
+}
+
+void rppicomidi::Rp2040_i2c_bus::get_mux_statistics(Mux_statistics& stats)
+{
+    enter_critical();
+    stats = mux_stats;
+    exit_critical();
+}
+
+void rppicomidi::Rp2040_i2c_bus::reset_mux_statistics()
+{
+    enter_critical();
+    memset(&mux_stats, 0, sizeof(mux_stats));
+    exit_critical();
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::write(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*))
+{
+    critical_section_enter_blocking(&crit_sec);
+    bool result = write_locked(dev, send_restart, send_stop, data, nbytes, done_callback);
     critical_section_exit(&crit_sec);
     return result;
 }
 
-bool rppicomidi::Rp2040_i2c_bus::write(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*))
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::write_locked(RP2040_i2c_device* dev, bool send_restart, bool send_stop, const uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*))
 {
     bool result = false;
-    critical_section_enter_blocking(&crit_sec);
-    if ((nbytes <= (16-i2c_bus->hw->txflr)) && is_active_device(dev)) {
+    if ((nbytes <= (16-i2c_bus->hw->txflr)) && !is_streaming() && !is_framing() && is_active_device(dev)) {
         current_transfer.callback = done_callback;
         current_transfer.dev = dev;
         current_transfer.is_read = false;
@@ -286,15 +479,131 @@ bool rppicomidi::Rp2040_i2c_bus::write(RP2040_i2c_device* dev, bool send_restart
         i2c_bus->hw->intr_mask |= I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
         result = true;
     }
+    return result;
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::write_stream(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint32_t nbytes,
+    void (*fill_callback)(RP2040_i2c_device* dev, uint8_t* data, uint8_t nbytes), void (*done_callback)(RP2040_i2c_device*))
+{
+    critical_section_enter_blocking(&crit_sec);
+    bool result = write_stream_locked(dev, send_restart, send_stop, nbytes, fill_callback, done_callback);
     critical_section_exit(&crit_sec);
     return result;
 }
 
-bool rppicomidi::Rp2040_i2c_bus::read(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*))
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::write_stream_locked(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint32_t nbytes,
+    void (*fill_callback)(RP2040_i2c_device* dev, uint8_t* data, uint8_t nbytes), void (*done_callback)(RP2040_i2c_device*))
 {
     bool result = false;
+    if (nbytes > 0 && fill_callback != nullptr && !is_streaming() && !is_framing() && is_active_device(dev)) {
+        current_transfer.callback = done_callback;
+        current_transfer.dev = dev;
+        current_transfer.is_read = false;
+        current_transfer.send_restart = send_restart;
+        current_transfer.send_stop = send_stop;
+        current_transfer.fill_callback = fill_callback;
+        current_transfer.stream_remaining = nbytes;
+        stream_fill_locked();
+        if (current_transfer.stream_remaining != 0) {
+            // refill when the TX FIFO is half empty so the bus does not stall between bytes
+            i2c_bus->hw->tx_tl = 8;
+        }
+        // enable TX FIFO empty IRQ
+        i2c_bus->hw->intr_mask |= I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+        result = true;
+    }
+    return result;
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::write_frame(RP2040_i2c_device* dev, Frame_entry* entries, uint8_t nentries, void (*done_callback)(RP2040_i2c_device*))
+{
+    critical_section_enter_blocking(&crit_sec);
+    bool result = write_frame_locked(dev, entries, nentries, done_callback);
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::write_frame_locked(RP2040_i2c_device* dev, Frame_entry* entries, uint8_t nentries, void (*done_callback)(RP2040_i2c_device*))
+{
+    if (entries == nullptr || nentries == 0 || !is_active_device(dev) || is_busy() || is_streaming() || current_transfer.callback != nullptr)
+        return false;
+    for (uint8_t idx = 0; idx < nentries; idx++) {
+        if (entries[idx].nbytes == 0 || entries[idx].nbytes > 16)
+            return false;
+        entries[idx].status = frame_pending;
+    }
+    current_frame.entries = entries;
+    current_frame.nentries = nentries;
+    current_frame.next = 0;
+    current_frame.dev = dev;
+    current_frame.callback = done_callback;
+    (void)i2c_bus->hw->clr_tx_abrt;
+    (void)i2c_bus->hw->clr_stop_det;
+    i2c_bus->hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+    frame_next_locked();
+    return true;
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::frame_next_locked()
+{
+    if (current_frame.next < current_frame.nentries) {
+        const Frame_entry& entry = current_frame.entries[current_frame.next];
+        if ((i2c_bus->hw->tar & 0xFFF) != entry.addr) {
+            i2c_bus->hw->enable = 0;
+            i2c_bus->hw->tar = entry.addr;
+            i2c_bus->hw->enable = 1;
+        }
+        for (uint8_t idx = 0; idx < entry.nbytes; idx++) {
+            io_rw_32 next_data_cmd = entry.data[idx];
+            if (idx == entry.nbytes - 1)
+                next_data_cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+            i2c_bus->hw->data_cmd = next_data_cmd;
+        }
+        return;
+    }
+    i2c_bus->hw->intr_mask = 0;
+    RP2040_i2c_device* dev = current_frame.dev;
+    void (*callback)(RP2040_i2c_device*) = current_frame.callback;
+    current_frame.entries = nullptr;
+    current_frame.callback = nullptr;
+    if (callback)
+        callback(dev);
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::stream_fill_locked()
+{
+    uint8_t space = 16 - i2c_bus->hw->txflr;
+    uint8_t nbytes = current_transfer.stream_remaining < space ? current_transfer.stream_remaining : space;
+    if (nbytes == 0)
+        return;
+    uint8_t data[16];
+    current_transfer.fill_callback(current_transfer.dev, data, nbytes);
+    for (uint8_t idx = 0; idx < nbytes; idx++) {
+        io_rw_32 next_data_cmd = data[idx];
+        if (current_transfer.send_restart) {
+            next_data_cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+            current_transfer.send_restart = false;
+        }
+        if (current_transfer.stream_remaining == 1 && current_transfer.send_stop) {
+            next_data_cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        }
+        i2c_bus->hw->data_cmd = next_data_cmd;
+        --current_transfer.stream_remaining;
+    }
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::read(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*))
+{
     critical_section_enter_blocking(&crit_sec);
-    if ((nbytes > 0) && is_active_device(dev) && (current_transfer.callback == nullptr)) {
+    bool result = read_locked(dev, send_restart, send_stop, data, nbytes, done_callback);
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::Rp2040_i2c_bus::read_locked(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*))
+{
+    bool result = false;
+    if ((nbytes > 0) && is_active_device(dev) && (current_transfer.callback == nullptr) && !is_framing()) {
         current_transfer.callback = done_callback;
         current_transfer.dev = dev;
         current_transfer.is_read = true;
@@ -322,13 +631,12 @@ bool rppicomidi::Rp2040_i2c_bus::read(RP2040_i2c_device* dev, bool send_restart,
         i2c_bus->hw->intr_mask |= I2C_IC_INTR_MASK_M_RX_FULL_BITS;
         result = true;
     }
-    critical_section_exit(&crit_sec);
     return result;
 }
 
 bool rppicomidi::Rp2040_i2c_bus::set_general_call_mode(RP2040_i2c_device* dev, bool general_call_mode_active)
 {
-    if (!is_active_device(dev) || (i2c_bus->hw->status & I2C_IC_STATUS_ACTIVITY_BITS) != 0)
+    if (!is_active_device(dev) || (i2c_bus->hw->status & I2C_IC_STATUS_ACTIVITY_BITS) != 0 || is_framing())
         return false;
     i2c_bus->hw->enable = 0;
     if (general_call_mode_active)
@@ -339,7 +647,135 @@ bool rppicomidi::Rp2040_i2c_bus::set_general_call_mode(RP2040_i2c_device* dev, b
     return true;
 }
 
+bool rppicomidi::Rp2040_i2c_bus::set_target_addr(RP2040_i2c_device* dev, uint16_t target_addr)
+{
+    bool result = false;
+    critical_section_enter_blocking(&crit_sec);
+    if (is_active_device(dev) && !is_busy()) {
+        if (i2c_bus->hw->tar != target_addr) {
+            i2c_bus->hw->enable = 0;
+            i2c_bus->hw->tar = target_addr;
+            i2c_bus->hw->enable = 1;
+        }
+        result = true;
+    }
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
+int rppicomidi::Rp2040_i2c_bus::probe(RP2040_i2c_device* dev, uint16_t probe_addr, uint32_t timeout_us)
+{
+    int result = -1;
+    critical_section_enter_blocking(&crit_sec);
+    if (!is_active_device(dev) || is_busy() || current_transfer.callback != nullptr) {
+        critical_section_exit(&crit_sec);
+        return result;
+    }
+    // Mask the interrupts so the IRQ handler does not see the probe; probing keeps
+    // is_busy() true so no transfer starts while the target address is swapped
+    uint32_t saved_tar = i2c_bus->hw->tar;
+    uint32_t saved_mask = i2c_bus->hw->intr_mask;
+    i2c_bus->hw->intr_mask = 0;
+    i2c_bus->hw->enable = 0;
+    i2c_bus->hw->tar = probe_addr;
+    i2c_bus->hw->enable = 1;
+    (void)i2c_bus->hw->clr_tx_abrt;
+    i2c_bus->hw->data_cmd = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS;
+    probing = true;
+    critical_section_exit(&crit_sec);
+
+    // Poll with interrupts enabled; only this function touches the hardware while probing
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    while (result < 0 && !time_reached(deadline)) {
+        if ((i2c_bus->hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) != 0)
+            result = 0;
+        else if (i2c_bus->hw->rxflr > 0)
+            result = 1;
+        else
+            tight_loop_contents();
+    }
+    // Even after a timeout, the hardware finishes or aborts the read in bounded time. Wait
+    // for the stop condition and drain a late byte or abort before restoring the target address
+    while ((i2c_bus->hw->status & I2C_IC_STATUS_ACTIVITY_BITS) != 0)
+        tight_loop_contents();
+    while (i2c_bus->hw->rxflr > 0)
+        (void)i2c_bus->hw->data_cmd;
+    (void)i2c_bus->hw->clr_tx_abrt;
+
+    critical_section_enter_blocking(&crit_sec);
+    i2c_bus->hw->enable = 0;
+    i2c_bus->hw->tar = saved_tar;
+    i2c_bus->hw->enable = 1;
+    i2c_bus->hw->intr_mask = saved_mask;
+    probing = false;
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
 int rppicomidi::Rp2040_i2c_bus::is_general_call_mode(RP2040_i2c_device* dev)
 {
     return (i2c_bus->hw->tar & I2C_IC_TAR_SPECIAL_BITS) != 0;
 }
+
+bool rppicomidi::Rp2040_i2c_bus::attach(RP2040_i2c_device* dev)
+{
+    if (dev == nullptr || dev->bus != this)
+        return false;
+    if (dev->service_slot >= 0)
+        return true;
+    for (uint8_t slot = 0; slot < RP2040_I2C_MAX_ATTACHED_DEVICES; slot++) {
+        if (attached_devices[slot] == nullptr) {
+            attached_devices[slot] = dev;
+            enter_critical();
+            dev->service_slot = slot;
+            // run the device once in case it already has work
+            pending |= 1ul << slot;
+            exit_critical();
+            return true;
+        }
+    }
+    return false;
+}
+
+void rppicomidi::Rp2040_i2c_bus::detach(RP2040_i2c_device* dev)
+{
+    if (dev == nullptr || dev->bus != this || dev->service_slot < 0)
+        return;
+    enter_critical();
+    uint8_t slot = dev->service_slot;
+    pending &= ~(1ul << slot);
+    dev->service_slot = -1;
+    exit_critical();
+    attached_devices[slot] = nullptr;
+}
+
+uint8_t rppicomidi::Rp2040_i2c_bus::service(uint32_t budget_us)
+{
+    enter_critical();
+    uint32_t work = pending;
+    pending = 0;
+    exit_critical();
+    uint8_t ran = 0;
+    uint64_t start = budget_us != 0 ? time_us_64() : 0;
+    for (uint8_t count = 0; work != 0 && count < RP2040_I2C_MAX_ATTACHED_DEVICES; count++) {
+        uint8_t slot = next_service_slot;
+        next_service_slot = (slot + 1) % RP2040_I2C_MAX_ATTACHED_DEVICES;
+        uint32_t bit = 1ul << slot;
+        if ((work & bit) == 0)
+            continue;
+        work &= ~bit;
+        if (attached_devices[slot] != nullptr) {
+            attached_devices[slot]->task();
+            ++ran;
+        }
+        if (budget_us != 0 && time_us_64() - start >= budget_us)
+            break;
+    }
+    if (work != 0) {
+        // out of time; the devices that did not run stay pending
+        enter_critical();
+        pending |= work;
+        exit_critical();
+    }
+    return ran;
+}
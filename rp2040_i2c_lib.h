@@ -30,15 +30,14 @@
  * Calls to this library are non-blocking and interrupt driven. Reads
  * and writes make use of the I2C hardware's built-in TX FIFO and RX FIFO
  * so the processor does not need to service every interrupt. Write transactions
- * may be stacked as long as the TX FIFO would not overflow. Read transactions
+ * may be stacked as long as the TX FIFO would not overflow; longer writes
+ * may be streamed through the TX FIFO from the IRQ handler. Read transactions
  * have to be one at a time. Bus sharing uses cooperative bus request and release.
  * If your I2C bus has more than one device on it, each device will need
  * to request the bus for a transaction or set of transactions and release the
  * bus when done. Device functions should be robust to failing to request the bus.
  */
 #pragma once
-#include <list>
-#include <queue>
 #include <cstdint>
 #include "hardware/i2c.h"
 #include "hardware/irq.h"
@@ -47,6 +46,30 @@
 #include "pico/critical_section.h"
 #include "hardware/gpio.h"
 #include "hardware/irq.h"
+#ifndef RP2040_I2C_MAX_DEVICES
+// The most devices that may be active or waiting for one bus at the same time
+#define RP2040_I2C_MAX_DEVICES 8
+#endif
+#ifndef RP2040_I2C_MAX_ATTACHED_DEVICES
+// The most devices service() can run for one bus (1-32)
+#define RP2040_I2C_MAX_ATTACHED_DEVICES 16
+#endif
+#ifndef RP2040_MCP4728_RAM_FUNCS
+// Set to 1 to run the I2C transaction hot path from SRAM instead of XIP flash
+#define RP2040_MCP4728_RAM_FUNCS 0
+#endif
+#if RP2040_MCP4728_RAM_FUNCS
+// Put a function definition in the SRAM the boot code copies .time_critical sections to.
+// __not_in_flash_func() cannot be used because it turns the qualified name into the section name.
+#define RP2040_MCP4728_RAM_FUNC __attribute__((section(".time_critical.rp2040_mcp4728")))
+#else
+#define RP2040_MCP4728_RAM_FUNC
+#endif
+#ifndef RP2040_I2C_MUX_MAX_SKIPS
+// The most times the device at the front of the bus queue may be passed over
+// for devices on the I2C mux segment that is already connected
+#define RP2040_I2C_MUX_MAX_SKIPS 4
+#endif
 namespace rppicomidi
 {
 class Rp2040_i2c_bus;
@@ -57,13 +80,56 @@ class Rp2040_i2c_bus;
 class RP2040_i2c_device
 {
 public:
-    RP2040_i2c_device(uint16_t addr_, Rp2040_i2c_bus* bus_) : addr{addr_}, bus{bus_} {}
+    RP2040_i2c_device(uint16_t addr_, Rp2040_i2c_bus* bus_) : addr{addr_}, bus{bus_}, service_slot{-1},
+        mux_addr{no_mux}, mux_channels{0} {}
+    virtual ~RP2040_i2c_device()=default;
     uint16_t get_addr() const {
         return addr;
     }
+
+    static const uint16_t no_mux = 0;   // the mux address of a device wired directly to the bus
+    static const uint16_t first_mux_addr = 0x70; // the TCA9548A address range
+    static const uint16_t last_mux_addr = 0x77;
+    /**
+     * @brief say which TCA9548A I2C mux channels connect the device to the bus
+     *
+     * When the device gets the bus, the bus writes channel_mask to the mux
+     * at mux_addr_ first if those channels are not already the only ones
+     * connected. Call this before the device requests the bus. A device on
+     * the bus side of the muxes (no_mux) must not share its address with any
+     * device behind a mux.
+     * @return true if successful or false if mux_addr_ is not no_mux or
+     * a TCA9548A address, or channel_mask is 0 for a mux
+     * @param mux_addr_ the 7-bit I2C address of the mux, or no_mux
+     * @param channel_mask bit n set connects mux channel n
+     */
+    bool set_mux_path(uint16_t mux_addr_, uint8_t channel_mask) {
+        if (mux_addr_ == no_mux) {
+            mux_addr = no_mux;
+            mux_channels = 0;
+            return true;
+        }
+        if (mux_addr_ < first_mux_addr || mux_addr_ > last_mux_addr || channel_mask == 0)
+            return false;
+        mux_addr = mux_addr_;
+        mux_channels = channel_mask;
+        return true;
+    }
+    uint16_t get_mux_addr() const { return mux_addr; }
+    uint8_t get_mux_channels() const { return mux_channels; }
+
+    /**
+     * @brief do the device's non-interrupt work, such as calling application callbacks.
+     * Rp2040_i2c_bus::service() calls this for attached devices that have work pending.
+     */
+    virtual void task() {}
 protected:
+    friend class Rp2040_i2c_bus;
     uint16_t addr;      // The I2C address of the device; 10-bit addresses must have upper 5 MSBs 0b11110
     Rp2040_i2c_bus* bus;
+    int8_t service_slot; // the device's index in the bus's attached device registry or -1 if not attached
+    uint16_t mux_addr;  // the address of the TCA9548A mux the device is behind, or no_mux
+    uint8_t mux_channels; // the mux channels that connect the device to the bus
     void* context; // the context for the currently pending callback
     void (*callback)(void* context); // the currently pending callback
     static void dev_cb(RP2040_i2c_device* dev) {
@@ -94,7 +160,9 @@ public:
      * 
      * @return 1 if the requesting device is now the active device
      * @return 0 if the requesting device activation is deferred; callback will be called when the device is active.
-     * @return -1 if the parameters are invalid.
+     * Activation is also deferred while the bus switches the I2C mux channels for the device (see
+     * RP2040_i2c_device::set_mux_path()).
+     * @return -1 if the parameters are invalid or RP2040_I2C_MAX_DEVICES devices are already waiting.
      * @param requesting_device is the device that wants to become active
      * @param ready_callback is called when the device becomes active after deferral. This function will be called
      * from the IRQ context of the interrupted core in a multi-core critical section. Do not try to start a new
@@ -137,6 +205,95 @@ public:
      */
     bool write(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*)=nullptr);
 
+    /**
+     * @brief same as write() except that the caller must already be in this bus's critical section
+     * (see enter_critical()). Device classes that keep their own transaction queues use this so
+     * that queue bookkeeping and the hardware FIFO load happen atomically with respect to the IRQ.
+     */
+    bool write_locked(RP2040_i2c_device* dev, bool send_restart, bool send_stop, const uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device*)=nullptr);
+
+    /**
+     * @brief Write a stream of nbytes of data that may be longer than the TX FIFO to the last
+     * device that successfully requested the bus; call done_callback() when done.
+     *
+     * The bytes go out in one transaction. This function loads as much of the stream as the
+     * TX FIFO will hold, and the IRQ handler refills the TX FIFO as it drains by calling
+     * fill_callback() for the next bytes. If the I2C hardware aborts the transaction
+     * (for example, because the target did not acknowledge), the rest of the stream is dropped.
+     *
+     * @return true if successful or false if nbytes is 0, another stream is in progress,
+     * or the bus was not successfully requested
+     * @param dev the RP2040_i2c_device that has bus access; must be the same device that successfully requested the bus
+     * @param send_restart is true if the first byte of the stream is preceeded by a restart condition
+     * @param send_stop is true if the last byte of the stream is followed by a stop condition
+     * @param nbytes the total number of bytes in the stream
+     * @param fill_callback is called to copy the next nbytes bytes of the stream to data. It is called
+     * from this function and from the IRQ context of the interrupted core in a multi-core critical section.
+     * @param done_callback is called when the TX FIFO is empty after the last byte. Same restrictions as
+     * the done_callback for write().
+     */
+    bool write_stream(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint32_t nbytes,
+        void (*fill_callback)(RP2040_i2c_device* dev, uint8_t* data, uint8_t nbytes), void (*done_callback)(RP2040_i2c_device*)=nullptr);
+
+    /**
+     * @brief same as write_stream() except that the caller must already be in this bus's critical section
+     * (see enter_critical()).
+     */
+    bool write_stream_locked(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint32_t nbytes,
+        void (*fill_callback)(RP2040_i2c_device* dev, uint8_t* data, uint8_t nbytes), void (*done_callback)(RP2040_i2c_device*)=nullptr);
+
+    /**
+     * @brief
+     *
+     * @return true if a write_stream() transaction is still loading the TX FIFO
+     */
+    bool is_streaming() const { return current_transfer.fill_callback != nullptr; }
+
+    enum Frame_status : uint8_t {
+        frame_pending,  // the entry has not been sent yet
+        frame_ok,       // the target acknowledged every byte
+        frame_nack,     // the transfer aborted, for example because the target did not acknowledge
+    };
+    /**
+     * One write in a bus frame (see write_frame())
+     */
+    struct Frame_entry {
+        uint16_t addr;          // the 7-bit I2C address to write to
+        const uint8_t* data;    // the bytes to write
+        uint8_t nbytes;         // the number of bytes (1-16)
+        uint8_t status;         // a Frame_status the bus sets as the frame runs
+    };
+
+    /**
+     * @brief write a list of complete transactions, each to its own I2C address,
+     * as one bus operation; call done_callback() when the last one is done.
+     *
+     * The IRQ handler sends each entry with a stop condition, changes the target
+     * address and starts the next entry without returning to the caller in between.
+     * A transfer that aborts only fails its own entry; the rest of the frame still runs.
+     * When the frame is done, the target address is the address of the last entry.
+     * @return true if the frame started or false if nentries is 0, an entry has no bytes or
+     * more than 16 bytes, the bus is busy, or dev does not have the bus
+     * @param dev the RP2040_i2c_device that has bus access; must be the same device that successfully requested the bus
+     * @param entries the list of writes. The list and the data must stay valid until done_callback() is called.
+     * @param nentries the number of entries in the list
+     * @param done_callback is called when every entry has its status. Same restrictions as the done_callback for write().
+     */
+    bool write_frame(RP2040_i2c_device* dev, Frame_entry* entries, uint8_t nentries, void (*done_callback)(RP2040_i2c_device*)=nullptr);
+
+    /**
+     * @brief same as write_frame() except that the caller must already be in this bus's critical section
+     * (see enter_critical()).
+     */
+    bool write_frame_locked(RP2040_i2c_device* dev, Frame_entry* entries, uint8_t nentries, void (*done_callback)(RP2040_i2c_device*)=nullptr);
+
+    /**
+     * @brief
+     *
+     * @return true if a write_frame() frame is still running
+     */
+    bool is_framing() const { return current_frame.entries != nullptr; }
+
     /**
      * @brief enter or exit the I2C bus master general call mode
      *
@@ -152,6 +309,34 @@ public:
      */
     bool set_general_call_mode(RP2040_i2c_device* dev, bool general_call_mode_active);
 
+    /**
+     * @brief change the I2C address the bus sends to without releasing the bus
+     *
+     * Use this to let one device object (for example, a group of chips that are
+     * updated together) talk to several addresses in one bus session. The target
+     * returns to the address of the next device when dev releases the bus.
+     * @return true if successful or false if dev does not have bus access or if a
+     * transaction is still in progress
+     * @param dev the RP2040_i2c_device that has bus access; must be the same device that successfully requested the bus
+     * @param target_addr the 7-bit I2C address for subsequent reads and writes
+     */
+    bool set_target_addr(RP2040_i2c_device* dev, uint16_t target_addr);
+
+    /**
+     * @brief
+     *
+     * @return the I2C address that reads and writes currently go to
+     */
+    uint16_t get_target_addr() const { return i2c_bus->hw->tar & 0x3FF; }
+
+    /**
+     * @brief
+     *
+     * @return true if the I2C hardware is sending or receiving or has bytes waiting in the TX FIFO,
+     * or a write_frame() frame or probe() is still running
+     */
+    bool is_busy() const { return (i2c_bus->hw->status & I2C_IC_STATUS_ACTIVITY_BITS) != 0 || i2c_bus->hw->txflr != 0 || is_framing() || probing; }
+
     /**
      * @brief
      *
@@ -191,6 +376,28 @@ public:
      */
     bool read(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device* dev));
 
+    /**
+     * @brief same as read() except that the caller must already be in this bus's critical section
+     * (see enter_critical()).
+     */
+    bool read_locked(RP2040_i2c_device* dev, bool send_restart, bool send_stop, uint8_t* data, const uint8_t nbytes, void (*done_callback)(RP2040_i2c_device* dev));
+
+    /**
+     * @brief check whether any device answers at an I2C address by reading one byte from it
+     *
+     * This function blocks until the read finishes, so use it for bring-up scans, not during
+     * normal operation. It holds the bus critical section only while it swaps the target
+     * address; interrupts stay enabled while it polls the hardware. After a timeout it still
+     * waits for the stop condition, and discards any late byte, before it restores the target
+     * address.
+     * @return 1 if a device acknowledged the address, 0 if no device did, -1 if dev does not
+     * have the bus, a transfer is in progress, or the read timed out
+     * @param dev the device that owns the bus; must be the same device that successfully requested the bus
+     * @param probe_addr the 7-bit I2C address to check
+     * @param timeout_us the maximum time to wait
+     */
+    int probe(RP2040_i2c_device* dev, uint16_t probe_addr, uint32_t timeout_us=1000);
+
     /**
      * @brief Change the I2C pins to the RP2040 GPIO numbers
      *
@@ -201,6 +408,23 @@ public:
      */
     bool set_bus_pins(RP2040_i2c_device* dev, uint sda_pin_, uint scl_pin_);
 
+    /**
+     * @brief change the I2C clock rate
+     *
+     * @return the clock rate the hardware actually set, or 0 if dev does not own the bus
+     * or a transfer is in progress
+     * @param dev the device that owns the bus; must be the same device that successfully requested the bus
+     * @param baudrate_ the requested SCL frequency in Hz
+     */
+    uint set_baudrate(RP2040_i2c_device* dev, uint baudrate_);
+
+    /**
+     * @brief
+     *
+     * @return the SCL frequency in Hz requested in the constructor or the last set_baudrate() call
+     */
+    uint get_baudrate() const { return baudrate; }
+
     /**
      * @brief get the GPIO pins for the I2C bus. It is not necessary to have successfully requested the bus to do this
      *
@@ -216,7 +440,7 @@ public:
      * @param dev is the I2C device that is currently communicating on this bus.
      * @note call this in a critical section.
      */
-    bool is_active_device(RP2040_i2c_device* dev) const {return dev == requesting_devices.begin()->dev; }
+    bool is_active_device(RP2040_i2c_device* dev) const {return num_requesting_devices != 0 && dev == requesting_devices[0].dev && !mux_switching; }
 
     /**
      * @brief deactivate the on-chip I2C and associated hardware
@@ -230,24 +454,124 @@ public:
 
     /**
      * @brief reverse the effects of the deinit_i2c_bus() function and
-     * restore on-chip I2C hardware support.
+     * restore on-chip I2C hardware support. Any transfer that was still
+     * in progress is discarded without calling its callback.
      *
      * @return true if dev currently has I2C bus access; false otherwise
      * @param dev is the I2C device that is currently communicating on this bus.
      */
     bool reinit_i2c_bus(RP2040_i2c_device* dev);
+
+    /**
+     * @brief add a device to the registry of devices that service() runs
+     *
+     * @return false if the device is on another bus or RP2040_I2C_MAX_ATTACHED_DEVICES devices are
+     * already attached; true if the device is attached, including if it already was
+     * @param dev the device to attach
+     */
+    bool attach(RP2040_i2c_device* dev);
+
+    /**
+     * @brief remove a device from the registry of devices that service() runs
+     *
+     * @param dev the device to detach
+     */
+    void detach(RP2040_i2c_device* dev);
+
+    /**
+     * @brief note that an attached device has work for its task() function
+     *
+     * Device classes call this from their interrupt callbacks. It does nothing if dev is not attached.
+     * @param dev the device
+     * @note call this in the bus critical section. Interrupt callbacks already are.
+     */
+    void set_pending_locked(RP2040_i2c_device* dev) {
+        if (dev->service_slot >= 0)
+            pending |= 1ul << dev->service_slot;
+    }
+
+    /**
+     * @brief same as set_pending_locked() except that it enters the bus critical section
+     */
+    void set_pending(RP2040_i2c_device* dev) {
+        enter_critical();
+        set_pending_locked(dev);
+        exit_critical();
+    }
+
+    /**
+     * @brief call task() for the attached devices that have work pending
+     *
+     * The devices take turns going first, so a device that always has work
+     * cannot starve the others. Devices that do not get to run because the
+     * budget ran out stay pending for the next call.
+     * @return the number of devices whose task() ran
+     * @param budget_us if not 0, stop calling task() functions after this many microseconds.
+     * At least one task() function runs on every call that has work pending.
+     */
+    uint8_t service(uint32_t budget_us=0);
+
+    struct Mux_statistics {
+        uint32_t switches;          // the number of TCA9548A control register writes
+        uint32_t grants_no_switch;  // the number of times a device behind a mux got the bus without a switch
+        uint32_t regrouped;         // the number of times a device on the connected segment went ahead in the queue
+        uint32_t errors;            // the number of control register writes the mux did not acknowledge
+        uint64_t switch_us;         // the total time devices waited for mux switches
+    };
+    /**
+     * @brief copy the I2C mux switching counters to stats
+     *
+     * @param stats the structure that receives the counters
+     */
+    void get_mux_statistics(Mux_statistics& stats);
+    void reset_mux_statistics();
 protected:
     static Rp2040_i2c_bus* i2c0_irq_context;
     static Rp2040_i2c_bus* i2c1_irq_context;
-    static void i2c0_irq_handler(void) {
-        i2c0_irq_context->i2c_irq_handler();
-    }
-    static void i2c1_irq_handler(void) {
-        i2c1_irq_context->i2c_irq_handler();
-    }
+    static void i2c0_irq_handler(void);
+    static void i2c1_irq_handler(void);
     void i2c_irq_handler();
     void set_bus_pins(uint sda_pin_, uint scl_pin_);
     void init_bus();
+    /**
+     * @brief load as many bytes of the current write_stream() transaction as the TX FIFO will hold
+     * @note call this in the bus critical section
+     */
+    void stream_fill_locked();
+    /**
+     * @brief
+     *
+     * @return true if a mux control register must change before dev can talk to its address
+     */
+    bool needs_mux_switch(const RP2040_i2c_device* dev) const;
+    /**
+     * @brief if a device behind the connected mux segment is waiting, move it to
+     * the front of the queue unless the front device has been passed over
+     * RP2040_I2C_MUX_MAX_SKIPS times
+     * @note call this in the bus critical section
+     */
+    void regroup_locked();
+    /**
+     * @brief make the device at the front of the queue active, switching the
+     * mux channels first if needed
+     *
+     * @return true if the device is active now or false if it will be active
+     * when the mux switch finishes
+     * @note call this in the bus critical section
+     */
+    bool grant_locked();
+    /**
+     * @brief write the next pending mux control register value or, if none are left, make the
+     * device at the front of the queue active and call its ready callback
+     * @note call this in the bus critical section
+     */
+    void mux_next_locked();
+    /**
+     * @brief load the current write_frame() entry into the TX FIFO or, if all entries are
+     * done, end the frame and call its done_callback
+     * @note call this in the bus critical section
+     */
+    void frame_next_locked();
     struct I2c_dev_cb
     {
         RP2040_i2c_device* dev;
@@ -257,6 +581,7 @@ protected:
     {
         void reset() {
             buffer = nullptr; buffer_size=0; is_read=false; send_restart=false; send_stop=false; dev = nullptr; callback = nullptr;
+            fill_callback = nullptr; stream_remaining = 0;
         }
         uint8_t* buffer;
         uint8_t buffer_size;
@@ -264,14 +589,42 @@ protected:
         bool is_read;
         bool send_restart;
         bool send_stop;
+        void (*fill_callback)(RP2040_i2c_device* dev, uint8_t* data, uint8_t nbytes); // not nullptr while a write_stream() is loading the TX FIFO
+        uint32_t stream_remaining; // the number of write_stream() bytes not yet in the TX FIFO
     };
     i2c_inst_t* i2c_bus;
     uint baudrate;
     uint sda_pin;
     uint scl_pin;
     critical_section_t crit_sec;
-    std::list<I2c_dev_cb> requesting_devices; // The front of the queue is the current device
+    I2c_dev_cb requesting_devices[RP2040_I2C_MAX_DEVICES]; // The front of the queue is the current device
+    uint8_t num_requesting_devices;
+    RP2040_i2c_device* attached_devices[RP2040_I2C_MAX_ATTACHED_DEVICES];
+    volatile uint32_t pending; // bit n set means attached_devices[n] has work for task()
+    uint8_t next_service_slot; // the slot service() looks at first
     I2c_dev_in_progress current_transfer; // if there is no current transfer, then buffer will be NULL, buffer_size will be 0, send_restart will be false and send_stop will be false
+    static const uint8_t num_mux_addrs = RP2040_i2c_device::last_mux_addr - RP2040_i2c_device::first_mux_addr + 1;
+    struct Mux_write {
+        uint16_t addr;
+        uint8_t channels;
+    };
+    static const uint16_t mux_unknown = 0x100; // the mux_state of a mux that did not acknowledge a write
+    uint16_t mux_state[num_mux_addrs]; // the channels connected on each TCA9548A address
+    Mux_write mux_writes[num_mux_addrs]; // the control register writes of the switch in progress
+    uint8_t num_mux_writes;
+    uint8_t next_mux_write;
+    volatile bool mux_switching; // true while the bus writes mux control registers for the front device
+    uint8_t mux_skips; // the times the front device of the queue has been passed over
+    uint64_t mux_switch_start_us;
+    volatile bool probing; // true while probe() has the target address swapped
+    Mux_statistics mux_stats;
+    struct {
+        Frame_entry* entries; // nullptr if no frame is running
+        uint8_t nentries;
+        uint8_t next;         // the entry in the TX FIFO
+        RP2040_i2c_device* dev;
+        void (*callback)(RP2040_i2c_device*);
+    } current_frame;
 private:
     Rp2040_i2c_bus()=delete;
     Rp2040_i2c_bus(const Rp2040_i2c_bus&)=delete;
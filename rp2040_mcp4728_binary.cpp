@@ -0,0 +1,169 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include <cstring>
+#include "rp2040_mcp4728_binary.h"
+
+rppicomidi::RP2040_MCP4728_binary::RP2040_MCP4728_binary(RP2040_MCP4728_group* group_,
+    void (*send_)(void* context, const uint8_t* data, size_t nbytes), void* send_context_, uint8_t ack_batch_) :
+    group{group_}, send{send_}, send_context{send_context_}, ack_batch{ack_batch_}, queue_head{0}, queue_tail{0},
+    open{false}, closing{false}, expected_seq{0}, tx_seq{0}, unacked{0}, ack_flags{0},
+    reported_free{RP2040_MCP4728_BINARY_QUEUE_SIZE}
+{
+    static_assert((RP2040_MCP4728_BINARY_QUEUE_SIZE & (RP2040_MCP4728_BINARY_QUEUE_SIZE - 1)) == 0,
+        "RP2040_MCP4728_BINARY_QUEUE_SIZE must be a power of 2");
+    static_assert(RP2040_MCP4728_BINARY_QUEUE_SIZE <= 32768, "RP2040_MCP4728_BINARY_QUEUE_SIZE is too large");
+    if (ack_batch == 0)
+        ack_batch = 1;
+    reset_statistics();
+}
+
+void rppicomidi::RP2040_MCP4728_binary::reset_statistics()
+{
+    memset(&stat, 0, sizeof(stat));
+}
+
+void rppicomidi::RP2040_MCP4728_binary::reject()
+{
+    ack_flags |= mcp4728_protocol::ack_flag_rejected;
+    ++stat.rejected;
+}
+
+bool rppicomidi::RP2040_MCP4728_binary::queue_write_frame(const uint8_t* payload, size_t nbytes)
+{
+    // check every record before queuing any of them
+    size_t offset = 0;
+    while (offset < nbytes) {
+        if (offset + 2 > nbytes)
+            return false;
+        uint8_t chip = payload[offset];
+        uint8_t len = payload[offset + 1];
+        if (chip >= group->get_num_dacs() || len == 0 || len > mcp4728_protocol::max_record_bytes || offset + 2 + len > nbytes)
+            return false;
+        offset += 2 + len;
+    }
+    if (nbytes > get_queue_free())
+        return false;
+    for (offset = 0; offset < nbytes; offset++)
+        queue_put(payload[offset]);
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_binary::receive(uint8_t c)
+{
+    int result = decoder.receive(c);
+    if (result == -1) {
+        if (open)
+            reject();
+        return;
+    }
+    if (result != 1)
+        return;
+    uint8_t type = decoder.get_type();
+    if (type == mcp4728_protocol::msg_open) {
+        // the host may open again at any time to restart the sequence numbers
+        if (!open) {
+            queue_head = queue_tail = 0;
+            reported_free = RP2040_MCP4728_BINARY_QUEUE_SIZE;
+            ack_flags = 0;
+            group->request_bus(nullptr, nullptr);
+        }
+        open = true;
+        closing = false;
+        expected_seq = decoder.get_seq() + 1;
+        ++unacked;
+        ++stat.frames;
+        send_ack();
+        return;
+    }
+    if (!open) {
+        if (type == mcp4728_protocol::msg_close) {
+            // the ack of the close frame was lost, so the host sent it again
+            ack_flags |= mcp4728_protocol::ack_flag_closed;
+            send_ack();
+        }
+        return;
+    }
+    if (closing || decoder.get_seq() != expected_seq) {
+        reject();
+        return;
+    }
+    if (type == mcp4728_protocol::msg_write) {
+        if (!queue_write_frame(decoder.get_payload(), decoder.get_payload_len())) {
+            reject();
+            return;
+        }
+    }
+    else if (type == mcp4728_protocol::msg_close) {
+        closing = true;
+    }
+    else {
+        reject();
+        return;
+    }
+    ++expected_seq;
+    ++unacked;
+    ++stat.frames;
+}
+
+void rppicomidi::RP2040_MCP4728_binary::send_ack()
+{
+    uint16_t queue_free = get_queue_free();
+    uint8_t payload[mcp4728_protocol::ack_payload_len] = {expected_seq, ack_flags, (uint8_t)(queue_free >> 8), (uint8_t)(queue_free & 0xFF)};
+    uint8_t frame[mcp4728_protocol::cobs_max_encoded(mcp4728_protocol::frame_overhead + sizeof(payload)) + 1];
+    size_t nbytes = mcp4728_protocol::encode_frame(tx_seq++, mcp4728_protocol::msg_ack, payload, sizeof(payload), frame);
+    send(send_context, frame, nbytes);
+    unacked = 0;
+    ack_flags = 0;
+    reported_free = queue_free;
+    ++stat.acks;
+}
+
+void rppicomidi::RP2040_MCP4728_binary::task()
+{
+    if (!open)
+        return;
+    group->task();
+    if (group->has_bus()) {
+        uint8_t record[mcp4728_protocol::max_record_bytes];
+        while (queue_head != queue_tail) {
+            uint8_t len = queue_peek(1);
+            for (uint8_t idx = 0; idx < len; idx++)
+                record[idx] = queue_peek(2 + idx);
+            if (!group->write_chip(queue_peek(0), record, len))
+                break; // the I2C hardware is busy; try again on the next call
+            queue_tail += 2 + len;
+            ++stat.writes;
+        }
+    }
+    bool drained = queue_head == queue_tail;
+    if (closing && drained && !group->is_bus_busy()) {
+        group->release_bus();
+        open = false;
+        closing = false;
+        ack_flags |= mcp4728_protocol::ack_flag_closed;
+    }
+    if (unacked >= ack_batch || ack_flags != 0 || (drained && (unacked != 0 || reported_free != RP2040_MCP4728_BINARY_QUEUE_SIZE)))
+        send_ack();
+}
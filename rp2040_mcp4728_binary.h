@@ -0,0 +1,129 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class implements the target end of a framed binary protocol for
+ * streaming DAC updates from a host at rates the text CLI cannot reach.
+ * See rp2040_mcp4728_protocol.h for the frame format. The host encodes
+ * the MCP4728 commands (see rp2040_mcp4728_frames.h), so a write record
+ * goes from the received frame into a byte queue and from there straight
+ * to RP2040_MCP4728_group::write_chip() without any parsing.
+ *
+ * An open frame makes the group request the I2C bus. Frames must then
+ * arrive in sequence; a damaged, out of sequence or oversized frame is
+ * rejected and the next ack says which sequence number to resend from
+ * (go-back-N). Acks are batched: the target sends one after every
+ * ack_batch accepted frames, after a rejection, and when the queue has
+ * drained. Each ack also reports the free queue space, so the host can
+ * send only what fits. A close frame releases the bus after the queued
+ * writes are done.
+ *
+ * Call receive() and task() from the same core.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+#include "rp2040_mcp4728_protocol.h"
+#ifndef RP2040_MCP4728_BINARY_QUEUE_SIZE
+// The number of bytes in the write record queue; must be a power of 2
+#define RP2040_MCP4728_BINARY_QUEUE_SIZE 1024
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_binary
+{
+public:
+    struct statistics {
+        uint32_t frames;        // frames accepted
+        uint32_t rejected;      // frames rejected
+        uint32_t writes;        // write records sent to the chips
+        uint32_t acks;          // acks sent
+    };
+
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips the write records go to
+     * @param send_ the function that sends bytes to the host
+     * @param send_context_ the context parameter for send_
+     * @param ack_batch_ the number of accepted frames per ack
+     */
+    RP2040_MCP4728_binary(RP2040_MCP4728_group* group_, void (*send_)(void* context, const uint8_t* data, size_t nbytes),
+        void* send_context_, uint8_t ack_batch_=8);
+
+    /**
+     * @brief process one byte received from the host
+     */
+    void receive(uint8_t c);
+
+    /**
+     * @brief send queued write records to the chips, send acks and call the
+     * group's task() function. Call this periodically.
+     */
+    void task();
+
+    /**
+     * @brief
+     *
+     * @return true from the time an open frame arrives until the close is done
+     */
+    bool is_open() const { return open; }
+
+    /**
+     * @brief copy the statistics
+     *
+     * @param stats receives the statistics
+     */
+    void get_statistics(statistics& stats) const { stats = stat; }
+
+    void reset_statistics();
+protected:
+    void reject();
+    void send_ack();
+    bool queue_write_frame(const uint8_t* payload, size_t nbytes);
+    uint16_t get_queue_free() const { return RP2040_MCP4728_BINARY_QUEUE_SIZE - (uint16_t)(queue_head - queue_tail); }
+    void queue_put(uint8_t c) { queue[queue_head++ & (RP2040_MCP4728_BINARY_QUEUE_SIZE - 1)] = c; }
+    uint8_t queue_peek(uint16_t offset) const { return queue[(queue_tail + offset) & (RP2040_MCP4728_BINARY_QUEUE_SIZE - 1)]; }
+    RP2040_MCP4728_group* group;
+    void (*send)(void* context, const uint8_t* data, size_t nbytes);
+    void* send_context;
+    uint8_t ack_batch;
+    mcp4728_protocol::frame_decoder decoder;
+    uint8_t queue[RP2040_MCP4728_BINARY_QUEUE_SIZE];
+    uint16_t queue_head;
+    uint16_t queue_tail;
+    bool open;
+    bool closing;
+    uint8_t expected_seq;
+    uint8_t tx_seq;
+    uint8_t unacked;            // frames accepted since the last ack
+    uint8_t ack_flags;
+    uint16_t reported_free;     // the queue space in the last ack
+    statistics stat;
+private:
+    RP2040_MCP4728_binary()=delete;
+    RP2040_MCP4728_binary(const RP2040_MCP4728_binary&)=delete;
+    RP2040_MCP4728_binary& operator=(const RP2040_MCP4728_binary&)=delete;
+};
+}
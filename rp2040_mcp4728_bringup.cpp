@@ -0,0 +1,111 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_bringup.h"
+#include <cstring> // memset
+#include "hardware/timer.h"
+
+bool rppicomidi::RP2040_MCP4728_bringup::wait_idle(absolute_time_t deadline)
+{
+    while (group->is_bus_busy()) {
+        if (time_reached(deadline))
+            return false;
+        tight_loop_contents();
+    }
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_bringup::run(report& rep, const mcp4728_channel_data* expected, uint32_t timeout_us)
+{
+    memset(&rep, 0, sizeof(rep));
+    rep.nchips = group->get_num_dacs();
+    if (!group->has_bus() || group->is_updating())
+        return false;
+    uint64_t start = time_us_64();
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+
+    // One reset and one wake-up reach every chip on the bus
+    if (!wait_idle(deadline) || !group->general_call(0x06) || !wait_idle(deadline) ||
+            !group->general_call(0x09) || !wait_idle(deadline))
+        return false;
+
+    // Scan the MCP4728 address range
+    for (uint8_t addr_bits = 0; addr_bits < 8 && !time_reached(deadline); addr_bits++) {
+        if (group->probe(0x60 | addr_bits) == 1)
+            rep.scan_mask |= 1 << addr_bits;
+    }
+    rep.unexpected_mask = rep.scan_mask;
+    for (uint8_t dacnum = 0; dacnum < rep.nchips; dacnum++) {
+        auto& chip = rep.chips[dacnum];
+        chip.addr = group->get_chip_addr(dacnum);
+        if (chip.addr >= 0x60 && chip.addr <= 0x67) {
+            chip.present = (rep.scan_mask & (1 << (chip.addr & 0x7))) != 0;
+            rep.unexpected_mask &= ~(1 << (chip.addr & 0x7));
+        }
+    }
+
+    // Read back every chip that answered without giving up the bus between chips
+    for (uint8_t dacnum = 0; dacnum < rep.nchips; dacnum++) {
+        auto& chip = rep.chips[dacnum];
+        if (!chip.present)
+            continue;
+        uint8_t bytes[24];
+        if (!wait_idle(deadline) || !group->read_chip(dacnum, bytes, sizeof(bytes)))
+            continue;
+        // The I2C IRQ fills bytes until the read is done, so wait for that even after the
+        // deadline; the hardware always finishes or aborts a read in bounded time
+        while (group->is_read_in_flight())
+            tight_loop_contents();
+        if (!wait_idle(deadline))
+            continue;
+        chip.read_ok = true;
+        chip.ready = true;
+        chip.powered_on = true;
+        for (uint8_t idx = 0; idx < 8; idx++) {
+            RP2040_MCP4728::bytes2channel_read_data(bytes + idx*3, chip.regs + idx);
+            chip.regs[idx].is_eeprom = (idx & 1) != 0;
+            chip.ready = chip.ready && chip.regs[idx].rdy;
+            chip.powered_on = chip.powered_on && chip.regs[idx].por;
+        }
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            const auto& dac_reg = chip.regs[chan*2];
+            bool match;
+            if (expected) {
+                const auto& exp = expected[dacnum*4 + chan];
+                match = dac_reg.vref == exp.vref && dac_reg.gain == exp.gain && dac_reg.pd == exp.pd &&
+                    dac_reg.dac_code == exp.dac_code;
+            }
+            else {
+                const auto& eeprom = chip.regs[chan*2+1];
+                match = dac_reg.vref == eeprom.vref && dac_reg.gain == eeprom.gain && dac_reg.dac_code == eeprom.dac_code;
+            }
+            if (!match)
+                chip.mismatch_mask |= 1 << chan;
+        }
+        if (chip.ready && chip.powered_on && chip.mismatch_mask == 0)
+            ++rep.nok;
+    }
+    rep.total_us = (uint32_t)(time_us_64() - start);
+    return rep.nok == rep.nchips;
+}
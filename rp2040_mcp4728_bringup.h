@@ -0,0 +1,90 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class brings up every MCP4728 chip in an RP2040_MCP4728_group in one
+ * bus session. It sends one general call reset, which makes every chip load
+ * its EEPROM into its DAC registers, and one general call wake-up to every
+ * chip at once instead of one per chip. It then scans the 8 MCP4728
+ * addresses, reads back every DAC and EEPROM register of every chip that
+ * answered, and flags chips that are absent, not ready, not powered on, or
+ * whose DAC registers do not match the expected values.
+ *
+ * run() blocks. It never takes longer than its timeout no matter how many
+ * chips there are.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+namespace rppicomidi
+{
+class RP2040_MCP4728_bringup
+{
+public:
+    struct chip_report {
+        uint16_t addr;
+        bool present;           // the chip acknowledged its address in the scan
+        bool read_ok;           // the registers were read back
+        bool ready;             // RDY/BSY\ showed ready for every register
+        bool powered_on;        // POR showed powered on for every register
+        uint8_t mismatch_mask;  // bit n is set if channel n does not match the expected value
+        mcp4728_channel_read_data regs[8]; // DAC register then EEPROM for channels A-D
+    };
+    struct report {
+        chip_report chips[RP2040_MCP4728_group::max_dacs];
+        uint8_t nchips;
+        uint8_t nok;            // chips that are present, ready, powered on and match
+        uint8_t scan_mask;      // bit n is set if a device acknowledged address 0x60+n
+        uint8_t unexpected_mask;// bits of scan_mask that are not chips in the group
+        uint32_t total_us;
+    };
+
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips to bring up. The group must have the I2C bus when run() is called.
+     */
+    RP2040_MCP4728_bringup(RP2040_MCP4728_group* group_) : group{group_} {}
+
+    /**
+     * @brief reset, wake up, scan and verify every chip in the group
+     *
+     * @return true if every chip in the group is OK
+     * @param rep returns the result for each chip
+     * @param expected if not nullptr, 4 entries per chip in group order with the Vref, gain,
+     * power-down and code each channel should have after reset and wake-up. If nullptr,
+     * each channel's DAC register must match its EEPROM register except for the power-down
+     * bits, which the wake-up command clears.
+     * @param timeout_us the maximum time for the whole bring-up
+     */
+    bool run(report& rep, const mcp4728_channel_data* expected=nullptr, uint32_t timeout_us=20000);
+protected:
+    bool wait_idle(absolute_time_t deadline);
+    RP2040_MCP4728_group* group;
+private:
+    RP2040_MCP4728_bringup()=delete;
+    RP2040_MCP4728_bringup(const RP2040_MCP4728_bringup&)=delete;
+    RP2040_MCP4728_bringup& operator=(const RP2040_MCP4728_bringup&)=delete;
+};
+}
@@ -33,6 +33,8 @@
 rppicomidi::RP2040_MCP4728_cli::RP2040_MCP4728_cli(EmbeddedCli* cli_, RP2040_MCP4728* dac_list_, const uint8_t ndacs_, uint8_t first_dacnum) : cli{cli_}, dac_list{dac_list_},
         ndacs{ndacs_}, dac{dac_list_+first_dacnum}, current_dacnum{first_dacnum}, next_dacnum{first_dacnum}
 {
+    memset(&batch, 0, sizeof(batch));
+    memset(&bench, 0, sizeof(bench));
     int result = dac->request_bus(allocation_successful, nullptr);
     assert(result == 1);
     bool add_result = embeddedCliAddBinding(cli, {
@@ -130,7 +132,7 @@ rppicomidi::RP2040_MCP4728_cli::RP2040_MCP4728_cli(EmbeddedCli* cli_, RP2040_MCP
             "Send General Call Software Update to all I2C devices on the bus. Updates all DAC outputs at the same time",
             true,
             this,
-            on_reset
+            on_update
     });
     assert(add_result);
     if (ndacs > 1) {
@@ -167,25 +169,43 @@ rppicomidi::RP2040_MCP4728_cli::RP2040_MCP4728_cli(EmbeddedCli* cli_, RP2040_MCP
             on_write_i2c_addr
     });
     assert(add_result);
+    add_result = embeddedCliAddBinding(cli, {
+            "dac-batch",
+            "Record a script of dac- commands and run it back-to-back; use dac-batch with no args for usage",
+            true,
+            this,
+            on_batch
+    });
+    assert(add_result);
+    add_result = embeddedCliAddBinding(cli, {
+            "dac-bench",
+            "Measure operation throughput and latency; use dac-bench with no args for usage",
+            true,
+            this,
+            on_bench
+    });
+    assert(add_result);
     (void)add_result;
 }
 
 void rppicomidi::RP2040_MCP4728_cli::write_complete(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
-    printf("MCP4728 # %u write complete\r\n", me->current_dacnum);
+    if (me->batch.running)
+        return; // the batch report shows the timing instead
+    me->msg_log.log("MCP4728 # %u write complete\r\n", me->current_dacnum);
 }
 
 void rppicomidi::RP2040_MCP4728_cli::allocation_successful(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
-    printf("MCP4728 # %u deferred allocation successful\r\n", me->current_dacnum);
+    me->msg_log.log("MCP4728 # %u deferred allocation successful\r\n", me->current_dacnum);
 }
 
 void rppicomidi::RP2040_MCP4728_cli::reset_complete(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
-    printf("reset complete\r\n", me->current_dacnum);
+    me->msg_log.log("MCP4728 # %u reset complete\r\n", me->current_dacnum);
 }
 
 void rppicomidi::RP2040_MCP4728_cli::seq_polling_callback(void* context, bool is_busy, bool is_powered_on)
@@ -196,7 +216,7 @@ void rppicomidi::RP2040_MCP4728_cli::seq_polling_callback(void* context, bool is
         me->dac->poll_status(seq_polling_callback, me);
     }
     else {
-        printf("MCP4728 # %u programming complete\r\n", me->current_dacnum);
+        me->msg_log.log("MCP4728 # %u programming complete\r\n", me->current_dacnum);
     }
 }
 
@@ -204,7 +224,7 @@ void rppicomidi::RP2040_MCP4728_cli::seq_write_complete(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
     me->dac->poll_status(seq_polling_callback, me);
-    printf("MCP4728 # %u registers programmed.\r\nPolling DAC EEPROM...", me->current_dacnum);
+    me->msg_log.log("MCP4728 # %u registers programmed.\r\nPolling DAC EEPROM...", me->current_dacnum);
 }
 
 void rppicomidi::RP2040_MCP4728_cli::print_multi_write_usage()
@@ -223,6 +243,8 @@ void rppicomidi::RP2040_MCP4728_cli::print_multi_write_usage()
 void rppicomidi::RP2040_MCP4728_cli::on_multi_write(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_multi_write, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
 
     // must be 6 arguments per DAC channel and no more than 4 channels
@@ -291,6 +313,8 @@ void rppicomidi::RP2040_MCP4728_cli::print_fast_write_usage()
 void rppicomidi::RP2040_MCP4728_cli::on_fast_write(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_fast_write, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     // must be 9 arguments (PD and DAC code for all 4 channels plus stop 0 or 1)
     if (argc != 9) {
@@ -339,23 +363,25 @@ void rppicomidi::RP2040_MCP4728_cli::read_callback(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
     auto rb = &me->readback_data;
-    printf("MCP4728 # %u readback data:\r\n", me->current_dacnum);
+    me->msg_log.log("MCP4728 # %u readback data:\r\n", me->current_dacnum);
     for (uint8_t chan = 0; chan < rb->nchan; chan++) {
-        printf("channel %c %s registers:\r\n", 'A'+rb->data[chan].chan, rb->data[chan].is_eeprom ? "EEPROM":"DAC Output");
-        printf("POR=%u RDY=%u \r\n", rb->data[chan].por, rb->data[chan].rdy);
-        printf("code=%u G=%u PD=%u Vref=%u\r\n", rb->data[chan].dac_code, rb->data[chan].gain, rb->data[chan].pd, rb->data[chan].vref);
+        me->msg_log.log("channel %c %s registers:\r\n", 'A'+rb->data[chan].chan, rb->data[chan].is_eeprom ? "EEPROM":"DAC Output");
+        me->msg_log.log("POR=%u RDY=%u \r\n", rb->data[chan].por, rb->data[chan].rdy);
+        me->msg_log.log("code=%u G=%u PD=%u Vref=%u\r\n", rb->data[chan].dac_code, rb->data[chan].gain, rb->data[chan].pd, rb->data[chan].vref);
     }
 }
 
 void rppicomidi::RP2040_MCP4728_cli::status_callback(void* context, bool is_busy, bool is_powered_on)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
-    printf("MCP4728 # %u is %sbusy. MCP4728 # %u is %spowered on.\r\n", me->current_dacnum, is_busy?"":"not ", me->current_dacnum, is_powered_on?"":"not ");
+    me->msg_log.log("MCP4728 # %u is %sbusy. MCP4728 # %u is %spowered on.\r\n", me->current_dacnum, is_busy?"":"not ", me->current_dacnum, is_powered_on?"":"not ");
 }
 
 void rppicomidi::RP2040_MCP4728_cli::on_read(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_read, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     // must be 1 argument (nchan, and 0<nchan<=8)
     if (argc != 1) {
@@ -380,11 +406,13 @@ void rppicomidi::RP2040_MCP4728_cli::on_read(EmbeddedCli *, char *args, void *co
 void rppicomidi::RP2040_MCP4728_cli::on_status(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_status, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 0) {
         printf("Print the Ready/Busy status and the powered-on status. usage: status");
     }
-    else if (!me->dac->poll_status(status_callback, &me->readback_data)) {
+    else if (!me->dac->poll_status(status_callback, me)) {
         printf("error starting MCP4728 # %u read\r\n", me->current_dacnum);
     }
     else {
@@ -413,6 +441,8 @@ void rppicomidi::RP2040_MCP4728_cli::print_write_eeprom_usage()
 void rppicomidi::RP2040_MCP4728_cli::on_write_eeprom(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_write_eeprom, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc < 6 || ((argc-2) %4) != 0) {
         print_write_eeprom_usage();
@@ -491,6 +521,8 @@ void rppicomidi::RP2040_MCP4728_cli::print_set_gains_usage()
 void rppicomidi::RP2040_MCP4728_cli::on_set_gains(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_set_gains, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 4) {
         print_set_gains_usage();
@@ -520,6 +552,8 @@ void rppicomidi::RP2040_MCP4728_cli::print_set_vrefs_usage()
 void rppicomidi::RP2040_MCP4728_cli::on_set_vrefs(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_set_vrefs, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 4) {
         print_set_vrefs_usage();
@@ -534,7 +568,7 @@ void rppicomidi::RP2040_MCP4728_cli::on_set_vrefs(EmbeddedCli *, char *args, voi
             }
             vrefs[idx-1] = tok[0] == '1';
         }
-        if (!me->dac->set_all_vrefs(vrefs[0], vrefs[1], vrefs[2], vrefs[3], write_complete, nullptr)) {
+        if (!me->dac->set_all_vrefs(vrefs[0], vrefs[1], vrefs[2], vrefs[3], write_complete, me)) {
             printf("error writing to MCP4728 # %u\r\n", me->current_dacnum);
         }
     }
@@ -552,6 +586,8 @@ void rppicomidi::RP2040_MCP4728_cli::print_set_pds_usage()
 void rppicomidi::RP2040_MCP4728_cli::on_set_pds(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_set_pds, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 4) {
         print_set_pds_usage();
@@ -575,6 +611,8 @@ void rppicomidi::RP2040_MCP4728_cli::on_set_pds(EmbeddedCli *, char *args, void
 void rppicomidi::RP2040_MCP4728_cli::on_reset(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_reset, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 0) {
         printf("usage: dac-reset\r\n");
@@ -589,6 +627,8 @@ void rppicomidi::RP2040_MCP4728_cli::on_reset(EmbeddedCli *, char *args, void *c
 void rppicomidi::RP2040_MCP4728_cli::on_wakeup(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_wakeup, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 0) {
         printf("usage: dac-wakeup\r\n");
@@ -603,6 +643,8 @@ void rppicomidi::RP2040_MCP4728_cli::on_wakeup(EmbeddedCli *, char *args, void *
 void rppicomidi::RP2040_MCP4728_cli::on_update(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_update, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 0) {
         printf("usage: dac-update\r\n");
@@ -625,26 +667,28 @@ void rppicomidi::RP2040_MCP4728_cli::assign_next_bus()
     dac = dac_list + next_dacnum;
     int result = dac->request_bus(allocation_successful, this);
     if (result == -1) {
-        printf("bus allocation problem\r\n");
+        msg_log.log("bus allocation problem\r\n");
     }
     else if (result == 0) {
-        printf("bus allocation deferred until other device releases the bus\r\n");
+        msg_log.log("bus allocation deferred until other device releases the bus\r\n");
     }
     else {
-        printf("MCP4728 # %u is currently accessible on the I2C bus at address 0x%02x\r\n", current_dacnum, dac->get_addr());
+        msg_log.log("MCP4728 # %u is currently accessible on the I2C bus at address 0x%02x\r\n", current_dacnum, dac->get_addr());
     }
 }
 
 void rppicomidi::RP2040_MCP4728_cli::release_bus_callback(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
-    printf("bus released\r\n");
+    me->msg_log.log("bus released\r\n");
     me->assign_next_bus();
 }
 
 void rppicomidi::RP2040_MCP4728_cli::on_select_dac(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_select_dac, args))
+        return;
     if (me->ndacs == 1) {
         printf("There is only one MCP4728 chip on this I2C bus. Nothing to select.\r\n");
         return;
@@ -682,6 +726,8 @@ void rppicomidi::RP2040_MCP4728_cli::on_select_dac(EmbeddedCli *, char *args, vo
 void rppicomidi::RP2040_MCP4728_cli::on_set_ldac(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_set_ldac, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 1) {
         printf("usage: set-ldac 0|1\r\n");
@@ -696,9 +742,35 @@ void rppicomidi::RP2040_MCP4728_cli::on_set_ldac(EmbeddedCli *, char *args, void
     }
 }
 
+void rppicomidi::RP2040_MCP4728_cli::read_addr_callback(void* context, bool success, uint8_t read_addr)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (!success) {
+        me->msg_log.log("problem reading address bits from DAC\r\n");
+    }
+    else {
+        me->msg_log.log("MCP4728 # %u raw value read =0x%02x\r\n", me->current_dacnum, read_addr);
+        me->msg_log.log("I2C address in EEPROM=%02x in input register=%02x\r\n",
+            0x60|(((read_addr)>>5) & 0x7), 0x60|(((read_addr)>>1) & 0x7));
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_cli::write_addr_callback(void* context, bool success, uint8_t)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (!success) {
+        me->msg_log.log("problem writing address bits to MCP4728 # %u\r\n", me->current_dacnum);
+    }
+    else {
+        me->msg_log.log("new EEPROM address 0x%02x written to MCP4728 # %u\r\n", me->dac->get_addr(), me->current_dacnum);
+    }
+}
+
 void rppicomidi::RP2040_MCP4728_cli::on_read_i2c_addr(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_read_i2c_addr, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 0) {
         printf("usage: dac-read-addr\r\n");
@@ -707,21 +779,17 @@ void rppicomidi::RP2040_MCP4728_cli::on_read_i2c_addr(EmbeddedCli *, char *args,
         printf("error: no LDAC pin is defined for MCP4728 # %u\r\n", me->current_dacnum);
     }
     else {
-        uint8_t read_addr;
-        if (!me->dac->access_addr_bits(0, read_addr)) {
+        if (!me->dac->access_addr_bits_async(0, read_addr_callback, me)) {
             printf("problem reading address bits from DAC\r\n");
         }
-        else {
-            printf("MCP4728 # %u raw value read =0x%02x\r\n", me->current_dacnum, read_addr);
-            printf("I2C address in EEPROM=%02x in input register=%02x\r\n",
-                0x60|(((read_addr)>>5) & 0x7), 0x60|(((read_addr)>>1) & 0x7));
-        }
     }
 }
 
 void rppicomidi::RP2040_MCP4728_cli::on_write_i2c_addr(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_write_i2c_addr, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 1) {
         printf("usage: dac-write-addr [0x60-0x67]\r\n");
@@ -732,13 +800,9 @@ void rppicomidi::RP2040_MCP4728_cli::on_write_i2c_addr(EmbeddedCli *, char *args
     else {
         uint8_t new_addr = strtol(embeddedCliGetToken(args, 1), nullptr, 16);
         if (new_addr >= 0x60 && new_addr <= 0x67) {
-            uint8_t dummy;
-            if (!me->dac->access_addr_bits(new_addr, dummy)) {
+            if (!me->dac->access_addr_bits_async(new_addr, write_addr_callback, me)) {
                 printf("problem writing address bits to MCP4728 # %u\r\n", me->current_dacnum);
             }
-            else {
-                printf("new EEPROM address 0x%02x written to MCP4728 # %u\r\n", new_addr, me->current_dacnum);
-            }
         }
         else {
             printf("usage: dac-write-addr [0x60-0x67]\r\n");
@@ -750,7 +814,7 @@ void rppicomidi::RP2040_MCP4728_cli::save_cmd_read_callback(void* context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
     rppicomidi::mcp4728_channel_data data[4];
-    printf("Read of MCP4728 # %u complete. Starting EEPROM write\r\n", me->current_dacnum);
+    me->msg_log.log("Read of MCP4728 # %u complete. Starting EEPROM write\r\n", me->current_dacnum);
     for (uint8_t chan = 0; chan < 4; chan++) {
         data[chan].chan = me->readback_data.data[chan*2].chan;
         data[chan].dac_code = me->readback_data.data[chan*2].dac_code;
@@ -761,13 +825,15 @@ void rppicomidi::RP2040_MCP4728_cli::save_cmd_read_callback(void* context)
     }
 
     if (!me->dac->sequential_write_eeprom(data, 4, write_complete, context)) {
-        printf("error writing to MCP4728 # %u\r\n", me->current_dacnum);
+        me->msg_log.log("error writing to MCP4728 # %u\r\n", me->current_dacnum);
     }
 }
 
 void rppicomidi::RP2040_MCP4728_cli::on_save(EmbeddedCli *, char *args, void *context)
 {
     auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_save, args))
+        return;
     uint16_t argc = embeddedCliGetTokenCount(args);
     if (argc != 0) {
         printf("usage: dac-save\r\n");
@@ -781,3 +847,477 @@ void rppicomidi::RP2040_MCP4728_cli::on_save(EmbeddedCli *, char *args, void *co
         }
     }
 }
+
+const rppicomidi::RP2040_MCP4728_cli::command_entry rppicomidi::RP2040_MCP4728_cli::commands[] = {
+    {"dac-multi-write", on_multi_write, true},
+    {"dac-fast-write", on_fast_write, true},
+    {"dac-read", on_read, false},
+    {"dac-status", on_status, false},
+    {"dac-write-eeprom", on_write_eeprom, true},
+    {"dac-save", on_save, false},
+    {"dac-set-gains", on_set_gains, true},
+    {"dac-set-vrefs", on_set_vrefs, true},
+    {"dac-set-pds", on_set_pds, true},
+    {"dac-reset", on_reset, true},
+    {"dac-wakeup", on_wakeup, true},
+    {"dac-update", on_update, true},
+    {"dac-select", on_select_dac, false},
+    {"dac-set-ldac", on_set_ldac, false},
+    {"dac-read-addr", on_read_i2c_addr, false},
+    {"dac-write-addr", on_write_i2c_addr, false},
+    {"dac-bench", on_bench, false},
+};
+
+const uint8_t rppicomidi::RP2040_MCP4728_cli::num_commands = sizeof(commands) / sizeof(commands[0]);
+
+bool rppicomidi::RP2040_MCP4728_cli::batch_record(command_handler handler, char* args)
+{
+    if (!batch.recording)
+        return false;
+    uint8_t command = 0;
+    while (command < num_commands && commands[command].handler != handler)
+        command++;
+    assert(command < num_commands);
+    // Copy the arguments in tokenized form: each token is followed by a 0 and the
+    // last token is followed by an extra 0.
+    uint16_t argc = embeddedCliGetTokenCount(args);
+    uint16_t nbytes = argc == 0 ? 2 : 1;
+    for (uint16_t idx = 1; idx <= argc; idx++)
+        nbytes += strlen(embeddedCliGetToken(args, idx)) + 1;
+    if (batch.nsteps >= RP2040_MCP4728_CLI_BATCH_MAX_STEPS || batch.buffer_used + nbytes > RP2040_MCP4728_CLI_BATCH_BUFFER_SIZE) {
+        printf("dac-batch script is full; %s not recorded\r\n", commands[command].name);
+        return true;
+    }
+    auto& step = batch.steps[batch.nsteps++];
+    step.command = command;
+    step.args = batch.buffer_used;
+    char* ptr = batch.buffer + batch.buffer_used;
+    for (uint16_t idx = 1; idx <= argc; idx++) {
+        const char* tok = embeddedCliGetToken(args, idx);
+        size_t len = strlen(tok) + 1;
+        memcpy(ptr, tok, len);
+        ptr += len;
+    }
+    *ptr++ = '\0';
+    if (argc == 0)
+        *ptr++ = '\0';
+    batch.buffer_used += nbytes;
+    printf("%u: %s\r\n", batch.nsteps, commands[command].name);
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_cli::print_batch_usage()
+{
+    printf("usage:\r\n\tdac-batch begin|end|run|abort|loop count|delay ms\r\n\r\n");
+    printf("begin starts recording a new script. Until end, dac- commands are added to the\r\n");
+    printf("script instead of being run.\r\n");
+    printf("loop count runs the whole script count times (default 1)\r\n");
+    printf("delay ms adds a pause of ms milliseconds to the script\r\n");
+    printf("end stops recording and runs the script. Write commands are queued back-to-back\r\n");
+    printf("while the chip has free operation records; reads, delays and the other commands\r\n");
+    printf("wait for the writes before them to finish. When the script is done, the time each\r\n");
+    printf("step took is printed.\r\n");
+    printf("run runs the last script again; abort stops a running script\r\n");
+    printf("example: 100 ramp steps on channel A, 2ms apart\r\n");
+    printf("\tdac-batch begin\r\n\tdac-batch loop 100\r\n\tdac-fast-write 0 1000 0 0 0 0 0 0 1\r\n");
+    printf("\tdac-batch delay 1\r\n\tdac-fast-write 0 3000 0 0 0 0 0 0 1\r\n\tdac-batch delay 1\r\n\tdac-batch end\r\n");
+}
+
+void rppicomidi::RP2040_MCP4728_cli::on_batch(EmbeddedCli *, char *args, void *context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    auto& batch = me->batch;
+    uint16_t argc = embeddedCliGetTokenCount(args);
+    const char* subcmd = argc > 0 ? embeddedCliGetToken(args, 1) : "";
+    if (argc == 1 && strcmp(subcmd, "begin") == 0) {
+        if (batch.running) {
+            printf("a dac-batch script is running; use dac-batch abort first\r\n");
+            return;
+        }
+        batch.nsteps = 0;
+        batch.buffer_used = 0;
+        batch.loops = 1;
+        batch.recording = true;
+        printf("recording dac-batch script; type dac-batch end to run it\r\n");
+    }
+    else if (argc == 1 && (strcmp(subcmd, "end") == 0 || strcmp(subcmd, "run") == 0)) {
+        batch.recording = false;
+        if (batch.running)
+            printf("a dac-batch script is already running\r\n");
+        else if (batch.nsteps == 0)
+            printf("the dac-batch script is empty\r\n");
+        else
+            me->batch_start();
+    }
+    else if (argc == 1 && strcmp(subcmd, "abort") == 0) {
+        batch.recording = false;
+        if (batch.running) {
+            batch.running = false;
+            printf("dac-batch aborted in loop %lu step %u\r\n", batch.loop + 1, batch.step + 1);
+        }
+    }
+    else if (argc == 2 && strcmp(subcmd, "loop") == 0 && batch.recording) {
+        batch.loops = strtoul(embeddedCliGetToken(args, 2), nullptr, 10);
+        if (batch.loops == 0)
+            batch.loops = 1;
+    }
+    else if (argc == 2 && strcmp(subcmd, "delay") == 0 && batch.recording) {
+        if (batch.nsteps >= RP2040_MCP4728_CLI_BATCH_MAX_STEPS) {
+            printf("dac-batch script is full; delay not recorded\r\n");
+            return;
+        }
+        auto& step = batch.steps[batch.nsteps++];
+        step.command = delay_step;
+        step.delay_ms = strtoul(embeddedCliGetToken(args, 2), nullptr, 10);
+        printf("%u: delay %lu ms\r\n", batch.nsteps, step.delay_ms);
+    }
+    else {
+        print_batch_usage();
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_cli::batch_start()
+{
+    for (uint8_t idx = 0; idx < batch.nsteps; idx++) {
+        batch.steps[idx].total_us = 0;
+        batch.steps[idx].max_us = 0;
+    }
+    batch.step = 0;
+    batch.loop = 0;
+    batch.step_active = false;
+    batch.running = true;
+    batch.start_us = time_us_64();
+}
+
+bool rppicomidi::RP2040_MCP4728_cli::is_idle()
+{
+    return !bench.running && current_dacnum == next_dacnum && !dac->has_pending_ops() && !dac->is_addr_access_busy();
+}
+
+void rppicomidi::RP2040_MCP4728_cli::batch_report()
+{
+    uint64_t total_us = time_us_64() - batch.start_us;
+    printf("dac-batch done: %lu loop(s) of %u step(s) in %llu us\r\n", batch.loops, batch.nsteps, total_us);
+    for (uint8_t idx = 0; idx < batch.nsteps; idx++) {
+        auto& step = batch.steps[idx];
+        const char* name = step.command == delay_step ? "delay" : commands[step.command].name;
+        printf("%2u: %-16s avg %8lu us max %8lu us\r\n", idx + 1, name, step.total_us / batch.loops, step.max_us);
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_cli::task()
+{
+    if (bench.running) {
+        // any chip in the chip set may have callbacks to deliver
+        for (uint8_t idx = 0; idx < ndacs; idx++) {
+            uint32_t completed = bench.completed;
+            uint64_t start = time_us_64();
+            dac_list[idx].task();
+            if (bench.completed != completed) {
+                uint32_t elapsed = time_us_64() - start;
+                if (bench.task_calls++ == 0 || elapsed < bench.task_min_us)
+                    bench.task_min_us = elapsed;
+                if (elapsed > bench.task_max_us)
+                    bench.task_max_us = elapsed;
+                bench.task_total_us += elapsed;
+            }
+        }
+        bench_step();
+    }
+    else {
+        dac->task();
+    }
+    batch_task();
+    msg_log.drain(RP2040_MCP4728_CLI_LOG_DRAIN);
+}
+
+void rppicomidi::RP2040_MCP4728_cli::batch_task()
+{
+    if (!batch.running)
+        return;
+    uint64_t now = time_us_64();
+    if (batch.step_active) {
+        auto& step = batch.steps[batch.step];
+        if (!batch.step_issued) {
+            // Delays, reads, chip selection and address access wait for
+            // the writes before them to finish
+            if (!is_idle())
+                return;
+            batch.step_issued = true;
+            batch.step_start_us = now;
+            if (step.command != delay_step)
+                commands[step.command].handler(cli, batch.buffer + step.args, this);
+            return;
+        }
+        bool last = batch.step + 1 == batch.nsteps && batch.loop + 1 == batch.loops;
+        if (step.command == delay_step) {
+            if (now - batch.step_start_us < (uint64_t)step.delay_ms * 1000)
+                return;
+        }
+        else if (commands[step.command].is_write && !last) {
+            // The next step may start as soon as there is an operation record for it
+            if (!dac->has_free_op())
+                return;
+        }
+        else if (!is_idle()) {
+            return;
+        }
+        uint32_t elapsed = now - batch.step_start_us;
+        step.total_us += elapsed;
+        if (elapsed > step.max_us)
+            step.max_us = elapsed;
+        batch.step_active = false;
+        if (++batch.step == batch.nsteps) {
+            batch.step = 0;
+            if (++batch.loop == batch.loops) {
+                batch.running = false;
+                batch_report();
+                return;
+            }
+        }
+    }
+    // Start the next step. A write step is queued right away, behind any writes
+    // still in flight; every other step waits for them first.
+    auto& step = batch.steps[batch.step];
+    batch.step_start_us = now;
+    batch.step_active = true;
+    batch.step_issued = step.command != delay_step && commands[step.command].is_write && dac->has_free_op();
+    if (batch.step_issued)
+        commands[step.command].handler(cli, batch.buffer + step.args, this);
+}
+
+void rppicomidi::RP2040_MCP4728_cli::print_bench_usage()
+{
+    printf("usage:\r\n\tdac-bench fast|multi|read|eeprom nchan iterations [dacnum ...]\r\n\r\n");
+    printf("fast runs fast_write, multi runs multi_write, read runs read_channels and\r\n");
+    printf("eeprom runs sequential_write_eeprom then polls until the EEPROM write is done\r\n");
+    printf("nchan is the number of channels per operation, 1-4\r\n");
+    printf("iterations is the number of operations to run\r\n");
+    printf("dacnum ... is the chip set; the operations go round robin to these chips and\r\n");
+    printf("the chips take turns with the bus. The default is the currently selected chip\r\n");
+    printf("example: dac-bench fast 4 10000 0 1\r\n");
+}
+
+void rppicomidi::RP2040_MCP4728_cli::on_bench(EmbeddedCli *, char *args, void *context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (me->batch_record(on_bench, args))
+        return;
+    auto& bench = me->bench;
+    if (bench.running) {
+        printf("dac-bench is already running\r\n");
+        return;
+    }
+    uint16_t argc = embeddedCliGetTokenCount(args);
+    if (argc < 3 || argc > 3 + sizeof(bench.chips)) {
+        print_bench_usage();
+        return;
+    }
+    const char* opname = embeddedCliGetToken(args, 1);
+    if (strcmp(opname, "fast") == 0)
+        bench.op = bench_fast_write;
+    else if (strcmp(opname, "multi") == 0)
+        bench.op = bench_multi_write;
+    else if (strcmp(opname, "read") == 0)
+        bench.op = bench_read;
+    else if (strcmp(opname, "eeprom") == 0)
+        bench.op = bench_eeprom_write;
+    else {
+        print_bench_usage();
+        return;
+    }
+    int nchan = atoi(embeddedCliGetToken(args, 2));
+    long iterations = atol(embeddedCliGetToken(args, 3));
+    if (nchan < 1 || nchan > 4 || iterations < 1) {
+        print_bench_usage();
+        return;
+    }
+    bench.nchips = 0;
+    for (uint16_t idx = 4; idx <= argc; idx++) {
+        int dacnum = atoi(embeddedCliGetToken(args, idx));
+        if (dacnum < 0 || dacnum >= me->ndacs) {
+            print_on_select_dac_usage(me);
+            return;
+        }
+        bench.chips[bench.nchips++] = dacnum;
+    }
+    if (me->current_dacnum != me->next_dacnum) {
+        printf("wait for dac-select to finish\r\n");
+        return;
+    }
+    if (bench.nchips == 0)
+        bench.chips[bench.nchips++] = me->current_dacnum;
+    bench.nchan = nchan;
+    bench.iterations = iterations;
+    bench.owner = me->current_dacnum;
+    bench.submitted = 0;
+    bench.completed = 0;
+    bench.bus_pending = false;
+    bench.eeprom_polling = false;
+    bench.restoring = false;
+    bench.min_us = 0;
+    bench.max_us = 0;
+    bench.total_us = 0;
+    memset(bench.histogram, 0, sizeof(bench.histogram));
+    bench.task_calls = 0;
+    bench.task_min_us = 0;
+    bench.task_max_us = 0;
+    bench.task_total_us = 0;
+    bench.elapsed_us = 0;
+    bench.running = true;
+    bench.start_us = time_us_64();
+}
+
+void rppicomidi::RP2040_MCP4728_cli::bench_callback(void* context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    auto& bench = me->bench;
+    uint64_t now = time_us_64();
+    // operations complete in the order they were submitted
+    uint32_t latency = now - bench.submit_us[bench.completed % RP2040_MCP4728_MAX_PENDING_OPS];
+    if (bench.completed == 0 || latency < bench.min_us)
+        bench.min_us = latency;
+    if (latency > bench.max_us)
+        bench.max_us = latency;
+    bench.total_us += latency;
+    ++bench.histogram[bench_bucket(latency)];
+    if (++bench.completed == bench.iterations)
+        bench.elapsed_us = now - bench.start_us;
+    if (bench.op == bench_eeprom_write)
+        bench.eeprom_polling = true;
+}
+
+void rppicomidi::RP2040_MCP4728_cli::bench_status_callback(void* context, bool is_busy, bool)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    if (!is_busy)
+        me->bench.eeprom_polling = false;
+}
+
+void rppicomidi::RP2040_MCP4728_cli::bench_bus_callback(void* context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_cli*>(context);
+    me->bench.bus_pending = false;
+}
+
+uint8_t rppicomidi::RP2040_MCP4728_cli::bench_bucket(uint32_t us)
+{
+    if (us < 8)
+        return us;
+    uint8_t msb = 31 - __builtin_clz(us);
+    return msb * 4 + ((us >> (msb - 2)) & 3);
+}
+
+uint32_t rppicomidi::RP2040_MCP4728_cli::bench_bucket_max(uint8_t idx)
+{
+    if (idx < 8)
+        return idx;
+    uint8_t msb = idx / 4;
+    return ((uint32_t)(4 + (idx & 3) + 1) << (msb - 2)) - 1;
+}
+
+bool rppicomidi::RP2040_MCP4728_cli::bench_handoff(uint8_t next)
+{
+    if (bench.owner == next)
+        return !bench.bus_pending;
+    auto& owner_dac = dac_list[bench.owner];
+    // releasing the bus would be deferred until the operations are done; wait for them here
+    if (owner_dac.has_pending_ops() || owner_dac.is_addr_access_busy())
+        return false;
+    owner_dac.release_bus(nullptr, nullptr);
+    bench.owner = next;
+    int result = dac_list[next].request_bus(bench_bus_callback, this);
+    if (result == 0) {
+        bench.bus_pending = true;
+        return false;
+    }
+    if (result == -1) {
+        printf("dac-bench: MCP4728 # %u bus allocation problem\r\n", next);
+        bench.running = false;
+        return false;
+    }
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_cli::bench_step()
+{
+    if (bench.bus_pending)
+        return;
+    auto& owner_dac = dac_list[bench.owner];
+    if (bench.eeprom_polling) {
+        if (!owner_dac.has_pending_ops())
+            owner_dac.poll_status(bench_status_callback, this);
+        return;
+    }
+    if (bench.completed == bench.iterations) {
+        // give the bus back to the selected chip before reporting
+        if (bench_handoff(current_dacnum)) {
+            bench.running = false;
+            bench_report();
+        }
+        return;
+    }
+    uint32_t max_in_flight = bench.op == bench_eeprom_write ? 1 : RP2040_MCP4728_MAX_PENDING_OPS;
+    while (bench.submitted < bench.iterations && bench.submitted - bench.completed < max_in_flight) {
+        if (!bench_handoff(bench.chips[bench.submitted % bench.nchips]))
+            return;
+        auto& bench_dac = dac_list[bench.owner];
+        uint16_t code = (bench.submitted * 64) & 0xFFF;
+        mcp4728_channel_data chan_dat[4];
+        for (uint8_t chan = 0; chan < bench.nchan; chan++) {
+            chan_dat[chan].chan = chan;
+            chan_dat[chan].vref = 0;
+            chan_dat[chan].pd = 0;
+            chan_dat[chan].gain = 0;
+            chan_dat[chan].udac = 0;
+            chan_dat[chan].dac_code = code;
+        }
+        uint16_t codes[4] = {code, code, code, code};
+        uint64_t now = time_us_64();
+        bool ok = false;
+        switch(bench.op) {
+        case bench_fast_write:
+            ok = bench_dac.fast_write(codes, bench.nchan, true, bench_callback, this);
+            break;
+        case bench_multi_write:
+            ok = bench_dac.multi_write(chan_dat, bench.nchan, bench_callback, this);
+            break;
+        case bench_read:
+            ok = bench_dac.read_channels(bench.read_data, bench.nchan, bench_callback, this);
+            break;
+        case bench_eeprom_write:
+            ok = bench_dac.sequential_write_eeprom(chan_dat, bench.nchan, bench_callback, this);
+            break;
+        }
+        if (!ok)
+            return; // all operation records are in use; try again on the next task() call
+        bench.submit_us[bench.submitted++ % RP2040_MCP4728_MAX_PENDING_OPS] = now;
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_cli::bench_report()
+{
+    static const char* op_names[] = {"fast_write", "multi_write", "read_channels", "seq_write_eeprom"};
+    uint32_t completed = bench.completed;
+    float rate = bench.elapsed_us ? (float)completed * bench.nchan * 1e6f / bench.elapsed_us : 0;
+    printf("dac-bench %s chips=%u chans=%u: %lu operations in %llu us, %.0f updates/s\r\n",
+        op_names[bench.op], bench.nchips, bench.nchan, completed, bench.elapsed_us, rate);
+    // the 99th percentile is the upper edge of the bucket that holds it, but no more than the maximum
+    uint32_t target = completed - completed / 100;
+    uint32_t count = 0;
+    uint32_t p99 = bench.max_us;
+    for (uint8_t idx = 0; idx < bench_histogram_size; idx++) {
+        count += bench.histogram[idx];
+        if (count >= target) {
+            if (bench_bucket_max(idx) < p99)
+                p99 = bench_bucket_max(idx);
+            break;
+        }
+    }
+    printf("submit to callback latency: min %lu us avg %lu us p99 %lu us max %lu us\r\n",
+        bench.min_us, (uint32_t)(bench.total_us / completed), p99, bench.max_us);
+    if (bench.task_calls != 0) {
+        printf("task() callback delivery: min %lu us avg %lu us max %lu us over %lu calls\r\n",
+            bench.task_min_us, (uint32_t)(bench.task_total_us / bench.task_calls), bench.task_max_us, bench.task_calls);
+    }
+}
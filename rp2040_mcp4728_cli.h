@@ -36,6 +36,22 @@
 #include <cstdint>
 #include "embedded_cli.h"
 #include "rp2040_mcp4728_lib.h"
+#include "rp2040_mcp4728_log.h"
+#if !RP2040_MCP4728_ENABLE_EEPROM || !RP2040_MCP4728_ENABLE_GENERAL_CALL || !RP2040_MCP4728_ENABLE_READ || !RP2040_MCP4728_ENABLE_ADDR_BITS
+#error "rp2040_mcp4728_cli_lib requires all RP2040_MCP4728_ENABLE_ features"
+#endif
+#ifndef RP2040_MCP4728_CLI_LOG_DRAIN
+// The most callback messages task() prints per call
+#define RP2040_MCP4728_CLI_LOG_DRAIN 2
+#endif
+#ifndef RP2040_MCP4728_CLI_BATCH_MAX_STEPS
+// The maximum number of commands and delays in a dac-batch script
+#define RP2040_MCP4728_CLI_BATCH_MAX_STEPS 32
+#endif
+#ifndef RP2040_MCP4728_CLI_BATCH_BUFFER_SIZE
+// The number of bytes for the arguments of all commands in a dac-batch script
+#define RP2040_MCP4728_CLI_BATCH_BUFFER_SIZE 512
+#endif
 namespace rppicomidi
 {
 class RP2040_MCP4728_cli
@@ -43,8 +59,22 @@ class RP2040_MCP4728_cli
 public:
     RP2040_MCP4728_cli(EmbeddedCli* cli_, RP2040_MCP4728* dac_list_, const uint8_t ndacs_, uint8_t first_dacnum);
     ~RP2040_MCP4728_cli()=default;
-    static const uint16_t get_num_commands() { return 16; }
+    static const uint16_t get_num_commands() { return 18; }
     RP2040_MCP4728* get_current_dac() {return dac;}
+    /**
+     * @brief
+     *
+     * @return the log that holds the messages of the MCP4728 callbacks until task() prints them
+     */
+    RP2040_MCP4728_log& get_log() {return msg_log;}
+
+    /**
+     * @brief call the current DAC's task() function, start the next dac-batch
+     * script step when the chip can take it, keep a dac-bench
+     * measurement going and print a few logged callback messages.
+     * Call this periodically.
+     */
+    void task();
 protected:
     // MCP4728 callbacks
     static void write_complete(void*);
@@ -56,6 +86,11 @@ protected:
     static void status_callback(void*, bool is_busy, bool is_powered_on);
     static void save_cmd_read_callback(void* context);
     static void release_bus_callback(void*);
+    static void read_addr_callback(void* context, bool success, uint8_t read_addr);
+    static void write_addr_callback(void* context, bool success, uint8_t read_addr);
+    static void bench_callback(void* context);
+    static void bench_status_callback(void* context, bool is_busy, bool is_powered_on);
+    static void bench_bus_callback(void* context);
     // CLI callbacks
     static void on_multi_write(EmbeddedCli *, char *args, void *context);
     static void on_fast_write(EmbeddedCli *, char *args, void *context);
@@ -74,6 +109,8 @@ protected:
     static void on_save(EmbeddedCli *, char *args, void *context);
     // ndacs must be greater than 1 for this command to be added to the CLI
     static void on_select_dac(EmbeddedCli *, char *args, void *context);
+    static void on_batch(EmbeddedCli *, char *args, void *context);
+    static void on_bench(EmbeddedCli *, char *args, void *context);
 
     // CLI helper functions
     static void print_multi_write_usage();
@@ -84,7 +121,121 @@ protected:
     static void print_set_vrefs_usage();
     static void print_set_pds_usage();
     static void print_on_select_dac_usage(RP2040_MCP4728_cli* context);
+    static void print_batch_usage();
+    static void print_bench_usage();
     void assign_next_bus();
+
+    // dac-batch support
+    typedef void (*command_handler)(EmbeddedCli *, char *args, void *context);
+    struct command_entry {
+        const char* name;
+        command_handler handler;
+        bool is_write;  // the command only queues one write, so dac-batch does not wait for it to finish
+    };
+    static const command_entry commands[];
+    static const uint8_t num_commands;
+    static const uint8_t delay_step = 0xFF; // the command index of a delay step
+
+    /**
+     * @brief if a dac-batch script is being recorded, add a command to it
+     *
+     * @return true if the command was recorded instead of run
+     * @param handler the command handler function
+     * @param args the command's tokenized arguments
+     */
+    bool batch_record(command_handler handler, char* args);
+    void batch_start();
+    void batch_task();
+    void batch_report();
+    /**
+     * @brief
+     *
+     * @return true if the current DAC has finished everything the last command started
+     */
+    bool is_idle();
+    struct batch_step {
+        uint8_t command;    // index into commands[] or delay_step
+        uint16_t args;      // offset of the tokenized arguments in buffer; unused for delay steps
+        uint32_t delay_ms;  // for delay steps only
+        uint32_t total_us;  // the time spent in this step over all loops
+        uint32_t max_us;
+    };
+    struct {
+        batch_step steps[RP2040_MCP4728_CLI_BATCH_MAX_STEPS];
+        char buffer[RP2040_MCP4728_CLI_BATCH_BUFFER_SIZE];
+        uint16_t buffer_used;
+        uint8_t nsteps;
+        uint32_t loops;
+        bool recording;
+        bool running;
+        bool step_active;
+        bool step_issued;   // false while the step waits for the writes before it to finish
+        uint8_t step;
+        uint32_t loop;
+        uint64_t start_us;
+        uint64_t step_start_us;
+    } batch;
+
+    // dac-bench support
+    enum bench_op {
+        bench_fast_write,
+        bench_multi_write,
+        bench_read,
+        bench_eeprom_write,
+    };
+    static const uint8_t bench_histogram_size = 128;
+    /**
+     * @brief
+     *
+     * @return the index of the latency histogram bucket for a time in microseconds.
+     * Buckets are 1/4 of a power of 2 wide, so the percentile error is less than 25%
+     */
+    static uint8_t bench_bucket(uint32_t us);
+    /**
+     * @brief
+     *
+     * @return the largest time in microseconds that falls into bucket idx
+     */
+    static uint32_t bench_bucket_max(uint8_t idx);
+    /**
+     * @brief submit as many benchmark operations as the chip that has the bus
+     * can queue, handing the bus to the next chip in the chip set as needed
+     */
+    void bench_step();
+    /**
+     * @brief give the bus to the chip dac_list[next] when the chip that has it is done
+     *
+     * @return true if dac_list[next] has the bus
+     */
+    bool bench_handoff(uint8_t next);
+    void bench_report();
+    struct {
+        bench_op op;
+        uint8_t nchan;
+        uint8_t chips[8];           // the chip set, as indices into dac_list
+        uint8_t nchips;
+        uint8_t owner;              // the index in dac_list of the chip that has the bus
+        uint32_t iterations;
+        uint32_t submitted;
+        uint32_t completed;
+        bool running;
+        bool bus_pending;           // waiting for a chip to get the bus
+        bool eeprom_polling;        // waiting for the EEPROM write to finish
+        bool restoring;             // returning the bus to the selected chip
+        uint64_t submit_us[RP2040_MCP4728_MAX_PENDING_OPS]; // submit times of the operations in flight
+        uint64_t start_us;
+        uint64_t elapsed_us;
+        uint32_t min_us;
+        uint32_t max_us;
+        uint64_t total_us;
+        uint32_t histogram[bench_histogram_size];
+        uint32_t task_calls;        // the number of task() calls that delivered at least one callback
+        uint32_t task_min_us;
+        uint32_t task_max_us;
+        uint64_t task_total_us;
+        mcp4728_channel_read_data read_data[4];
+    } bench;
+    RP2040_MCP4728_log msg_log;
     EmbeddedCli* cli;
     RP2040_MCP4728* dac_list;
     uint8_t ndacs;
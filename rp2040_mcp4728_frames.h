@@ -0,0 +1,222 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * MCP4728 command encoders. Every function here is constexpr, so frames for
+ * fixed presets or calibration patterns can be built by the compiler and
+ * stored in flash as std::array objects, then sent with
+ * RP2040_MCP4728::write_frame(). The RP2040_MCP4728 class uses the same
+ * per-command encoders at run time, so a frame built here is bit identical
+ * to the bytes the equivalent RP2040_MCP4728 function sends.
+ *
+ * This file does not depend on the Pico SDK.
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+namespace rppicomidi
+{
+struct mcp4728_channel_data
+{
+    uint8_t chan;       // the DAC channel 0-3=>A-D
+    uint8_t udac;       // 0 to update DAC channel after input register is written; 1 updates the input register only
+    uint8_t vref;       // 0 Vref=VDD. 1 Vref=2.048V
+    uint8_t pd;         // 0b00 Power On. 0b01 Vout loaded 1K to ground. 0b10 Vout loaded 100K to ground. 0b10 Vout loaded 500k to ground
+    uint8_t gain;       // 0 gain=1. 1 gain=2.
+    uint16_t dac_code;  // 12-bit DAC output value 0-4095
+};
+
+namespace mcp4728_encode
+{
+/**
+ * @brief encode the Vref, PD, gain and upper 4 DAC code bits byte that multi write
+ * and sequential write commands use
+ */
+constexpr uint8_t config_byte(const mcp4728_channel_data& cd)
+{
+    return static_cast<uint8_t>((cd.vref << 7) | (cd.pd << 5) | (cd.gain << 4) | ((cd.dac_code >> 8) & 0xF));
+}
+
+/**
+ * @brief encode one channel of a fast write command
+ *
+ * @param code the 12-bit DAC code with the power-down code in bits 13:12
+ * @param frame points to 2 bytes that receive the encoded channel
+ */
+constexpr void fast_write_channel(uint16_t code, uint8_t* frame)
+{
+    frame[0] = (code >> 8) & 0x3F;
+    frame[1] = code & 0xFF;
+}
+
+/**
+ * @brief encode one channel of a multi write command
+ *
+ * @param frame points to 3 bytes that receive the encoded channel
+ */
+constexpr void multi_write_channel(const mcp4728_channel_data& cd, uint8_t* frame)
+{
+    frame[0] = static_cast<uint8_t>(0x40 | (cd.chan << 1) | cd.udac);
+    frame[1] = config_byte(cd);
+    frame[2] = cd.dac_code & 0xFF;
+}
+
+/**
+ * @brief encode a sequential write (nchan > 1) or single write (nchan == 1) to
+ * DAC and EEPROM command. See RP2040_MCP4728::sequential_write_eeprom().
+ *
+ * @param chan_dat the channel data
+ * @param nchan the number of channels 1-4
+ * @param frame points to 2*nchan+1 bytes that receive the encoded command
+ */
+constexpr void seq_write_eeprom(const mcp4728_channel_data* chan_dat, uint8_t nchan, uint8_t* frame)
+{
+    if (nchan == 1) {
+        frame[0] = static_cast<uint8_t>(0x58 | (chan_dat[0].chan << 1) | chan_dat[0].udac);
+    }
+    else {
+        // channels A-D correspond to channel bitfield values 0x0-0x3.
+        frame[0] = static_cast<uint8_t>(0x50 | ((4 - nchan) << 1) | chan_dat[0].udac);
+    }
+    for (uint8_t chan = 0; chan < nchan; chan++) {
+        frame[chan*2+1] = config_byte(chan_dat[chan]);
+        frame[chan*2+2] = chan_dat[chan].dac_code & 0xFF;
+    }
+}
+
+/**
+ * @brief encode the write gain select bits command
+ */
+constexpr uint8_t gains(bool gainA, bool gainB, bool gainC, bool gainD)
+{
+    return static_cast<uint8_t>(0xC0 | (gainA?0x8:0)|(gainB?0x4:0)|(gainC?0x2:0)|(gainD?0x1:0));
+}
+
+/**
+ * @brief encode the write Vref select bits command
+ */
+constexpr uint8_t vrefs(bool vrefA, bool vrefB, bool vrefC, bool vrefD)
+{
+    return static_cast<uint8_t>(0x80 | (vrefA?0x8:0)|(vrefB?0x4:0)|(vrefC?0x2:0)|(vrefD?0x1:0));
+}
+
+/**
+ * @brief encode the write power-down select bits command
+ *
+ * @param frame points to 2 bytes that receive the encoded command
+ */
+constexpr void pds(uint8_t pdA, uint8_t pdB, uint8_t pdC, uint8_t pdD, uint8_t* frame)
+{
+    frame[0] = static_cast<uint8_t>(0xA0 | ((pdA & 0x3) << 2) | (pdB & 0x3));
+    frame[1] = static_cast<uint8_t>(((pdC & 0x3) << 6) | ((pdD & 0x3) << 4));
+}
+} // namespace mcp4728_encode
+
+/**
+ * @brief build a fast write frame for channels A through N-1
+ *
+ * @param codes the 12-bit DAC codes with power-down codes in bits 13:12
+ */
+template<size_t N>
+constexpr std::array<uint8_t, 2*N> mcp4728_fast_write_frame(const std::array<uint16_t, N>& codes)
+{
+    static_assert(N >= 1 && N <= 4, "a fast write frame has 1-4 channels");
+    std::array<uint8_t, 2*N> frame{};
+    for (size_t chan = 0; chan < N; chan++)
+        mcp4728_encode::fast_write_channel(codes[chan], &frame[chan*2]);
+    return frame;
+}
+
+/**
+ * @brief build a multi write frame for N channels in any order
+ */
+template<size_t N>
+constexpr std::array<uint8_t, 3*N> mcp4728_multi_write_frame(const std::array<mcp4728_channel_data, N>& chan_dat)
+{
+    static_assert(N >= 1 && N <= 4, "a multi write frame has 1-4 channels");
+    std::array<uint8_t, 3*N> frame{};
+    for (size_t chan = 0; chan < N; chan++)
+        mcp4728_encode::multi_write_channel(chan_dat[chan], &frame[chan*3]);
+    return frame;
+}
+
+/**
+ * @brief build a sequential write (or single write if N == 1) to DAC and EEPROM frame
+ */
+template<size_t N>
+constexpr std::array<uint8_t, 2*N+1> mcp4728_seq_write_eeprom_frame(const std::array<mcp4728_channel_data, N>& chan_dat)
+{
+    static_assert(N >= 1 && N <= 4, "a sequential write frame has 1-4 channels");
+    std::array<uint8_t, 2*N+1> frame{};
+    mcp4728_encode::seq_write_eeprom(chan_dat.data(), N, frame.data());
+    return frame;
+}
+
+constexpr std::array<uint8_t, 1> mcp4728_gains_frame(bool gainA, bool gainB, bool gainC, bool gainD)
+{
+    return {mcp4728_encode::gains(gainA, gainB, gainC, gainD)};
+}
+
+constexpr std::array<uint8_t, 1> mcp4728_vrefs_frame(bool vrefA, bool vrefB, bool vrefC, bool vrefD)
+{
+    return {mcp4728_encode::vrefs(vrefA, vrefB, vrefC, vrefD)};
+}
+
+constexpr std::array<uint8_t, 2> mcp4728_pds_frame(uint8_t pdA, uint8_t pdB, uint8_t pdC, uint8_t pdD)
+{
+    std::array<uint8_t, 2> frame{};
+    mcp4728_encode::pds(pdA, pdB, pdC, pdD, frame.data());
+    return frame;
+}
+
+namespace mcp4728_encode
+{
+// std::array operator==() is not constexpr until C++20
+template<size_t N>
+constexpr bool frames_equal(const std::array<uint8_t, N>& a, const std::array<uint8_t, N>& b)
+{
+    for (size_t idx = 0; idx < N; idx++) {
+        if (a[idx] != b[idx])
+            return false;
+    }
+    return true;
+}
+} // namespace mcp4728_encode
+
+// Check the encoders against command bytes worked out by hand from the data sheet
+static_assert(mcp4728_encode::frames_equal(mcp4728_fast_write_frame<2>({0x1ABC, 0x0FFF}),
+    std::array<uint8_t, 4>{0x1A, 0xBC, 0x0F, 0xFF}), "fast write encoding");
+static_assert(mcp4728_encode::frames_equal(mcp4728_multi_write_frame<1>({mcp4728_channel_data{2, 1, 1, 0, 1, 0x0123}}),
+    std::array<uint8_t, 3>{0x45, 0x91, 0x23}), "multi write encoding");
+static_assert(mcp4728_encode::frames_equal(mcp4728_seq_write_eeprom_frame<2>({mcp4728_channel_data{0, 0, 0, 0, 0, 0x0800}, mcp4728_channel_data{0, 0, 1, 0, 1, 0x0FFF}}),
+    std::array<uint8_t, 5>{0x54, 0x08, 0x00, 0x9F, 0xFF}), "sequential write encoding");
+static_assert(mcp4728_encode::frames_equal(mcp4728_seq_write_eeprom_frame<1>({mcp4728_channel_data{3, 1, 0, 2, 0, 0x0001}}),
+    std::array<uint8_t, 3>{0x5F, 0x40, 0x01}), "single write encoding");
+static_assert(mcp4728_gains_frame(true, false, true, false)[0] == 0xCA, "gain encoding");
+static_assert(mcp4728_vrefs_frame(false, true, false, true)[0] == 0x85, "vref encoding");
+static_assert(mcp4728_encode::frames_equal(mcp4728_pds_frame(1, 2, 3, 1),
+    std::array<uint8_t, 2>{0xA6, 0xD0}), "power-down encoding");
+} // namespace rppicomidi
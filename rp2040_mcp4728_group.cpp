@@ -0,0 +1,323 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_group.h"
+#include <cstring> // memset
+#include "hardware/timer.h"
+
+rppicomidi::RP2040_MCP4728_group::RP2040_MCP4728_group(RP2040_MCP4728* dac_list_, uint8_t ndacs_, Rp2040_i2c_bus* bus_) :
+    RP2040_i2c_device(dac_list_[0].get_addr(), bus_), dac_list{dac_list_}, ndacs{ndacs_}, nvisits{0}, frame_started{false},
+    updating{false}, write_in_flight{false}, read_in_flight{false}, bus_ready{false}, req_bus_cb{nullptr}, req_bus_context{nullptr},
+    update_cb{nullptr}, update_context{nullptr}, call_update_cb{false}, transaction_count{0}, switch_count{0}, nack_count{0},
+    failed_chips{0}, last_write_done_us{0}
+{
+    assert(ndacs > 0 && ndacs <= max_dacs);
+    memset(codes, 0, sizeof(codes));
+    memset(dirty, 0, sizeof(dirty));
+    memset(visit_order, 0, sizeof(visit_order));
+    memset(frame_entries, 0, sizeof(frame_entries));
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728_group::bus_ready_callback(RP2040_i2c_device* dev)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_group*>(dev);
+    me->bus_ready = true;
+    me->bus->set_pending_locked(me);
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728_group::write_done_callback(RP2040_i2c_device* dev)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_group*>(dev);
+    me->write_in_flight = false;
+    me->last_write_done_us = time_us_64();
+    me->bus->set_pending_locked(me);
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728_group::read_done_callback(RP2040_i2c_device* dev)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_group*>(dev);
+    me->read_in_flight = false;
+    me->bus->set_pending_locked(me);
+}
+
+int rppicomidi::RP2040_MCP4728_group::request_bus(void (*callback)(void* context), void* context)
+{
+    req_bus_cb = callback;
+    req_bus_context = context;
+    return bus->request_bus(this, bus_ready_callback);
+}
+
+int rppicomidi::RP2040_MCP4728_group::release_bus()
+{
+    if (updating)
+        return 0;
+    return bus->release_bus(this);
+}
+
+bool rppicomidi::RP2040_MCP4728_group::set_channel(uint8_t chan, uint16_t code, uint8_t pd)
+{
+    if (chan >= ndacs * 4 || code > 4095 || pd > 3)
+        return false;
+    uint16_t value = ((uint16_t)pd << 12) | code;
+    bus->enter_critical();
+    if (codes[chan] != value) {
+        codes[chan] = value;
+        dirty[chan >> 2] |= 1 << (chan & 3);
+    }
+    bus->exit_critical();
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_group::set_channels(uint8_t first_chan, const uint16_t* chan_dat, uint8_t nchan)
+{
+    if ((uint16_t)first_chan + nchan > ndacs * 4)
+        return false;
+    for (uint8_t idx = 0; idx < nchan; idx++) {
+        if (chan_dat[idx] > 0x3FFF)
+            return false;
+    }
+    bus->enter_critical();
+    for (uint8_t idx = 0; idx < nchan; idx++) {
+        uint8_t chan = first_chan + idx;
+        if (codes[chan] != chan_dat[idx]) {
+            codes[chan] = chan_dat[idx];
+            dirty[chan >> 2] |= 1 << (chan & 3);
+        }
+    }
+    bus->exit_critical();
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_group::update(void (*callback)(void* context), void* context)
+{
+    if (updating || !bus->is_active_device(this))
+        return false;
+    // Visit the chip the bus already targets first (no address change needed),
+    // then the rest in dac_list order.
+    nvisits = 0;
+    uint16_t current = bus->get_target_addr();
+    for (uint8_t dacnum = 0; dacnum < ndacs; dacnum++) {
+        if (dirty[dacnum] != 0 && dac_list[dacnum].get_addr() == current)
+            visit_order[nvisits++] = dacnum;
+    }
+    for (uint8_t dacnum = 0; dacnum < ndacs; dacnum++) {
+        if (dirty[dacnum] != 0 && dac_list[dacnum].get_addr() != current)
+            visit_order[nvisits++] = dacnum;
+    }
+    update_cb = callback;
+    update_context = context;
+    if (nvisits == 0) {
+        // nothing to do; report completion on the next task()
+        call_update_cb = true;
+        bus->set_pending(this);
+        return true;
+    }
+    updating = true;
+    frame_started = false;
+    start_frame();
+    bus->set_pending(this);
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_group::start_frame()
+{
+    if (write_in_flight)
+        return false;
+    uint16_t chan_dat[4];
+    uint16_t target = bus->get_target_addr();
+    uint8_t nswitches = 0;
+    bus->enter_critical();
+    for (uint8_t visit = 0; visit < nvisits; visit++) {
+        uint8_t dacnum = visit_order[visit];
+        uint8_t mask = dirty[dacnum];
+        uint8_t nchan = 0;
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            if (mask & (1 << chan))
+                nchan = chan + 1;
+            chan_dat[chan] = codes[dacnum*4 + chan];
+        }
+        RP2040_MCP4728::encode_fast_write(chan_dat, nchan, frame_data[visit]);
+        frame_entries[visit] = {dac_list[dacnum].get_addr(), frame_data[visit], static_cast<uint8_t>(nchan*2), 0};
+        frame_masks[visit] = mask;
+        if (frame_entries[visit].addr != target)
+            ++nswitches;
+        target = frame_entries[visit].addr;
+    }
+    bool result = bus->write_frame_locked(this, frame_entries, nvisits, frame_done_callback);
+    if (result) {
+        for (uint8_t visit = 0; visit < nvisits; visit++)
+            dirty[visit_order[visit]] = 0;
+        write_in_flight = true;
+    }
+    bus->exit_critical();
+    if (result) {
+        frame_started = true;
+        transaction_count += nvisits;
+        switch_count += nswitches;
+    }
+    return result;
+}
+
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728_group::frame_done_callback(RP2040_i2c_device* dev)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_group*>(dev);
+    uint8_t failed = 0;
+    for (uint8_t visit = 0; visit < me->nvisits; visit++) {
+        if (me->frame_entries[visit].status != Rp2040_i2c_bus::frame_ok) {
+            // The chip did not get its codes; send them with the next update
+            me->dirty[me->visit_order[visit]] |= me->frame_masks[visit];
+            failed |= 1 << me->visit_order[visit];
+            ++me->nack_count;
+        }
+    }
+    me->failed_chips = failed;
+    write_done_callback(dev);
+}
+
+bool rppicomidi::RP2040_MCP4728_group::write_chips(const chip_frame* chips, uint8_t nchips, void (*callback)(void* context), void* context)
+{
+    if (nchips == 0 || nchips > max_dacs || updating || write_in_flight || read_in_flight)
+        return false;
+    uint16_t target = bus->get_target_addr();
+    uint8_t nswitches = 0;
+    for (uint8_t visit = 0; visit < nchips; visit++) {
+        if (chips[visit].dacnum >= ndacs || chips[visit].nbytes == 0 || chips[visit].nbytes > 16)
+            return false;
+        visit_order[visit] = chips[visit].dacnum;
+        frame_entries[visit] = {dac_list[chips[visit].dacnum].get_addr(), chips[visit].data, chips[visit].nbytes, 0};
+        frame_masks[visit] = 0; // these writes do not come from the dirty channels
+        if (frame_entries[visit].addr != target)
+            ++nswitches;
+        target = frame_entries[visit].addr;
+    }
+    bus->enter_critical();
+    bool result = bus->is_active_device(this) && bus->write_frame_locked(this, frame_entries, nchips, frame_done_callback);
+    if (result) {
+        nvisits = nchips;
+        update_cb = callback;
+        update_context = context;
+        updating = true;
+        frame_started = true;
+        write_in_flight = true;
+    }
+    bus->exit_critical();
+    if (result) {
+        transaction_count += nchips;
+        switch_count += nswitches;
+        bus->set_pending(this);
+    }
+    return result;
+}
+
+void rppicomidi::RP2040_MCP4728_group::task()
+{
+    if (bus_ready) {
+        bus_ready = false;
+        if (req_bus_cb)
+            req_bus_cb(req_bus_context);
+    }
+    if (updating) {
+        if (!frame_started) {
+            start_frame();
+        }
+        else if (!write_in_flight) {
+            updating = false;
+            call_update_cb = true;
+        }
+    }
+    if (call_update_cb) {
+        call_update_cb = false;
+        if (update_cb)
+            update_cb(update_context);
+    }
+    if (updating)
+        bus->set_pending(this);
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728_group::target_chip(uint8_t dacnum)
+{
+    // Only change the target address if needed so writes to the same chip can stack in the TX FIFO
+    uint16_t chip_addr = dac_list[dacnum].get_addr();
+    bus->enter_critical();
+    bool same_target = bus->get_target_addr() == chip_addr && bus->is_general_call_mode(this) == 0;
+    bus->exit_critical();
+    if (!same_target) {
+        if (!bus->set_target_addr(this, chip_addr))
+            return false;
+        ++switch_count;
+    }
+    return true;
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728_group::write_chip(uint8_t dacnum, const uint8_t* frame, uint8_t nbytes)
+{
+    if (dacnum >= ndacs || nbytes == 0 || nbytes > 16)
+        return false;
+    if (!target_chip(dacnum))
+        return false;
+    bus->enter_critical();
+    bool result = bus->write_locked(this, false, true, frame, nbytes, write_done_callback);
+    if (result)
+        write_in_flight = true; // write_done_callback() cannot run until the critical section ends
+    bus->exit_critical();
+    if (result)
+        ++transaction_count;
+    return result;
+}
+
+bool rppicomidi::RP2040_MCP4728_group::read_chip(uint8_t dacnum, uint8_t* data, uint8_t nbytes)
+{
+    if (dacnum >= ndacs || nbytes == 0 || is_bus_busy() || !target_chip(dacnum))
+        return false;
+    read_in_flight = true;
+    bus->enter_critical();
+    bool result = bus->read_locked(this, false, true, data, nbytes, read_done_callback);
+    bus->exit_critical();
+    if (result)
+        ++transaction_count;
+    else
+        read_in_flight = false;
+    return result;
+}
+
+bool rppicomidi::RP2040_MCP4728_group::general_call(uint8_t command)
+{
+    bus->enter_critical();
+    bool result = bus->set_general_call_mode(this, true) && bus->write_locked(this, false, true, &command, 1, write_done_callback);
+    if (result)
+        write_in_flight = true;
+    bus->exit_critical();
+    if (result)
+        ++transaction_count;
+    return result;
+}
+
+bool rppicomidi::RP2040_MCP4728_group::pulse_ldac(uint8_t dacnum)
+{
+    if (dacnum >= ndacs || !dac_list[dacnum].set_ldac_pin(false))
+        return false;
+    busy_wait_us_32(1); // LDAC\ low pulse width must be at least 210ns
+    dac_list[dacnum].set_ldac_pin(true);
+    return true;
+}
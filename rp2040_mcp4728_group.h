@@ -0,0 +1,324 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class treats up to 8 MCP4728 chips on the same I2C bus as one
+ * DAC with up to 32 channels numbered 0 to 4*ndacs-1 (channel = dac index * 4 +
+ * DAC channel A-D). The group requests the I2C bus once and keeps it for as
+ * many updates as you like, so there is no request_bus()/release_bus() round trip
+ * per chip. The chips' own RP2040_MCP4728 objects supply the I2C addresses but do
+ * not use the bus while the group has it.
+ *
+ * Set any number of channel codes, then call update(). The group visits only the
+ * chips with changed channels, starting with the chip the bus is already addressing,
+ * and sends one fast write per chip that covers channels A through the highest
+ * changed channel. All of the fast writes go out as one bus frame (see
+ * Rp2040_i2c_bus::write_frame()), so the chip to chip hops need no task() calls.
+ * Call task() periodically to start the update if the bus was busy and to call the
+ * application callbacks.
+ */
+#pragma once
+#include "rp2040_mcp4728_lib.h"
+namespace rppicomidi
+{
+class RP2040_MCP4728_group : public RP2040_i2c_device
+{
+public:
+    static const uint8_t max_dacs = 8;
+    /**
+     * One chip's part of a write_chips() bus frame
+     */
+    struct chip_frame {
+        uint8_t dacnum;         // the index of the chip in dac_list
+        const uint8_t* data;    // the encoded command bytes
+        uint8_t nbytes;         // the number of bytes (1-16)
+    };
+    /**
+     * @brief constructor
+     *
+     * @param dac_list_ an array of ndacs_ MCP4728 objects on the same bus
+     * @param ndacs_ the number of MCP4728 objects in dac_list_ (1-8)
+     * @param bus_ the bus the MCP4728 chips are attached to
+     */
+    RP2040_MCP4728_group(RP2040_MCP4728* dac_list_, uint8_t ndacs_, Rp2040_i2c_bus* bus_);
+
+    /**
+     * @brief request to make this group the active device on the I2C bus
+     *
+     * @return 1 if this group is now active on the I2C bus.
+     * @return 0 if access is deferred (callback will be called when the group is active)
+     * @return -1 if parameters are invalid
+     * @param callback pointer to function that is called when deferred bus is available
+     * @param context is the context parameter for the callback function
+     */
+    int request_bus(void (*callback)(void* context), void* context);
+
+    /**
+     * @brief allow another device to be the active device on this bus
+     *
+     * @return 1 if the bus was released; 0 if an update is in progress (try again later);
+     * -1 if the group did not have the bus
+     */
+    int release_bus();
+
+    /**
+     * @brief set one channel's code; the DAC output changes on the next update()
+     *
+     * @return false if chan or code or pd is out of range
+     * @param chan the channel number 0 to 4*ndacs-1
+     * @param code the 12-bit DAC code
+     * @param pd the power-down code (0 is on)
+     */
+    bool set_channel(uint8_t chan, uint16_t code, uint8_t pd=0);
+
+    /**
+     * @brief set the codes of nchan consecutive channels; the DAC outputs change on the next update()
+     *
+     * @return false if any channel or code is out of range
+     * @param first_chan the first channel number
+     * @param chan_dat an array of nchan 12-bit DAC codes with the power-down code in bits 13:12
+     * @param nchan the number of channels
+     */
+    bool set_channels(uint8_t first_chan, const uint16_t* chan_dat, uint8_t nchan);
+
+    /**
+     * @brief send every changed channel to the chips
+     *
+     * @return false if the group does not have the bus or an update is already in progress
+     * @param callback is called from task() when the last chip has been written (optional)
+     * @param context is the context parameter for the callback
+     */
+    bool update(void (*callback)(void* context)=nullptr, void* context=nullptr);
+
+    /**
+     * @brief write already encoded commands to several chips as one bus frame
+     *
+     * Use this instead of update() when the caller encodes the commands itself, for
+     * example to send multi-writes or to reuse frames it computed in place. The channel
+     * codes that set_channel() and update() track are not changed.
+     * @return false if the group does not have the bus, an update is in progress, the
+     * I2C hardware is still busy, or an entry is out of range
+     * @param chips the chips to write and what to write to each; the data must stay valid
+     * until the callback is called
+     * @param nchips the number of entries in chips (1-8)
+     * @param callback is called from task() when the last chip has been written (optional).
+     * get_failed_chips() tells which chips did not get their commands.
+     * @param context is the context parameter for the callback
+     */
+    bool write_chips(const chip_frame* chips, uint8_t nchips, void (*callback)(void* context)=nullptr, void* context=nullptr);
+
+    /**
+     * @brief advance an update in progress and call application callbacks
+     */
+    void task();
+
+    // Immediate access functions. These do not wait for anything, so they may be called
+    // from an interrupt handler. They return false if the I2C hardware is still busy with
+    // an earlier transfer; try again later. Do not use them while an update() is in progress.
+
+    /**
+     * @brief write an encoded frame to one chip right away
+     *
+     * If the bus already targets the chip, the frame is stacked behind any write still in
+     * the TX FIFO. Otherwise the bus must be idle so the target address can change.
+     * @return true if the frame was loaded into the TX FIFO
+     * @param dacnum the index of the chip in dac_list
+     * @param frame the encoded command bytes; they are copied, so they may be in flash
+     * @param nbytes the number of bytes in the frame (1-16)
+     */
+    bool write_chip(uint8_t dacnum, const uint8_t* frame, uint8_t nbytes);
+
+    /**
+     * @brief start reading nbytes from one chip right away
+     *
+     * The bus must be idle. The data is in the buffer when is_read_in_flight() returns false.
+     * @return true if the read started
+     * @param dacnum the index of the chip in dac_list
+     * @param data the buffer that receives the bytes; it must stay valid until the read is done
+     * @param nbytes the number of bytes to read (24 bytes reads every DAC and EEPROM register)
+     */
+    bool read_chip(uint8_t dacnum, uint8_t* data, uint8_t nbytes);
+
+    /**
+     * @brief
+     *
+     * @return true if a read_chip() read has not finished yet
+     */
+    bool is_read_in_flight() const { return read_in_flight; }
+
+    /**
+     * @brief send a one byte general call command (for example, 0x08 software update)
+     * to every chip on the bus right away
+     *
+     * The bus stays in general call mode until the next write_chip().
+     * @return true if the command was loaded into the TX FIFO
+     * @param command the general call command byte
+     */
+    bool general_call(uint8_t command);
+
+    /**
+     * @brief pulse one chip's LDAC\ pin low to copy its input registers to its outputs
+     *
+     * @return false if the chip has no LDAC pin or dacnum is out of range
+     * @param dacnum the index of the chip in dac_list
+     */
+    bool pulse_ldac(uint8_t dacnum);
+
+    /**
+     * @brief check whether a chip answers at an I2C address (see Rp2040_i2c_bus::probe())
+     *
+     * This blocks, so it is not for interrupt handlers.
+     * @return 1 if a chip answered, 0 if not, -1 if the group does not have the bus or the bus is busy
+     * @param probe_addr the 7-bit I2C address to check
+     */
+    int probe(uint16_t probe_addr) { return bus->probe(this, probe_addr); }
+
+    /**
+     * @brief
+     *
+     * @return true if chip dacnum has an LDAC\ pin
+     */
+    bool has_ldac_pin(uint8_t dacnum) const { return dacnum < ndacs && dac_list[dacnum].has_ldac_pin(); }
+
+    /**
+     * @brief
+     *
+     * @return true if the I2C hardware is still busy with a transfer or has not yet
+     * reported the end of the last one
+     */
+    bool is_bus_busy() const { return bus->is_busy() || write_in_flight || read_in_flight; }
+
+    /**
+     * @brief
+     *
+     * @return the time in microseconds since boot when the last write_chip() frame finished
+     */
+    uint64_t get_last_write_done_us() const { return last_write_done_us; }
+
+    /**
+     * @brief
+     *
+     * @return true if an update is in progress
+     */
+    bool is_updating() const { return updating; }
+
+    /**
+     * @brief
+     *
+     * @return true if the group is the active device on the I2C bus
+     */
+    bool has_bus() const { return bus->is_active_device(const_cast<RP2040_MCP4728_group*>(this)); }
+
+    /**
+     * @brief
+     *
+     * @return the number of channels in the group
+     */
+    uint8_t get_num_channels() const { return ndacs * 4; }
+
+    /**
+     * @brief
+     *
+     * @return the number of chips in the group
+     */
+    uint8_t get_num_dacs() const { return ndacs; }
+
+    /**
+     * @brief
+     *
+     * @return the I2C address of chip dacnum
+     */
+    uint16_t get_chip_addr(uint8_t dacnum) const { return dac_list[dacnum].get_addr(); }
+
+    /**
+     * @brief
+     *
+     * @return the number of I2C transactions sent by all updates so far
+     */
+    uint32_t get_transaction_count() const { return transaction_count; }
+
+    /**
+     * @brief
+     *
+     * @return the number of times an update had to change the bus target address
+     */
+    uint32_t get_switch_count() const { return switch_count; }
+
+    /**
+     * @brief
+     *
+     * @return the number of update() chip writes that failed. The failed channels are sent again with the next update().
+     */
+    uint32_t get_nack_count() const { return nack_count; }
+
+    /**
+     * @brief
+     *
+     * @return a bit mask of the chips (bit n is dac_list index n) whose write failed in
+     * the last update() or write_chips() frame
+     */
+    uint8_t get_failed_chips() const { return failed_chips; }
+protected:
+    static void bus_ready_callback(RP2040_i2c_device* dev);
+    static void write_done_callback(RP2040_i2c_device* dev);
+    static void read_done_callback(RP2040_i2c_device* dev);
+    static void frame_done_callback(RP2040_i2c_device* dev);
+    bool target_chip(uint8_t dacnum);
+    /**
+     * @brief encode a fast write for every chip in visit_order and send them as one bus frame
+     *
+     * @return true if the frame started or false if the bus is still busy
+     */
+    bool start_frame();
+    RP2040_MCP4728* dac_list;
+    uint8_t ndacs;
+    uint16_t codes[max_dacs * 4];   // 12-bit DAC code with the power down code in bits 13:12
+    uint8_t dirty[max_dacs];        // bit mask of changed channels for each chip
+    uint8_t visit_order[max_dacs];
+    uint8_t nvisits;
+    Rp2040_i2c_bus::Frame_entry frame_entries[max_dacs]; // one entry per visit
+    uint8_t frame_data[max_dacs][8];
+    uint8_t frame_masks[max_dacs];  // the dirty channels each entry sends
+    bool frame_started;
+    volatile bool updating;
+    volatile bool write_in_flight;
+    volatile bool read_in_flight;
+    volatile bool bus_ready;
+    void (*req_bus_cb)(void* context);
+    void* req_bus_context;
+    void (*update_cb)(void* context);
+    void* update_context;
+    bool call_update_cb;
+    uint32_t transaction_count;
+    uint32_t switch_count;
+    uint32_t nack_count;
+    volatile uint8_t failed_chips;
+    volatile uint64_t last_write_done_us;
+private:
+    RP2040_MCP4728_group()=delete;
+    RP2040_MCP4728_group(const RP2040_MCP4728_group&)=delete;
+    RP2040_MCP4728_group& operator=(const RP2040_MCP4728_group&)=delete;
+};
+}
@@ -24,10 +24,18 @@
  */
 #include "rp2040_mcp4728_lib.h"
 #include <cstring> // for memset
-rppicomidi::RP2040_MCP4728::RP2040_MCP4728(uint16_t addr_, Rp2040_i2c_bus* bus_, uint ldac_, bool ldac_invert_) : RP2040_i2c_device(addr_, bus_), ldac_gpio{ldac_}, release_bus_pending{false}
-{
-    memset(&app_callbacks, 0, sizeof(app_callbacks));
-    memset(read_data, 0, sizeof(read_data));
+rppicomidi::RP2040_MCP4728::RP2040_MCP4728(uint16_t addr_, Rp2040_i2c_bus* bus_, uint ldac_, bool ldac_invert_) : RP2040_i2c_device(addr_, bus_),
+    next_seq{0}, general_call_active{false}, ldac_gpio{ldac_}, release_bus_pending{false},
+    irq_notify{nullptr}, irq_notify_context{nullptr}
+{
+    static_assert(RP2040_MCP4728_MAX_PENDING_OPS >= 1 && RP2040_MCP4728_MAX_PENDING_OPS <= 8, "RP2040_MCP4728_MAX_PENDING_OPS must be 1-8");
+    memset(&req_bus, 0, sizeof(req_bus));
+    memset(&rel_bus, 0, sizeof(rel_bus));
+    memset(ops, 0, sizeof(ops));
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+    memset(&addr_access, 0, sizeof(addr_access));
+    addr_access.state = addr_idle;
+#endif
     if (ldac_gpio != no_ldac_gpio) {
         gpio_init(ldac_gpio);
         if (ldac_invert_) {
@@ -38,90 +46,240 @@ rppicomidi::RP2040_MCP4728::RP2040_MCP4728(uint16_t addr_, Rp2040_i2c_bus* bus_,
     }
 }
 
-void rppicomidi::RP2040_MCP4728::req_bus_callback(RP2040_i2c_device* context)
-{
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.req_bus.call_callback = true;
-}
-
-void rppicomidi::RP2040_MCP4728::fast_write_callback(RP2040_i2c_device* context)
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::req_bus_callback(RP2040_i2c_device* context)
 {
     auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.fast_write.call_callback = true;
+    ptr->req_bus.call_callback = true;
+    ptr->bus->set_pending_locked(ptr);
+    if (ptr->irq_notify)
+        ptr->irq_notify(ptr->irq_notify_context);
 }
 
-void rppicomidi::RP2040_MCP4728::multi_write_callback(RP2040_i2c_device* context)
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::op_done_callback(RP2040_i2c_device* context)
 {
+    // Called from the I2C IRQ in the bus critical section. Everything this device had
+    // in the I2C hardware is finished: writes are stacked in the TX FIFO and the
+    // bus signals completion when the FIFO drains; reads are never stacked.
     auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.multi_write.call_callback = true;
+    for (auto& op: ptr->ops) {
+        if (op.state == op_in_flight) {
+            op.state = op_done;
+        }
+    }
+    ptr->bus->set_pending_locked(ptr);
+    if (ptr->irq_notify)
+        ptr->irq_notify(ptr->irq_notify_context);
 }
 
-void rppicomidi::RP2040_MCP4728::gain_set_callback(RP2040_i2c_device* context)
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::stream_fill_callback(RP2040_i2c_device* context, uint8_t* data, uint8_t nbytes)
 {
+    // Called from the I2C IRQ in the bus critical section. Only one stream_op is in flight at a time.
     auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.set_gain.call_callback = true;
+    for (auto& op: ptr->ops) {
+        if (op.kind == stream_op && op.state == op_in_flight) {
+            while (nbytes > 0) {
+                uint8_t record[3];
+                mcp4728_encode::multi_write_channel(op.stream_src[op.stream_pos / 3], record);
+                for (uint8_t idx = op.stream_pos % 3; idx < 3 && nbytes > 0; idx++, nbytes--) {
+                    *data++ = record[idx];
+                    op.stream_pos++;
+                }
+            }
+            break;
+        }
+    }
 }
 
-void rppicomidi::RP2040_MCP4728::vref_set_callback(RP2040_i2c_device* context)
+rppicomidi::RP2040_MCP4728::op_record* RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::alloc_op(op_kind kind, void (*callback)(void* context), void* context)
 {
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.set_vref.call_callback = true;
+    op_record* rec = nullptr;
+    bus->enter_critical();
+    for (auto& op: ops) {
+        if (op.state == op_free) {
+            rec = &op;
+            rec->state = op_filling;
+            break;
+        }
+    }
+    bus->exit_critical();
+    if (rec) {
+        rec->kind = kind;
+        rec->stop = true;
+        rec->nbytes = 0;
+        rec->nchan = 0;
+        rec->callback = callback;
+        rec->status_callback = nullptr;
+        rec->context = context;
+        rec->read_dest = nullptr;
+        rec->stream_src = nullptr;
+    }
+    return rec;
 }
 
-void rppicomidi::RP2040_MCP4728::pd_set_callback(RP2040_i2c_device* context)
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::submit_op(op_record* rec, mcp4728_op_handle* handle)
 {
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.set_pd.call_callback = true;
+    bool result = false;
+    bus->enter_critical();
+    if (bus->is_active_device(this)) {
+        rec->seq = next_seq++;
+        rec->state = op_queued;
+        issue_ops_locked();
+        result = true;
+    }
+    else {
+        rec->state = op_free;
+    }
+    bus->exit_critical();
+    if (handle) {
+        *handle = result ? static_cast<mcp4728_op_handle>(((rec->generation & 0xFFF) << 3) | (rec - ops)) : invalid_op;
+    }
+    return result;
 }
 
-void rppicomidi::RP2040_MCP4728::reset_callback(RP2040_i2c_device* context)
-{
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.reset.call_callback = true;
+void RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::issue_ops_locked()
+{
+    while (!general_call_active) {
+        // find the oldest queued operation and note what is still in the hardware
+        op_record* oldest = nullptr;
+        bool write_in_flight = false;
+        bool other_in_flight = false;
+        for (auto& op: ops) {
+            if (op.state == op_queued) {
+                if (oldest == nullptr || (int32_t)(op.seq - oldest->seq) < 0)
+                    oldest = &op;
+            }
+            else if (op.state == op_in_flight) {
+                if (op.kind == stream_op)
+                    return; // nothing may share the TX FIFO with a stream
+                if (op.kind == write_op)
+                    write_in_flight = true;
+                else
+                    other_in_flight = true;
+            }
+        }
+        if (oldest == nullptr || other_in_flight)
+            return;
+        bool issued = false;
+        switch(oldest->kind) {
+        case write_op:
+            issued = bus->write_locked(this, false, oldest->stop, oldest->buffer, oldest->nbytes, op_done_callback);
+            break;
+        case stream_op:
+            // mark the record in flight first; the bus fills the TX FIFO from it right away
+            oldest->state = op_in_flight;
+            oldest->stream_pos = 0;
+            issued = bus->write_stream_locked(this, false, true, (uint32_t)oldest->stream_nchan * 3, stream_fill_callback, op_done_callback);
+            if (!issued)
+                oldest->state = op_queued;
+            break;
+        case read_op:
+        case status_op:
+            if (!write_in_flight)
+                issued = bus->read_locked(this, false, true, oldest->buffer, oldest->nbytes, op_done_callback);
+            break;
+        case general_call_op:
+            if (!write_in_flight && bus->set_general_call_mode(this, true)) {
+                issued = bus->write_locked(this, false, true, oldest->buffer, oldest->nbytes, op_done_callback);
+                if (issued)
+                    general_call_active = true;
+                else
+                    bus->set_general_call_mode(this, false);
+            }
+            break;
+        }
+        if (!issued)
+            return;
+        oldest->state = op_in_flight;
+    }
 }
 
-void rppicomidi::RP2040_MCP4728::wakeup_callback(RP2040_i2c_device* context)
+rppicomidi::RP2040_MCP4728::op_record* rppicomidi::RP2040_MCP4728::find_op(mcp4728_op_handle handle)
 {
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.wakeup.call_callback = true;
+    if (handle < 0 || (handle & 0x7) >= RP2040_MCP4728_MAX_PENDING_OPS)
+        return nullptr;
+    return ops + (handle & 0x7);
 }
 
-void rppicomidi::RP2040_MCP4728::update_callback(RP2040_i2c_device* context)
-{
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.update.call_callback = true;
+rppicomidi::mcp4728_op_status rppicomidi::RP2040_MCP4728::get_op_status(mcp4728_op_handle handle)
+{
+    op_record* rec = find_op(handle);
+    if (rec == nullptr)
+        return mcp4728_op_invalid;
+    mcp4728_op_status status = mcp4728_op_complete;
+    bus->enter_critical();
+    if ((rec->generation & 0xFFF) == (handle >> 3)) {
+        switch(rec->state) {
+        case op_queued:
+            status = mcp4728_op_queued;
+            break;
+        case op_in_flight:
+            status = mcp4728_op_in_flight;
+            break;
+        case op_done:
+            status = mcp4728_op_done;
+            break;
+        default:
+            break;
+        }
+    }
+    bus->exit_critical();
+    return status;
 }
 
-void rppicomidi::RP2040_MCP4728::seq_write_eeprom_callback(RP2040_i2c_device* context)
+bool rppicomidi::RP2040_MCP4728::wait_op(mcp4728_op_handle handle, uint32_t timeout_us)
 {
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.seq_write_eeprom.call_callback = true;
+    absolute_time_t timeout = make_timeout_time_us(timeout_us);
+    for (;;) {
+        task();
+        mcp4728_op_status status = get_op_status(handle);
+        if (status == mcp4728_op_complete || status == mcp4728_op_invalid)
+            return status == mcp4728_op_complete;
+        if (time_reached(timeout))
+            return false;
+        tight_loop_contents();
+    }
 }
 
-void rppicomidi::RP2040_MCP4728::read_callback(RP2040_i2c_device* context)
+bool rppicomidi::RP2040_MCP4728::has_pending_ops()
 {
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.read.call_callback = true;
+    bool pending = false;
+    bus->enter_critical();
+    for (auto& op: ops) {
+        if (op.state != op_free) {
+            pending = true;
+            break;
+        }
+    }
+    bus->exit_critical();
+    return pending;
 }
 
-void rppicomidi::RP2040_MCP4728::status_callback(RP2040_i2c_device* context)
+bool rppicomidi::RP2040_MCP4728::has_free_op()
 {
-    auto ptr=reinterpret_cast<RP2040_MCP4728*>(context);
-    ptr->app_callbacks.status.call_callback = true;
+    bool free = false;
+    bus->enter_critical();
+    for (auto& op: ops) {
+        if (op.state == op_free) {
+            free = true;
+            break;
+        }
+    }
+    bus->exit_critical();
+    return free;
 }
 
 int rppicomidi::RP2040_MCP4728::request_bus(void (*callback)(void* context), void* context)
 {
-    app_callbacks.req_bus.callback = callback;
-    app_callbacks.req_bus.context = context;
+    req_bus.callback = callback;
+    req_bus.context = context;
     return bus->request_bus(this, req_bus_callback); 
 }
 
 int rppicomidi::RP2040_MCP4728::release_bus(void (*callback)(void* context), void* context)
 {
-    app_callbacks.rel_bus.callback = callback;
-    app_callbacks.rel_bus.context = context;
-    int status =  bus->release_bus(this);
+    rel_bus.callback = callback;
+    rel_bus.context = context;
+    int status = has_pending_ops() ? 0 : bus->release_bus(this);
     if (status == 0)
         release_bus_pending = true;
     return status;
@@ -138,7 +296,7 @@ void rppicomidi::RP2040_MCP4728::check_callback(app_callback& app_cb)
     }
 }
 
-void rppicomidi::RP2040_MCP4728::bytes2channel_read_data(uint8_t* bytes, mcp4728_channel_read_data* data)
+void rppicomidi::RP2040_MCP4728::bytes2channel_read_data(const uint8_t* bytes, mcp4728_channel_read_data* data)
 {
     data->chan = (bytes[0] >> 4) & 0x3;
     data->rdy = (bytes[0] & 0x80) != 0;
@@ -151,211 +309,282 @@ void rppicomidi::RP2040_MCP4728::bytes2channel_read_data(uint8_t* bytes, mcp4728
 
 void rppicomidi::RP2040_MCP4728::task()
 {
-    check_callback(app_callbacks.req_bus);
-    if (release_bus_pending) {
-        int status = bus->release_bus(this);
-        assert(status != -1);
-        if (status == 1) {
-            release_bus_pending = false;
-            app_callbacks.rel_bus.callback(app_callbacks.rel_bus.context);
-        }
-    }
-    check_callback(app_callbacks.fast_write);
-    check_callback(app_callbacks.multi_write);
-    check_callback(app_callbacks.seq_write_eeprom);
-    check_callback(app_callbacks.set_gain);
-    check_callback(app_callbacks.set_vref);
-    check_callback(app_callbacks.set_pd);
-    if (app_callbacks.read.call_callback) {
+    check_callback(req_bus);
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+    if (addr_access.state != addr_idle)
+        addr_access_task();
+#endif
+    // Deliver completed operations in the order they were submitted
+    for (;;) {
+        op_record* oldest = nullptr;
         bus->enter_critical();
-        app_callbacks.read.call_callback = false;
+        for (auto& op: ops) {
+            if (op.state == op_done && (oldest == nullptr || (int32_t)(op.seq - oldest->seq) < 0))
+                oldest = &op;
+        }
         bus->exit_critical();
-        // copy and format read_data into the API's array
-        auto data = app_callbacks.read.data;
-        for (uint8_t chan; chan < app_callbacks.read.nchan; chan++) {
-            bytes2channel_read_data(read_data + (chan*3), data + chan);
-            data[chan].is_eeprom = (chan & 1) != 0;
+        if (oldest == nullptr)
+            break;
+        if (oldest->kind == general_call_op) {
+            // return to normal addressing before anything else uses the bus
+            if (!bus->set_general_call_mode(this, false))
+                break;
+            general_call_active = false;
         }
-        if (app_callbacks.read.callback != nullptr)
-            app_callbacks.read.callback(app_callbacks.read.context);
-    }
-    else if (app_callbacks.status.call_callback) {
+        else if (oldest->kind == read_op) {
+            // copy and format the read data into the API's array
+            for (uint8_t chan = 0; chan < oldest->nchan; chan++) {
+                bytes2channel_read_data(oldest->buffer + (chan*3), oldest->read_dest + chan);
+                oldest->read_dest[chan].is_eeprom = (chan & 1) != 0;
+            }
+        }
+        // Retire the record before calling the callback so the callback can submit new operations
+        auto callback = oldest->callback;
+        auto status_callback = oldest->status_callback;
+        auto context = oldest->context;
+        bool is_bsy = (oldest->buffer[0] & 0x80) == 0;
+        bool is_powered_on = (oldest->buffer[0] & 0x40) != 0;
+        bool is_status = oldest->kind == status_op;
         bus->enter_critical();
-        app_callbacks.status.call_callback = false;
+        oldest->generation++;
+        oldest->state = op_free;
         bus->exit_critical();
-        bool is_bsy = (read_data[0] & 0x80) == 0;
-        bool is_powered_on = (read_data[0] & 0x40) != 0;
-        if (app_callbacks.status.callback != nullptr) {
-            app_callbacks.status.callback(app_callbacks.status.context, is_bsy, is_powered_on);
+        if (is_status) {
+            if (status_callback != nullptr)
+                status_callback(context, is_bsy, is_powered_on);
         }
-    }
-    else if (app_callbacks.reset.call_callback) {
-        if (bus->set_general_call_mode(this, false)) {
-            bus->enter_critical();
-            app_callbacks.reset.call_callback = false;
-            bus->exit_critical();
-            if (app_callbacks.reset.callback != nullptr) {
-                app_callbacks.reset.callback(app_callbacks.reset.context);
-            }
+        else if (callback != nullptr) {
+            callback(context);
         }
     }
-    else if (app_callbacks.wakeup.call_callback) {
-        if (bus->set_general_call_mode(this, false)) {
-            bus->enter_critical();
-            app_callbacks.wakeup.call_callback = false;
-            bus->exit_critical();
-            if (app_callbacks.wakeup.callback != nullptr) {
-                app_callbacks.wakeup.callback(app_callbacks.wakeup.context);
-            }
+    // Start anything that was waiting for the hardware
+    bus->enter_critical();
+    issue_ops_locked();
+    bus->exit_critical();
+
+    if (release_bus_pending && !has_pending_ops()) {
+        int status = bus->release_bus(this);
+        assert(status != -1);
+        if (status == 1) {
+            release_bus_pending = false;
+            if (rel_bus.callback != nullptr)
+                rel_bus.callback(rel_bus.context);
         }
     }
-    else if (app_callbacks.update.call_callback) {
-        if (bus->set_general_call_mode(this, false)) {
-            bus->enter_critical();
-            app_callbacks.update.call_callback = false;
-            bus->exit_critical();
-            if (app_callbacks.update.callback != nullptr) {
-                app_callbacks.update.callback(app_callbacks.update.context);
-            }
-        }
+
+    // Ask Rp2040_i2c_bus::service() to come back if something is waiting for a
+    // retry rather than for an interrupt
+    bool again = release_bus_pending;
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+    again = again || addr_access.state != addr_idle;
+#endif
+    bus->enter_critical();
+    for (auto& op: ops) {
+        if (op.state == op_queued || op.state == op_done)
+            again = true;
     }
+    if (again)
+        bus->set_pending_locked(this);
+    bus->exit_critical();
 }
 
-bool rppicomidi::RP2040_MCP4728::fast_write(const uint16_t* chan_dat, uint8_t nchan, bool stop, void (*callback)(void* context), void* context)
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::fast_write(const uint16_t* chan_dat, uint8_t nchan, bool stop, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
     if (nchan > 4)
         return false;
-    uint8_t data[nchan*2];
-    app_callbacks.fast_write.callback = callback;
-    app_callbacks.fast_write.context = context;
-    // make sure data is big endian and limited to 2 bits of 
-    // powerdown code (bits 13:12) and 12 bits of DAC code (bits 11:0)
-    for (int chan = 0; chan < nchan; chan++) {
-        data[chan*2] = (chan_dat[chan] >> 8) & 0x3F;
-        data[chan*2+1] = chan_dat[chan] & 0xFF;
-    }
-    return bus->write(this, false, stop, data, nchan*2, fast_write_callback);
+    op_record* rec = alloc_op(write_op, callback, context);
+    if (rec == nullptr)
+        return false;
+    encode_fast_write(chan_dat, nchan, rec->buffer);
+    rec->nbytes = nchan*2;
+    rec->stop = stop;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::multi_write(const mcp4728_channel_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context)
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::write_frame(const uint8_t* frame, uint8_t nbytes, bool stop, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
-    if (nchan > 4)
+    if (nbytes == 0 || nbytes > 16)
+        return false;
+    op_record* rec = alloc_op(write_op, callback, context);
+    if (rec == nullptr)
         return false;
-    uint8_t data[nchan*3];
-    app_callbacks.multi_write.callback = callback;
-    app_callbacks.multi_write.context = context;
+    memcpy(rec->buffer, frame, nbytes);
+    rec->nbytes = nbytes;
+    rec->stop = stop;
+    return submit_op(rec, handle);
+}
+
+bool RP2040_MCP4728_RAM_FUNC rppicomidi::RP2040_MCP4728::multi_write(const mcp4728_channel_data* chan_dat, uint16_t nchan, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
+{
+    if (nchan == 0)
+        return false;
+    op_record* rec = alloc_op(nchan > 4 ? stream_op : write_op, callback, context);
+    if (rec == nullptr)
+        return false;
+    if (nchan > 4) {
+        rec->stream_src = chan_dat;
+        rec->stream_nchan = nchan;
+        return submit_op(rec, handle);
+    }
     // format the data for the multi-write command
     for (int chan = 0; chan < nchan; chan++) {
-        data[chan*3] = 0x40 | (chan_dat[chan].chan << 1) | chan_dat[chan].udac;
-        data[chan*3+1] = (chan_dat[chan].vref << 7) | (chan_dat[chan].pd << 5) | (chan_dat[chan].gain << 4) | ((chan_dat[chan].dac_code >> 8) & 0xF);
-        data[chan*3+2] = chan_dat[chan].dac_code & 0xFF;
+        mcp4728_encode::multi_write_channel(chan_dat[chan], rec->buffer + chan*3);
     }
-    return bus->write(this, false, true, data, nchan*3, multi_write_callback);
+    rec->nbytes = nchan*3;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::read_channels(mcp4728_channel_read_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context)
+#if RP2040_MCP4728_ENABLE_READ
+bool rppicomidi::RP2040_MCP4728::read_channels(mcp4728_channel_read_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
-    if (nchan > 8)
+    if (nchan > 8 || nchan == 0)
+        return false;
+    op_record* rec = alloc_op(read_op, callback, context);
+    if (rec == nullptr)
         return false;
-    app_callbacks.read.data = chan_dat;
-    app_callbacks.read.nchan = nchan;
-    app_callbacks.read.callback = callback;
-    app_callbacks.read.context = context;
-    memset(read_data, 0, sizeof(read_data));
-    return bus->read(this, false, true, read_data, nchan * 3, read_callback);
+    rec->read_dest = chan_dat;
+    rec->nchan = nchan;
+    rec->nbytes = nchan * 3;
+    memset(rec->buffer, 0, sizeof(rec->buffer));
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::poll_status(void (*callback)(void* context, bool is_busy, bool is_powered_on), void* context)
+bool rppicomidi::RP2040_MCP4728::poll_status(void (*callback)(void* context, bool is_busy, bool is_powered_on), void* context,
+    mcp4728_op_handle* handle)
 {
-    app_callbacks.status.callback = callback;
-    app_callbacks.status.context = context;
-    read_data[0] = 0;
-    return bus->read(this, false, true, read_data, 1, status_callback);
+    op_record* rec = alloc_op(status_op, nullptr, context);
+    if (rec == nullptr)
+        return false;
+    rec->status_callback = callback;
+    rec->nbytes = 1;
+    rec->buffer[0] = 0;
+    return submit_op(rec, handle);
 }
+#endif
 
-bool rppicomidi::RP2040_MCP4728::sequential_write_eeprom(const mcp4728_channel_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context)
+#if RP2040_MCP4728_ENABLE_EEPROM
+bool rppicomidi::RP2040_MCP4728::sequential_write_eeprom(const mcp4728_channel_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
     // the number of channels + the first channel number from 0 must be 4 or fewer
-    if (nchan > 4)
+    if (nchan > 4 || nchan == 0)
         return false;
-    app_callbacks.seq_write_eeprom.callback = callback;
-    app_callbacks.seq_write_eeprom.context = context;
-    uint8_t data[(2*nchan)+1];
-    if (nchan == 1) {
-        data[0] = 0x58 | (chan_dat[0].chan << 1) | chan_dat[0].udac;
-    }
-    else {
-        // channels A-D correspond to channel bitfield values 0x0-0x3.
-        data[0] = 0x50 | ((4 - nchan) << 1) | chan_dat[0].udac;
-    }
-    for (uint8_t chan = 0; chan < nchan; chan++) {
-        data[chan*2+1] = (chan_dat[chan].vref << 7) | (chan_dat[chan].pd << 5) | (chan_dat[chan].gain << 4) | ((chan_dat[chan].dac_code >> 8) & 0xF);
-        data[chan*2+2] = chan_dat[chan].dac_code & 0xFF;
-    }
-    return bus->write(this, false, true, data, sizeof(data), seq_write_eeprom_callback);
+    op_record* rec = alloc_op(write_op, callback, context);
+    if (rec == nullptr)
+        return false;
+    mcp4728_encode::seq_write_eeprom(chan_dat, nchan, rec->buffer);
+    rec->nbytes = (2*nchan)+1;
+    return submit_op(rec, handle);
 }
+#endif
 
-bool rppicomidi::RP2040_MCP4728::set_all_gains(bool gainA, bool gainB, bool gainC, bool gainD, void (*callback)(void* context), void* context)
+bool rppicomidi::RP2040_MCP4728::set_all_gains(bool gainA, bool gainB, bool gainC, bool gainD, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
-    app_callbacks.set_gain.callback = callback;
-    app_callbacks.set_gain.context = context;
-    uint8_t data = 0xC0 | (gainA?0x8:0)|(gainB?0x4:0)|(gainC?0x2:0)|(gainD?0x1:0);
-    return bus->write(this, false, true, &data, 1, gain_set_callback);
+    op_record* rec = alloc_op(write_op, callback, context);
+    if (rec == nullptr)
+        return false;
+    rec->buffer[0] = mcp4728_encode::gains(gainA, gainB, gainC, gainD);
+    rec->nbytes = 1;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::set_all_vrefs(bool vrefA, bool vrefB, bool vrefC, bool vrefD, void (*callback)(void* context), void* context)
+bool rppicomidi::RP2040_MCP4728::set_all_vrefs(bool vrefA, bool vrefB, bool vrefC, bool vrefD, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
-    app_callbacks.set_vref.callback = callback;
-    app_callbacks.set_vref.context = context;
-    uint8_t data = 0x80 | (vrefA?0x8:0)|(vrefB?0x4:0)|(vrefC?0x2:0)|(vrefD?0x1:0);
-    return bus->write(this, false, true, &data, 1, vref_set_callback);
+    op_record* rec = alloc_op(write_op, callback, context);
+    if (rec == nullptr)
+        return false;
+    rec->buffer[0] = mcp4728_encode::vrefs(vrefA, vrefB, vrefC, vrefD);
+    rec->nbytes = 1;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::set_all_pds(uint8_t pdA, uint8_t pdB, uint8_t pdC, uint8_t pdD, void (*callback)(void* context), void* context)
+bool rppicomidi::RP2040_MCP4728::set_all_pds(uint8_t pdA, uint8_t pdB, uint8_t pdC, uint8_t pdD, void (*callback)(void* context), void* context,
+    mcp4728_op_handle* handle)
 {
     if (pdA>3 || pdB>3 || pdC>3 || pdD>3)
         return false;
-    app_callbacks.set_pd.callback = callback;
-    app_callbacks.set_pd.context = context;
-    uint8_t data[2] = {static_cast<uint8_t>(0xA0 | (pdA << 2) | pdB), static_cast<uint8_t>((pdC << 6) | (pdD << 4))};
-    return bus->write(this, false, true, data, 2, pd_set_callback);
+    op_record* rec = alloc_op(write_op, callback, context);
+    if (rec == nullptr)
+        return false;
+    mcp4728_encode::pds(pdA, pdB, pdC, pdD, rec->buffer);
+    rec->nbytes = 2;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::reset(void (*callback)(void* context), void* context)
+#if RP2040_MCP4728_ENABLE_GENERAL_CALL
+bool rppicomidi::RP2040_MCP4728::reset(void (*callback)(void* context), void* context, mcp4728_op_handle* handle)
 {
-    if (!bus->set_general_call_mode(this, true))
+    op_record* rec = alloc_op(general_call_op, callback, context);
+    if (rec == nullptr)
         return false;
-    app_callbacks.reset.callback = callback;
-    app_callbacks.reset.context = context;
-    uint8_t data = 0x06;
-    return bus->write(this, false, true, &data, 1, reset_callback);
+    rec->buffer[0] = 0x06;
+    rec->nbytes = 1;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::wakeup(void (*callback)(void* context), void* context)
+bool rppicomidi::RP2040_MCP4728::wakeup(void (*callback)(void* context), void* context, mcp4728_op_handle* handle)
 {
-    if (!bus->set_general_call_mode(this, true))
+    op_record* rec = alloc_op(general_call_op, callback, context);
+    if (rec == nullptr)
         return false;
-    app_callbacks.wakeup.callback = callback;
-    app_callbacks.wakeup.context = context;
-    uint8_t data = 0x09;
-    return bus->write(this, false, true, &data, 1, wakeup_callback);
+    rec->buffer[0] = 0x09;
+    rec->nbytes = 1;
+    return submit_op(rec, handle);
 }
 
-bool rppicomidi::RP2040_MCP4728::update_all_channels(void (*callback)(void* context), void* context)
+bool rppicomidi::RP2040_MCP4728::update_all_channels(void (*callback)(void* context), void* context, mcp4728_op_handle* handle)
 {
-    if (!bus->set_general_call_mode(this, true))
+    op_record* rec = alloc_op(general_call_op, callback, context);
+    if (rec == nullptr)
         return false;
-    app_callbacks.update.callback = callback;
-    app_callbacks.update.context = context;
-    uint8_t data = 0x08;
-    return bus->write(this, false, true, &data, 1, update_callback);
+    rec->buffer[0] = 0x08;
+    rec->nbytes = 1;
+    return submit_op(rec, handle);
 }
+#endif
 
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
 #define BIT_TIME 2
 
-bool rppicomidi::RP2040_MCP4728::bit_bang_8_bits(uint8_t write_byte, uint8_t& read_byte, bool ignore_nak, uint sda_pin, uint scl_pin, bool change_ldac)
+void rppicomidi::RP2040_MCP4728::bit_bang_begin(uint sda_pin, uint scl_pin)
 {
-    if (ldac_gpio == no_ldac_gpio)
+    // Make the I2C pins GPIO pins instead; driving a pin low means making it an output
+    gpio_set_dir(sda_pin, false);
+    gpio_set_dir(scl_pin, false);
+    gpio_put(sda_pin, false);
+    gpio_put(scl_pin, false);
+    gpio_set_function(sda_pin, GPIO_FUNC_SIO);
+    gpio_set_function(scl_pin, GPIO_FUNC_SIO);
+    sleep_us(BIT_TIME);
+}
+
+void rppicomidi::RP2040_MCP4728::bit_bang_start(uint sda_pin, uint scl_pin)
+{
+    gpio_set_dir(sda_pin, true);
+    sleep_us(BIT_TIME);
+    gpio_set_dir(scl_pin, true);
+    sleep_us(BIT_TIME);
+}
+
+void rppicomidi::RP2040_MCP4728::bit_bang_stop(uint sda_pin, uint scl_pin)
+{
+    gpio_set_dir(sda_pin, true);
+    sleep_us(BIT_TIME);
+    gpio_set_dir(scl_pin, false);
+    sleep_us(BIT_TIME);
+    gpio_set_dir(sda_pin, false);
+    sleep_us(BIT_TIME);
+}
+
+bool rppicomidi::RP2040_MCP4728::bit_bang_8_bits(uint8_t write_byte, uint8_t& read_byte, bool ignore_nak, uint sda_pin, uint scl_pin, uint ldac_gpio, bool change_ldac)
+{
+    if (change_ldac && ldac_gpio == no_ldac_gpio)
         return false;
 
     uint8_t mask = 0x80;
@@ -398,101 +627,96 @@ bool rppicomidi::RP2040_MCP4728::bit_bang_8_bits(uint8_t write_byte, uint8_t& re
     return timeout != 0;
 }
 
-bool rppicomidi::RP2040_MCP4728::access_addr_bits(uint8_t new_addr, uint8_t& read_addr)
+bool rppicomidi::RP2040_MCP4728::bit_bang_addr_bits(uint sda_pin, uint scl_pin, uint ldac_gpio, uint8_t cur_addr, uint8_t new_addr, uint8_t& read_addr)
 {
-    if (ldac_gpio == no_ldac_gpio || !bus->deinit_i2c_bus(this)) {
+    if (ldac_gpio == no_ldac_gpio)
         return false;
-    }
-    uint64_t final_wait_us = 100;
-    // Make the I2C pins GPIO pins instead
-    uint sda_pin, scl_pin;
-    bus->get_bus_pins(sda_pin, scl_pin);
-    gpio_set_dir(sda_pin, false);
-    gpio_set_dir(scl_pin, false);
-    gpio_put(sda_pin, false);
-    gpio_put(scl_pin, false);
-    gpio_set_function(sda_pin, GPIO_FUNC_SIO);
-    gpio_set_function(scl_pin, GPIO_FUNC_SIO);
-    sleep_us(BIT_TIME);
     // Make sure the ldac_pin is a GPIO output initialized to high
     gpio_put(ldac_gpio, true);
 
     // Send a Start Bit
-    gpio_set_dir(sda_pin, true);
-    sleep_us(BIT_TIME);
-    gpio_set_dir(scl_pin, true);
-    sleep_us(BIT_TIME);
+    bit_bang_start(sda_pin, scl_pin);
 
     // Send the address
-    uint8_t byte = new_addr == 0 ? 0:(addr << 1);
+    uint8_t byte = new_addr == 0 ? 0:(cur_addr << 1);
     uint8_t read_byte = 0;
-
-    if (!bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, false)) {
-        bus->reinit_i2c_bus(this);
-        return false;
-    }
+    bool success = bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, ldac_gpio, false);
 
     // send the command
-    if (new_addr == 0) {
+    if (success && new_addr == 0) {
         // read old address command
         byte = 0x0C;
-        if (!bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, true)) {
-            bus->reinit_i2c_bus(this);
-            return false;
-        } 
-        // Repeated Start
-        gpio_set_dir(scl_pin, false); // clock high
-        sleep_us(BIT_TIME);
-        gpio_set_dir(sda_pin, true);
-        sleep_us(BIT_TIME);
-        gpio_set_dir(scl_pin, true);
-        sleep_us(BIT_TIME);
-        byte = 0xC1;
-        if (!bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, true)) {
-            bus->reinit_i2c_bus(this);
-            return false;
+        success = bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, ldac_gpio, true);
+        if (success) {
+            // Repeated Start
+            gpio_set_dir(scl_pin, false); // clock high
+            sleep_us(BIT_TIME);
+            bit_bang_start(sda_pin, scl_pin);
+            byte = 0xC1;
+            success = bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, ldac_gpio, true);
         }
-
-        byte = 0xFF; // for read
-        if (!bit_bang_8_bits(byte, read_addr, true, sda_pin, scl_pin, false)) {
-            bus->reinit_i2c_bus(this);
-            return false;
+        if (success) {
+            byte = 0xFF; // for read
+            success = bit_bang_8_bits(byte, read_addr, true, sda_pin, scl_pin, ldac_gpio, false);
         }
-        // Make current address the address that was read back.
-        addr = ((read_addr >> 1) & 0x7) | 0x60;
     }
-    else {
+    else if (success) {
         // writing a new address. Send command with current address bits encoded
-        byte = ((addr & 0x7) << 2) | 0x61;
-        if (!bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, true)) {
-            bus->reinit_i2c_bus(this);
-            return false;
-        }
+        byte = ((cur_addr & 0x7) << 2) | 0x61;
+        success = bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, ldac_gpio, true);
         // Send the new address
-        byte = ((new_addr & 0x7) << 2) | 0x62;
-        if (!bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, false)) {
-            bus->reinit_i2c_bus(this);
-            return false;
+        if (success) {
+            byte = ((new_addr & 0x7) << 2) | 0x62;
+            success = bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, ldac_gpio, false);
         }
         // Send new address confirmation
-        byte = ((new_addr & 0x7) << 2) | 0x63;
-        if (!bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, false)) {
-            bus->reinit_i2c_bus(this);
-            return false;
+        if (success) {
+            byte = ((new_addr & 0x7) << 2) | 0x63;
+            success = bit_bang_8_bits(byte, read_byte, false, sda_pin, scl_pin, ldac_gpio, false);
         }
-        // The new address is active. Update the target address
-        addr = new_addr;
-        final_wait_us = 60000; // write time speicifed max is 50ms. Pad it some
     }
     gpio_put(ldac_gpio, true);   // Done with LDAC\ signaling
 
-    
     // Stop condition
-    gpio_set_dir(sda_pin, true);
-    sleep_us(BIT_TIME);
-    gpio_set_dir(scl_pin, false);
-    sleep_us(BIT_TIME);
-    gpio_set_dir(sda_pin, false);
+    bit_bang_stop(sda_pin, scl_pin);
+    return success;
+}
+
+bool rppicomidi::RP2040_MCP4728::bit_bang_read_status(uint sda_pin, uint scl_pin, uint8_t addr_, uint8_t& status)
+{
+    bit_bang_start(sda_pin, scl_pin);
+    uint8_t read_byte;
+    bool success = bit_bang_8_bits((addr_ << 1) | 1, read_byte, false, sda_pin, scl_pin, no_ldac_gpio, false);
+    if (success) {
+        // Read the first byte and NAK it to end the read
+        success = bit_bang_8_bits(0xFF, status, true, sda_pin, scl_pin, no_ldac_gpio, false);
+    }
+    bit_bang_stop(sda_pin, scl_pin);
+    return success;
+}
+
+bool rppicomidi::RP2040_MCP4728::access_addr_bits(uint8_t new_addr, uint8_t& read_addr)
+{
+    if (ldac_gpio == no_ldac_gpio || !bus->deinit_i2c_bus(this)) {
+        return false;
+    }
+    uint64_t final_wait_us = 100;
+    uint sda_pin, scl_pin;
+    bus->get_bus_pins(sda_pin, scl_pin);
+    bit_bang_begin(sda_pin, scl_pin);
+    if (!bit_bang_addr_bits(sda_pin, scl_pin, ldac_gpio, addr, new_addr, read_addr)) {
+        bus->reinit_i2c_bus(this);
+        return false;
+    }
+    if (new_addr == 0) {
+        // Make current address the address that was read back.
+        addr = ((read_addr >> 1) & 0x7) | 0x60;
+    }
+    else {
+        // The new address is active. Update the target address
+        addr = new_addr;
+        final_wait_us = 60000; // write time speicifed max is 50ms. Pad it some
+    }
     sleep_us(final_wait_us);
     // restore I2C function
     if (!bus->reinit_i2c_bus(this)) {
@@ -500,6 +724,7 @@ bool rppicomidi::RP2040_MCP4728::access_addr_bits(uint8_t new_addr, uint8_t& rea
     }
     return true;
 }
+#endif
 
 bool rppicomidi::RP2040_MCP4728::set_ldac_pin(bool is_high)
 {
@@ -507,4 +732,271 @@ bool rppicomidi::RP2040_MCP4728::set_ldac_pin(bool is_high)
         return false;
     gpio_put(ldac_gpio, is_high);
     return true;
-}
\ No newline at end of file
+}
+
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+// The bit time for access_addr_bits_async(). Each bit takes 3 timer ticks.
+#define ADDR_ACCESS_TICK_US 5
+// The maximum number of ticks to wait for clock stretching or for ACK
+#define ADDR_ACCESS_MAX_WAIT_TICKS 100
+// How long to wait for the EEPROM write (specified max is 50ms) and how often to poll it
+#define ADDR_ACCESS_EEPROM_TIMEOUT_US 100000
+#define ADDR_ACCESS_EEPROM_POLL_US 1000
+
+bool rppicomidi::RP2040_MCP4728::access_addr_bits_async(uint8_t new_addr, void (*callback)(void* context, bool success, uint8_t read_addr), void* context,
+    bool wait_for_eeprom)
+{
+    if (ldac_gpio == no_ldac_gpio || addr_access.state != addr_idle || has_pending_ops() ||
+            !(new_addr == 0 || (new_addr >= 0x60 && new_addr <= 0x67))) {
+        return false;
+    }
+    auto& aa = addr_access;
+    // Build the list of bytes to send; see access_addr_bits() for the protocol
+    if (new_addr == 0) {
+        aa.bytes[0] = 0;    // general call
+        aa.flags[0] = 0;
+        aa.bytes[1] = 0x0C; // read address bits command
+        aa.flags[1] = addr_byte_ldac;
+        aa.bytes[2] = 0xC1;
+        aa.flags[2] = addr_byte_restart | addr_byte_ldac;
+        aa.bytes[3] = 0xFF;
+        aa.flags[3] = addr_byte_read;
+    }
+    else {
+        aa.bytes[0] = addr << 1;
+        aa.flags[0] = 0;
+        aa.bytes[1] = ((addr & 0x7) << 2) | 0x61;
+        aa.flags[1] = addr_byte_ldac;
+        aa.bytes[2] = ((new_addr & 0x7) << 2) | 0x62;
+        aa.flags[2] = 0;
+        aa.bytes[3] = ((new_addr & 0x7) << 2) | 0x63;
+        aa.flags[3] = 0;
+    }
+    aa.nbytes = 4;
+    aa.byte_idx = 0;
+    aa.bit = 7;
+    aa.phase = addr_start_sda;
+    aa.wait_ticks = 0;
+    aa.read_byte = 0;
+    aa.new_addr = new_addr;
+    aa.wait_for_eeprom = wait_for_eeprom;
+    aa.poll_pending = false;
+    aa.callback = callback;
+    aa.context = context;
+    if (!bus->deinit_i2c_bus(this))
+        return false;
+    bus->get_bus_pins(aa.sda_pin, aa.scl_pin);
+    bit_bang_begin(aa.sda_pin, aa.scl_pin);
+    gpio_put(ldac_gpio, true);
+    aa.state = addr_bit_banging;
+    if (!add_repeating_timer_us(-ADDR_ACCESS_TICK_US, addr_access_timer_callback, this, &aa.timer)) {
+        aa.state = addr_idle;
+        bus->reinit_i2c_bus(this);
+        return false;
+    }
+    bus->set_pending(this); // task() watches for the end of the access
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728::addr_access_timer_callback(repeating_timer_t* rt)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728*>(rt->user_data);
+    return me->addr_access_step();
+}
+
+void rppicomidi::RP2040_MCP4728::addr_access_next_byte()
+{
+    auto& aa = addr_access;
+    if (aa.byte_idx >= aa.nbytes) {
+        aa.phase = addr_stop_sda;
+    }
+    else if (aa.flags[aa.byte_idx] & addr_byte_restart) {
+        aa.phase = addr_restart_scl_high;
+    }
+    else {
+        aa.bit = 7;
+        aa.phase = addr_bit_sda;
+    }
+}
+
+bool rppicomidi::RP2040_MCP4728::addr_access_step()
+{
+    // One step of the I2C with LDAC protocol per timer tick. Returns false to stop the timer.
+    auto& aa = addr_access;
+    switch(aa.phase) {
+    case addr_start_sda:
+        gpio_set_dir(aa.sda_pin, true);
+        aa.phase = addr_start_scl;
+        break;
+    case addr_start_scl:
+        gpio_set_dir(aa.scl_pin, true);
+        addr_access_next_byte();
+        break;
+    case addr_restart_scl_high:
+        gpio_set_dir(aa.scl_pin, false);
+        aa.phase = addr_restart_sda;
+        break;
+    case addr_restart_sda:
+        gpio_set_dir(aa.sda_pin, true);
+        aa.phase = addr_restart_scl_low;
+        break;
+    case addr_restart_scl_low:
+        gpio_set_dir(aa.scl_pin, true);
+        aa.bit = 7;
+        aa.phase = addr_bit_sda;
+        break;
+    case addr_bit_sda:
+        gpio_set_dir(aa.sda_pin, ((aa.bytes[aa.byte_idx] >> aa.bit) & 1) == 0);
+        aa.phase = addr_bit_scl_high;
+        break;
+    case addr_bit_scl_high:
+        gpio_set_dir(aa.scl_pin, false);
+        aa.wait_ticks = 0;
+        aa.phase = addr_bit_sample;
+        break;
+    case addr_bit_sample:
+        if (!gpio_get(aa.scl_pin)) {
+            // clock stretching
+            if (++aa.wait_ticks > ADDR_ACCESS_MAX_WAIT_TICKS)
+                break;
+            return true;
+        }
+        if (gpio_get(aa.sda_pin))
+            aa.read_byte |= (1 << aa.bit);
+        gpio_set_dir(aa.scl_pin, true);
+        if (aa.bit == 0) {
+            if (aa.flags[aa.byte_idx] & addr_byte_ldac)
+                gpio_put(ldac_gpio, false);
+            aa.phase = addr_ack_sda;
+        }
+        else {
+            --aa.bit;
+            aa.phase = addr_bit_sda;
+        }
+        return true;
+    case addr_ack_sda:
+        gpio_set_dir(aa.sda_pin, false);
+        aa.phase = addr_ack_scl_high;
+        break;
+    case addr_ack_scl_high:
+        gpio_set_dir(aa.scl_pin, false);
+        aa.wait_ticks = 0;
+        aa.phase = addr_ack_sample;
+        break;
+    case addr_ack_sample:
+        if (!gpio_get(aa.scl_pin) || (!(aa.flags[aa.byte_idx] & addr_byte_read) && gpio_get(aa.sda_pin))) {
+            // clock stretching or waiting for ACK
+            if (++aa.wait_ticks > ADDR_ACCESS_MAX_WAIT_TICKS)
+                break;
+            return true;
+        }
+        gpio_set_dir(aa.scl_pin, true);
+        if (!(aa.flags[aa.byte_idx] & addr_byte_read))
+            aa.read_byte = 0; // only keep the bits of the byte read from the chip
+        ++aa.byte_idx;
+        addr_access_next_byte();
+        return true;
+    case addr_stop_sda:
+        gpio_put(ldac_gpio, true);   // Done with LDAC\ signaling
+        gpio_set_dir(aa.sda_pin, true);
+        aa.phase = addr_stop_scl;
+        return true;
+    case addr_stop_scl:
+        gpio_set_dir(aa.scl_pin, false);
+        aa.phase = addr_stop_release;
+        return true;
+    case addr_stop_release:
+        gpio_set_dir(aa.sda_pin, false);
+        aa.state = addr_bit_bang_done;
+        return false;
+    }
+    if (aa.wait_ticks > ADDR_ACCESS_MAX_WAIT_TICKS) {
+        // timed out; release everything
+        gpio_put(ldac_gpio, true);
+        gpio_set_dir(aa.sda_pin, false);
+        gpio_set_dir(aa.scl_pin, false);
+        aa.state = addr_bit_bang_failed;
+        return false;
+    }
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728::addr_access_finish(bool success)
+{
+    auto callback = addr_access.callback;
+    auto context = addr_access.context;
+    uint8_t read_addr = addr_access.read_byte;
+    addr_access.state = addr_idle;
+    if (callback)
+        callback(context, success, read_addr);
+}
+
+void rppicomidi::RP2040_MCP4728::addr_access_poll_callback(void* context, bool is_busy, bool)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728*>(context);
+    me->addr_access.poll_pending = false;
+    if (!is_busy)
+        me->addr_access_finish(true);
+    else
+        me->addr_access.next_poll = make_timeout_time_us(ADDR_ACCESS_EEPROM_POLL_US);
+}
+
+void rppicomidi::RP2040_MCP4728::addr_access_task()
+{
+    auto& aa = addr_access;
+    switch(aa.state) {
+    case addr_bit_bang_done:
+        if (!bus->reinit_i2c_bus(this)) {
+            addr_access_finish(false);
+            break;
+        }
+        if (aa.new_addr == 0) {
+            // Make current address the address that was read back.
+            addr = ((aa.read_byte >> 1) & 0x7) | 0x60;
+            bus->set_target_addr(this, addr);
+            addr_access_finish(true);
+        }
+        else {
+            // The new address is active. Update the target address
+            addr = aa.new_addr;
+            bus->set_target_addr(this, addr);
+            if (aa.wait_for_eeprom) {
+                aa.deadline = make_timeout_time_us(ADDR_ACCESS_EEPROM_TIMEOUT_US);
+                aa.next_poll = get_absolute_time();
+                aa.state = addr_eeprom_wait;
+            }
+            else {
+                addr_access_finish(true);
+            }
+        }
+        break;
+    case addr_bit_bang_failed:
+        bus->reinit_i2c_bus(this);
+        addr_access_finish(false);
+        break;
+    case addr_eeprom_wait:
+        if (time_reached(aa.deadline)) {
+            if (aa.poll_pending) {
+                // The status read never finished. Retire its record so the callback
+                // never runs and reset the I2C hardware to drop the stuck transfer.
+                op_record* rec = find_op(aa.poll_handle);
+                bus->enter_critical();
+                if (rec && (rec->generation & 0xFFF) == (aa.poll_handle >> 3) && rec->state != op_free) {
+                    rec->state = op_free;
+                    rec->generation++;
+                }
+                bus->exit_critical();
+                bus->reinit_i2c_bus(this);
+                aa.poll_pending = false;
+            }
+            addr_access_finish(false);
+        }
+        else if (!aa.poll_pending && time_reached(aa.next_poll)) {
+            aa.poll_pending = poll_status(addr_access_poll_callback, this, &aa.poll_handle);
+        }
+        break;
+    default:
+        break;
+    }
+}
+#endif
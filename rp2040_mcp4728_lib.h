@@ -24,15 +24,46 @@
  */
 #pragma once
 #include "rp2040_i2c_lib.h"
+#include "rp2040_mcp4728_frames.h"
+#include "pico/time.h"
+#ifndef RP2040_MCP4728_MAX_PENDING_OPS
+// The number of operations that may be submitted to one MCP4728 before the
+// callback for the oldest one is delivered by task(). Must be 1-8.
+#define RP2040_MCP4728_MAX_PENDING_OPS 4
+#endif
+// Feature switches. Set any of these to 0 to compile out a command family
+// the application does not use.
+#ifndef RP2040_MCP4728_ENABLE_EEPROM
+// sequential_write_eeprom()
+#define RP2040_MCP4728_ENABLE_EEPROM 1
+#endif
+#ifndef RP2040_MCP4728_ENABLE_GENERAL_CALL
+// reset(), wakeup(), wake_up() and update_all_channels()
+#define RP2040_MCP4728_ENABLE_GENERAL_CALL 1
+#endif
+#ifndef RP2040_MCP4728_ENABLE_READ
+// read_channels() and poll_status()
+#define RP2040_MCP4728_ENABLE_READ 1
+#endif
+#ifndef RP2040_MCP4728_ENABLE_ADDR_BITS
+// access_addr_bits(), access_addr_bits_async() and the bit_bang_ helpers
+#define RP2040_MCP4728_ENABLE_ADDR_BITS 1
+#endif
+#if RP2040_MCP4728_ENABLE_ADDR_BITS && !RP2040_MCP4728_ENABLE_READ
+#error "RP2040_MCP4728_ENABLE_ADDR_BITS requires RP2040_MCP4728_ENABLE_READ"
+#endif
 namespace rppicomidi {
-struct mcp4728_channel_data
-{
-    uint8_t chan;       // the DAC channel 0-3=>A-D
-    uint8_t udac;       // 0 to update DAC channel after input register is written; 1 updates the input register only
-    uint8_t vref;       // 0 Vref=VDD. 1 Vref=2.048V
-    uint8_t pd;         // 0b00 Power On. 0b01 Vout loaded 1K to ground. 0b10 Vout loaded 100K to ground. 0b10 Vout loaded 500k to ground
-    uint8_t gain;       // 0 gain=1. 1 gain=2.
-    uint16_t dac_code;  // 12-bit DAC output value 0-4095
+/**
+ * Identifies one submitted MCP4728 operation. Negative values are invalid.
+ */
+typedef int16_t mcp4728_op_handle;
+
+enum mcp4728_op_status {
+    mcp4728_op_invalid,     // the handle was never valid
+    mcp4728_op_queued,      // submitted but waiting for the I2C hardware
+    mcp4728_op_in_flight,   // the I2C hardware is working on it
+    mcp4728_op_done,        // the I2C transfer is done but task() has not called the callback yet
+    mcp4728_op_complete     // the callback has been called (or there was none); the handle is retired
 };
 
 struct mcp4728_channel_read_data : public mcp4728_channel_data
@@ -46,6 +77,7 @@ class RP2040_MCP4728 : public RP2040_i2c_device
 {
 public:
     static const uint no_ldac_gpio=0xFFFF;
+    static const mcp4728_op_handle invalid_op=-1;
     /**
      * @brief constructor
      *
@@ -57,10 +89,59 @@ public:
     RP2040_MCP4728(uint16_t addr_, Rp2040_i2c_bus* bus_, uint ldac_=no_ldac_gpio, bool ldac_invert_=false);
 
     /**
-     * poll the status of pending operations and call callback functions if needed
+     * poll the status of pending operations, start queued operations, and
+     * call callback functions if needed. If this device is attached to the bus
+     * (see Rp2040_i2c_bus::attach()), Rp2040_i2c_bus::service() calls it only
+     * when there is something to do.
      */
     void task();
 
+    /**
+     * @brief get the status of a previously submitted operation
+     *
+     * @return the operation status. Once the operation's callback has been called, the
+     * status is mcp4728_op_complete until the handle is reused much later.
+     * @param handle the handle returned by the operation function
+     */
+    mcp4728_op_status get_op_status(mcp4728_op_handle handle);
+
+    /**
+     * @brief call task() until the operation is complete or until timeout_us elapses
+     *
+     * @return true if the operation is complete, false if the wait timed out
+     * @param handle the handle returned by the operation function
+     * @param timeout_us the maximum time to wait in microseconds
+     * @note this function blocks; it is most useful during initialization
+     */
+    bool wait_op(mcp4728_op_handle handle, uint32_t timeout_us);
+
+    /**
+     * @brief
+     *
+     * @return true if any submitted operation has not yet had its callback called
+     */
+    bool has_pending_ops();
+
+    /**
+     * @brief
+     *
+     * @return true if an operation record is free, so the next write function call
+     * will not fail for lack of one
+     */
+    bool has_free_op();
+
+    /**
+     * @brief set a function to call as soon as there is something for task() to do
+     *
+     * The notify function is called when I2C operations finish and when this device
+     * gets the bus after request_bus() returned 0. It is called from the I2C IRQ or from
+     * another device's release_bus(), always in the bus critical section, so it must only
+     * wake up whatever calls task() (for example, give an RTOS task notification).
+     * @param notify the function to call or nullptr for none
+     * @param context the parameter to pass to notify
+     */
+    void set_irq_notify(void (*notify)(void* context), void* context) { irq_notify_context = context; irq_notify = notify; }
+
     /**
      * @brief request to make this device the active device on the I2C bus
      *
@@ -108,23 +189,76 @@ public:
      * transfer for each function call. (optional)
      * @param callback is the function called when write completes (optional)
      * @param context is the context paramter passed to the callback function (optional)
+     * @param handle if not nullptr, receives the handle of the submitted operation (optional)
+     */
+    bool fast_write(const uint16_t* chan_dat, uint8_t nchan, bool stop=true, void (*callback)(void* context)=nullptr, void* context=nullptr,
+        mcp4728_op_handle* handle=nullptr);
+
+    /**
+     * @brief write a frame of bytes that is already encoded as one or more MCP4728 commands.
+     *
+     * Use this with encode_fast_write(), the frame builders in rp2040_mcp4728_frames.h,
+     * or other pre-encoded command bytes so that
+     * the command encoding does not have to happen every time the frame is sent.
+     * @return true if successful, false if issues accessing the I2C bus or nbytes > 16
+     * @param frame the encoded command bytes. The bytes are copied, so frame may be
+     * reused as soon as this function returns; it may point to flash.
+     * @param nbytes the number of bytes in the frame (1-16)
+     * @param stop is true to send I2C stop after the frame (see fast_write())
+     * @param callback is the function called when write completes (optional)
+     * @param context is the context paramter passed to the callback function (optional)
+     * @param handle if not nullptr, receives the handle of the submitted operation (optional)
+     */
+    bool write_frame(const uint8_t* frame, uint8_t nbytes, bool stop=true, void (*callback)(void* context)=nullptr, void* context=nullptr,
+        mcp4728_op_handle* handle=nullptr);
 
+    /**
+     * @brief write a frame built by one of the constexpr builders in rp2040_mcp4728_frames.h
+     *
+     * See the other write_frame() for the parameters.
      */
-    bool fast_write(const uint16_t* chan_dat, uint8_t nchan, bool stop=true, void (*callback)(void* context)=nullptr, void* context=nullptr);
+    template<size_t N>
+    bool write_frame(const std::array<uint8_t, N>& frame, bool stop=true, void (*callback)(void* context)=nullptr, void* context=nullptr,
+        mcp4728_op_handle* handle=nullptr) {
+        static_assert(N >= 1 && N <= 16, "write_frame() frames are 1-16 bytes");
+        return write_frame(frame.data(), N, stop, callback, context, handle);
+    }
+
+    /**
+     * @brief encode fast write command bytes the same way fast_write() does
+     *
+     * @param chan_dat is an array of 12-bit DAC channel outputs with the power-down code in bits 13:12
+     * @param nchan the number of channels to encode (1-4)
+     * @param frame points to at least nchan*2 bytes that receive the encoded command
+     */
+    static void encode_fast_write(const uint16_t* chan_dat, uint8_t nchan, uint8_t* frame) {
+        // make sure data is big endian and limited to 2 bits of
+        // powerdown code (bits 13:12) and 12 bits of DAC code (bits 11:0)
+        for (uint8_t chan = 0; chan < nchan; chan++) {
+            mcp4728_encode::fast_write_channel(chan_dat[chan], frame + chan*2);
+        }
+    }
 
     /**
      * @brief write nchan of channel data to the DAC (no EEPROM update); the channels
-     * written are specified in the chan_dat array; channel order is arbitrary;
-     * nchan no greater than 4.
+     * written are specified in the chan_dat array; channel order is arbitrary and
+     * the same channel may appear more than once.
      *
-     * @return true if successful, false if issues accessing the I2C bus or nchan > 4
+     * All nchan records go out in one I2C transaction. Up to 4 records are copied
+     * before this function returns. Longer arrays are encoded as the I2C hardware
+     * sends them, so chan_dat must stay valid until the operation completes.
+     *
+     * @return true if successful, false if issues accessing the I2C bus or nchan is 0
      * @param chan_dat the array of DAC values to write (MCP4728)
-     * @param nchan the number of channels (1-4).
+     * @param nchan the number of channel records
      * @param callback is the function called when write completes (optional)
      * @param context is the context paramter passed to the callback function (optional)
+     * @param handle if not nullptr, receives the handle of the submitted operation (optional)
      */
-    bool multi_write(const mcp4728_channel_data* chan_dat, uint8_t nchan, void (*callback)(void* context)=nullptr, void* context=nullptr);
+    bool multi_write(const mcp4728_channel_data* chan_dat, uint16_t nchan, void (*callback)(void* context)=nullptr, void* context=nullptr,
+        mcp4728_op_handle* handle=nullptr);
 
+#if RP2040_MCP4728_ENABLE_EEPROM
     /**
      * @brief Write to DAC outputs and EEPROM. If nchan == 1, write to one of
      * channel A, B, C, or D. If nchan > 1, write to sequential channels C-D, or 
@@ -140,11 +274,15 @@ public:
      * @param nchan is the number of channels to write.
      * @param callback is the function called when write completes (optional)
      * @param context is the context paramter passed to the callback function
+     * @param handle if not nullptr, receives the handle of the submitted operation (optional)
      * @note after transfer completes and EEPROM write starts, further writes will be ignored
      * until the RDY/BSY flag clears (call poll_status() or monitor the RDY/BSY\ pin)
      */
-    bool sequential_write_eeprom(const mcp4728_channel_data* chan_dat, uint8_t nchan, void (*callback)(void* context)=nullptr, void* context=nullptr);
+    bool sequential_write_eeprom(const mcp4728_channel_data* chan_dat, uint8_t nchan, void (*callback)(void* context)=nullptr, void* context=nullptr,
+        mcp4728_op_handle* handle=nullptr);
+#endif
 
+#if RP2040_MCP4728_ENABLE_READ
     /**
      * @brief read out nchan DAC register values alternating between DAC output values and EEPROM values
      *
@@ -156,11 +294,13 @@ public:
      * the last channel's EEPROM data is not read.
      * @param callback is the function to call when all nchan channels are read
      * @param context is the context parameter to use for the callback function
+     * @param handle if not nullptr, receives the handle of the submitted operation (optional)
      * @note although it is possible to set the callback function pointer to nullptr, it is
-     * not recommended. It is the only way to know if the chan_dat array contains the read
-     * data or not.
+     * not recommended unless you wait on the handle. The chan_dat array is filled in by
+     * task() just before the callback is called.
      */
-    bool read_channels(mcp4728_channel_read_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context);
+    bool read_channels(mcp4728_channel_read_data* chan_dat, uint8_t nchan, void (*callback)(void* context), void* context,
+        mcp4728_op_handle* handle=nullptr);
 
     /**
      * @brief read the DAC A register to discover MCP4728 status and call a callback with the status information
@@ -171,8 +311,11 @@ public:
      * is true if the MCP4728 is still writing to EEPROM. The is_powered_on parameter is true if the
      * Vdd > Vpor.
      * @param context is the context parameter to use for the callback function
+     * @param handle if not nullptr, receives the handle of the submitted operation (optional)
      */
-    bool poll_status(void (*callback)(void* context, bool is_busy, bool is_powered_on), void* context);
+    bool poll_status(void (*callback)(void* context, bool is_busy, bool is_powered_on), void* context,
+        mcp4728_op_handle* handle=nullptr);
+#endif
 
     /**
      * @brief set the gain values for all channels
@@ -183,7 +326,7 @@ public:
      * @param gainC is true for channel C gain=2, false for gain=1
      * @param gainD is true for channel D gain=2, false for gain=1
      */
-    bool set_all_gains(bool gainA, bool gainB, bool gainC, bool gainD, void (*callback)(void* context), void* context);
+    bool set_all_gains(bool gainA, bool gainB, bool gainC, bool gainD, void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
 
     /**
      * @brief set the Vref values for all channels
@@ -194,7 +337,7 @@ public:
      * @param vrefC is true for channel C Vref=2.048V, false for Vref=Vdd
      * @param vrefD is true for channel D Vref=2.048V, false for Vref=Vdd
      */
-    bool set_all_vrefs(bool gainA, bool gainB, bool gainC, bool gainD, void (*callback)(void* context), void* context);
+    bool set_all_vrefs(bool gainA, bool gainB, bool gainC, bool gainD, void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
 
     /**
      * @brief set the PD values for all channels
@@ -205,32 +348,35 @@ public:
      * @param pdC is PD value 0-3 for channel A
      * @param pdD is true for channel D Vref=2.048V, false for Vref=Vdd
      */
-    bool set_all_pds(uint8_t pdA, uint8_t pdB, uint8_t pdC, uint8_t pdD, void (*callback)(void* context), void* context);
+    bool set_all_pds(uint8_t pdA, uint8_t pdB, uint8_t pdC, uint8_t pdD, void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
 
+#if RP2040_MCP4728_ENABLE_GENERAL_CALL
     /**
      * @brief send the reset command to all devices on the same bus as this MCP4728
      *
      * @return true if successful or false if the DAC does not have I2C bus access
      */
-    bool reset(void (*callback)(void* context), void* context);
+    bool reset(void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
 
     /**
      * @brief send the wakeup command to all devices on the same bus as this MCP4728
      *
      * @return true if successful or false if the DAC does not have I2C bus access
      */
-    bool wakeup(void (*callback)(void* context), void* context);
+    bool wakeup(void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
 
     /**
      * @brief send the wake-up command to all devices on the same bus as this MCP4728
      */
-    bool wake_up(void (*callback)(void* context), void* context);
+    bool wake_up(void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
 
     /**
      * @brief send the general call software update command to all devices on the same bus as this MCP4728
      */
-    bool update_all_channels(void (*callback)(void* context), void* context);
+    bool update_all_channels(void (*callback)(void* context), void* context, mcp4728_op_handle* handle=nullptr);
+#endif
 
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
     /**
      * @brief this bit bangs the MCP4728 I2C with LDAC protocol
      * for reading and writing the MCP4728's I2C address bits.
@@ -250,6 +396,39 @@ public:
      */
     bool access_addr_bits(uint8_t new_addr, uint8_t& read_addr);
 
+    /**
+     * @brief the non-blocking version of access_addr_bits().
+     *
+     * A repeating timer interrupt bit bangs the I2C with LDAC protocol, so the
+     * calling core keeps running. When the bit banging is done, task() restores
+     * the on-chip I2C. If a new address was written and wait_for_eeprom is true,
+     * task() polls the chip at its new address until the EEPROM write is done
+     * instead of waiting a fixed time. Then task() calls the callback.
+     * @return true if the operation started, false if this device does not have access
+     * to the I2C bus, has pending operations, new_addr is not valid, there is no LDAC
+     * GPIO, or an address access is already in progress.
+     * @param new_addr Valid new_addr values are 0, or 0x60-0x67.
+     * Use new_addr=0 to for general call read device address or
+     * set new_addr to 0x60-0x67 to update the address bits to 0-7
+     * @param callback is called from task() when the access is complete. success is
+     * false if the chip did not respond or the EEPROM write did not finish in time.
+     * read_addr has the same meaning as for access_addr_bits().
+     * @param context is the context parameter for the callback function
+     * @param wait_for_eeprom if true and new_addr is not 0, do not call the callback until the
+     * chip's EEPROM write is complete. If false, call the callback as soon as the address
+     * is sent; the caller must then wait for the chip to be ready before using it.
+     */
+    bool access_addr_bits_async(uint8_t new_addr, void (*callback)(void* context, bool success, uint8_t read_addr), void* context,
+        bool wait_for_eeprom=true);
+
+    /**
+     * @brief
+     *
+     * @return true if an access_addr_bits_async() operation is in progress
+     */
+    bool is_addr_access_busy() const { return addr_access.state != addr_idle; }
+#endif
+
     /**
      * @brief Set the ldac GPIO high or low
      * 
@@ -260,21 +439,60 @@ public:
     bool set_ldac_pin(bool is_high);
 
     bool has_ldac_pin() {return ldac_gpio != no_ldac_gpio; }
+
+    /**
+     * @brief decode 3 bytes of read_channels() data
+     *
+     * @param bytes the 3 bytes the chip sent for one DAC or EEPROM register
+     * @param crd receives the decoded data. The is_eeprom field is not changed.
+     */
+    static void bytes2channel_read_data(const uint8_t* bytes, mcp4728_channel_read_data* crd);
+
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+    // Blocking bit-bang helpers for board bring-up and provisioning tools. The caller must
+    // own the bus and have called deinit_i2c_bus() before using them.
+
+    /**
+     * @brief make the SDA and SCL pins software controlled open drain GPIO pins with
+     * both lines released high
+     *
+     * @param sda_pin is the GPIO number of the SDA pin
+     * @param scl_pin is the GPIO number of the SCL pin
+     */
+    static void bit_bang_begin(uint sda_pin, uint scl_pin);
+
+    /**
+     * @brief bit bang one complete I2C with LDAC read or write address bits transaction
+     *
+     * This is the bus traffic of access_addr_bits() without the bus deinit and reinit
+     * or the wait for the EEPROM write.
+     * @return true if the chip acknowledged every byte
+     * @param sda_pin is the GPIO number of the SDA pin
+     * @param scl_pin is the GPIO number of the SCL pin
+     * @param ldac_gpio is the GPIO number of the LDAC pin of the chip to access
+     * @param cur_addr is the current I2C address of the chip; not used if new_addr is 0
+     * @param new_addr has the same meaning as for access_addr_bits()
+     * @param read_addr has the same meaning as for access_addr_bits()
+     */
+    static bool bit_bang_addr_bits(uint sda_pin, uint scl_pin, uint ldac_gpio, uint8_t cur_addr, uint8_t new_addr, uint8_t& read_addr);
+
+    /**
+     * @brief bit bang a one byte read from the chip at addr_
+     *
+     * @return true if a chip acknowledged addr_, false if no chip is at addr_
+     * @param sda_pin is the GPIO number of the SDA pin
+     * @param scl_pin is the GPIO number of the SCL pin
+     * @param addr_ is the I2C address to read
+     * @param status is the first byte read. Bit 7 is RDY/BSY\ and bit 6 is POR.
+     */
+    static bool bit_bang_read_status(uint sda_pin, uint scl_pin, uint8_t addr_, uint8_t& status);
+#endif
 protected:
     static void req_bus_callback(RP2040_i2c_device* context);
-    static void fast_write_callback(RP2040_i2c_device* context);
-    static void multi_write_callback(RP2040_i2c_device* context);
-    static void read_callback(RP2040_i2c_device* context);
-    static void status_callback(RP2040_i2c_device* context);
-    static void seq_write_eeprom_callback(RP2040_i2c_device* context);
-    static void gain_set_callback(RP2040_i2c_device* context);
-    static void pd_set_callback(RP2040_i2c_device* context);
-    static void vref_set_callback(RP2040_i2c_device* context);
-    static void reset_callback(RP2040_i2c_device* context);
-    static void wakeup_callback(RP2040_i2c_device* context);
-    static void update_callback(RP2040_i2c_device* context);
-    void bytes2channel_read_data(uint8_t* bytes, mcp4728_channel_read_data* crd);
+    static void op_done_callback(RP2040_i2c_device* context);
+    static void stream_fill_callback(RP2040_i2c_device* context, uint8_t* data, uint8_t nbytes);
 
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
     /**
      * @brief bit bang 8 bits of data to the device and read back from the device and
      * set LDAC low on the 8th bit if change_ldac is true.
@@ -285,43 +503,141 @@ protected:
      * @pram ignore_nak is true during byte reads
      * @param sda_pin is the GPIO number of the SDA pin
      * @param scl_pin is the GPIO number of the SCL pin
+     * @param ldac_gpio is the GPIO number of the LDAC pin; may be no_ldac_gpio if change_ldac is false
      * @param change_ldac is true if LDAC\ toggles low on the 8th bit
      */
-    bool bit_bang_8_bits(uint8_t write_byte, uint8_t& read_byte, bool ignore_nak, uint sda_pin, uint scl_pin, bool change_ldac);
+    static bool bit_bang_8_bits(uint8_t write_byte, uint8_t& read_byte, bool ignore_nak, uint sda_pin, uint scl_pin, uint ldac_gpio, bool change_ldac);
+    static void bit_bang_start(uint sda_pin, uint scl_pin);
+    static void bit_bang_stop(uint sda_pin, uint scl_pin);
+#endif
 
     struct app_callback {
         void (*callback)(void* context);
         void *context;
         volatile bool call_callback;
     };
-    struct app_read_callback : public app_callback {
-        mcp4728_channel_read_data* data;
-        uint8_t nchan;
+    enum op_kind : uint8_t {
+        write_op,           // any write command to this device's address
+        read_op,            // read_channels()
+        status_op,          // poll_status()
+        general_call_op,    // any write command to the general call address
+        stream_op           // multi_write() with more records than fit in the buffer
     };
-    struct app_status_callback {
-        void (*callback)(void* context, bool is_busy, bool is_powered_on);
+    enum op_state : uint8_t {
+        op_free,            // available for allocation
+        op_filling,         // allocated; the caller is filling in the buffer
+        op_queued,          // waiting for the I2C hardware
+        op_in_flight,       // in the I2C hardware
+        op_done             // transfer done; waiting for task() to call the callback
+    };
+    /**
+     * Each submitted operation gets its own record so that several
+     * operations may be outstanding at once without their callbacks,
+     * contexts or data buffers overwriting each other.
+     */
+    struct op_record {
+        op_kind kind;
+        volatile op_state state;
+        bool stop;
+        uint8_t nbytes;
+        uint8_t nchan;              // for read_op only
+        uint16_t generation;        // incremented each time the record is retired
+        uint32_t seq;               // submission order
+        void (*callback)(void* context);
+        void (*status_callback)(void* context, bool is_busy, bool is_powered_on);
         void *context;
-        volatile bool call_callback;
+        mcp4728_channel_read_data* read_dest;
+        const mcp4728_channel_data* stream_src; // for stream_op only
+        uint16_t stream_nchan;      // for stream_op only
+        uint32_t stream_pos;        // for stream_op only; the next byte of the stream to encode
+#if RP2040_MCP4728_ENABLE_READ
+        uint8_t buffer[24];         // the bytes to write or the bytes read; up to 8 channels of 3 bytes
+#else
+        uint8_t buffer[16];         // the bytes to write; at most one TX FIFO load
+#endif
     };
-    struct {
-        app_callback req_bus;
-        app_callback rel_bus;
-        app_callback fast_write;
-        app_callback multi_write;
-        app_read_callback read;
-        app_status_callback status;
-        app_callback seq_write_eeprom;
-        app_callback set_gain;
-        app_callback set_pd;
-        app_callback set_vref;
-        app_callback reset;
-        app_callback wakeup;
-        app_callback update;
-    } app_callbacks;
+    /**
+     * @brief allocate a free operation record
+     *
+     * @return a pointer to a record in the op_filling state or nullptr if all records are in use
+     */
+    op_record* alloc_op(op_kind kind, void (*callback)(void* context), void* context);
+
+    /**
+     * @brief queue a filled-in operation record and start it if the bus allows
+     *
+     * @return true if the operation was queued; false if this device does not have bus access.
+     * The record is freed if this function returns false.
+     * @param rec the record returned by alloc_op()
+     * @param handle if not nullptr, receives the handle of the operation
+     */
+    bool submit_op(op_record* rec, mcp4728_op_handle* handle);
+
+    /**
+     * @brief start as many queued operations as the I2C hardware will accept, oldest first
+     * @note call this in the bus critical section
+     */
+    void issue_ops_locked();
+    op_record* find_op(mcp4728_op_handle handle);
+    app_callback req_bus;
+    app_callback rel_bus;
+    op_record ops[RP2040_MCP4728_MAX_PENDING_OPS];
+    uint32_t next_seq;
+    bool general_call_active; // true from the time a general call op is issued until task() restores normal addressing
     uint ldac_gpio;
     bool release_bus_pending;
+    void (*volatile irq_notify)(void* context);
+    void* irq_notify_context;
+
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+    // access_addr_bits_async() state
+    enum addr_access_state : uint8_t {
+        addr_idle,
+        addr_bit_banging,       // the timer interrupt is running the I2C with LDAC protocol
+        addr_bit_bang_done,     // waiting for task() to restore the I2C hardware
+        addr_bit_bang_failed,
+        addr_eeprom_wait        // polling the chip until the EEPROM write finishes
+    };
+    enum addr_access_phase : uint8_t {
+        addr_start_sda, addr_start_scl,
+        addr_restart_scl_high, addr_restart_sda, addr_restart_scl_low,
+        addr_bit_sda, addr_bit_scl_high, addr_bit_sample,
+        addr_ack_sda, addr_ack_scl_high, addr_ack_sample,
+        addr_stop_sda, addr_stop_scl, addr_stop_release
+    };
+    static const uint8_t addr_byte_ldac = 0x1;      // LDAC goes low on the last bit of this byte
+    static const uint8_t addr_byte_restart = 0x2;   // send repeated start before this byte
+    static const uint8_t addr_byte_read = 0x4;      // this byte is read from the chip; ignore NAK
+    struct {
+        uint8_t bytes[4];
+        uint8_t flags[4];
+        uint8_t nbytes;
+        uint8_t byte_idx;
+        int8_t bit;
+        addr_access_phase phase;
+        uint8_t wait_ticks;
+        uint8_t read_byte;
+        volatile addr_access_state state;
+        uint8_t new_addr;
+        bool wait_for_eeprom;
+        bool poll_pending;
+        mcp4728_op_handle poll_handle;
+        uint sda_pin;
+        uint scl_pin;
+        void (*callback)(void* context, bool success, uint8_t read_addr);
+        void* context;
+        repeating_timer_t timer;
+        absolute_time_t deadline;
+        absolute_time_t next_poll;
+    } addr_access;
+    static bool addr_access_timer_callback(repeating_timer_t* rt);
+    static void addr_access_poll_callback(void* context, bool is_busy, bool is_powered_on);
+    bool addr_access_step();
+    void addr_access_next_byte();
+    void addr_access_task();
+    void addr_access_finish(bool success);
+#endif
     void check_callback(app_callback& app_cb);
-    uint8_t read_data[24]; // 8 channels of 3 bytes
 private:
     RP2040_MCP4728() = delete;
     RP2040_MCP4728(const RP2040_MCP4728&) = delete;
@@ -0,0 +1,85 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_log.h"
+#include <cstdio>
+#include "hardware/sync.h"
+
+rppicomidi::RP2040_MCP4728_log::RP2040_MCP4728_log(bool deferred_) :
+    head{0}, tail{0}, dropped{0}, reported_dropped{0}, enabled{true}, deferred{deferred_}
+{
+    static_assert((RP2040_MCP4728_LOG_SIZE & (RP2040_MCP4728_LOG_SIZE - 1)) == 0, "RP2040_MCP4728_LOG_SIZE must be a power of 2");
+}
+
+void rppicomidi::RP2040_MCP4728_log::print(const char* fmt, const uintptr_t* words)
+{
+    // printf() ignores the words the format string does not use
+    printf(fmt, words[0], words[1], words[2], words[3], words[4], words[5]);
+}
+
+bool rppicomidi::RP2040_MCP4728_log::put(const char* fmt, const uintptr_t* words)
+{
+    if (!enabled)
+        return false;
+    if (!deferred) {
+        print(fmt, words);
+        return true;
+    }
+    // an interrupt handler on this core could log between reading and writing head
+    uint32_t status = save_and_disable_interrupts();
+    uint32_t slot = head;
+    bool result = slot - tail < RP2040_MCP4728_LOG_SIZE;
+    if (result) {
+        auto& msg = ring[slot & (RP2040_MCP4728_LOG_SIZE - 1)];
+        msg.fmt = fmt;
+        for (uint8_t idx = 0; idx < max_args; idx++)
+            msg.words[idx] = words[idx];
+        __dmb(); // the message must be complete before drain() can see it
+        head = slot + 1;
+    }
+    else {
+        dropped = dropped + 1;
+    }
+    restore_interrupts(status);
+    return result;
+}
+
+uint32_t rppicomidi::RP2040_MCP4728_log::drain(uint32_t max_messages)
+{
+    uint32_t count = 0;
+    while (count < max_messages && tail != head) {
+        __dmb();
+        auto& msg = ring[tail & (RP2040_MCP4728_LOG_SIZE - 1)];
+        print(msg.fmt, msg.words);
+        __dmb(); // finish with the slot before log() can reuse it
+        tail = tail + 1;
+        ++count;
+    }
+    uint32_t now_dropped = dropped;
+    if (now_dropped != reported_dropped) {
+        printf("%lu log messages dropped\r\n", now_dropped - reported_dropped);
+        reported_dropped = now_dropped;
+    }
+    return count;
+}
@@ -0,0 +1,133 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class is a message log for code that must not wait for printf()
+ * output, such as operation completion callbacks. log() stores only the
+ * format string pointer, which identifies the message, and up to max_args
+ * argument words in a ring; drain() formats and prints them later from a
+ * low-priority step such as the main loop. If the ring is full, log()
+ * drops the message and counts it.
+ *
+ * Because formatting is deferred, every argument must be an integer of at
+ * most 32 bits, a character, or a pointer to a string that stays valid
+ * until the message is printed, such as a string literal.
+ *
+ * log() may be called from thread code and interrupt handlers on one core;
+ * drain() may run on either core.
+ */
+#pragma once
+#include <cstdint>
+#include <type_traits>
+#ifndef RP2040_MCP4728_LOG_SIZE
+// The number of messages the log holds; must be a power of 2
+#define RP2040_MCP4728_LOG_SIZE 64
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_log
+{
+public:
+    static const uint8_t max_args = 6;
+
+    /**
+     * @brief constructor
+     *
+     * @param deferred_ if false, log() prints right away; this is for debugging
+     * when the order of log messages and other output matters
+     */
+    RP2040_MCP4728_log(bool deferred_=true);
+
+    /**
+     * @brief add a message to the log
+     *
+     * @return false if the log is disabled or full
+     * @param fmt the printf() format string; it must stay valid until the message is printed
+     * @param args the arguments for the format string
+     */
+    template<typename... Args>
+    bool log(const char* fmt, Args... args)
+    {
+        static_assert(sizeof...(Args) <= max_args, "too many log message arguments");
+        const uintptr_t words[max_args + 1] = {to_word(args)...};
+        return put(fmt, words);
+    }
+
+    /**
+     * @brief print the oldest messages
+     *
+     * @return the number of messages printed
+     * @param max_messages the most messages to print
+     */
+    uint32_t drain(uint32_t max_messages=RP2040_MCP4728_LOG_SIZE);
+
+    /**
+     * @brief
+     *
+     * @return true if there are messages to print
+     */
+    bool is_empty() const { return head == tail; }
+
+    void set_enabled(bool enabled_) { enabled = enabled_; }
+    bool is_enabled() const { return enabled; }
+    void set_deferred(bool deferred_) { deferred = deferred_; }
+    bool is_deferred() const { return deferred; }
+
+    /**
+     * @brief
+     *
+     * @return the number of messages dropped because the log was full
+     */
+    uint32_t get_dropped() const { return dropped; }
+protected:
+    template<typename T>
+    static uintptr_t to_word(T value)
+    {
+        static_assert(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+            "log message arguments must be integers or pointers");
+        static_assert(std::is_pointer<T>::value || sizeof(T) <= sizeof(uint32_t), "log message integers must be 32 bits or less");
+        if constexpr (std::is_pointer<T>::value)
+            return reinterpret_cast<uintptr_t>(value);
+        else
+            return static_cast<uintptr_t>(value);
+    }
+    bool put(const char* fmt, const uintptr_t* words);
+    static void print(const char* fmt, const uintptr_t* words);
+    struct message {
+        const char* fmt;
+        uintptr_t words[max_args];
+    };
+    message ring[RP2040_MCP4728_LOG_SIZE];
+    volatile uint32_t head; // written only by log()
+    volatile uint32_t tail; // written only by drain()
+    volatile uint32_t dropped;
+    uint32_t reported_dropped;
+    bool enabled;
+    bool deferred;
+private:
+    RP2040_MCP4728_log(const RP2040_MCP4728_log&)=delete;
+    RP2040_MCP4728_log& operator=(const RP2040_MCP4728_log&)=delete;
+};
+}
@@ -0,0 +1,392 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_midi_cv.h"
+#include "hardware/timer.h"
+#include <cstring> // memset
+
+rppicomidi::RP2040_MCP4728_midi_cv::RP2040_MCP4728_midi_cv(RP2040_MCP4728_group* group_, uint8_t midi_channel_) :
+    group{group_}, ndacs{group_->get_num_dacs()}, midi_channel{midi_channel_}, running_status{0}, ndata{0}, in_sysex{false},
+    nvoices{0}, mode{alloc_round_robin}, next_voice{0}, note_counter{0}, nheld{0},
+    codes_per_octave{1000}, zero_note{24}, bend_range{2}, bend{0}, gate_on_code{4095}, ncc_maps{0},
+    nframes{0}, frame_event_us{0}
+{
+    assert(ndacs > 0 && ndacs <= RP2040_MCP4728_MIDI_CV_MAX_CHIPS);
+    memset(voices, 0, sizeof(voices));
+    memset(voice_states, 0, sizeof(voice_states));
+    memset(chips, 0, sizeof(chips));
+    memset(chip_frames, 0, sizeof(chip_frames));
+    for (auto& chip: chips) {
+        chip.me = this;
+    }
+    clear_latency_stats();
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::clear_latency_stats()
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.min_done_us = UINT32_MAX;
+}
+
+bool rppicomidi::RP2040_MCP4728_midi_cv::set_voices(const voice_config* voices_, uint8_t nvoices_, alloc_mode mode_)
+{
+    if (nvoices_ == 0 || nvoices_ > RP2040_MCP4728_MIDI_CV_MAX_VOICES)
+        return false;
+    const uint8_t nchans = ndacs * 4;
+    for (uint8_t idx = 0; idx < nvoices_; idx++) {
+        if (voices_[idx].pitch_chan >= nchans ||
+                (voices_[idx].gate_chan != no_channel && voices_[idx].gate_chan >= nchans) ||
+                (voices_[idx].velocity_chan != no_channel && voices_[idx].velocity_chan >= nchans))
+            return false;
+    }
+    memcpy(voices, voices_, nvoices_ * sizeof(voice_config));
+    memset(voice_states, 0, sizeof(voice_states));
+    nvoices = nvoices_;
+    mode = mode_;
+    next_voice = 0;
+    nheld = 0;
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::set_pitch_scale(uint16_t codes_per_octave_, uint8_t zero_note_, uint8_t bend_range_)
+{
+    codes_per_octave = codes_per_octave_;
+    zero_note = zero_note_;
+    bend_range = bend_range_;
+}
+
+bool rppicomidi::RP2040_MCP4728_midi_cv::map_cc(uint8_t cc_num, uint8_t chan)
+{
+    if (ncc_maps >= RP2040_MCP4728_MIDI_CV_MAX_CC_MAPS || chan >= ndacs * 4 || cc_num > 127)
+        return false;
+    cc_nums[ncc_maps] = cc_num;
+    cc_chans[ncc_maps] = chan;
+    ++ncc_maps;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_midi_cv::set_channel_config(uint8_t chan, uint8_t vref, uint8_t gain, uint8_t pd)
+{
+    if (chan >= ndacs * 4 || vref > 1 || gain > 1 || pd > 3)
+        return false;
+    auto& chip = chips[chan >> 2];
+    chip.vref[chan & 3] = vref;
+    chip.gain[chan & 3] = gain;
+    chip.pd[chan & 3] = pd;
+    chip.configured |= 1 << (chan & 3);
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::receive(const uint8_t* bytes, size_t nbytes)
+{
+    uint32_t now_us = time_us_32();
+    for (size_t idx = 0; idx < nbytes; idx++) {
+        uint8_t byte = bytes[idx];
+        if (byte >= 0xF8) {
+            continue; // real-time messages may appear anywhere and do not affect running status
+        }
+        if (byte & 0x80) {
+            in_sysex = (byte == 0xF0);
+            // system common messages cancel running status
+            running_status = (byte < 0xF0) ? byte : 0;
+            ndata = 0;
+            continue;
+        }
+        if (in_sysex || running_status == 0) {
+            continue;
+        }
+        data_bytes[ndata++] = byte;
+        uint8_t needed = ((running_status & 0xF0) == 0xC0 || (running_status & 0xF0) == 0xD0) ? 1 : 2;
+        if (ndata >= needed) {
+            handle_message(now_us);
+            ndata = 0;
+        }
+    }
+    // send everything this batch of bytes changed in as few transactions as possible
+    flush(now_us);
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::task()
+{
+    flush(time_us_32());
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::handle_message(uint32_t now_us)
+{
+    if (midi_channel != omni && (running_status & 0x0F) != midi_channel)
+        return;
+    switch (running_status & 0xF0) {
+    case 0x90:
+        if (data_bytes[1] != 0) {
+            note_on(data_bytes[0], data_bytes[1], now_us);
+            break;
+        }
+        // note on with velocity 0 is note off
+        [[fallthrough]];
+    case 0x80:
+        note_off(data_bytes[0], now_us);
+        break;
+    case 0xE0:
+        bend = (int16_t)(((uint16_t)data_bytes[1] << 7) | data_bytes[0]) - 8192;
+        for (uint8_t voicenum = 0; voicenum < nvoices; voicenum++) {
+            update_pitch(voicenum, now_us);
+        }
+        break;
+    case 0xB0:
+        for (uint8_t idx = 0; idx < ncc_maps; idx++) {
+            if (cc_nums[idx] == data_bytes[0]) {
+                set_code(cc_chans[idx], ((uint32_t)data_bytes[1] * 4095u) / 127u, now_us);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::note_on(uint8_t note, uint8_t velocity, uint32_t now_us)
+{
+    if (nvoices == 0)
+        return;
+    if (mode == alloc_last_note) {
+        // move the note to the top of the stack
+        uint8_t dst = 0;
+        for (uint8_t idx = 0; idx < nheld; idx++) {
+            if (held_notes[idx] != note)
+                held_notes[dst++] = held_notes[idx];
+        }
+        nheld = dst;
+        if (nheld >= sizeof(held_notes)) {
+            memmove(held_notes, held_notes+1, sizeof(held_notes)-1);
+            --nheld;
+        }
+        held_notes[nheld++] = note;
+        assign_voice(0, note, velocity, now_us);
+        return;
+    }
+    // retrigger a voice already playing this note
+    for (uint8_t voicenum = 0; voicenum < nvoices; voicenum++) {
+        if (voice_states[voicenum].gate && voice_states[voicenum].note == note) {
+            assign_voice(voicenum, note, velocity, now_us);
+            return;
+        }
+    }
+    int voice = -1;
+    if (mode == alloc_lowest_free) {
+        for (uint8_t voicenum = 0; voicenum < nvoices; voicenum++) {
+            if (!voice_states[voicenum].gate) {
+                voice = voicenum;
+                break;
+            }
+        }
+    }
+    else {
+        for (uint8_t count = 0; count < nvoices; count++) {
+            uint8_t voicenum = (next_voice + count) % nvoices;
+            if (!voice_states[voicenum].gate) {
+                voice = voicenum;
+                break;
+            }
+        }
+    }
+    if (voice < 0) {
+        // steal the oldest note
+        voice = 0;
+        for (uint8_t voicenum = 1; voicenum < nvoices; voicenum++) {
+            if ((int32_t)(voice_states[voicenum].age - voice_states[voice].age) < 0)
+                voice = voicenum;
+        }
+    }
+    next_voice = (voice + 1) % nvoices;
+    assign_voice(voice, note, velocity, now_us);
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::note_off(uint8_t note, uint32_t now_us)
+{
+    if (mode == alloc_last_note) {
+        uint8_t dst = 0;
+        for (uint8_t idx = 0; idx < nheld; idx++) {
+            if (held_notes[idx] != note)
+                held_notes[dst++] = held_notes[idx];
+        }
+        bool was_top = nheld > 0 && held_notes[nheld-1] == note;
+        nheld = dst;
+        if (was_top) {
+            if (nheld > 0) {
+                // legato back to the previous held note
+                assign_voice(0, held_notes[nheld-1], voice_states[0].velocity, now_us);
+            }
+            else {
+                voice_states[0].gate = false;
+                if (voices[0].gate_chan != no_channel)
+                    set_code(voices[0].gate_chan, 0, now_us);
+            }
+        }
+        return;
+    }
+    for (uint8_t voicenum = 0; voicenum < nvoices; voicenum++) {
+        if (voice_states[voicenum].gate && voice_states[voicenum].note == note) {
+            voice_states[voicenum].gate = false;
+            if (voices[voicenum].gate_chan != no_channel)
+                set_code(voices[voicenum].gate_chan, 0, now_us);
+        }
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::assign_voice(uint8_t voicenum, uint8_t note, uint8_t velocity, uint32_t now_us)
+{
+    auto& vs = voice_states[voicenum];
+    vs.note = note;
+    vs.velocity = velocity;
+    vs.gate = true;
+    vs.age = note_counter++;
+    update_pitch(voicenum, now_us);
+    if (voices[voicenum].gate_chan != no_channel)
+        set_code(voices[voicenum].gate_chan, gate_on_code, now_us);
+    if (voices[voicenum].velocity_chan != no_channel)
+        set_code(voices[voicenum].velocity_chan, ((uint32_t)velocity * 4095u) / 127u, now_us);
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::update_pitch(uint8_t voicenum, uint32_t now_us)
+{
+    // pitch in 1/8192 semitone units relative to zero_note
+    int32_t pitch = ((int32_t)voice_states[voicenum].note - zero_note) * 8192 + (int32_t)bend * bend_range;
+    int32_t code = (int32_t)(((int64_t)pitch * codes_per_octave) / (12 * 8192));
+    if (code < 0)
+        code = 0;
+    else if (code > 4095)
+        code = 4095;
+    set_code(voices[voicenum].pitch_chan, code, now_us);
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::set_code(uint8_t chan, uint16_t code, uint32_t now_us)
+{
+    auto& chip = chips[chan >> 2];
+    if (chip.codes[chan & 3] == code && (chip.dirty & (1 << (chan & 3))) == 0)
+        return;
+    chip.codes[chan & 3] = code;
+    chip.dirty |= 1 << (chan & 3);
+    if (!chip.has_event_time) {
+        chip.event_us = now_us;
+        chip.has_event_time = true;
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::flush(uint32_t now_us)
+{
+    // The chips' frame buffers belong to the bus frame until it is done
+    if (nframes != 0 || group->is_updating() || !group->has_bus())
+        return;
+    bool has_event_time = false;
+    uint32_t oldest_us = 0;
+    for (uint8_t dacnum = 0; dacnum < ndacs; dacnum++) {
+        auto& chip = chips[dacnum];
+        if (chip.dirty == 0)
+            continue;
+        uint8_t highest = 0;
+        uint8_t ndirty = 0;
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            if (chip.dirty & (1 << chan)) {
+                highest = chan;
+                ++ndirty;
+            }
+        }
+        // fast write must cover channels A through the highest changed channel;
+        // multi-write covers only the changed channels but costs 3 bytes each.
+        // Multi-write also sends Vref and gain, so it is only used when they are known.
+        uint8_t nbytes;
+        if ((highest + 1) * 2 <= ndirty * 3 || (chip.dirty & ~chip.configured) != 0) {
+            uint16_t chan_dat[4];
+            for (uint8_t chan = 0; chan <= highest; chan++) {
+                chan_dat[chan] = ((uint16_t)chip.pd[chan] << 12) | chip.codes[chan];
+            }
+            RP2040_MCP4728::encode_fast_write(chan_dat, highest + 1, chip.frame);
+            nbytes = (highest + 1) * 2;
+        }
+        else {
+            nbytes = 0;
+            for (uint8_t chan = 0; chan < 4; chan++) {
+                if (chip.dirty & (1 << chan)) {
+                    mcp4728_channel_data chan_dat;
+                    chan_dat.chan = chan;
+                    chan_dat.udac = 0;
+                    chan_dat.vref = chip.vref[chan];
+                    chan_dat.gain = chip.gain[chan];
+                    chan_dat.pd = chip.pd[chan];
+                    chan_dat.dac_code = chip.codes[chan];
+                    mcp4728_encode::multi_write_channel(chan_dat, chip.frame + nbytes);
+                    nbytes += 3;
+                }
+            }
+        }
+        chip_frames[nframes++] = {dacnum, chip.frame, nbytes};
+        if (!has_event_time || (int32_t)(chip.event_us - oldest_us) < 0)
+            oldest_us = chip.event_us;
+        has_event_time = true;
+    }
+    if (nframes == 0)
+        return;
+    if (!group->write_chips(chip_frames, nframes, write_done, this)) {
+        nframes = 0; // try again on the next call
+        return;
+    }
+    for (uint8_t idx = 0; idx < nframes; idx++) {
+        auto& chip = chips[chip_frames[idx].dacnum];
+        chip.in_flight = chip.dirty;
+        chip.dirty = 0;
+        chip.has_event_time = false;
+    }
+    frame_event_us = oldest_us;
+    stats.last_submit_us = now_us - oldest_us;
+    if (stats.last_submit_us > stats.max_submit_us)
+        stats.max_submit_us = stats.last_submit_us;
+}
+
+void rppicomidi::RP2040_MCP4728_midi_cv::write_done(void* context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_midi_cv*>(context);
+    auto& stats = me->stats;
+    uint32_t latency = time_us_32() - me->frame_event_us;
+    stats.last_done_us = latency;
+    if (latency < stats.min_done_us)
+        stats.min_done_us = latency;
+    if (latency > stats.max_done_us)
+        stats.max_done_us = latency;
+    stats.total_done_us += latency;
+    ++stats.count;
+    // Chips that did not acknowledge get their channels again with the next frame
+    uint8_t failed = me->group->get_failed_chips();
+    for (uint8_t idx = 0; idx < me->nframes; idx++) {
+        auto& chip = me->chips[me->chip_frames[idx].dacnum];
+        if (failed & (1 << me->chip_frames[idx].dacnum)) {
+            chip.dirty |= chip.in_flight;
+            if (!chip.has_event_time) {
+                chip.event_us = me->frame_event_us;
+                chip.has_event_time = true;
+            }
+        }
+        chip.in_flight = 0;
+    }
+    me->nframes = 0;
+}
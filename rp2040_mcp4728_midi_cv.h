@@ -0,0 +1,211 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class converts a raw MIDI byte stream to MCP4728 DAC outputs. It
+ * parses note on, note off, pitch bend and control change messages (with
+ * running status; real-time bytes and system exclusive messages are skipped),
+ * allocates notes to voices, converts note numbers to 1V/octave DAC codes,
+ * and sends the minimum number of I2C bytes to bring each chip's outputs
+ * up to date: for each chip with changed channels it chooses a fast write
+ * or a multi-write, whichever is shorter. The writes for all changed chips
+ * go out as one bus frame through an RP2040_MCP4728_group, which must have
+ * the bus.
+ *
+ * Each voice has a pitch CV output and optional gate and velocity outputs.
+ * Channel numbers are dac index * 4 + DAC channel (0-3 => A-D). Latency from
+ * the time the MIDI bytes are passed to receive() until the bus frame is
+ * submitted and until it is done is measured for every frame.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+#ifndef RP2040_MCP4728_MIDI_CV_MAX_CHIPS
+#define RP2040_MCP4728_MIDI_CV_MAX_CHIPS 8
+#endif
+#ifndef RP2040_MCP4728_MIDI_CV_MAX_VOICES
+#define RP2040_MCP4728_MIDI_CV_MAX_VOICES 8
+#endif
+#ifndef RP2040_MCP4728_MIDI_CV_MAX_CC_MAPS
+#define RP2040_MCP4728_MIDI_CV_MAX_CC_MAPS 8
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_midi_cv
+{
+public:
+    static const uint8_t no_channel = 0xFF;
+    static const uint8_t omni = 0xFF;
+    enum alloc_mode {
+        alloc_round_robin,  // each new note goes to the next voice; steals the oldest note if none are free
+        alloc_lowest_free,  // each new note goes to the lowest numbered free voice; steals the oldest note if none are free
+        alloc_last_note     // monophonic (voice 0 only) with last note priority; releasing a note returns to the previous held note
+    };
+    struct voice_config {
+        uint8_t pitch_chan;     // channel for the 1V/oct pitch CV
+        uint8_t gate_chan;      // channel for the gate or no_channel
+        uint8_t velocity_chan;  // channel for the velocity CV or no_channel
+    };
+    struct latency_stats {
+        uint32_t count;         // the number of bus frames measured
+        uint32_t last_submit_us;// event to frame submit for the most recent frame
+        uint32_t max_submit_us;
+        uint32_t last_done_us;  // event to frame done for the most recent frame
+        uint32_t min_done_us;
+        uint32_t max_done_us;
+        uint64_t total_done_us;
+    };
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips to write (1-RP2040_MCP4728_MIDI_CV_MAX_CHIPS)
+     * @param midi_channel_ the MIDI channel 0-15 to respond to or omni
+     */
+    RP2040_MCP4728_midi_cv(RP2040_MCP4728_group* group_, uint8_t midi_channel_=omni);
+
+    /**
+     * @brief set the voices and the voice allocation mode
+     *
+     * @return false if nvoices is 0 or too large or any channel is out of range
+     * @param voices_ an array of nvoices_ voice configurations; it is copied
+     * @param nvoices_ the number of voices
+     * @param mode_ the voice allocation mode
+     */
+    bool set_voices(const voice_config* voices_, uint8_t nvoices_, alloc_mode mode_);
+
+    /**
+     * @brief set the pitch conversion
+     *
+     * @param codes_per_octave_ the number of DAC codes per volt (for example, 1000
+     * when Vref=2.048V and gain=2)
+     * @param zero_note_ the MIDI note number that produces DAC code 0
+     * @param bend_range_ the pitch bend range in semitones
+     */
+    void set_pitch_scale(uint16_t codes_per_octave_, uint8_t zero_note_, uint8_t bend_range_);
+
+    /**
+     * @brief set the DAC code to send to gate channels when the gate is on
+     */
+    void set_gate_on_code(uint16_t code) { gate_on_code = code > 4095 ? 4095 : code; }
+
+    /**
+     * @brief map a MIDI control change number to a channel; value 0-127 maps to code 0-4095
+     *
+     * @return false if there is no room for another map or chan is out of range
+     */
+    bool map_cc(uint8_t cc_num, uint8_t chan);
+
+    /**
+     * @brief set the Vref, gain and power down bits for a channel. These
+     * are used if the channel is updated with a multi-write. A fast write only
+     * sends the power down bits, so channels without a configuration are only
+     * updated with fast writes and keep the Vref and gain the chip already has.
+     *
+     * @return false if chan is out of range
+     */
+    bool set_channel_config(uint8_t chan, uint8_t vref, uint8_t gain, uint8_t pd);
+
+    /**
+     * @brief parse MIDI bytes and update the DAC outputs
+     *
+     * @param bytes the MIDI bytes
+     * @param nbytes the number of bytes
+     */
+    void receive(const uint8_t* bytes, size_t nbytes);
+
+    /**
+     * @brief retry any DAC updates that could not be submitted. Call this periodically
+     * (after calling the group's task() function)
+     */
+    void task();
+
+    const latency_stats& get_latency_stats() const { return stats; }
+    void clear_latency_stats();
+protected:
+    struct chip_state {
+        RP2040_MCP4728_midi_cv* me;
+        uint16_t codes[4];
+        uint8_t vref[4];
+        uint8_t gain[4];
+        uint8_t pd[4];
+        uint8_t configured;         // bit mask of channels set_channel_config() has set
+        uint8_t dirty;              // bit mask of channels that need to be written
+        uint8_t in_flight;          // bit mask of channels in the bus frame being sent
+        bool has_event_time;
+        uint32_t event_us;          // arrival time of the oldest event not yet submitted
+        uint8_t frame[12];          // the encoded write in the bus frame being sent
+    };
+    struct voice_state {
+        uint8_t note;
+        uint8_t velocity;
+        bool gate;
+        uint32_t age;               // note on order for voice stealing
+    };
+    static void write_done(void* context);
+    void handle_message(uint32_t now_us);
+    void note_on(uint8_t note, uint8_t velocity, uint32_t now_us);
+    void note_off(uint8_t note, uint32_t now_us);
+    void assign_voice(uint8_t voicenum, uint8_t note, uint8_t velocity, uint32_t now_us);
+    void update_pitch(uint8_t voicenum, uint32_t now_us);
+    void set_code(uint8_t chan, uint16_t code, uint32_t now_us);
+    void flush(uint32_t now_us);
+    RP2040_MCP4728_group* group;
+    uint8_t ndacs;
+    uint8_t midi_channel;
+    // parser state
+    uint8_t running_status;
+    uint8_t data_bytes[2];
+    uint8_t ndata;
+    bool in_sysex;
+    // voice state
+    voice_config voices[RP2040_MCP4728_MIDI_CV_MAX_VOICES];
+    voice_state voice_states[RP2040_MCP4728_MIDI_CV_MAX_VOICES];
+    uint8_t nvoices;
+    alloc_mode mode;
+    uint8_t next_voice;
+    uint32_t note_counter;
+    uint8_t held_notes[16];         // note stack for alloc_last_note; most recent last
+    uint8_t nheld;
+    // pitch conversion
+    uint16_t codes_per_octave;
+    uint8_t zero_note;
+    uint8_t bend_range;
+    int16_t bend;                   // -8192 to 8191
+    uint16_t gate_on_code;
+    // CC maps
+    uint8_t cc_nums[RP2040_MCP4728_MIDI_CV_MAX_CC_MAPS];
+    uint8_t cc_chans[RP2040_MCP4728_MIDI_CV_MAX_CC_MAPS];
+    uint8_t ncc_maps;
+
+    chip_state chips[RP2040_MCP4728_MIDI_CV_MAX_CHIPS];
+    RP2040_MCP4728_group::chip_frame chip_frames[RP2040_MCP4728_MIDI_CV_MAX_CHIPS];
+    uint8_t nframes;                // the number of chips in the bus frame being sent
+    uint32_t frame_event_us;        // arrival time of the oldest event in the bus frame being sent
+    latency_stats stats;
+private:
+    RP2040_MCP4728_midi_cv()=delete;
+    RP2040_MCP4728_midi_cv(const RP2040_MCP4728_midi_cv&)=delete;
+    RP2040_MCP4728_midi_cv& operator=(const RP2040_MCP4728_midi_cv&)=delete;
+};
+}
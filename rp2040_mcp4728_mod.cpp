@@ -0,0 +1,221 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_mod.h"
+#include <cmath>
+#include <cstring> // memset
+
+int16_t rppicomidi::RP2040_MCP4728_mod::sine_table[257];
+bool rppicomidi::RP2040_MCP4728_mod::sine_table_ready = false;
+
+rppicomidi::RP2040_MCP4728_mod::RP2040_MCP4728_mod(RP2040_MCP4728_group* group_, uint32_t tick_rate_hz_) :
+    group{group_}, ndacs{group_->get_num_dacs()}, tick_rate_hz{tick_rate_hz_}
+{
+    assert(ndacs > 0 && ndacs <= RP2040_MCP4728_MOD_MAX_CHIPS);
+    assert(tick_rate_hz > 0);
+    nchans = ndacs * 4;
+    if (!sine_table_ready) {
+        // one full cycle plus a guard entry for interpolation
+        for (int idx = 0; idx <= 256; idx++) {
+            sine_table[idx] = (int16_t)lrint(32767.0 * sin(2.0 * M_PI * idx / 256.0));
+        }
+        sine_table_ready = true;
+    }
+    memset(base, 0, sizeof(base));
+    memset(pd, 0, sizeof(pd));
+    memset(lfo_phase, 0, sizeof(lfo_phase));
+    memset(lfo_inc, 0, sizeof(lfo_inc));
+    memset(lfo_depth, 0, sizeof(lfo_depth));
+    memset(lfo_out, 0, sizeof(lfo_out));
+    memset(env_level, 0, sizeof(env_level));
+    memset(env_attack_inc, 0, sizeof(env_attack_inc));
+    memset(env_decay_inc, 0, sizeof(env_decay_inc));
+    memset(env_sustain_level, 0, sizeof(env_sustain_level));
+    memset(env_release_inc, 0, sizeof(env_release_inc));
+    memset(env_depth, 0, sizeof(env_depth));
+    memset(frames, 0, sizeof(frames));
+    compute_buf = 0;
+    computed_buf = 0;
+    for (uint8_t dacnum = 0; dacnum < ndacs; dacnum++)
+        chip_frames[dacnum] = {dacnum, frames[0][dacnum], sizeof(frames[0][dacnum])};
+    for (uint8_t chan = 0; chan < max_channels; chan++) {
+        lfo_shapes[chan] = lfo_off;
+        env_stages[chan] = env_idle;
+    }
+}
+
+int32_t rppicomidi::RP2040_MCP4728_mod::per_tick(uint32_t time_us)
+{
+    // the 8.24 level change per tick to traverse full scale in time_us
+    uint64_t ticks = ((uint64_t)time_us * tick_rate_hz) / 1000000ull;
+    if (ticks == 0)
+        return env_full;
+    return (int32_t)(env_full / ticks);
+}
+
+bool rppicomidi::RP2040_MCP4728_mod::set_base(uint8_t chan, uint16_t code, uint8_t pd_)
+{
+    if (chan >= nchans || code > 4095 || pd_ > 3)
+        return false;
+    base[chan] = code;
+    pd[chan] = pd_;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_mod::set_lfo(uint8_t chan, lfo_shape shape, uint32_t freq_millihz, int16_t depth)
+{
+    if (chan >= nchans)
+        return false;
+    // phase increment per tick = freq * 2^32 / tick rate
+    lfo_inc[chan] = (uint32_t)((((uint64_t)freq_millihz) << 32) / ((uint64_t)tick_rate_hz * 1000ull));
+    lfo_depth[chan] = depth;
+    lfo_shapes[chan] = shape;
+    if (shape == lfo_off)
+        lfo_out[chan] = 0;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_mod::set_adsr(uint8_t chan, uint32_t attack_us, uint32_t decay_us, uint16_t sustain, uint32_t release_us, int16_t depth)
+{
+    if (chan >= nchans)
+        return false;
+    env_attack_inc[chan] = per_tick(attack_us);
+    env_decay_inc[chan] = per_tick(decay_us);
+    env_sustain_level[chan] = (int32_t)(((uint32_t)sustain * (uint32_t)(env_full >> 8)) / 65535u) << 8;
+    env_release_inc[chan] = per_tick(release_us);
+    env_depth[chan] = depth;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_mod::gate(uint8_t chan, bool on)
+{
+    if (chan >= nchans)
+        return false;
+    if (on)
+        env_stages[chan] = env_attack;  // attack from the current level for legato-friendly retrigger
+    else if (env_stages[chan] != env_idle)
+        env_stages[chan] = env_release;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_mod::reset_lfo_phase(uint8_t chan)
+{
+    if (chan >= nchans)
+        return false;
+    lfo_phase[chan] = 0;
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_mod::compute()
+{
+    // Advance all phase accumulators
+    for (uint8_t chan = 0; chan < nchans; chan++) {
+        lfo_phase[chan] += lfo_inc[chan];
+    }
+    // Evaluate the LFOs (Q15 results)
+    for (uint8_t chan = 0; chan < nchans; chan++) {
+        uint32_t phase = lfo_phase[chan];
+        int32_t out;
+        switch (lfo_shapes[chan]) {
+        case lfo_sine: {
+            uint32_t idx = phase >> 24;
+            int32_t frac = (phase >> 8) & 0xFFFF;
+            int32_t a = sine_table[idx];
+            int32_t b = sine_table[idx+1];
+            out = a + (((b - a) * frac) >> 16);
+            break;
+        }
+        case lfo_triangle: {
+            // rises -1 to 1 over the first half cycle, falls over the second
+            int32_t ramp = (int32_t)(phase >> 15);   // 0 to 0x1FFFF
+            out = (ramp < 0x10000 ? ramp : 0x1FFFF - ramp) - 0x8000;
+            break;
+        }
+        case lfo_saw:
+            out = (int32_t)(phase >> 16) - 0x8000;
+            break;
+        case lfo_square:
+            out = (phase & 0x80000000ul) ? -0x7FFF : 0x7FFF;
+            break;
+        default:
+            out = 0;
+            break;
+        }
+        lfo_out[chan] = out;
+    }
+    // Advance all envelopes
+    for (uint8_t chan = 0; chan < nchans; chan++) {
+        int32_t level = env_level[chan];
+        switch (env_stages[chan]) {
+        case env_attack:
+            level += env_attack_inc[chan];
+            if (level >= env_full) {
+                level = env_full;
+                env_stages[chan] = env_decay;
+            }
+            break;
+        case env_decay:
+            level -= env_decay_inc[chan];
+            if (level <= env_sustain_level[chan]) {
+                level = env_sustain_level[chan];
+                env_stages[chan] = env_sustain;
+            }
+            break;
+        case env_release:
+            level -= env_release_inc[chan];
+            if (level <= 0) {
+                level = 0;
+                env_stages[chan] = env_idle;
+            }
+            break;
+        default:
+            break;
+        }
+        env_level[chan] = level;
+    }
+    // Combine and encode straight into each chip's fast write frame in the buffer not in flight
+    for (uint8_t chan = 0; chan < nchans; chan++) {
+        int32_t code = base[chan];
+        code += (lfo_out[chan] * lfo_depth[chan]) >> 15;
+        code += (int32_t)(((int64_t)env_level[chan] * env_depth[chan]) >> 24);
+        if (code < 0)
+            code = 0;
+        else if (code > 4095)
+            code = 4095;
+        uint8_t* frame = frames[compute_buf][chan >> 2] + ((chan & 3) * 2);
+        frame[0] = (pd[chan] << 4) | (code >> 8);
+        frame[1] = code & 0xFF;
+    }
+    computed_buf = compute_buf;
+}
+
+bool rppicomidi::RP2040_MCP4728_mod::write_frames()
+{
+    for (uint8_t dacnum = 0; dacnum < ndacs; dacnum++)
+        chip_frames[dacnum].data = frames[computed_buf][dacnum];
+    if (!group->write_chips(chip_frames, ndacs))
+        return false;
+    compute_buf = computed_buf ^ 1;
+    return true;
+}
@@ -0,0 +1,188 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class is a modulation engine for MIDI-to-CV style applications. Every
+ * channel of every MCP4728 chip on a bus gets a base code, one LFO and one
+ * ADSR envelope. All math is fixed point: the LFOs are 32-bit phase accumulators
+ * and the envelopes are 8.24 fixed point levels. The state is stored as a
+ * structure of arrays so that each step of compute() is a tight loop over all
+ * 4 x N channels. compute() writes its results directly into encoded fast write
+ * frames, one per chip; write_frames() sends them to every chip as one bus
+ * frame through an RP2040_MCP4728_group, which must have the bus.
+ *
+ * The frames are double buffered. The group sends the frames in place, so
+ * write_frames() hands the group the buffer compute() just filled and flips
+ * compute() to the other one. compute() may run again while the group is still
+ * sending (for example, after write_frames() returned false because the last
+ * frames were not done), and it never changes bytes the group is sending.
+ *
+ * Call compute() then write_frames() once per tick (for example, from a
+ * repeating timer callback or the main loop) at the tick rate passed to the
+ * constructor. Call the group's task() function periodically so it can finish
+ * each frame.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+#ifndef RP2040_MCP4728_MOD_MAX_CHIPS
+#define RP2040_MCP4728_MOD_MAX_CHIPS 8
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_mod
+{
+public:
+    static const uint8_t max_channels = RP2040_MCP4728_MOD_MAX_CHIPS * 4;
+    enum lfo_shape : uint8_t {
+        lfo_off,
+        lfo_sine,
+        lfo_triangle,
+        lfo_saw,
+        lfo_square
+    };
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips to write (1-RP2040_MCP4728_MOD_MAX_CHIPS). Channel numbers are
+     * the group's channel numbers: dac index * 4 + DAC channel (0-3 => A-D)
+     * @param tick_rate_hz_ how many times per second compute() is called
+     */
+    RP2040_MCP4728_mod(RP2040_MCP4728_group* group_, uint32_t tick_rate_hz_);
+
+    /**
+     * @brief set the output code for a channel when the LFO and envelope contribute nothing
+     *
+     * @return false if chan is out of range or code > 4095 or pd > 3
+     * @param chan the channel number (see constructor)
+     * @param code the 12-bit DAC code
+     * @param pd the power-down code (0 is on)
+     */
+    bool set_base(uint8_t chan, uint16_t code, uint8_t pd=0);
+
+    /**
+     * @brief configure a channel's LFO
+     *
+     * @return false if chan is out of range
+     * @param chan the channel number (see constructor)
+     * @param shape the LFO waveform; lfo_off disables the LFO
+     * @param freq_millihz the LFO frequency in 1/1000 Hz units
+     * @param depth the peak deviation from the base code in DAC codes
+     */
+    bool set_lfo(uint8_t chan, lfo_shape shape, uint32_t freq_millihz, int16_t depth);
+
+    /**
+     * @brief configure a channel's ADSR envelope
+     *
+     * @return false if chan is out of range
+     * @param chan the channel number (see constructor)
+     * @param attack_us the time to rise from 0 to full level
+     * @param decay_us the time to fall from full level to 0 (the actual decay stops at the sustain level)
+     * @param sustain the sustain level; 0 is 0 and 65535 is full level
+     * @param release_us the time to fall from full level to 0 after the gate turns off
+     * @param depth the output deviation in DAC codes at full level
+     */
+    bool set_adsr(uint8_t chan, uint32_t attack_us, uint32_t decay_us, uint16_t sustain, uint32_t release_us, int16_t depth);
+
+    /**
+     * @brief turn a channel's envelope gate on (start attack) or off (start release)
+     *
+     * @return false if chan is out of range
+     * @param chan the channel number (see constructor)
+     * @param on true for gate on
+     */
+    bool gate(uint8_t chan, bool on);
+
+    /**
+     * @brief restart a channel's LFO at phase 0
+     */
+    bool reset_lfo_phase(uint8_t chan);
+
+    /**
+     * @brief advance every LFO and envelope by one tick and encode the results into the fast write frames
+     *
+     * This function writes the buffer that is not being sent, so it is safe to call while the
+     * group is updating.
+     */
+    void compute();
+
+    /**
+     * @brief send the most recently computed fast write frame of every chip as one bus frame
+     *
+     * If the group accepts the frames, the next compute() writes the other buffer.
+     * @return false if the frames could not be sent (for example, because the group does not
+     * have I2C bus access or the previous frames are still being sent)
+     */
+    bool write_frames();
+
+    /**
+     * @brief
+     *
+     * @return the encoded 8-byte fast write frame for channels A-D of the chip
+     * @param dacnum the index of the chip in the group
+     */
+    const uint8_t* get_frame(uint8_t dacnum) const { return frames[computed_buf][dacnum]; }
+protected:
+    enum env_stage : uint8_t {
+        env_idle,
+        env_attack,
+        env_decay,
+        env_sustain,
+        env_release
+    };
+    static const int32_t env_full = 1l << 24;
+    static int16_t sine_table[257];
+    static bool sine_table_ready;
+    int32_t per_tick(uint32_t time_us);
+    RP2040_MCP4728_group* group;
+    uint8_t ndacs;
+    uint8_t nchans;
+    uint32_t tick_rate_hz;
+
+    // structure of arrays channel state; index is the channel number
+    uint16_t base[max_channels];
+    uint8_t pd[max_channels];
+    uint32_t lfo_phase[max_channels];
+    uint32_t lfo_inc[max_channels];
+    int16_t lfo_depth[max_channels];
+    lfo_shape lfo_shapes[max_channels];
+    int32_t lfo_out[max_channels];        // Q15 LFO value for this tick
+    int32_t env_level[max_channels];      // 8.24 fixed point
+    int32_t env_attack_inc[max_channels];
+    int32_t env_decay_inc[max_channels];
+    int32_t env_sustain_level[max_channels];
+    int32_t env_release_inc[max_channels];
+    int16_t env_depth[max_channels];
+    env_stage env_stages[max_channels];
+
+    uint8_t frames[2][RP2040_MCP4728_MOD_MAX_CHIPS][8];
+    uint8_t compute_buf;  // the frames[] buffer the next compute() writes; the other may be in flight
+    uint8_t computed_buf; // the frames[] buffer the last compute() wrote
+    RP2040_MCP4728_group::chip_frame chip_frames[RP2040_MCP4728_MOD_MAX_CHIPS]; // one entry per chip for write_frames()
+private:
+    RP2040_MCP4728_mod()=delete;
+    RP2040_MCP4728_mod(const RP2040_MCP4728_mod&)=delete;
+    RP2040_MCP4728_mod& operator=(const RP2040_MCP4728_mod&)=delete;
+};
+}
@@ -0,0 +1,143 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_pipeline.h"
+#include <cstring> // memset, memcpy
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+rppicomidi::RP2040_MCP4728_pipeline::RP2040_MCP4728_pipeline(RP2040_MCP4728_group* group_, uint32_t period_us_) :
+    group{group_}, nchan{group_->get_num_channels()}, period_us{period_us_}, next_due_us{0}, head{0}, tail{0}
+{
+    static_assert(RP2040_MCP4728_PIPELINE_DEPTH >= 2 && RP2040_MCP4728_PIPELINE_DEPTH <= 128 &&
+        (RP2040_MCP4728_PIPELINE_DEPTH & (RP2040_MCP4728_PIPELINE_DEPTH - 1)) == 0,
+        "RP2040_MCP4728_PIPELINE_DEPTH must be a power of 2 from 2 to 128");
+    memset(slots, 0, sizeof(slots));
+    reset_statistics();
+}
+
+uint16_t* rppicomidi::RP2040_MCP4728_pipeline::acquire_frame()
+{
+    uint32_t h = head;
+    if (h - tail >= RP2040_MCP4728_PIPELINE_DEPTH) {
+        ++full_count;
+        return nullptr;
+    }
+    // Do not touch the slot until the consumer's reads of it are complete
+    __dmb();
+    return slots[h % RP2040_MCP4728_PIPELINE_DEPTH];
+}
+
+void rppicomidi::RP2040_MCP4728_pipeline::commit_frame()
+{
+    // Make the frame contents visible to the other core before publishing the slot
+    __dmb();
+    uint32_t h = head + 1;
+    head = h;
+    ++produced;
+    uint8_t occupancy = (uint8_t)(h - tail);
+    if (occupancy > high_water)
+        high_water = occupancy;
+}
+
+bool rppicomidi::RP2040_MCP4728_pipeline::push_frame(const uint16_t* codes)
+{
+    uint16_t* slot = acquire_frame();
+    if (slot == nullptr)
+        return false;
+    memcpy(slot, codes, nchan * sizeof(uint16_t));
+    commit_frame();
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_pipeline::service()
+{
+    group->task();
+    if (group->is_updating())
+        return;
+    uint64_t now = time_us_64();
+    if (period_us != 0) {
+        if (next_due_us == 0)
+            next_due_us = now;
+        if (now < next_due_us)
+            return;
+    }
+    uint32_t t = tail;
+    uint32_t occupancy = head - t;
+    if (occupancy == 0) {
+        if (period_us != 0) {
+            ++underruns;
+            advance_due(now);
+        }
+        return;
+    }
+    // Read the frame only after seeing the producer's head update
+    __dmb();
+    // A frame with an out of range code can never be sent; drop it
+    if (!group->set_channels(0, slots[t % RP2040_MCP4728_PIPELINE_DEPTH], nchan)) {
+        __dmb();
+        tail = t + 1;
+        ++dropped;
+        return;
+    }
+    // If the group cannot start the update (for example, it does not have
+    // the bus yet), keep the frame in the ring and try again on the next call
+    if (!group->update())
+        return;
+    __dmb();
+    tail = t + 1;
+    occupancy_sum += occupancy;
+    ++consumed;
+    if (period_us != 0)
+        advance_due(now);
+}
+
+void rppicomidi::RP2040_MCP4728_pipeline::advance_due(uint64_t now)
+{
+    next_due_us += period_us;
+    if (next_due_us < now)
+        next_due_us = now + period_us; // fell more than a period behind; do not try to catch up
+}
+
+void rppicomidi::RP2040_MCP4728_pipeline::get_statistics(statistics& stats) const
+{
+    stats.produced = produced;
+    stats.consumed = consumed;
+    stats.full_count = full_count;
+    stats.underruns = underruns;
+    stats.dropped = dropped;
+    stats.occupancy_sum = occupancy_sum;
+    stats.high_water = high_water;
+}
+
+void rppicomidi::RP2040_MCP4728_pipeline::reset_statistics()
+{
+    produced = 0;
+    full_count = 0;
+    high_water = 0;
+    consumed = 0;
+    underruns = 0;
+    dropped = 0;
+    occupancy_sum = 0;
+}
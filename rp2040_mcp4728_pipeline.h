@@ -0,0 +1,152 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class splits CV computation and I2C output between the two RP2040
+ * cores. The producer core computes complete frames, one 12-bit code (with
+ * the power-down code in bits 13:12) for every channel of an
+ * RP2040_MCP4728_group, directly into preallocated slots of a lock-free
+ * single producer single consumer ring. The consumer core owns the group
+ * and the I2C bus; it takes frames from the ring and sends them with
+ * RP2040_MCP4728_group::update(), which only writes the chips whose
+ * channels changed.
+ *
+ * If the ring is full, acquire_frame() returns nullptr and counts it, so the
+ * producer can slow down or skip work instead of blocking (backpressure). If
+ * the consumer runs at a fixed frame period and finds the ring empty when a
+ * frame is due, it counts an underrun. A frame stays in the ring until the
+ * group accepts its update; a frame with an out of range code is dropped and
+ * counted. The ring occupancy is sampled on
+ * every consumed frame for the average and high-water statistics.
+ *
+ * Only one core may call the producer functions and only the other core may
+ * call the consumer functions.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+#ifndef RP2040_MCP4728_PIPELINE_DEPTH
+// The number of frames in the ring; must be a power of 2
+#define RP2040_MCP4728_PIPELINE_DEPTH 8
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_pipeline
+{
+public:
+    struct statistics {
+        uint32_t produced;      // frames committed by the producer
+        uint32_t consumed;      // frames sent by the consumer
+        uint32_t full_count;    // times acquire_frame() found the ring full
+        uint32_t underruns;     // times a frame was due but the ring was empty
+        uint32_t dropped;       // frames discarded because a code was out of range
+        uint32_t occupancy_sum; // sum of the occupancy samples; divide by consumed for the average
+        uint8_t high_water;     // the most frames that were ever waiting in the ring
+    };
+
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips the frames are written to
+     * @param period_us_ if not 0, the consumer sends one frame every period_us_ microseconds
+     * and counts an underrun if none is ready. If 0, the consumer sends frames as soon as
+     * the previous update finishes.
+     */
+    RP2040_MCP4728_pipeline(RP2040_MCP4728_group* group_, uint32_t period_us_=0);
+
+    // Producer core functions
+
+    /**
+     * @brief get the next free frame slot
+     *
+     * @return a pointer to get_frame_size() codes to fill in, or nullptr if the ring is full
+     */
+    uint16_t* acquire_frame();
+
+    /**
+     * @brief make the slot returned by the last acquire_frame() available to the consumer
+     */
+    void commit_frame();
+
+    /**
+     * @brief copy a frame into the ring
+     *
+     * @return false if the ring is full
+     * @param codes get_frame_size() codes
+     */
+    bool push_frame(const uint16_t* codes);
+
+    // Consumer core functions
+
+    /**
+     * @brief send the next frame if the group is ready for it; also calls the group's
+     * task() function. Call this often from the core that owns the I2C bus.
+     */
+    void service();
+
+    // Either core
+
+    uint8_t get_frame_size() const { return nchan; }
+    uint8_t get_occupancy() const { return (uint8_t)(head - tail); }
+
+    /**
+     * @brief copy the statistics
+     *
+     * @param stats receives the statistics
+     */
+    void get_statistics(statistics& stats) const;
+
+    /**
+     * @brief clear the statistics; call only while neither core is using the pipeline
+     */
+    void reset_statistics();
+protected:
+    RP2040_MCP4728_group* group;
+    uint8_t nchan;
+    uint32_t period_us;
+    uint64_t next_due_us;
+    uint16_t slots[RP2040_MCP4728_PIPELINE_DEPTH][RP2040_MCP4728_group::max_dacs * 4];
+    volatile uint32_t head; // written only by the producer
+    volatile uint32_t tail; // written only by the consumer
+    // producer statistics
+    uint32_t produced;
+    uint32_t full_count;
+    uint8_t high_water;
+    // consumer statistics
+    uint32_t consumed;
+    uint32_t underruns;
+    uint32_t dropped;
+    uint32_t occupancy_sum;
+    /**
+     * @brief schedule the next frame one period after the current one
+     *
+     * @param now the current time in microseconds
+     */
+    void advance_due(uint64_t now);
+private:
+    RP2040_MCP4728_pipeline()=delete;
+    RP2040_MCP4728_pipeline(const RP2040_MCP4728_pipeline&)=delete;
+    RP2040_MCP4728_pipeline& operator=(const RP2040_MCP4728_pipeline&)=delete;
+};
+}
@@ -0,0 +1,303 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_program.h"
+#include "hardware/timer.h"
+
+// How long to wait before trying a step again when the I2C hardware is busy
+#define PLAYER_RETRY_US 5
+
+rppicomidi::RP2040_MCP4728_recorder::RP2040_MCP4728_recorder(uint8_t* buffer_, size_t buffer_size_) :
+    buffer{buffer_}, buffer_size{buffer_size_}, length{0}, use_clock{false}, last_step_us{0}
+{
+}
+
+void rppicomidi::RP2040_MCP4728_recorder::start(bool use_clock_)
+{
+    length = 0;
+    use_clock = use_clock_;
+    last_step_us = time_us_64();
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::begin_step(size_t nbytes)
+{
+    if (use_clock) {
+        uint64_t now = time_us_64();
+        uint64_t elapsed = now - last_step_us;
+        if (elapsed > 0xFFFFFFFFul)
+            elapsed = 0xFFFFFFFFul;
+        if (elapsed != 0 && !delay((uint32_t)elapsed))
+            return false;
+        last_step_us = now;
+    }
+    // always leave room for the end instruction
+    return length + nbytes + 1 <= buffer_size;
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::write_frame(uint8_t dacnum, const uint8_t* frame, uint8_t nbytes)
+{
+    if (dacnum >= RP2040_MCP4728_group::max_dacs || nbytes == 0 || nbytes > 16 || !begin_step(nbytes + 2))
+        return false;
+    buffer[length++] = mcp4728_program_op::write | dacnum;
+    buffer[length++] = nbytes;
+    for (uint8_t idx = 0; idx < nbytes; idx++)
+        buffer[length++] = frame[idx];
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::fast_write(uint8_t dacnum, const uint16_t* chan_dat, uint8_t nchan)
+{
+    if (nchan == 0 || nchan > 4)
+        return false;
+    uint8_t frame[8];
+    RP2040_MCP4728::encode_fast_write(chan_dat, nchan, frame);
+    return write_frame(dacnum, frame, nchan*2);
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::multi_write(uint8_t dacnum, const mcp4728_channel_data* chan_dat, uint8_t nchan)
+{
+    if (nchan == 0 || nchan > 4)
+        return false;
+    uint8_t frame[12];
+    for (uint8_t chan = 0; chan < nchan; chan++)
+        mcp4728_encode::multi_write_channel(chan_dat[chan], frame + chan*3);
+    return write_frame(dacnum, frame, nchan*3);
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::general_call(uint8_t command)
+{
+    if (!begin_step(2))
+        return false;
+    buffer[length++] = mcp4728_program_op::general_call;
+    buffer[length++] = command;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::ldac_pulse(uint8_t dacnum)
+{
+    if (dacnum >= RP2040_MCP4728_group::max_dacs || !begin_step(1))
+        return false;
+    buffer[length++] = mcp4728_program_op::ldac_pulse | dacnum;
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_recorder::delay(uint32_t delay_us)
+{
+    // 1 opcode byte + up to 5 LEB128 bytes + the end instruction
+    if (length + 7 > buffer_size)
+        return false;
+    buffer[length++] = mcp4728_program_op::delay;
+    do {
+        uint8_t byte = delay_us & 0x7F;
+        delay_us >>= 7;
+        buffer[length++] = byte | (delay_us != 0 ? 0x80 : 0);
+    } while (delay_us != 0);
+    return true;
+}
+
+size_t rppicomidi::RP2040_MCP4728_recorder::finish()
+{
+    if (length + 1 > buffer_size)
+        return 0;
+    buffer[length++] = mcp4728_program_op::end;
+    return length;
+}
+
+rppicomidi::RP2040_MCP4728_player::RP2040_MCP4728_player(RP2040_MCP4728_group* group_) :
+    group{group_}, program{nullptr}, pc{0}, due_us{0}, fire_us{0}, alarm_id{0}, running{false}, call_done_cb{false},
+    step_was_late{false}, done_cb{nullptr}, done_context{nullptr}, late_steps{0}, max_lateness_us{0}
+{
+}
+
+size_t rppicomidi::RP2040_MCP4728_player::decode_delay(const uint8_t* bytes, uint32_t& delay_us)
+{
+    size_t idx = 0;
+    delay_us = 0;
+    uint8_t byte;
+    do {
+        byte = bytes[idx];
+        delay_us |= (uint32_t)(byte & 0x7F) << (7 * idx);
+        ++idx;
+    } while ((byte & 0x80) != 0);
+    return idx;
+}
+
+bool rppicomidi::RP2040_MCP4728_player::validate(const uint8_t* program_, size_t size, uint8_t ndacs, uint16_t ldac_mask)
+{
+    size_t idx = 0;
+    while (idx < size) {
+        uint8_t op = program_[idx] & 0xF0;
+        uint8_t dacnum = program_[idx] & 0x0F;
+        if (op == mcp4728_program_op::end) {
+            return true;
+        }
+        else if (op == mcp4728_program_op::write) {
+            if (dacnum >= ndacs || idx + 1 >= size || program_[idx+1] == 0 || program_[idx+1] > 16 ||
+                    idx + 2 + program_[idx+1] > size)
+                return false;
+            idx += 2 + program_[idx+1];
+        }
+        else if (op == mcp4728_program_op::general_call) {
+            if (idx + 1 >= size)
+                return false;
+            idx += 2;
+        }
+        else if (op == mcp4728_program_op::ldac_pulse) {
+            if (dacnum >= ndacs || (ldac_mask & (1 << dacnum)) == 0)
+                return false;
+            ++idx;
+        }
+        else if (op == mcp4728_program_op::delay) {
+            // at most 5 LEB128 bytes for a 32-bit delay
+            size_t nbytes = 1;
+            while (idx + nbytes < size && (program_[idx + nbytes] & 0x80) != 0 && nbytes < 5)
+                ++nbytes;
+            if (idx + nbytes >= size || (program_[idx + nbytes] & 0x80) != 0)
+                return false;
+            idx += nbytes + 1;
+        }
+        else {
+            return false;
+        }
+    }
+    return false; // no end instruction
+}
+
+bool rppicomidi::RP2040_MCP4728_player::start(const uint8_t* program_, size_t size, uint32_t start_delay_us, void (*callback)(void* context), void* context)
+{
+    uint16_t ldac_mask = 0;
+    for (uint8_t dacnum = 0; dacnum < group->get_num_dacs(); dacnum++) {
+        if (group->has_ldac_pin(dacnum))
+            ldac_mask |= 1 << dacnum;
+    }
+    if (running || !group->has_bus() || group->is_updating() || !validate(program_, size, group->get_num_dacs(), ldac_mask))
+        return false;
+    program = program_;
+    pc = 0;
+    done_cb = callback;
+    done_context = context;
+    call_done_cb = false;
+    step_was_late = false;
+    late_steps = 0;
+    max_lateness_us = 0;
+    due_us = time_us_64() + start_delay_us;
+    fire_us = due_us;
+    running = true;
+    alarm_id = add_alarm_at(from_us_since_boot(due_us), alarm_callback, this, true);
+    if (alarm_id < 0) {
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_player::stop()
+{
+    if (running) {
+        cancel_alarm(alarm_id);
+        running = false;
+    }
+}
+
+int64_t rppicomidi::RP2040_MCP4728_player::alarm_callback(alarm_id_t, void* user_data)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_player*>(user_data);
+    return me->run_steps();
+}
+
+bool rppicomidi::RP2040_MCP4728_player::run_step(const uint8_t* step)
+{
+    uint8_t op = step[0] & 0xF0;
+    uint8_t dacnum = step[0] & 0x0F;
+    bool result = true;
+    if (op == mcp4728_program_op::write) {
+        result = group->write_chip(dacnum, step + 2, step[1]);
+        if (result)
+            pc += 2 + step[1];
+    }
+    else if (op == mcp4728_program_op::general_call) {
+        result = group->general_call(step[1]);
+        if (result)
+            pc += 2;
+    }
+    else if (op == mcp4728_program_op::ldac_pulse) {
+        // the writes before the pulse may still be in the TX FIFO; the pulse
+        // must wait for them to reach the chip's input registers
+        result = !group->is_bus_busy() && group->pulse_ldac(dacnum);
+        if (result)
+            ++pc;
+    }
+    return result;
+}
+
+int64_t rppicomidi::RP2040_MCP4728_player::run_steps()
+{
+    // Run every step that is due now. Return the time to the next alarm relative to when
+    // this alarm was scheduled to fire (a negative return value) so the timing does not drift.
+    for (;;) {
+        const uint8_t* step = program + pc;
+        uint8_t op = step[0] & 0xF0;
+        if (op == mcp4728_program_op::end) {
+            running = false;
+            call_done_cb = true;
+            return 0;
+        }
+        else if (op == mcp4728_program_op::delay) {
+            uint32_t delay_us;
+            pc += 1 + decode_delay(step + 1, delay_us);
+            if (delay_us != 0) {
+                due_us += delay_us;
+                int64_t next = (int64_t)(due_us - fire_us);
+                if (next < 1)
+                    next = 1; // behind schedule; run as soon as possible
+                fire_us += next;
+                return -next;
+            }
+        }
+        else {
+            if (!run_step(step)) {
+                // the I2C hardware is still busy with the previous step; try again soon
+                if (!step_was_late) {
+                    step_was_late = true;
+                    ++late_steps;
+                }
+                fire_us += PLAYER_RETRY_US;
+                return -PLAYER_RETRY_US;
+            }
+            uint64_t now = time_us_64();
+            if (now > due_us && (now - due_us) > max_lateness_us)
+                max_lateness_us = (uint32_t)(now - due_us);
+            step_was_late = false;
+        }
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_player::task()
+{
+    if (call_done_cb) {
+        call_done_cb = false;
+        if (done_cb)
+            done_cb(done_context);
+    }
+}
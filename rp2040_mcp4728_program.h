@@ -0,0 +1,241 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * These classes record and replay fixed sequences of MCP4728 operations
+ * ("frame programs") for test fixtures and other scripted output.
+ *
+ * RP2040_MCP4728_recorder encodes fast writes, multi writes, general call
+ * commands, LDAC pulses and delays into a compact bytecode buffer. Every write
+ * is stored as the already encoded command bytes. A recorded program may be
+ * copied into a const array so that it runs straight from flash.
+ *
+ * RP2040_MCP4728_player runs a program from a timer alarm interrupt through an
+ * RP2040_MCP4728_group that has the I2C bus. Each step only loads the stored
+ * bytes into the I2C TX FIFO or toggles an LDAC pin. An LDAC pulse waits until
+ * the writes before it are done on the wire, so it latches them. Step times are computed
+ * from the start time plus the sum of the recorded delays, so timing errors do
+ * not accumulate. If the I2C hardware is still busy with the previous step, the
+ * step is retried a few microseconds later and counted as late.
+ *
+ * Bytecode format. The upper 4 bits of the first byte of each instruction are
+ * the opcode and the lower 4 bits are the chip index in the group, if used.
+ *   0x00                 end of program
+ *   0x1c n b[0]..b[n-1]  write n (1-16) encoded bytes to chip c
+ *   0x20 cmd             send general call command cmd (0x08 is software update)
+ *   0x3c                 pulse chip c's LDAC\ pin
+ *   0x40 d...            delay d microseconds before the next step; d is unsigned
+ *                        LEB128 (7 bits per byte, least significant first)
+ */
+#pragma once
+#include <cstddef>
+#include "rp2040_mcp4728_group.h"
+namespace rppicomidi
+{
+namespace mcp4728_program_op
+{
+    static const uint8_t end = 0x00;
+    static const uint8_t write = 0x10;
+    static const uint8_t general_call = 0x20;
+    static const uint8_t ldac_pulse = 0x30;
+    static const uint8_t delay = 0x40;
+}
+
+class RP2040_MCP4728_recorder
+{
+public:
+    /**
+     * @brief constructor
+     *
+     * @param buffer_ the buffer that receives the bytecode
+     * @param buffer_size_ the number of bytes in buffer
+     */
+    RP2040_MCP4728_recorder(uint8_t* buffer_, size_t buffer_size_);
+
+    /**
+     * @brief discard any recorded program and start a new one
+     *
+     * @param use_clock_ if true, each recorded step is preceded by a delay equal to the time
+     * since the previous recorded step, so you can record a sequence by running it live.
+     * If false, only delay() adds delays.
+     */
+    void start(bool use_clock_=false);
+
+    /**
+     * @brief record a fast write of channels A through nchan-1 (see RP2040_MCP4728::fast_write())
+     *
+     * @return false if the buffer is full or the parameters are not valid
+     */
+    bool fast_write(uint8_t dacnum, const uint16_t* chan_dat, uint8_t nchan);
+
+    /**
+     * @brief record a multi write (see RP2040_MCP4728::multi_write())
+     *
+     * @return false if the buffer is full or the parameters are not valid
+     */
+    bool multi_write(uint8_t dacnum, const mcp4728_channel_data* chan_dat, uint8_t nchan);
+
+    /**
+     * @brief record a write of already encoded command bytes
+     *
+     * @return false if the buffer is full or the parameters are not valid
+     */
+    bool write_frame(uint8_t dacnum, const uint8_t* frame, uint8_t nbytes);
+
+    /**
+     * @brief record a general call software update (see RP2040_MCP4728::update_all_channels())
+     *
+     * @return false if the buffer is full
+     */
+    bool update_all_channels() { return general_call(0x08); }
+
+    /**
+     * @brief record a general call command
+     *
+     * @return false if the buffer is full
+     */
+    bool general_call(uint8_t command);
+
+    /**
+     * @brief record an LDAC\ pulse on one chip
+     *
+     * @return false if the buffer is full or dacnum is not valid
+     */
+    bool ldac_pulse(uint8_t dacnum);
+
+    /**
+     * @brief record a delay before the next step
+     *
+     * @return false if the buffer is full
+     */
+    bool delay(uint32_t delay_us);
+
+    /**
+     * @brief terminate the program
+     *
+     * @return the number of bytes in the program including the end instruction or 0 if the
+     * buffer is full
+     */
+    size_t finish();
+
+    const uint8_t* get_program() const { return buffer; }
+    size_t get_size() const { return length; }
+protected:
+    bool begin_step(size_t nbytes);
+    uint8_t* buffer;
+    size_t buffer_size;
+    size_t length;
+    bool use_clock;
+    uint64_t last_step_us;
+private:
+    RP2040_MCP4728_recorder()=delete;
+    RP2040_MCP4728_recorder(const RP2040_MCP4728_recorder&)=delete;
+    RP2040_MCP4728_recorder& operator=(const RP2040_MCP4728_recorder&)=delete;
+};
+
+class RP2040_MCP4728_player
+{
+public:
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips the program writes to. The group must have the I2C bus while
+     * the program runs and must not be used for anything else until the program is done.
+     */
+    RP2040_MCP4728_player(RP2040_MCP4728_group* group_);
+
+    /**
+     * @brief check a program and start running it
+     *
+     * @return false if a program is already running, the group does not have the bus,
+     * the program is not valid (including an LDAC\ pulse on a chip without an LDAC\ pin)
+     * or no timer alarm is available
+     * @param program_ the bytecode; it must stay valid until the program is done. It may be in flash.
+     * @param size the number of bytes in the program
+     * @param start_delay_us the time from now until the first step
+     * @param callback is called from task() when the program ends (optional)
+     * @param context is the context parameter for the callback
+     */
+    bool start(const uint8_t* program_, size_t size, uint32_t start_delay_us=0, void (*callback)(void* context)=nullptr, void* context=nullptr);
+
+    /**
+     * @brief stop a running program before its end
+     */
+    void stop();
+
+    /**
+     * @brief call the end of program callback; call this periodically
+     */
+    void task();
+
+    bool is_running() const { return running; }
+
+    /**
+     * @brief
+     *
+     * @return the number of steps in the most recent run that could not start on time
+     * because the I2C hardware was busy
+     */
+    uint32_t get_late_steps() const { return late_steps; }
+
+    /**
+     * @brief
+     *
+     * @return the largest time in microseconds between when a step was due and when it ran
+     */
+    uint32_t get_max_lateness_us() const { return max_lateness_us; }
+
+    /**
+     * @brief check that a program is well formed
+     *
+     * @return true if every instruction is valid for a group of ndacs chips and the
+     * program ends with an end instruction
+     * @param ldac_mask bit n is set if chip n has an LDAC\ pin; LDAC\ pulses on other chips are not valid
+     */
+    static bool validate(const uint8_t* program_, size_t size, uint8_t ndacs, uint16_t ldac_mask=0xFFFF);
+protected:
+    static int64_t alarm_callback(alarm_id_t id, void* user_data);
+    int64_t run_steps();
+    bool run_step(const uint8_t* step);
+    static size_t decode_delay(const uint8_t* bytes, uint32_t& delay_us);
+    RP2040_MCP4728_group* group;
+    const uint8_t* program;
+    size_t pc;
+    uint64_t due_us;        // when the next step should run
+    uint64_t fire_us;       // when the alarm was scheduled to fire
+    alarm_id_t alarm_id;
+    volatile bool running;
+    volatile bool call_done_cb;
+    bool step_was_late;
+    void (*done_cb)(void* context);
+    void* done_context;
+    uint32_t late_steps;
+    uint32_t max_lateness_us;
+private:
+    RP2040_MCP4728_player()=delete;
+    RP2040_MCP4728_player(const RP2040_MCP4728_player&)=delete;
+    RP2040_MCP4728_player& operator=(const RP2040_MCP4728_player&)=delete;
+};
+}
@@ -0,0 +1,244 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * The framing and checksum code of the binary DAC control protocol. The
+ * RP2040_MCP4728_binary class uses it on the target and the host client
+ * library in the host directory uses it on a PC, so both ends share one
+ * implementation.
+ *
+ * A decoded frame is a sequence number byte, a message type byte, the
+ * payload and a CRC-16/CCITT-FALSE of all of those bytes, most significant
+ * byte first. On the wire, each frame is COBS encoded and followed by a 0
+ * byte, so a receiver can always find the start of the next frame.
+ *
+ * This file does not depend on the Pico SDK.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace rppicomidi
+{
+namespace mcp4728_protocol
+{
+enum message_type : uint8_t {
+    // host to target
+    msg_open = 0x01,    // start binary mode; no payload. The sequence number restarts at this frame's
+    msg_close = 0x02,   // leave binary mode when the queued writes are done; no payload
+    msg_write = 0x03,   // one or more write records: chip number, nbytes (1-16), nbytes of encoded MCP4728 command.
+                        // The records take as many bytes in the target's write queue as in the payload
+    // target to host
+    msg_ack = 0x81,     // payload: the next sequence number the target expects, ack_flag_ bits and
+                        // the free bytes in the target's write queue, most significant byte first
+};
+
+enum ack_flags : uint8_t {
+    ack_flag_rejected = 0x01,   // a frame was rejected because it was damaged, out of sequence or did not fit
+    ack_flag_closed = 0x02,     // the target has left binary mode
+};
+
+static const size_t ack_payload_len = 4;
+// the header is the sequence number and message type; the trailer is the CRC
+static const size_t frame_overhead = 4;
+static const size_t max_payload = 250;
+static const size_t max_frame = max_payload + frame_overhead;
+static const size_t max_record_bytes = 16;
+
+/**
+ * @brief
+ *
+ * @return the CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) of nbytes bytes
+ */
+constexpr uint16_t crc16(const uint8_t* data, size_t nbytes)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t idx = 0; idx < nbytes; idx++) {
+        crc ^= (uint16_t)data[idx] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+/**
+ * @brief
+ *
+ * @return the largest number of bytes COBS encoding nbytes bytes can produce
+ */
+constexpr size_t cobs_max_encoded(size_t nbytes)
+{
+    return nbytes + nbytes / 254 + 1;
+}
+
+/**
+ * @brief COBS encode nbytes bytes. The result contains no 0 bytes.
+ *
+ * @return the number of bytes written to dst
+ * @param src the bytes to encode
+ * @param nbytes the number of bytes to encode
+ * @param dst points to at least cobs_max_encoded(nbytes) bytes
+ */
+constexpr size_t cobs_encode(const uint8_t* src, size_t nbytes, uint8_t* dst)
+{
+    size_t code_idx = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+    for (size_t idx = 0; idx < nbytes; idx++) {
+        if (src[idx] == 0) {
+            dst[code_idx] = code;
+            code_idx = out++;
+            code = 1;
+        }
+        else {
+            dst[out++] = src[idx];
+            if (++code == 0xFF) {
+                dst[code_idx] = code;
+                code_idx = out++;
+                code = 1;
+            }
+        }
+    }
+    dst[code_idx] = code;
+    return out;
+}
+
+/**
+ * @brief decode a COBS encoded block that does not include the 0 delimiter
+ *
+ * @return the number of bytes written to dst or 0 if the block is not valid COBS
+ * or does not fit in dst
+ * @param src the encoded bytes
+ * @param nbytes the number of encoded bytes
+ * @param dst receives the decoded bytes
+ * @param dst_size the number of bytes dst can hold
+ */
+constexpr size_t cobs_decode(const uint8_t* src, size_t nbytes, uint8_t* dst, size_t dst_size)
+{
+    size_t out = 0;
+    size_t idx = 0;
+    while (idx < nbytes) {
+        uint8_t code = src[idx++];
+        if (code == 0 || idx + code - 1 > nbytes)
+            return 0;
+        for (uint8_t count = 1; count < code; count++) {
+            if (src[idx] == 0 || out >= dst_size)
+                return 0;
+            dst[out++] = src[idx++];
+        }
+        if (code != 0xFF && idx < nbytes) {
+            if (out >= dst_size)
+                return 0;
+            dst[out++] = 0;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief build a complete wire frame: a COBS encoded frame followed by a 0 delimiter
+ *
+ * @return the number of bytes written to dst, or 0 if the payload is too long
+ * @param seq the sequence number
+ * @param type the message type
+ * @param payload the message payload
+ * @param nbytes the number of payload bytes (0 to max_payload)
+ * @param dst points to at least cobs_max_encoded(max_frame) + 1 bytes
+ */
+constexpr size_t encode_frame(uint8_t seq, uint8_t type, const uint8_t* payload, size_t nbytes, uint8_t* dst)
+{
+    if (nbytes > max_payload)
+        return 0;
+    uint8_t frame[max_frame] = {};
+    frame[0] = seq;
+    frame[1] = type;
+    for (size_t idx = 0; idx < nbytes; idx++)
+        frame[idx + 2] = payload[idx];
+    uint16_t crc = crc16(frame, nbytes + 2);
+    frame[nbytes + 2] = crc >> 8;
+    frame[nbytes + 3] = crc & 0xFF;
+    size_t encoded = cobs_encode(frame, nbytes + frame_overhead, dst);
+    dst[encoded] = 0;
+    return encoded + 1;
+}
+
+/**
+ * This class collects received bytes until a frame delimiter and checks the frame.
+ */
+class frame_decoder
+{
+public:
+    frame_decoder() : nreceived{0}, overflow{false}, frame_len{0} {}
+
+    /**
+     * @brief process one received byte
+     *
+     * @return 1 if a valid frame is ready; get_seq(), get_type(), get_payload()
+     * and get_payload_len() describe it until the next call.
+     * @return -1 if a damaged frame was discarded
+     * @return 0 otherwise
+     */
+    int receive(uint8_t c)
+    {
+        if (c != 0) {
+            if (nreceived < sizeof(encoded))
+                encoded[nreceived++] = c;
+            else
+                overflow = true;
+            return 0;
+        }
+        // end of frame; a 0 byte right after another one is just a resynchronization marker
+        size_t nbytes = nreceived;
+        bool too_long = overflow;
+        nreceived = 0;
+        overflow = false;
+        if (nbytes == 0)
+            return 0;
+        if (too_long)
+            return -1;
+        frame_len = cobs_decode(encoded, nbytes, frame, sizeof(frame));
+        if (frame_len < frame_overhead) {
+            frame_len = 0;
+            return -1;
+        }
+        uint16_t crc = ((uint16_t)frame[frame_len - 2] << 8) | frame[frame_len - 1];
+        if (crc != crc16(frame, frame_len - 2)) {
+            frame_len = 0;
+            return -1;
+        }
+        return 1;
+    }
+    uint8_t get_seq() const { return frame[0]; }
+    uint8_t get_type() const { return frame[1]; }
+    const uint8_t* get_payload() const { return frame + 2; }
+    size_t get_payload_len() const { return frame_len - frame_overhead; }
+private:
+    uint8_t encoded[cobs_max_encoded(max_frame)];
+    size_t nreceived;
+    bool overflow;
+    uint8_t frame[max_frame];
+    size_t frame_len;
+};
+} // namespace mcp4728_protocol
+} // namespace rppicomidi
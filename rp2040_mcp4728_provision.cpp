@@ -0,0 +1,157 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_provision.h"
+#include <cstring> // for memset
+#include "pico/time.h"
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+
+// The RP2040_i2c_device address is not used; every access is bit banged
+rppicomidi::RP2040_MCP4728_provisioner::RP2040_MCP4728_provisioner(Rp2040_i2c_bus* bus_) : RP2040_i2c_device(0x60, bus_),
+    bus_ready{false}
+{
+}
+
+void rppicomidi::RP2040_MCP4728_provisioner::bus_ready_callback(RP2040_i2c_device* dev)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_provisioner*>(dev);
+    me->bus_ready = true;
+}
+
+bool rppicomidi::RP2040_MCP4728_provisioner::wait_for_bus(uint32_t timeout_us)
+{
+    bus_ready = false;
+    int result = bus->request_bus(this, bus_ready_callback);
+    if (result < 0)
+        return false;
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    while (result == 0 && !bus_ready) {
+        if (time_reached(deadline)) {
+            bus->release_bus(this); // remove this device from the queue
+            return false;
+        }
+        tight_loop_contents();
+    }
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_provisioner::provision(const uint* ldac_gpios, const uint8_t* target_addrs, uint8_t nchips, report& rep, uint32_t timeout_us)
+{
+    memset(&rep, 0, sizeof(rep));
+    if (ldac_gpios == nullptr || target_addrs == nullptr || nchips < 1 || nchips > max_chips)
+        return false;
+    uint8_t target_mask = 0;
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        if (target_addrs[idx] < 0x60 || target_addrs[idx] > 0x67 || (target_mask & (1 << (target_addrs[idx] & 0x7))) != 0)
+            return false;
+        target_mask |= 1 << (target_addrs[idx] & 0x7);
+    }
+    absolute_time_t start = get_absolute_time();
+    rep.nchips = nchips;
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        rep.chips[idx].ldac_gpio = ldac_gpios[idx];
+        rep.chips[idx].target_addr = target_addrs[idx];
+        // Make sure every LDAC\ pin is an output initialized to high
+        gpio_init(ldac_gpios[idx]);
+        gpio_put(ldac_gpios[idx], true);
+        gpio_set_dir(ldac_gpios[idx], true);
+    }
+    if (!wait_for_bus(timeout_us))
+        return false;
+    if (!bus->deinit_i2c_bus(this)) {
+        bus->release_bus(this);
+        return false;
+    }
+    uint sda_pin, scl_pin;
+    bus->get_bus_pins(sda_pin, scl_pin);
+    RP2040_MCP4728::bit_bang_begin(sda_pin, scl_pin);
+
+    // Read all current addresses before changing any of them
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        uint8_t read_addr;
+        if (RP2040_MCP4728::bit_bang_addr_bits(sda_pin, scl_pin, ldac_gpios[idx], 0, 0, read_addr))
+            rep.chips[idx].old_addr = ((read_addr >> 1) & 0x7) | 0x60;
+    }
+
+    // Program every chip that needs it. Do not wait for each EEPROM write; the
+    // address in the input register changes as soon as the command completes.
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        auto& chip = rep.chips[idx];
+        uint8_t dummy;
+        if (chip.old_addr == 0) {
+            continue; // chip did not respond
+        }
+        else if (chip.old_addr == chip.target_addr) {
+            chip.eeprom_ready = true;
+        }
+        else if (RP2040_MCP4728::bit_bang_addr_bits(sda_pin, scl_pin, ldac_gpios[idx], chip.old_addr, chip.target_addr, dummy)) {
+            chip.programmed = true;
+        }
+    }
+
+    // Poll all programmed chips until their EEPROM writes finish
+    absolute_time_t wait_start = get_absolute_time();
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    bool all_ready;
+    do {
+        all_ready = true;
+        for (uint8_t idx = 0; idx < nchips; idx++) {
+            auto& chip = rep.chips[idx];
+            if (chip.programmed && !chip.eeprom_ready) {
+                uint8_t status;
+                if (RP2040_MCP4728::bit_bang_read_status(sda_pin, scl_pin, chip.target_addr, status) && (status & 0x80) != 0)
+                    chip.eeprom_ready = true;
+                else
+                    all_ready = false;
+            }
+        }
+        if (!all_ready)
+            sleep_us(500);
+    } while (!all_ready && !time_reached(deadline));
+    rep.eeprom_wait_us = absolute_time_diff_us(wait_start, get_absolute_time());
+
+    // Scan the MCP4728 address range
+    for (uint8_t addr_bits = 0; addr_bits < 8; addr_bits++) {
+        uint8_t status;
+        if (RP2040_MCP4728::bit_bang_read_status(sda_pin, scl_pin, 0x60 | addr_bits, status))
+            rep.scan_mask |= 1 << addr_bits;
+    }
+
+    // Read back the address bits. Bits 7:5 are the EEPROM copy and bits 3:1 are the input register copy
+    for (uint8_t idx = 0; idx < nchips; idx++) {
+        auto& chip = rep.chips[idx];
+        uint8_t bits = chip.target_addr & 0x7;
+        if (RP2040_MCP4728::bit_bang_addr_bits(sda_pin, scl_pin, ldac_gpios[idx], 0, 0, chip.read_addr)) {
+            chip.verified = chip.eeprom_ready && (rep.scan_mask & (1 << bits)) != 0 &&
+                ((chip.read_addr >> 5) & 0x7) == bits && ((chip.read_addr >> 1) & 0x7) == bits;
+        }
+        if (chip.verified)
+            ++rep.nverified;
+    }
+    bus->reinit_i2c_bus(this);
+    bus->release_bus(this);
+    rep.total_us = absolute_time_diff_us(start, get_absolute_time());
+    return rep.nverified == nchips;
+}
+#endif
@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class assigns I2C addresses to up to 8 MCP4728 chips on the same
+ * I2C bus in one pass, for example on a production line where every chip
+ * arrives with the factory address 0x60. Each chip needs its own LDAC GPIO.
+ *
+ * provision() reads every chip's current address, sends the write address
+ * bits command to every chip that needs a new address without waiting for
+ * the EEPROM write to finish, then polls all of the programmed chips until
+ * their EEPROM writes are done. The EEPROM write times overlap, so a full
+ * board takes about one EEPROM write time instead of one per chip. Finally
+ * it scans addresses 0x60-0x67, reads back every chip's address bits and
+ * fills in a report.
+ *
+ * provision() blocks and bit bangs the I2C bus, so it is meant for bring-up
+ * and factory test firmware, not for normal operation.
+ */
+#pragma once
+#include "rp2040_mcp4728_lib.h"
+#if RP2040_MCP4728_ENABLE_ADDR_BITS
+namespace rppicomidi
+{
+class RP2040_MCP4728_provisioner : public RP2040_i2c_device
+{
+public:
+    static const uint8_t max_chips = 8;
+    struct chip_report {
+        uint ldac_gpio;
+        uint8_t target_addr;
+        uint8_t old_addr;       // the address in the input register before provisioning; 0 if it could not be read
+        uint8_t read_addr;      // the raw address bits read back after provisioning; see RP2040_MCP4728::access_addr_bits()
+        bool programmed;        // true if a new address was written
+        bool eeprom_ready;      // true if the chip reported EEPROM write complete (or was not programmed)
+        bool verified;          // true if the chip answers at target_addr and its EEPROM and input register bits match
+    };
+    struct report {
+        chip_report chips[max_chips];
+        uint8_t nchips;
+        uint8_t nverified;
+        uint8_t scan_mask;      // bit n is set if a device acknowledged address 0x60+n
+        uint32_t eeprom_wait_us;// time from the last address write until every EEPROM write completed
+        uint32_t total_us;      // time for the whole provision() call
+    };
+
+    /**
+     * @brief constructor
+     *
+     * @param bus_ the bus the MCP4728 chips are attached to
+     */
+    RP2040_MCP4728_provisioner(Rp2040_i2c_bus* bus_);
+
+    /**
+     * @brief assign I2C addresses to a set of MCP4728 chips
+     *
+     * @return true if every chip was verified at its target address
+     * @param ldac_gpios the GPIO numbers of each chip's LDAC pin
+     * @param target_addrs the I2C address (0x60-0x67) each chip should have. The addresses
+     * must all be different
+     * @param nchips the number of entries in ldac_gpios and target_addrs (1-8)
+     * @param rep returns the result for each chip and the timing
+     * @param timeout_us the maximum time to wait for the bus and for the EEPROM writes
+     */
+    bool provision(const uint* ldac_gpios, const uint8_t* target_addrs, uint8_t nchips, report& rep, uint32_t timeout_us=200000);
+protected:
+    static void bus_ready_callback(RP2040_i2c_device* dev);
+    bool wait_for_bus(uint32_t timeout_us);
+    volatile bool bus_ready;
+private:
+    RP2040_MCP4728_provisioner()=delete;
+    RP2040_MCP4728_provisioner(const RP2040_MCP4728_provisioner&)=delete;
+    RP2040_MCP4728_provisioner& operator=(const RP2040_MCP4728_provisioner&)=delete;
+};
+}
+#endif
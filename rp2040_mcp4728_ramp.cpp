@@ -0,0 +1,191 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_ramp.h"
+#include <cmath>
+#include <cstring> // memset
+
+rppicomidi::RP2040_MCP4728_ramp::RP2040_MCP4728_ramp(RP2040_MCP4728* dac_, uint32_t tick_us_) :
+    dac{dac_}, tick_us{tick_us_}, running{false}, write_pending{false}, missed_ticks{0}
+{
+    critical_section_init(&crit_sec);
+    memset(channels, 0, sizeof(channels));
+    memset(&timer, 0, sizeof(timer));
+    for (auto& ch: channels) {
+        ch.curve = curve_linear;
+    }
+}
+
+rppicomidi::RP2040_MCP4728_ramp::~RP2040_MCP4728_ramp()
+{
+    if (running)
+        cancel_repeating_timer(&timer);
+    critical_section_deinit(&crit_sec);
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::set_current(uint8_t chan, uint16_t code, uint8_t pd)
+{
+    if (chan > 3 || code > 4095 || pd > 3)
+        return false;
+    critical_section_enter_blocking(&crit_sec);
+    channels[chan].position = (uint32_t)code << 16;
+    channels[chan].target = channels[chan].position;
+    channels[chan].pd = pd;
+    critical_section_exit(&crit_sec);
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::set_linear_slew(uint8_t chan, uint32_t codes_per_second)
+{
+    if (chan > 3)
+        return false;
+    // codes per tick in 12.16 fixed point; 0 means jump
+    uint64_t step = ((uint64_t)codes_per_second * tick_us << 16) / 1000000ull;
+    if (codes_per_second != 0 && step == 0)
+        step = 1;
+    critical_section_enter_blocking(&crit_sec);
+    channels[chan].curve = curve_linear;
+    channels[chan].step = step > 0xFFFFFFFFull ? 0xFFFFFFFF : (uint32_t)step;
+    critical_section_exit(&crit_sec);
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::set_exponential_slew(uint8_t chan, uint32_t time_constant_us)
+{
+    if (chan > 3 || time_constant_us == 0)
+        return false;
+    // fraction of the remaining distance to cover per tick in 0.16 fixed point.
+    // Computed here so the timer IRQ does no floating point math.
+    uint32_t step = (uint32_t)((1.0 - exp(-(double)tick_us / (double)time_constant_us)) * 65536.0);
+    if (step == 0)
+        step = 1;
+    critical_section_enter_blocking(&crit_sec);
+    channels[chan].curve = curve_exponential;
+    channels[chan].step = step;
+    critical_section_exit(&crit_sec);
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::start_locked()
+{
+    if (running)
+        return true;
+    // negative delay means tick_us between the starts of each callback
+    running = add_repeating_timer_us(-(int64_t)tick_us, timer_callback, this, &timer);
+    return running;
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::set_target(uint8_t chan, uint16_t code)
+{
+    if (chan > 3 || code > 4095)
+        return false;
+    critical_section_enter_blocking(&crit_sec);
+    channels[chan].target = (uint32_t)code << 16;
+    bool result = start_locked();
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::set_targets(const uint16_t* codes)
+{
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        if (codes[chan] > 4095)
+            return false;
+    }
+    critical_section_enter_blocking(&crit_sec);
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        channels[chan].target = (uint32_t)codes[chan] << 16;
+    }
+    bool result = start_locked();
+    critical_section_exit(&crit_sec);
+    return result;
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::timer_callback(repeating_timer_t* rt)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_ramp*>(rt->user_data);
+    return me->tick();
+}
+
+bool rppicomidi::RP2040_MCP4728_ramp::tick()
+{
+    uint16_t chan_dat[4];
+    int8_t last_moving = -1;
+    critical_section_enter_blocking(&crit_sec);
+    for (uint8_t chan = 0; chan < 4; chan++) {
+        auto& ch = channels[chan];
+        if (ch.position != ch.target) {
+            uint32_t distance = ch.position < ch.target ? ch.target - ch.position : ch.position - ch.target;
+            uint32_t delta;
+            if (ch.curve == curve_linear) {
+                delta = ch.step;
+            }
+            else {
+                delta = (uint32_t)(((uint64_t)distance * ch.step) >> 16);
+                // don't crawl forever through the last fraction of a code
+                if (delta < (1ul << 12))
+                    delta = 1ul << 12;
+            }
+            if (delta == 0 || delta >= distance)
+                ch.position = ch.target;
+            else if (ch.position < ch.target)
+                ch.position += delta;
+            else
+                ch.position -= delta;
+            last_moving = chan;
+        }
+    }
+    if (last_moving >= 0)
+        write_pending = true;
+    // fast_write always starts with channel A, so cover A through the last moving channel
+    uint8_t nchan = 0;
+    if (write_pending) {
+        nchan = last_moving >= 0 ? last_moving + 1 : 4;
+        for (uint8_t chan = 0; chan < nchan; chan++) {
+            // round to the nearest code
+            uint16_t code = (channels[chan].position + 0x8000) >> 16;
+            if (code > 4095)
+                code = 4095;
+            chan_dat[chan] = ((uint16_t)channels[chan].pd << 12) | code;
+        }
+    }
+    critical_section_exit(&crit_sec);
+
+    if (nchan != 0) {
+        if (dac->fast_write(chan_dat, nchan)) {
+            write_pending = false;
+        }
+        else {
+            ++missed_ticks;
+        }
+    }
+    critical_section_enter_blocking(&crit_sec);
+    bool keep_going = write_pending;
+    for (auto& ch: channels) {
+        keep_going = keep_going || (ch.position != ch.target);
+    }
+    running = keep_going;
+    critical_section_exit(&crit_sec);
+    return keep_going;
+}
@@ -0,0 +1,149 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class glides the outputs of one MCP4728 from their current codes to
+ * target codes (for portamento, slew limiting, and the like). A repeating
+ * timer interrupt does the interpolation and sends one fast_write() per tick
+ * that covers every channel that is still moving. The timer stops by itself
+ * once every channel has reached its target, so an idle ramp costs nothing.
+ *
+ * The MCP4728 must have access to the I2C bus while a ramp is running. Ticks
+ * where the fast_write() cannot be submitted are counted (see get_missed_ticks())
+ * and the next tick catches up.
+ */
+#pragma once
+#include "rp2040_mcp4728_lib.h"
+#include "pico/time.h"
+namespace rppicomidi
+{
+class RP2040_MCP4728_ramp
+{
+public:
+    enum curve_type {
+        curve_linear,       // move a constant number of codes per second
+        curve_exponential   // move a fixed fraction of the remaining distance each tick (RC-style)
+    };
+    /**
+     * @brief constructor
+     *
+     * @param dac_ the MCP4728 whose outputs this object ramps
+     * @param tick_us_ the interpolation and output update period in microseconds
+     */
+    RP2040_MCP4728_ramp(RP2040_MCP4728* dac_, uint32_t tick_us_=1000);
+    ~RP2040_MCP4728_ramp();
+
+    /**
+     * @brief set the channel's current code and target code without ramping or writing to the DAC.
+     * Use this to tell the ramp what the DAC outputs already are.
+     *
+     * @return false if chan > 3 or code > 4095 or pd > 3
+     * @param chan the DAC channel 0-3 => A-D
+     * @param code the 12-bit DAC code
+     * @param pd the power down code to send with each fast_write for this channel (0 is on)
+     */
+    bool set_current(uint8_t chan, uint16_t code, uint8_t pd=0);
+
+    /**
+     * @brief make the channel move a constant number of DAC codes per second
+     *
+     * @return false if chan > 3
+     * @param chan the DAC channel 0-3 => A-D
+     * @param codes_per_second the slew rate. 0 means jump to the target on the next tick.
+     */
+    bool set_linear_slew(uint8_t chan, uint32_t codes_per_second);
+
+    /**
+     * @brief make the channel approach its target exponentially
+     *
+     * @return false if chan > 3 or time_constant_us is 0
+     * @param chan the DAC channel 0-3 => A-D
+     * @param time_constant_us the time to cover 63% of the remaining distance
+     */
+    bool set_exponential_slew(uint8_t chan, uint32_t time_constant_us);
+
+    /**
+     * @brief start moving the channel toward a new target code. Starts the timer if needed.
+     *
+     * @return false if chan > 3 or code > 4095 or the timer could not be started
+     * @param chan the DAC channel 0-3 => A-D
+     * @param code the 12-bit target DAC code
+     */
+    bool set_target(uint8_t chan, uint16_t code);
+
+    /**
+     * @brief set the targets of all 4 channels at once so they start moving on the same tick
+     *
+     * @return false if any code > 4095 or the timer could not be started
+     * @param codes an array of 4 12-bit target DAC codes for channels A-D
+     */
+    bool set_targets(const uint16_t* codes);
+
+    /**
+     * @brief
+     *
+     * @return the code most recently sent to the DAC for channel chan (or set by set_current())
+     * @param chan the DAC channel 0-3 => A-D
+     */
+    uint16_t get_current(uint8_t chan) const {return chan < 4 ? channels[chan].position >> 16 : 0; }
+
+    /**
+     * @brief
+     *
+     * @return true if the ramp timer is running
+     */
+    bool is_running() const { return running; }
+
+    /**
+     * @brief
+     *
+     * @return the number of ticks where fast_write() could not be submitted
+     */
+    uint32_t get_missed_ticks() const { return missed_ticks; }
+protected:
+    static bool timer_callback(repeating_timer_t* rt);
+    bool tick();
+    bool start_locked();
+    struct channel_state {
+        uint32_t position;      // current code in 12.16 fixed point
+        uint32_t target;        // target code in 12.16 fixed point
+        uint32_t step;          // linear: 12.16 codes per tick; exponential: 0.16 fraction per tick
+        curve_type curve;
+        uint8_t pd;
+    };
+    RP2040_MCP4728* dac;
+    uint32_t tick_us;
+    channel_state channels[4];
+    critical_section_t crit_sec;
+    repeating_timer_t timer;
+    volatile bool running;
+    bool write_pending;         // the most recent positions have not been written to the DAC yet
+    volatile uint32_t missed_ticks;
+private:
+    RP2040_MCP4728_ramp()=delete;
+    RP2040_MCP4728_ramp(const RP2040_MCP4728_ramp&)=delete;
+    RP2040_MCP4728_ramp& operator=(const RP2040_MCP4728_ramp&)=delete;
+};
+}
@@ -0,0 +1,202 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_rtos.h"
+#include "hardware/sync.h"
+
+rppicomidi::RP2040_MCP4728_rtos::RP2040_MCP4728_rtos(RP2040_MCP4728* dac_) : dac{dac_},
+#if RP2040_MCP4728_USE_FREERTOS
+    waiting_task{nullptr},
+#else
+    notified{false},
+#endif
+    released{false}, status_busy{false}, status_powered_on{false}
+{
+    dac->set_irq_notify(irq_notify, this);
+}
+
+rppicomidi::RP2040_MCP4728_rtos::~RP2040_MCP4728_rtos()
+{
+    dac->set_irq_notify(nullptr, nullptr);
+}
+
+void rppicomidi::RP2040_MCP4728_rtos::irq_notify(void* context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_rtos*>(context);
+#if RP2040_MCP4728_USE_FREERTOS
+    TaskHandle_t task = me->waiting_task;
+    if (task == nullptr)
+        return;
+    if (portCHECK_IF_IN_ISR()) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(task, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }
+    else {
+        xTaskNotifyGive(task);
+    }
+#else
+    me->notified = true;
+    __sev(); // wake the other core if it is waiting
+#endif
+}
+
+void rppicomidi::RP2040_MCP4728_rtos::arm()
+{
+#if RP2040_MCP4728_USE_FREERTOS
+    waiting_task = xTaskGetCurrentTaskHandle();
+    // discard notifications from before this wait
+    ulTaskNotifyTake(pdTRUE, 0);
+#else
+    notified = false;
+#endif
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::sleep_until(absolute_time_t deadline)
+{
+#if RP2040_MCP4728_USE_FREERTOS
+    int64_t remaining_us = absolute_time_diff_us(get_absolute_time(), deadline);
+    if (remaining_us <= 0)
+        return false;
+    // round up so the task does not wake before the deadline
+    const int64_t tick_us = 1000000 / configTICK_RATE_HZ;
+    TickType_t ticks = (TickType_t)((remaining_us + tick_us - 1) / tick_us);
+    ulTaskNotifyTake(pdTRUE, ticks);
+    return true;
+#else
+    while (!notified) {
+        if (best_effort_wfe_or_timeout(deadline))
+            return false;
+    }
+    return true;
+#endif
+}
+
+int rppicomidi::RP2040_MCP4728_rtos::request_bus(uint32_t timeout_us)
+{
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    for (;;) {
+        arm();
+        int result = dac->request_bus(nullptr, nullptr);
+        if (result != 0)
+            return result;
+        if (!sleep_until(deadline))
+            return 0;
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_rtos::release_callback(void* context)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_rtos*>(context);
+    me->released = true;
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::release_bus(uint32_t timeout_us)
+{
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    released = false;
+    int result = dac->release_bus(release_callback, this);
+    if (result != 0)
+        return result == 1;
+    // task() releases the bus after the pending operations finish
+    for (;;) {
+        arm();
+        dac->task();
+        if (released)
+            return true;
+        if (!sleep_until(deadline))
+            return false;
+    }
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::wait_op(mcp4728_op_handle handle, uint32_t timeout_us)
+{
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    for (;;) {
+        arm();
+        dac->task();
+        mcp4728_op_status status = dac->get_op_status(handle);
+        if (status == mcp4728_op_complete || status == mcp4728_op_invalid)
+            return status == mcp4728_op_complete;
+        if (!sleep_until(deadline))
+            return false;
+    }
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::wait_buffer_op(mcp4728_op_handle handle, uint32_t timeout_us)
+{
+    if (wait_op(handle, timeout_us))
+        return true;
+    // The I2C IRQ and task() still use the caller's buffer until the operation retires
+    mcp4728_op_status status = dac->get_op_status(handle);
+    while (status != mcp4728_op_complete && status != mcp4728_op_invalid) {
+        wait_op(handle, 1000);
+        status = dac->get_op_status(handle);
+    }
+    return false;
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::fast_write(const uint16_t* chan_dat, uint8_t nchan, uint32_t timeout_us, bool stop)
+{
+    mcp4728_op_handle handle;
+    if (!dac->fast_write(chan_dat, nchan, stop, nullptr, nullptr, &handle))
+        return false;
+    return wait_op(handle, timeout_us);
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::multi_write(const mcp4728_channel_data* chan_dat, uint16_t nchan, uint32_t timeout_us)
+{
+    mcp4728_op_handle handle;
+    if (!dac->multi_write(chan_dat, nchan, nullptr, nullptr, &handle))
+        return false;
+    // up to 4 records are copied when the operation is submitted
+    return nchan > 4 ? wait_buffer_op(handle, timeout_us) : wait_op(handle, timeout_us);
+}
+
+#if RP2040_MCP4728_ENABLE_READ
+bool rppicomidi::RP2040_MCP4728_rtos::read_channels(mcp4728_channel_read_data* chan_dat, uint8_t nchan, uint32_t timeout_us)
+{
+    mcp4728_op_handle handle;
+    if (!dac->read_channels(chan_dat, nchan, nullptr, nullptr, &handle))
+        return false;
+    return wait_buffer_op(handle, timeout_us);
+}
+
+void rppicomidi::RP2040_MCP4728_rtos::status_callback(void* context, bool is_busy, bool is_powered_on)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_rtos*>(context);
+    me->status_busy = is_busy;
+    me->status_powered_on = is_powered_on;
+}
+
+bool rppicomidi::RP2040_MCP4728_rtos::poll_status(bool& is_busy, bool& is_powered_on, uint32_t timeout_us)
+{
+    mcp4728_op_handle handle;
+    if (!dac->poll_status(status_callback, this, &handle) || !wait_op(handle, timeout_us))
+        return false;
+    is_busy = status_busy;
+    is_powered_on = status_powered_on;
+    return true;
+}
+#endif
@@ -0,0 +1,169 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class lets RTOS tasks call an RP2040_MCP4728 and sleep until the
+ * operation is done instead of spinning on task(). The I2C IRQ wakes the
+ * waiting task directly through the RP2040_MCP4728::set_irq_notify() hook.
+ *
+ * If RP2040_MCP4728_USE_FREERTOS is defined to 1, the waiting task blocks on
+ * a FreeRTOS direct-to-task notification (so the adapter uses the notification
+ * value of any task that calls it). Otherwise the calling core sleeps
+ * in WFE (see best_effort_wfe_or_timeout()) until an interrupt or the timeout.
+ * That also works as a stand-in for bare metal super-loop code.
+ *
+ * Each blocking function calls the RP2040_MCP4728 task() function while it waits,
+ * so other operations' callbacks are called from the waiting task. Only one task at a
+ * time may use an RP2040_MCP4728_rtos object, and other code must not call the
+ * RP2040_MCP4728's task() function at the same time.
+ */
+#pragma once
+#include "rp2040_mcp4728_lib.h"
+#ifndef RP2040_MCP4728_USE_FREERTOS
+#define RP2040_MCP4728_USE_FREERTOS 0
+#endif
+#if RP2040_MCP4728_USE_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_rtos
+{
+public:
+    /**
+     * @brief constructor
+     *
+     * @param dac_ the MCP4728 to use; this object takes over its set_irq_notify() hook
+     */
+    RP2040_MCP4728_rtos(RP2040_MCP4728* dac_);
+    ~RP2040_MCP4728_rtos();
+
+    /**
+     * @brief request the I2C bus and sleep until this device gets it
+     *
+     * @return 1 if the device has the bus, 0 if the timeout expired first (the request
+     * stays in the queue; call again to keep waiting or call release_bus() to give up),
+     * -1 if the request is not valid
+     * @param timeout_us the maximum time to wait
+     */
+    int request_bus(uint32_t timeout_us);
+
+    /**
+     * @brief wait for pending operations to finish and release the I2C bus
+     *
+     * @return true if the bus was released before the timeout expired. If false, the
+     * release is still pending and happens in a later RP2040_MCP4728::task() call.
+     * @param timeout_us the maximum time to wait
+     */
+    bool release_bus(uint32_t timeout_us);
+
+    /**
+     * @brief sleep until a submitted operation's callback has been called
+     *
+     * @return true if the operation completed before the timeout expired
+     * @param handle the handle returned when the operation was submitted
+     * @param timeout_us the maximum time to wait
+     */
+    bool wait_op(mcp4728_op_handle handle, uint32_t timeout_us);
+
+    /**
+     * @brief the blocking version of RP2040_MCP4728::fast_write()
+     *
+     * @return true if the write completed before the timeout expired
+     */
+    bool fast_write(const uint16_t* chan_dat, uint8_t nchan, uint32_t timeout_us, bool stop=true);
+
+    /**
+     * @brief the blocking version of RP2040_MCP4728::multi_write()
+     *
+     * More than 4 records are encoded from chan_dat as the I2C hardware sends them. In that
+     * case, if the timeout expires, this function still waits for the operation to finish
+     * before it returns false, so chan_dat may go out of scope as soon as it returns.
+     * @return true if the write completed before the timeout expired
+     */
+    bool multi_write(const mcp4728_channel_data* chan_dat, uint16_t nchan, uint32_t timeout_us);
+#if RP2040_MCP4728_ENABLE_READ
+    /**
+     * @brief the blocking version of RP2040_MCP4728::read_channels()
+     *
+     * If the timeout expires, this function still waits for the read to finish before it
+     * returns false, so chan_dat may go out of scope as soon as it returns.
+     * @return true if chan_dat was filled in before the timeout expired
+     */
+    bool read_channels(mcp4728_channel_read_data* chan_dat, uint8_t nchan, uint32_t timeout_us);
+
+    /**
+     * @brief the blocking version of RP2040_MCP4728::poll_status()
+     *
+     * @return true if the status was read before the timeout expired
+     * @param is_busy is set true if the MCP4728 is still writing to EEPROM
+     * @param is_powered_on is set true if Vdd > Vpor
+     * @param timeout_us the maximum time to wait
+     */
+    bool poll_status(bool& is_busy, bool& is_powered_on, uint32_t timeout_us);
+#endif
+    RP2040_MCP4728* get_dac() { return dac; }
+protected:
+    static void irq_notify(void* context);
+    static void release_callback(void* context);
+#if RP2040_MCP4728_ENABLE_READ
+    static void status_callback(void* context, bool is_busy, bool is_powered_on);
+#endif
+    /**
+     * @brief prepare to wait; call before checking the condition to wait for
+     */
+    void arm();
+
+    /**
+     * @brief sleep until irq_notify() is called after the last arm() or the deadline passes
+     *
+     * @return false if the deadline passed
+     */
+    bool sleep_until(absolute_time_t deadline);
+
+    /**
+     * @brief wait_op() for an operation that uses the caller's buffer
+     *
+     * @return the wait_op() result. If the timeout expires, this function keeps waiting
+     * until the operation retires; the hardware finishes or aborts every transfer in
+     * bounded time, so this does not wait forever.
+     */
+    bool wait_buffer_op(mcp4728_op_handle handle, uint32_t timeout_us);
+    RP2040_MCP4728* dac;
+#if RP2040_MCP4728_USE_FREERTOS
+    TaskHandle_t volatile waiting_task;
+#else
+    volatile bool notified;
+#endif
+    bool released;
+    bool status_busy;
+    bool status_powered_on;
+private:
+    RP2040_MCP4728_rtos()=delete;
+    RP2040_MCP4728_rtos(const RP2040_MCP4728_rtos&)=delete;
+    RP2040_MCP4728_rtos& operator=(const RP2040_MCP4728_rtos&)=delete;
+};
+}
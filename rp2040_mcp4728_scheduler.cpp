@@ -0,0 +1,270 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_scheduler.h"
+#include "hardware/timer.h"
+
+// How long to wait before checking the I2C hardware again when it is busy
+#define SCHEDULER_RETRY_US 5
+
+rppicomidi::RP2040_MCP4728_scheduler* rppicomidi::RP2040_MCP4728_scheduler::alarm_context[4] = {nullptr, nullptr, nullptr, nullptr};
+
+rppicomidi::RP2040_MCP4728_scheduler::RP2040_MCP4728_scheduler(RP2040_MCP4728_group* group_, uint32_t guard_us_, uint32_t initial_latency_us) :
+    group{group_}, nevents{0}, nfree{RP2040_MCP4728_SCHEDULER_MAX_EVENTS}, next_id{0}, state{sched_idle}, nstaged{0}, nwritten{0},
+    stage_start_us{0}, commit_us{0}, report_head{0}, report_tail{0}, report_cb{nullptr}, report_context{nullptr},
+    guard_us{guard_us_}, latency_us{initial_latency_us}, max_lateness_us{0}, late_count{0}, dropped_reports{0}
+{
+    static_assert(RP2040_MCP4728_SCHEDULER_MAX_EVENTS >= 1 && RP2040_MCP4728_SCHEDULER_MAX_EVENTS <= 255,
+        "RP2040_MCP4728_SCHEDULER_MAX_EVENTS must be 1-255");
+    for (uint8_t idx = 0; idx < RP2040_MCP4728_SCHEDULER_MAX_EVENTS; idx++)
+        free_list[idx] = idx;
+    critical_section_init(&crit_sec);
+    alarm_num = hardware_alarm_claim_unused(true);
+    alarm_context[alarm_num] = this;
+    hardware_alarm_set_callback(alarm_num, alarm_irq_handler);
+}
+
+rppicomidi::RP2040_MCP4728_scheduler::~RP2040_MCP4728_scheduler()
+{
+    hardware_alarm_cancel(alarm_num);
+    hardware_alarm_set_callback(alarm_num, nullptr);
+    hardware_alarm_unclaim(alarm_num);
+    alarm_context[alarm_num] = nullptr;
+    critical_section_deinit(&crit_sec);
+}
+
+bool rppicomidi::RP2040_MCP4728_scheduler::earlier(uint8_t a, uint8_t b) const
+{
+    // Events with the same time keep the order they were scheduled in
+    if (events[a].when_us != events[b].when_us)
+        return events[a].when_us < events[b].when_us;
+    return (int16_t)(events[a].id - events[b].id) < 0;
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::heap_push(uint8_t idx)
+{
+    uint8_t pos = nevents++;
+    heap[pos] = idx;
+    while (pos > 0) {
+        uint8_t parent = (pos - 1) / 2;
+        if (!earlier(heap[pos], heap[parent]))
+            break;
+        uint8_t tmp = heap[parent];
+        heap[parent] = heap[pos];
+        heap[pos] = tmp;
+        pos = parent;
+    }
+}
+
+uint8_t rppicomidi::RP2040_MCP4728_scheduler::heap_pop()
+{
+    uint8_t top = heap[0];
+    heap[0] = heap[--nevents];
+    uint8_t pos = 0;
+    for (;;) {
+        uint8_t smallest = pos;
+        uint8_t left = pos*2 + 1;
+        uint8_t right = left + 1;
+        if (left < nevents && earlier(heap[left], heap[smallest]))
+            smallest = left;
+        if (right < nevents && earlier(heap[right], heap[smallest]))
+            smallest = right;
+        if (smallest == pos)
+            break;
+        uint8_t tmp = heap[smallest];
+        heap[smallest] = heap[pos];
+        heap[pos] = tmp;
+        pos = smallest;
+    }
+    return top;
+}
+
+bool rppicomidi::RP2040_MCP4728_scheduler::schedule(absolute_time_t when, uint8_t dacnum, const mcp4728_channel_data* chan_dat, uint8_t nchan,
+    commit_mode mode, uint16_t* event_id)
+{
+    if (dacnum >= group->get_num_dacs() || nchan == 0 || nchan > 4)
+        return false;
+    if (mode == commit_ldac && !group->has_ldac_pin(dacnum))
+        return false;
+    critical_section_enter_blocking(&crit_sec);
+    if (nfree == 0) {
+        critical_section_exit(&crit_sec);
+        return false;
+    }
+    uint8_t idx = free_list[--nfree];
+    event& ev = events[idx];
+    ev.when_us = to_us_since_boot(when);
+    ev.id = next_id++;
+    ev.dacnum = dacnum;
+    ev.mode = mode;
+    ev.nbytes = nchan*3;
+    for (uint8_t chan = 0; chan < nchan; chan++) {
+        mcp4728_channel_data cd = chan_dat[chan];
+        cd.udac = 1; // load the input register only; the commit updates the output
+        mcp4728_encode::multi_write_channel(cd, ev.frame + chan*3);
+    }
+    heap_push(idx);
+    bool new_first = heap[0] == idx && state == sched_idle;
+    if (event_id)
+        *event_id = ev.id;
+    critical_section_exit(&crit_sec);
+    if (new_first) {
+        // wake up the alarm handler so it can work out the new staging time
+        hardware_alarm_force_irq(alarm_num);
+    }
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::cancel_all()
+{
+    critical_section_enter_blocking(&crit_sec);
+    while (nevents > 0)
+        free_list[nfree++] = heap_pop();
+    critical_section_exit(&crit_sec);
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::set_report_callback(void (*callback)(void* context, uint16_t event_id, uint32_t lateness_us), void* context)
+{
+    report_cb = callback;
+    report_context = context;
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::alarm_irq_handler(uint alarm_num)
+{
+    if (alarm_context[alarm_num])
+        alarm_context[alarm_num]->service();
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::arm(uint64_t target_us)
+{
+    // hardware_alarm_set_target() returns true if the target time has already passed
+    if (hardware_alarm_set_target(alarm_num, from_us_since_boot(target_us)))
+        hardware_alarm_force_irq(alarm_num);
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::service()
+{
+    // This runs in the alarm interrupt. It may be called early or more than once;
+    // it always works out what to do from the current state and time.
+    for (;;) {
+        uint64_t now = time_us_64();
+        if (state == sched_idle) {
+            critical_section_enter_blocking(&crit_sec);
+            if (nevents == 0) {
+                critical_section_exit(&crit_sec);
+                return;
+            }
+            uint64_t when = events[heap[0]].when_us;
+            uint64_t lead = latency_us + guard_us;
+            if (when > lead && now < when - lead) {
+                critical_section_exit(&crit_sec);
+                arm(when - lead);
+                return;
+            }
+            // Take every event with the same time as the first one
+            nstaged = 0;
+            while (nevents > 0 && nstaged < max_batch && events[heap[0]].when_us == when) {
+                uint8_t idx = heap_pop();
+                staged[nstaged++] = events[idx];
+                free_list[nfree++] = idx;
+            }
+            critical_section_exit(&crit_sec);
+            nwritten = 0;
+            commit_us = when;
+            stage_start_us = now;
+            state = sched_staging;
+        }
+        if (state == sched_staging) {
+            while (nwritten < nstaged) {
+                if (!group->write_chip(staged[nwritten].dacnum, staged[nwritten].frame, staged[nwritten].nbytes)) {
+                    arm(now + SCHEDULER_RETRY_US);
+                    return;
+                }
+                ++nwritten;
+            }
+            state = sched_committing;
+            if (now < commit_us) {
+                arm(commit_us);
+                return;
+            }
+        }
+        if (state == sched_committing) {
+            if (now < commit_us) {
+                arm(commit_us);
+                return;
+            }
+            if (group->is_bus_busy()) {
+                arm(now + SCHEDULER_RETRY_US);
+                return;
+            }
+            bool general_call = false;
+            for (uint8_t idx = 0; idx < nstaged; idx++) {
+                if (staged[idx].mode == commit_general_call)
+                    general_call = true;
+                else
+                    group->pulse_ldac(staged[idx].dacnum);
+            }
+            if (general_call)
+                group->general_call(0x08); // the bus is idle so this does not fail
+            uint64_t done = time_us_64();
+            uint32_t lateness = (uint32_t)(done - commit_us);
+            if (lateness > max_lateness_us)
+                max_lateness_us = lateness;
+            if (lateness > guard_us)
+                ++late_count;
+            // Track the staging time. Follow increases right away and decreases slowly.
+            uint64_t write_done = group->get_last_write_done_us();
+            if (write_done > stage_start_us) {
+                uint32_t sample = (uint32_t)(write_done - stage_start_us);
+                if (sample > latency_us)
+                    latency_us = sample;
+                else
+                    latency_us -= (latency_us - sample) / 16;
+            }
+            for (uint8_t idx = 0; idx < nstaged; idx++) {
+                uint8_t next = (report_head + 1) % RP2040_MCP4728_SCHEDULER_MAX_EVENTS;
+                if (next == report_tail) {
+                    ++dropped_reports;
+                }
+                else {
+                    reports[report_head].id = staged[idx].id;
+                    reports[report_head].lateness_us = lateness;
+                    report_head = next;
+                }
+            }
+            nstaged = 0;
+            state = sched_idle;
+        }
+    }
+}
+
+void rppicomidi::RP2040_MCP4728_scheduler::task()
+{
+    while (report_tail != report_head) {
+        report rep = reports[report_tail];
+        report_tail = (report_tail + 1) % RP2040_MCP4728_SCHEDULER_MAX_EVENTS;
+        if (report_cb)
+            report_cb(report_context, rep.id, rep.lateness_us);
+    }
+}
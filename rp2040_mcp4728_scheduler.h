@@ -0,0 +1,171 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class changes MCP4728 outputs at absolute times, for example on MIDI
+ * clock ticks. Each event is a set of channel values for one chip in an
+ * RP2040_MCP4728_group plus the time the outputs should change.
+ *
+ * Events wait in a fixed capacity priority queue. A hardware timer alarm
+ * fires a little before the earliest event and sends that event's channels
+ * with multi write commands that only load the input registers (UDAC=1).
+ * All events with the same time are sent together. At the event time the
+ * alarm fires again and commits the new values, either by pulsing each chip's
+ * LDAC\ pin or with one general call software update. The lead time is the
+ * measured time the staging writes take plus a guard time, so it adapts to
+ * the bus speed and to the number of chips. Each event reports how late the
+ * commit actually happened through a callback that task() calls.
+ *
+ * The group must have the I2C bus and must not be used for anything else while
+ * events are scheduled. Each chip's LDAC\ pin must be held high between commits,
+ * or the input register writes show up on the outputs right away. Note that a
+ * general call update also commits anything else that has been written to any
+ * chip's input registers.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+#ifndef RP2040_MCP4728_SCHEDULER_MAX_EVENTS
+// The number of events that may be waiting at the same time
+#define RP2040_MCP4728_SCHEDULER_MAX_EVENTS 16
+#endif
+namespace rppicomidi
+{
+class RP2040_MCP4728_scheduler
+{
+public:
+    enum commit_mode : uint8_t {
+        commit_ldac,            // pulse the chip's LDAC\ pin at the event time
+        commit_general_call     // send a general call software update at the event time
+    };
+    static const uint8_t max_batch = 8; // the most events with the same time that commit together
+
+    /**
+     * @brief constructor; claims one hardware timer alarm
+     *
+     * @param group_ the chips the events write to
+     * @param guard_us_ extra time added to the measured staging time
+     * @param initial_latency_us the staging time to assume until one has been measured
+     */
+    RP2040_MCP4728_scheduler(RP2040_MCP4728_group* group_, uint32_t guard_us_=100, uint32_t initial_latency_us=500);
+
+    ~RP2040_MCP4728_scheduler();
+
+    /**
+     * @brief add an event to the queue
+     *
+     * @return false if the queue is full, the parameters are not valid, or mode is commit_ldac
+     * and the chip does not have an LDAC pin
+     * @param when the time the outputs should change. If the time is too close or has
+     * already passed, the event runs as soon as possible and reports how late it was.
+     * @param dacnum the index of the chip in the group
+     * @param chan_dat the channel values (1-4 channels in any order). The udac field is ignored.
+     * @param nchan the number of entries in chan_dat
+     * @param mode how to make the new values appear on the outputs
+     * @param event_id if not nullptr, receives a number that identifies this event in reports
+     */
+    bool schedule(absolute_time_t when, uint8_t dacnum, const mcp4728_channel_data* chan_dat, uint8_t nchan, commit_mode mode,
+        uint16_t* event_id=nullptr);
+
+    /**
+     * @brief discard every event that has not been staged yet
+     */
+    void cancel_all();
+
+    /**
+     * @brief set the function task() calls once for each committed event
+     *
+     * @param callback is called with the event ID and how many microseconds after the
+     * requested time the outputs changed
+     * @param context is the context parameter for the callback
+     */
+    void set_report_callback(void (*callback)(void* context, uint16_t event_id, uint32_t lateness_us), void* context);
+
+    /**
+     * @brief deliver event reports; call this periodically
+     */
+    void task();
+
+    uint8_t get_num_pending() const { return nevents; }
+    uint32_t get_lead_us() const { return latency_us + guard_us; }
+    uint32_t get_latency_us() const { return latency_us; }
+    uint32_t get_max_lateness_us() const { return max_lateness_us; }
+    uint32_t get_late_count() const { return late_count; }
+    uint32_t get_dropped_reports() const { return dropped_reports; }
+protected:
+    struct event {
+        uint64_t when_us;
+        uint16_t id;
+        uint8_t dacnum;
+        commit_mode mode;
+        uint8_t nbytes;
+        uint8_t frame[12];      // multi write command with UDAC=1, encoded when scheduled
+    };
+    struct report {
+        uint16_t id;
+        uint32_t lateness_us;
+    };
+    enum sched_state : uint8_t {
+        sched_idle,
+        sched_staging,
+        sched_committing
+    };
+    static void alarm_irq_handler(uint alarm_num);
+    static RP2040_MCP4728_scheduler* alarm_context[4];
+    void service();
+    void arm(uint64_t target_us);
+    bool earlier(uint8_t a, uint8_t b) const;
+    void heap_push(uint8_t idx);
+    uint8_t heap_pop();
+    RP2040_MCP4728_group* group;
+    uint alarm_num;
+    critical_section_t crit_sec;
+    event events[RP2040_MCP4728_SCHEDULER_MAX_EVENTS];
+    uint8_t heap[RP2040_MCP4728_SCHEDULER_MAX_EVENTS];      // min-heap of event indices by time
+    uint8_t free_list[RP2040_MCP4728_SCHEDULER_MAX_EVENTS];
+    uint8_t nevents;
+    uint8_t nfree;
+    uint16_t next_id;
+    sched_state state;
+    event staged[max_batch];
+    uint8_t nstaged;
+    uint8_t nwritten;
+    uint64_t stage_start_us;
+    uint64_t commit_us;
+    report reports[RP2040_MCP4728_SCHEDULER_MAX_EVENTS];
+    volatile uint8_t report_head;
+    volatile uint8_t report_tail;
+    void (*report_cb)(void* context, uint16_t event_id, uint32_t lateness_us);
+    void* report_context;
+    uint32_t guard_us;
+    uint32_t latency_us;
+    uint32_t max_lateness_us;
+    uint32_t late_count;
+    uint32_t dropped_reports;
+private:
+    RP2040_MCP4728_scheduler()=delete;
+    RP2040_MCP4728_scheduler(const RP2040_MCP4728_scheduler&)=delete;
+    RP2040_MCP4728_scheduler& operator=(const RP2040_MCP4728_scheduler&)=delete;
+};
+}
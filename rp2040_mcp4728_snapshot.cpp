@@ -0,0 +1,163 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+#include "rp2040_mcp4728_snapshot.h"
+#include "rp2040_mcp4728_protocol.h"
+#include <cstring> // memset, memcpy
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "hardware/timer.h"
+
+rppicomidi::RP2040_MCP4728_snapshot::RP2040_MCP4728_snapshot(RP2040_MCP4728_group* group_, uint32_t flash_offset_) :
+    group{group_}, flash_offset{flash_offset_}, have_capture{false}, restore_us{0}
+{
+    static_assert(sizeof(record) <= FLASH_PAGE_SIZE, "the snapshot record must fit in one flash page");
+    assert((flash_offset % FLASH_SECTOR_SIZE) == 0);
+    memset(&captured, 0, sizeof(captured));
+}
+
+uint16_t rppicomidi::RP2040_MCP4728_snapshot::crc16(const uint8_t* data, size_t nbytes)
+{
+    return mcp4728_protocol::crc16(data, nbytes);
+}
+
+bool rppicomidi::RP2040_MCP4728_snapshot::wait_idle(absolute_time_t deadline)
+{
+    while (group->is_bus_busy() || group->is_read_in_flight()) {
+        if (time_reached(deadline))
+            return false;
+        tight_loop_contents();
+    }
+    return true;
+}
+
+bool rppicomidi::RP2040_MCP4728_snapshot::capture(uint32_t timeout_us)
+{
+    have_capture = false;
+    if (!group->has_bus() || group->is_updating())
+        return false;
+    memset(&captured, 0, sizeof(captured));
+    captured.magic = record_magic;
+    captured.version = record_version;
+    captured.nchips = group->get_num_dacs();
+    for (uint8_t dacnum = 0; dacnum < captured.nchips; dacnum++) {
+        // 4 channels of DAC register then EEPROM, 3 bytes each
+        uint8_t bytes[24];
+        absolute_time_t deadline = make_timeout_time_us(timeout_us);
+        if (!wait_idle(deadline) || !group->read_chip(dacnum, bytes, sizeof(bytes)))
+            return false;
+        // The I2C IRQ fills bytes until the read is done, so wait for that even after the
+        // deadline; the hardware always finishes or aborts a read in bounded time
+        while (group->is_read_in_flight())
+            tight_loop_contents();
+        if (!wait_idle(deadline))
+            return false;
+        auto& chip = captured.chips[dacnum];
+        chip.addr = group->get_chip_addr(dacnum);
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            const uint8_t* dac_reg = bytes + chan*6;
+            if (((dac_reg[0] >> 4) & 0x3) != chan)
+                return false; // not the data we expected
+            chip.regs[chan*2] = dac_reg[1];
+            chip.regs[chan*2+1] = dac_reg[2];
+        }
+    }
+    captured.crc = crc16(reinterpret_cast<const uint8_t*>(captured.chips), captured.nchips * sizeof(chip_record));
+    have_capture = true;
+    return true;
+}
+
+void rppicomidi::RP2040_MCP4728_snapshot::program_flash(void* param)
+{
+    auto me = reinterpret_cast<RP2040_MCP4728_snapshot*>(param);
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &me->captured, sizeof(me->captured));
+    flash_range_erase(me->flash_offset, FLASH_SECTOR_SIZE);
+    flash_range_program(me->flash_offset, page, FLASH_PAGE_SIZE);
+}
+
+bool rppicomidi::RP2040_MCP4728_snapshot::save()
+{
+    if (!have_capture)
+        return false;
+    // flash_safe_execute() keeps the other core and interrupts out of flash while it is erased
+    return flash_safe_execute(program_flash, this, 100) == PICO_OK && get_saved() != nullptr;
+}
+
+bool rppicomidi::RP2040_MCP4728_snapshot::is_valid(const record* rec) const
+{
+    if (rec->magic != record_magic || rec->version != record_version || rec->nchips != group->get_num_dacs())
+        return false;
+    for (uint8_t dacnum = 0; dacnum < rec->nchips; dacnum++) {
+        if (rec->chips[dacnum].addr != group->get_chip_addr(dacnum))
+            return false;
+    }
+    return rec->crc == crc16(reinterpret_cast<const uint8_t*>(rec->chips), rec->nchips * sizeof(chip_record));
+}
+
+const rppicomidi::RP2040_MCP4728_snapshot::record* rppicomidi::RP2040_MCP4728_snapshot::get_saved() const
+{
+    auto rec = reinterpret_cast<const record*>(XIP_BASE + flash_offset);
+    return is_valid(rec) ? rec : nullptr;
+}
+
+bool rppicomidi::RP2040_MCP4728_snapshot::restore(bool use_ldac, uint32_t timeout_us)
+{
+    const record* rec = get_saved();
+    if (rec == nullptr || !group->has_bus() || group->is_updating())
+        return false;
+    if (use_ldac) {
+        for (uint8_t dacnum = 0; dacnum < rec->nchips; dacnum++) {
+            if (!group->has_ldac_pin(dacnum))
+                return false;
+        }
+    }
+    absolute_time_t deadline = make_timeout_time_us(timeout_us);
+    uint64_t start = time_us_64();
+    for (uint8_t dacnum = 0; dacnum < rec->nchips; dacnum++) {
+        // One multi write per chip; UDAC=1 so the outputs do not change yet
+        uint8_t frame[12];
+        for (uint8_t chan = 0; chan < 4; chan++) {
+            frame[chan*3] = 0x40 | (chan << 1) | 1;
+            frame[chan*3+1] = rec->chips[dacnum].regs[chan*2];
+            frame[chan*3+2] = rec->chips[dacnum].regs[chan*2+1];
+        }
+        while (!group->write_chip(dacnum, frame, sizeof(frame))) {
+            if (time_reached(deadline))
+                return false;
+        }
+    }
+    if (!wait_idle(deadline))
+        return false;
+    if (use_ldac) {
+        for (uint8_t dacnum = 0; dacnum < rec->nchips; dacnum++)
+            group->pulse_ldac(dacnum);
+    }
+    else if (!group->general_call(0x08) || !wait_idle(deadline)) {
+        return false;
+    }
+    restore_us = (uint32_t)(time_us_64() - start);
+    return true;
+}
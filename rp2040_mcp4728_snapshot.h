@@ -0,0 +1,137 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/**
+ * This class saves the DAC register state of every chip in an
+ * RP2040_MCP4728_group (Vref, power-down, gain and code for each channel) as
+ * a small CRC-protected record in RP2040 flash, and restores it at boot.
+ *
+ * restore() sends one multi write per chip with UDAC=1 so that the values
+ * only go to the input registers, then makes every output change at the same
+ * time with one general call software update (or with an LDAC\ pulse per
+ * chip). That is one I2C transaction per chip plus one, with no EEPROM
+ * writes, so valid outputs are ready in well under a millisecond at 1MHz
+ * bus speed. restore() measures and reports how long that took.
+ *
+ * capture() and restore() block, so they are meant for start up and for
+ * configuration changes, not for the normal update path.
+ */
+#pragma once
+#include "rp2040_mcp4728_group.h"
+namespace rppicomidi
+{
+class RP2040_MCP4728_snapshot
+{
+public:
+    static const uint32_t record_magic = 0x5334434Du; // "MC4S"
+    static const uint8_t record_version = 1;
+    struct chip_record {
+        uint8_t addr;       // the chip's I2C address when captured
+        uint8_t regs[8];    // for channels A-D: the Vref/PD/gain/code[11:8] byte and the code[7:0] byte
+    };
+    struct record {
+        uint32_t magic;
+        uint8_t version;
+        uint8_t nchips;
+        uint16_t crc;       // CRC-16/CCITT of chips[0] to chips[nchips-1]
+        chip_record chips[RP2040_MCP4728_group::max_dacs];
+    };
+
+    /**
+     * @brief constructor
+     *
+     * @param group_ the chips to capture and restore. The group must have the I2C bus
+     * when capture() or restore() is called.
+     * @param flash_offset_ the offset from the start of flash of the sector that holds
+     * the record. The default is the last sector of flash.
+     */
+    RP2040_MCP4728_snapshot(RP2040_MCP4728_group* group_, uint32_t flash_offset_=PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE);
+
+    /**
+     * @brief read every chip's DAC registers into the RAM copy of the record
+     *
+     * @return false if the group does not have the bus or a chip did not answer in time
+     * @param timeout_us the maximum time to wait for each chip
+     */
+    bool capture(uint32_t timeout_us=10000);
+
+    /**
+     * @brief erase the flash sector and program the RAM copy of the record into it
+     *
+     * @return false if capture() has not succeeded or if the flash could not be
+     * accessed safely (see flash_safe_execute())
+     */
+    bool save();
+
+    /**
+     * @brief
+     *
+     * @return the record in flash, or nullptr if the flash does not hold a valid record
+     * for this group
+     */
+    const record* get_saved() const;
+
+    /**
+     * @brief write the saved record to every chip and update all outputs at once
+     *
+     * @return false if there is no valid record, the group does not have the bus, or the
+     * I2C transfers did not finish in time
+     * @param use_ldac if true, commit with an LDAC\ pulse on every chip instead of a general
+     * call software update. Every chip must have an LDAC pin.
+     * @param timeout_us the maximum time for the whole restore
+     */
+    bool restore(bool use_ldac=false, uint32_t timeout_us=10000);
+
+    /**
+     * @brief
+     *
+     * @return the time the most recent restore() took from its first I2C write until
+     * the update command finished, in microseconds
+     */
+    uint32_t get_restore_us() const { return restore_us; }
+
+    /**
+     * @brief
+     *
+     * @return the RAM copy of the record that capture() fills in
+     */
+    const record& get_captured() const { return captured; }
+
+    static uint16_t crc16(const uint8_t* data, size_t nbytes);
+protected:
+    static void program_flash(void* param);
+    bool is_valid(const record* rec) const;
+    bool wait_idle(absolute_time_t deadline);
+    RP2040_MCP4728_group* group;
+    uint32_t flash_offset;
+    record captured;
+    bool have_capture;
+    uint32_t restore_us;
+private:
+    RP2040_MCP4728_snapshot()=delete;
+    RP2040_MCP4728_snapshot(const RP2040_MCP4728_snapshot&)=delete;
+    RP2040_MCP4728_snapshot& operator=(const RP2040_MCP4728_snapshot&)=delete;
+};
+}